@@ -0,0 +1,168 @@
+#!/usr/bin/env python3
+# SPDX-License-Identifier: MIT
+# Copyright (c) 2025 InstaChord Corp.
+#
+# 差分OTA用パッチの生成ツール
+# 旧ファームウェアと新ファームウェアから main/ota_patch.hpp の形式のパッチを生成する
+#
+# 使い方:
+#   python3 generate_ota_patch.py ota_bin/KANTAN_Play_Core2_v0_3_3.bin ota_bin/KANTAN_Play_Core2_v0_3_4.bin patch_033_034.kpd
+#   python3 generate_ota_patch.py --apply ota_bin/KANTAN_Play_Core2_v0_3_3.bin patch_033_034.kpd out.bin
+
+import hashlib
+import struct
+import sys
+
+MAGIC = b'KPD1'
+OP_END = 0x00
+OP_COPY = 0x01
+OP_DATA = 0x02
+
+BLOCK = 8      # 一致の検索に使用するブロック長
+MIN_MATCH = 8  # これより短い一致はデータとして記録する
+
+
+def varint(value):
+    out = bytearray()
+    while True:
+        b = value & 0x7F
+        value >>= 7
+        if value:
+            out.append(b | 0x80)
+        else:
+            out.append(b)
+            return bytes(out)
+
+
+def zigzag(value):
+    return (value << 1) if value >= 0 else ((-value << 1) - 1)
+
+
+def match_length(a, ai, b, bi, limit):
+    # 先頭から一致する長さを 256byte 単位で比較してから 1byte 単位で詰める
+    n = 0
+    while n + 256 <= limit and a[ai + n:ai + n + 256] == b[bi + n:bi + n + 256]:
+        n += 256
+    while n < limit and a[ai + n] == b[bi + n]:
+        n += 1
+    return n
+
+
+def make_patch(source, target):
+    index = {}
+    for i in range(0, len(source) - BLOCK + 1, 4):
+        index.setdefault(source[i:i + BLOCK], i)
+
+    ops = bytearray()
+    copy_end = 0
+    literal_start = 0
+    t = 0
+    # 直前の一致の続きを優先して探すことで、挿入・削除でずれた範囲を短い命令で表現する
+    last_delta = 0
+    while t + BLOCK <= len(target):
+        cand = []
+        s = t + last_delta
+        if 0 <= s and s + BLOCK <= len(source) and source[s:s + BLOCK] == target[t:t + BLOCK]:
+            cand.append(s)
+        s = index.get(target[t:t + BLOCK])
+        if s is not None:
+            cand.append(s)
+        best_len = 0
+        best_s = 0
+        for s in cand:
+            n = match_length(source, s, target, t, min(len(source) - s, len(target) - t))
+            if n > best_len:
+                best_len = n
+                best_s = s
+        if best_len < MIN_MATCH:
+            t += 1
+            continue
+        # 一致範囲を後方へ広げる
+        back = 0
+        while back < t - literal_start and best_s - back > 0 and source[best_s - back - 1] == target[t - back - 1]:
+            back += 1
+        t -= back
+        best_s -= back
+        best_len += back
+        if literal_start < t:
+            ops += bytes([OP_DATA]) + varint(t - literal_start) + target[literal_start:t]
+        ops += bytes([OP_COPY]) + varint(best_len) + varint(zigzag(best_s - copy_end))
+        copy_end = best_s + best_len
+        last_delta = best_s - t
+        t += best_len
+        literal_start = t
+    if literal_start < len(target):
+        ops += bytes([OP_DATA]) + varint(len(target) - literal_start) + target[literal_start:]
+    ops.append(OP_END)
+
+    header = MAGIC + struct.pack('<III', len(source), len(target), 0)
+    header += hashlib.sha256(source).digest() + hashlib.sha256(target).digest()
+    return bytes(header) + bytes(ops)
+
+
+def apply_patch(source, patch):
+    if patch[:4] != MAGIC:
+        raise ValueError('bad magic')
+    source_size, target_size, _ = struct.unpack_from('<III', patch, 4)
+    source_hash = patch[16:48]
+    target_hash = patch[48:80]
+    if len(source) != source_size or hashlib.sha256(source).digest() != source_hash:
+        raise ValueError('source mismatch')
+
+    def read_varint(pos):
+        value = 0
+        shift = 0
+        while True:
+            b = patch[pos]
+            pos += 1
+            value |= (b & 0x7F) << shift
+            shift += 7
+            if not b & 0x80:
+                return value, pos
+
+    out = bytearray()
+    copy_end = 0
+    pos = 80
+    while True:
+        op = patch[pos]
+        pos += 1
+        if op == OP_END:
+            break
+        length, pos = read_varint(pos)
+        if op == OP_COPY:
+            diff, pos = read_varint(pos)
+            copy_end += (diff >> 1) ^ -(diff & 1)
+            out += source[copy_end:copy_end + length]
+            copy_end += length
+        elif op == OP_DATA:
+            out += patch[pos:pos + length]
+            pos += length
+        else:
+            raise ValueError('bad op %02x' % op)
+    if len(out) != target_size or hashlib.sha256(out).digest() != target_hash:
+        raise ValueError('target mismatch')
+    return bytes(out)
+
+
+def main(argv):
+    if len(argv) == 4 and argv[0] == '--apply':
+        source = open(argv[1], 'rb').read()
+        patch = open(argv[2], 'rb').read()
+        open(argv[3], 'wb').write(apply_patch(source, patch))
+        return 0
+    if len(argv) != 3:
+        print('usage: generate_ota_patch.py <source.bin> <target.bin> <patch.kpd>')
+        print('       generate_ota_patch.py --apply <source.bin> <patch.kpd> <target.bin>')
+        return 1
+    source = open(argv[0], 'rb').read()
+    target = open(argv[1], 'rb').read()
+    patch = make_patch(source, target)
+    # 生成したパッチを適用し直して確認する
+    apply_patch(source, patch)
+    open(argv[2], 'wb').write(patch)
+    print('%s : %d bytes (target %d bytes, %.1f%%)' % (argv[2], len(patch), len(target), len(patch) * 100.0 / len(target)))
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv[1:]))
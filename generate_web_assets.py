@@ -0,0 +1,29 @@
+# SPDX-License-Identifier: MIT
+# Copyright (c) 2025 InstaChord Corp.
+#
+# Web UI 用のファイルを gzip 圧縮したファイルを生成する
+# incbin/html/*.html から incbin/html/*.html.gz を生成し、task_wifi.cpp で取り込む
+# PlatformIO のビルド前に実行されるほか、単体でも実行できる ( python3 generate_web_assets.py )
+# 内容が同じなら同じ出力となるよう、gzip ヘッダの時刻は 0 に固定する
+
+import glob
+import gzip
+import os
+
+try:
+    Import("env")
+    root_dir = env.subst("$PROJECT_DIR")
+except NameError:
+    root_dir = os.path.dirname(os.path.abspath(__file__))
+
+for src in sorted(glob.glob(os.path.join(root_dir, 'incbin', 'html', '*.html'))):
+    dst = src + '.gz'
+    with open(src, 'rb') as f:
+        data = gzip.compress(f.read(), compresslevel=9, mtime=0)
+    if os.path.exists(dst):
+        with open(dst, 'rb') as f:
+            if f.read() == data:
+                continue
+    with open(dst, 'wb') as f:
+        f.write(data)
+    print('generate_web_assets: %s (%d bytes)' % (os.path.relpath(dst, root_dir), len(data)))
@@ -89,6 +89,7 @@ namespace def {
     NOTIFY_CLEAR_ALL_NOTES,
     NOTIFY_ALL_RESET,
     NOTIFY_DEVELOPER_MODE,
+    NOTIFY_MIDI_LEARN,
   };
   enum qrcode_type_t : uint8_t {
     QRCODE_NONE,
@@ -195,6 +196,95 @@ Button Index mapping
 
     static constexpr const size_t max_note = 128;
 
+    // MIDIルーティングのポート
+    // 入力側の port_internal はかんぷれの演奏出力、出力側の port_internal は内蔵音源を表す
+    enum port_t : uint8_t {
+      port_internal = 0,
+      port_portc,
+      port_ble,
+      port_usb,
+      port_rtp,       // Wi-Fi経由の RTP-MIDI (AppleMIDI)
+      port_max,
+    };
+    static constexpr const char* port_name_table[port_max] = {
+      "internal", "port_c", "ble", "usb", "rtp",
+    };
+
+    // RTP-MIDI のコントロールポート (データポートは +1)
+    static constexpr const uint16_t rtp_midi_port = 5004;
+
+    // 入力ポートから出力ポートへのルート設定 (32bitに詰めてレジストリに保存する)
+    struct route_t {
+      // 通過させるメッセージの種類
+      enum type_bit_t : uint8_t {
+        type_note             = 1 << 0, // ノートオン・オフ
+        type_poly_pressure    = 1 << 1,
+        type_control_change   = 1 << 2,
+        type_program_change   = 1 << 3,
+        type_channel_pressure = 1 << 4,
+        type_pitch_bend       = 1 << 5,
+        type_system           = 1 << 6, // システムコモン・リアルタイム (SysExは含まない)
+        type_all              = 0x7F,
+      };
+      uint16_t channel_mask = 0;  // 通過させる入力チャンネル (bit0 = CH1)
+      uint8_t type_mask = 0;      // 0 の場合はルート無効
+      uint8_t channel_to = 0;     // 0:変換しない 1-16:全チャンネルを指定チャンネルへ変換
+
+      constexpr route_t(void) = default;
+      constexpr route_t(uint16_t ch_mask, uint8_t types, uint8_t ch_to)
+      : channel_mask { ch_mask }, type_mask { types }, channel_to { ch_to } {}
+      explicit constexpr route_t(uint32_t value)
+      : channel_mask { (uint16_t)(value >> 16) }, type_mask { (uint8_t)(value >> 8) }, channel_to { (uint8_t)value } {}
+      constexpr uint32_t getValue(void) const { return (uint32_t)channel_mask << 16 | type_mask << 8 | channel_to; }
+      constexpr bool isEnabled(void) const { return type_mask != 0; }
+
+      // 全てのメッセージをそのまま通過させる
+      static constexpr route_t thru(void) { return route_t { 0xFFFF, type_all, 0 }; }
+    };
+
+    // 受信したコントロールチェンジ / NRPN からパラメータへの割当 (32bitに詰めてレジストリに保存する)
+    struct control_map_t {
+      enum source_t : uint8_t {
+        source_none = 0,
+        source_cc,        // コントロールチェンジ (number = CC番号 0-119)
+        source_nrpn,      // NRPN (number = CC99/CC98 で指定された14bitのパラメータ番号)
+      };
+      // 割当先のパラメータ (値の範囲は UI で操作する場合と同じ)
+      enum target_t : uint8_t {
+        target_none = 0,
+        target_part_volume,   // パートのボリューム 0-100
+        target_part_position, // パートの音域位置 min_position - max_position
+        target_part_voicing,  // パートのボイシング
+        target_part_stroke,   // パートのストローク速度 5-50 msec
+        target_tempo,         // ソングのテンポ
+        target_swing,         // ソングのスウィング
+        target_max,
+      };
+      source_t source = source_none;
+      uint8_t channel = 0;    // 受信チャンネル 0-15
+      uint16_t number = 0;
+      target_t target = target_none;
+      uint8_t part = 0;       // パート対象の場合のパート番号 0-5
+
+      constexpr control_map_t(void) = default;
+      constexpr control_map_t(source_t src, uint8_t ch, uint16_t num, target_t tgt, uint8_t part_index)
+      : source { src }, channel { ch }, number { num }, target { tgt }, part { part_index } {}
+      explicit constexpr control_map_t(uint32_t value)
+      : source { (source_t)(value >> 30) }, channel { (uint8_t)((value >> 24) & 0x0F) }, number { (uint16_t)((value >> 8) & 0x3FFF) }
+      , target { (target_t)((value >> 4) & 0x0F) }, part { (uint8_t)(value & 0x0F) } {}
+      constexpr uint32_t getValue(void) const { return (uint32_t)source << 30 | (uint32_t)(channel & 0x0F) << 24 | (uint32_t)(number & 0x3FFF) << 8 | (target & 0x0F) << 4 | (part & 0x0F); }
+      constexpr bool isEnabled(void) const { return source != source_none && target != target_none && target < target_max; }
+      constexpr bool isPartTarget(void) const { return target_part_volume <= target && target <= target_part_stroke; }
+      constexpr bool isSameSource(const control_map_t& rhs) const { return source == rhs.source && channel == rhs.channel && number == rhs.number; }
+    };
+    static constexpr const size_t max_control_map = 16;
+    static constexpr const char* control_source_name_table[] = {
+      "", "cc", "nrpn",
+    };
+    static constexpr const char* control_target_name_table[control_map_t::target_max] = {
+      "", "part_volume", "part_position", "part_voicing", "part_stroke", "tempo", "swing",
+    };
+
     static constexpr const simple_text_array_t program_name_table = { 129, (const simple_text_t[]){
     // static constexpr const char* program_name_table[129] = {
     "Piano1(Ac.)",  "Piano2(Brt.)",  "Piano3(E-Grd)",  "Honky tonk",
@@ -308,6 +398,9 @@ Button Index mapping
       menu_open,
       internal_button,        // メインボタンへのマッピング (WebSocket等で利用)
       panic_stop,
+      sequence_control,       // コード進行トラック再生の制御 (sequence_control_t)
+      channel_pressure,       // チャンネルアフタータッチの送信 (0-127)
+      midi_learn,             // 次に受信したCC / NRPN をパラメータに割り当てる (midi::control_map_t::target_t)
       command_max,
     };
 
@@ -345,6 +438,9 @@ Button Index mapping
     enum autoplay_switch_t : uint8_t {
       autoplay_off = 0, autoplay_toggle, autoplay_start, autoplay_stop,
     };
+    enum sequence_control_t : uint8_t {
+      sequence_off = 0, sequence_toggle, sequence_start, sequence_stop, sequence_rewind, sequence_prev_bar, sequence_next_bar,
+    };
     enum step_advance_t : uint8_t {
       on_beat = 1,
       off_beat = 2, 
@@ -781,6 +877,23 @@ Button Index mapping
       offbeat_max,
     };
 
+    // ベロシティの入力元 (入力元ごとにベロシティカーブを設定できる)
+    enum velocity_source_t : uint8_t {
+      velocity_source_internal, // 本体ボタン (IMUベロシティ)
+      velocity_source_port_a,   // 外部ポートA
+      velocity_source_port_b,   // 外部ポートB
+      velocity_source_midi,     // MIDI入力
+      velocity_source_max,
+    };
+
+    enum velocity_curve_t : uint8_t {
+      velocity_curve_linear,    // 入力値をそのまま使用する
+      velocity_curve_soft,      // 弱い入力でも大きな値になる
+      velocity_curve_hard,      // 強い入力でないと大きな値にならない
+      velocity_curve_fixed,     // 入力値によらず一定の値にする
+      velocity_curve_max,
+    };
+
     enum arpeggio_style_t : uint8_t
     {
       same_time,        // 同時に鳴らす
@@ -850,6 +963,14 @@ Button Index mapping
   namespace app {
     static constexpr const uint8_t max_slot = 8;                // 設定を保持するスロットの数
     static constexpr const uint8_t max_chord_part = 6;          // コード演奏のパート数
+    // レイヤー演奏で同時に演奏するスロット数 (メインのスロットを含む)
+    // 各レイヤーの6パートには重複しないMIDIチャンネルの範囲が必要で、16チャンネルからノートボタン用(7)とドラム用(10)を除くと
+    // 6チャンネルの範囲は2つしか確保できないため、2を上限とする (処理量は sim_host のベンチマーク --layer で確認できる)
+    static constexpr const uint8_t max_layer = 2;
+    // 1ステップ分の演奏処理 (全レイヤー・全パート) に許容する処理時間 (usec)
+    // 演奏タスクの最短の待機時間 1ms を超えると、次の発音・消音の処理が遅れるため
+    static constexpr const uint32_t step_play_usec_budget = 1000;
+    static constexpr const uint8_t max_chord_track = max_chord_part * max_layer; // 発音管理を行うパートの総数
     static constexpr const uint8_t max_pitch_without_drum = 6;  // ピッチの数 (ドラム以外のパート)
     static constexpr const uint8_t max_pitch_with_drum = 7;     // ピッチの数 (ドラムパートを含む)
     static constexpr const uint8_t max_arpeggio_step = 64;      // コード演奏時のアルペジオパターンの最大ステップ数
@@ -867,8 +988,20 @@ Button Index mapping
     static constexpr const int16_t swing_percent_max = 100; // スウィング最大値
   
     static constexpr const int autorelease_msec = 5000; // コード演奏モードでの 自動ノートオフまでの時間 5秒
+
+    static constexpr const uint8_t polyphony_min = 8;      // 内部音源の同時発音数上限の最小値
+    static constexpr const uint8_t polyphony_default = 32; // 内部音源の同時発音数上限の初期値
+    static constexpr const uint8_t polyphony_max = 64;     // 内部音源の同時発音数上限の最大値 (管理可能なボイス数)
+
+    // レイヤーごとのパートの先頭MIDIチャンネル (ドラムパートはレイヤーに関わらずチャンネル10)
+    // ノートボタン用のチャンネル7とドラム用のチャンネル10を避けて割り当てる
+    static constexpr const uint8_t layer_midi_channel_base[max_layer] = { 0, 10 };
+    static_assert(layer_midi_channel_base[max_layer - 1] + max_chord_part <= 16, "layer MIDI channel range exceeds 16 channels");
     static constexpr const float arpeggio_reset_timeout_beats = 4.2f;
 
+    static constexpr const uint8_t max_sequence_event = 128;   // コード進行トラックのイベント最大数
+    static constexpr const uint8_t sequence_beat_per_bar = 4;  // コード進行トラックの1小節あたりの拍数
+
     static constexpr const int16_t step_per_beat_min = 1;  // 1ビートあたりのステップ数の最小値
     static constexpr const int16_t step_per_beat_default = 2; // 1ビートあたりのステップ数の初期値
     static constexpr const int16_t step_per_beat_max = 4; // 1ビートあたりのステップ数の最大値
@@ -1172,6 +1305,12 @@ Button Index mapping
       { "p4_edit"      , { "Part 4 Edit"    , "パート4 編集"       }, { command::part_edit, 4 } },
       { "p5_edit"      , { "Part 5 Edit"    , "パート5 編集"       }, { command::part_edit, 5 } },
       { "p6_edit"      , { "Part 6 Edit"    , "パート6 編集"       }, { command::part_edit, 6 } },
+      { "learn_vol"    , { "MIDI Learn Vol" , "MIDIラーン 音量"     }, { command::midi_learn, midi::control_map_t::target_part_volume   } },
+      { "learn_pos"    , { "MIDI Learn Oct" , "MIDIラーン 音域"     }, { command::midi_learn, midi::control_map_t::target_part_position } },
+      { "learn_voicing", { "MIDI Learn Voicing", "MIDIラーン ボイシング" }, { command::midi_learn, midi::control_map_t::target_part_voicing  } },
+      { "learn_stroke" , { "MIDI Learn Stroke", "MIDIラーン ストローク" }, { command::midi_learn, midi::control_map_t::target_part_stroke   } },
+      { "learn_tempo"  , { "MIDI Learn Tempo", "MIDIラーン テンポ"  }, { command::midi_learn, midi::control_map_t::target_tempo         } },
+      { "learn_swing"  , { "MIDI Learn Swing", "MIDIラーン スウィング" }, { command::midi_learn, midi::control_map_t::target_swing         } },
       { ""             , { "---"            , nullptr             }, {} },
       { nullptr        , nullptr                                   , {} },
     };
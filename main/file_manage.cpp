@@ -25,6 +25,13 @@
 #include "system_registry.hpp"
 
 #include <set>
+#include <mutex>
+
+#if !defined (M5UNIFIED_PC_BUILD) && __has_include (<freertos/freertos.h>)
+ #include <freertos/FreeRTOS.h>
+ #include <freertos/task.h>
+ #include <freertos/semphr.h>
+#endif
 
 
 // ファイルインポートマクロ
@@ -180,6 +187,205 @@ void memory_info_t::release(void) {
 
 //-------------------------------------------------------------------------
 
+#if __has_include(<SdFat.h>)
+class sdfat_stream_t : public storage_stream_t
+{
+public:
+  FsFile file;
+  bool is_write = false;
+  ~sdfat_stream_t() override
+  {
+    if (is_write) {
+      auto now = time(nullptr);
+      auto tm = gmtime(&now);
+      file.timestamp(T_CREATE|T_WRITE, tm->tm_year + 1900, tm->tm_mon + 1, tm->tm_mday, tm->tm_hour, tm->tm_min, tm->tm_sec);
+    }
+    file.close();
+  }
+  int read(uint8_t* dst, size_t length) override { return file.read(dst, length); }
+  int write(const uint8_t* src, size_t length) override { return file.write(src, length); }
+  size_t size(void) override { return file.fileSize(); }
+};
+#endif
+
+#if __has_include(<LittleFS.h>) || (!__has_include(<SdFat.h>) && __has_include(<SD.h>))
+class fs_stream_t : public storage_stream_t
+{
+public:
+  fs::File file;
+  ~fs_stream_t() override { file.close(); }
+  int read(uint8_t* dst, size_t length) override { return file.read(dst, length); }
+  int write(const uint8_t* src, size_t length) override { return file.write(src, length); }
+  size_t size(void) override { return file.size(); }
+};
+#endif
+
+#if !__has_include(<LittleFS.h>) || (!__has_include(<SdFat.h>) && !__has_include(<SD.h>))
+class stdio_stream_t : public storage_stream_t
+{
+public:
+  FILE* fp = nullptr;
+  ~stdio_stream_t() override { if (fp) { fclose(fp); } }
+  int read(uint8_t* dst, size_t length) override { return fread(dst, 1, length, fp); }
+  int write(const uint8_t* src, size_t length) override { return fwrite(src, 1, length, fp); }
+  size_t size(void) override
+  {
+    auto pos = ftell(fp);
+    fseek(fp, 0, SEEK_END);
+    auto len = ftell(fp);
+    fseek(fp, pos, SEEK_SET);
+    return len;
+  }
+};
+
+static storage_stream_t* openStdioStream(const char* path, bool write)
+{
+  if (path[0] == '/') { ++path; }
+  auto fp = fopen(path, write ? "wb" : "rb");
+  if (fp == nullptr) { return nullptr; }
+  auto stream = new stdio_stream_t();
+  stream->fp = fp;
+  return stream;
+}
+#endif
+
+//-------------------------------------------------------------------------
+
+static constexpr const char tmp_suffix[] = ".tmp";
+static constexpr const char bak_suffix[] = ".bak";
+
+static std::string makeTempPath(const char* path)
+{
+  return std::string(path) + tmp_suffix;
+}
+
+static std::string makeBackupPath(const char* path)
+{
+  return std::string(path) + bak_suffix;
+}
+
+storage_stream_t* storage_base_t::beginAtomicWrite(const char* path)
+{
+  return openStream(makeTempPath(path).c_str(), true);
+}
+
+bool storage_base_t::commitAtomicWrite(storage_stream_t* stream, const char* path)
+{
+  if (stream == nullptr) { return false; }
+  delete stream;
+  auto tmp = makeTempPath(path);
+  if (canRenameOver()) {
+    // LittleFS はリネームで既存のファイルを置き換える。置き換えは不可分のため、元のファイルを消す必要はない
+    if (0 > renameFile(tmp.c_str(), path)) {
+      M5_LOGE("atomic write: rename failed : %s", path);
+      return false;
+    }
+    return true;
+  }
+
+  // SDカード (FAT) は置き換え先が存在するとリネームできないため、元のファイルを退避してから置き換える
+  // 退避ファイルが残っている間に電源が切れた場合は recoverAtomicWrite で復旧する
+  auto bak = makeBackupPath(path);
+  bool has_old = fileExists(path);
+  if (has_old) {
+    removeFile(bak.c_str());
+    if (0 > renameFile(path, bak.c_str())) {
+      M5_LOGE("atomic write: backup failed : %s", path);
+      removeFile(tmp.c_str());
+      return false;
+    }
+  }
+  if (0 > renameFile(tmp.c_str(), path)) {
+    M5_LOGE("atomic write: rename failed : %s", path);
+    if (has_old) {
+      renameFile(bak.c_str(), path);
+    }
+    removeFile(tmp.c_str());
+    return false;
+  }
+  if (has_old) {
+    removeFile(bak.c_str());
+  }
+  return true;
+}
+
+void storage_base_t::abortAtomicWrite(storage_stream_t* stream, const char* path)
+{
+  if (stream == nullptr) { return; }
+  delete stream;
+  removeFile(makeTempPath(path).c_str());
+}
+
+void storage_base_t::recoverAtomicWrite(const char* path)
+{
+  auto tmp = makeTempPath(path);
+  auto bak = makeBackupPath(path);
+  if (fileExists(bak.c_str())) {
+    if (fileExists(path)) {
+      // 置き換えは完了しており、退避ファイルの削除前に止まった
+      removeFile(bak.c_str());
+    } else if (fileExists(tmp.c_str())) {
+      // 退避ファイルは一時ファイルを書き終えてから作られるため、一時ファイルは完全な内容を持つ
+      M5_LOGW("atomic write: recover : %s", path);
+      if (0 <= renameFile(tmp.c_str(), path)) {
+        removeFile(bak.c_str());
+      } else {
+        renameFile(bak.c_str(), path);
+      }
+    } else {
+      renameFile(bak.c_str(), path);
+    }
+  }
+  // ここで残っている一時ファイルは書込みの途中で止まったもののため削除する
+  if (fileExists(tmp.c_str())) {
+    M5_LOGW("atomic write: remove incomplete : %s", tmp.c_str());
+    removeFile(tmp.c_str());
+  }
+}
+
+void storage_base_t::recoverAtomicWrite(void)
+{
+  for (auto& dm : dir_manage) {
+    if (dm.getStorage() != this) { continue; }
+    auto dir_path = dm.makeFullPath("");
+    if (dir_path.empty()) { continue; }
+    if (dir_path.back() != '/') {
+      recoverAtomicWrite(dir_path.c_str());
+      continue;
+    }
+    // フォルダ内の一時ファイル・退避ファイルから元のファイル名を求める
+    std::vector<file_info_t> list;
+    if (0 > getFileList(dir_path.c_str(), list)) { continue; }
+    std::set<std::string> targets;
+    static constexpr const size_t suffix_len = sizeof(tmp_suffix) - 1;
+    for (auto& info : list) {
+      auto& name = info.filename;
+      if (name.size() <= suffix_len) { continue; }
+      auto suffix = name.substr(name.size() - suffix_len);
+      if (suffix == tmp_suffix || suffix == bak_suffix) {
+        targets.insert(name.substr(0, name.size() - suffix_len));
+      }
+    }
+    for (auto& name : targets) {
+      recoverAtomicWrite(dm.makeFullPath(name.c_str()).c_str());
+    }
+  }
+}
+
+int storage_base_t::saveFromMemoryToFileAtomic(const char* path, const uint8_t* data, size_t length)
+{
+  auto stream = beginAtomicWrite(path);
+  if (stream == nullptr) { return -1; }
+  int result = stream->write(data, length);
+  if (result != (int)length) {
+    abortAtomicWrite(stream, path);
+    return -1;
+  }
+  return commitAtomicWrite(stream, path) ? result : -1;
+}
+
+//-------------------------------------------------------------------------
+
 bool storage_sd_t::beginStorage(void)
 {
   if (_is_begin) { return true; }
@@ -202,6 +408,7 @@ bool storage_sd_t::beginStorage(void)
         makeDirectory(dm.makeFullPath("").c_str());
       }
     }
+    recoverAtomicWrite();
   }
 
   return _is_begin;
@@ -390,12 +597,58 @@ bool storage_sd_t::makeDirectory(const char* path)
 
 int storage_sd_t::removeFile(const char* path)
 {
-  return 0;
+  if (!_is_begin) { return -1; }
+#if __has_include (<SdFat.h>)
+  return SD.remove(path) ? 0 : -1;
+#elif __has_include (<SD.h>)
+  return SD.remove(path) ? 0 : -1;
+#else
+  if (path[0] == '/') { ++path; }
+  std::error_code ec;
+  return std::filesystem::remove(path, ec) ? 0 : -1;
+#endif
 }
 
 int storage_sd_t::renameFile(const char* path, const char* newpath)
 {
-  return 0;
+  if (!_is_begin) { return -1; }
+#if __has_include (<SdFat.h>)
+  return SD.rename(path, newpath) ? 0 : -1;
+#elif __has_include (<SD.h>)
+  return SD.rename(path, newpath) ? 0 : -1;
+#else
+  if (path[0] == '/') { ++path; }
+  if (newpath[0] == '/') { ++newpath; }
+  std::error_code ec;
+  std::filesystem::rename(path, newpath, ec);
+  return ec ? -1 : 0;
+#endif
+}
+
+storage_stream_t* storage_sd_t::openStream(const char* path, bool write)
+{
+  if (!_is_begin) { return nullptr; }
+#if __has_include (<SdFat.h>)
+  auto stream = new sdfat_stream_t();
+  stream->is_write = write;
+  stream->file = SD.open(path, write ? (O_CREAT | O_WRITE | O_TRUNC) : O_READ);
+  if (!stream->file) {
+    stream->is_write = false;
+    delete stream;
+    return nullptr;
+  }
+  return stream;
+#elif __has_include (<SD.h>)
+  auto stream = new fs_stream_t();
+  stream->file = SD.open(path, write ? FILE_WRITE : FILE_READ);
+  if (!stream->file) {
+    delete stream;
+    return nullptr;
+  }
+  return stream;
+#else
+  return openStdioStream(path, write);
+#endif
 }
 
 //-------------------------------------------------------------------------
@@ -413,6 +666,8 @@ bool storage_littlefs_t::beginStorage(void)
   if (!_is_begin) {
     system_registry.popup_notify.setPopup(false, def::notify_type_t::NOTIFY_STORAGE_OPEN);
     M5_LOGE("LittleFS mount failed");
+  } else {
+    recoverAtomicWrite();
   }
 
   return _is_begin;
@@ -540,12 +795,45 @@ bool storage_littlefs_t::makeDirectory(const char* path)
 
 int storage_littlefs_t::removeFile(const char* path)
 {
-  return 0;
+  if (!_is_begin) { return -1; }
+#if __has_include(<LittleFS.h>)
+  return LittleFS.remove(path) ? 0 : -1;
+#else
+  if (path[0] == '/') { ++path; }
+  std::error_code ec;
+  return std::filesystem::remove(path, ec) ? 0 : -1;
+#endif
 }
 
 int storage_littlefs_t::renameFile(const char* path, const char* newpath)
 {
-  return 0;
+  if (!_is_begin) { return -1; }
+#if __has_include(<LittleFS.h>)
+  return LittleFS.rename(path, newpath) ? 0 : -1;
+#else
+  if (path[0] == '/') { ++path; }
+  if (newpath[0] == '/') { ++newpath; }
+  std::error_code ec;
+  std::filesystem::rename(path, newpath, ec);
+  return ec ? -1 : 0;
+#endif
+}
+
+storage_stream_t* storage_littlefs_t::openStream(const char* path, bool write)
+{
+  if (!_is_begin) { return nullptr; }
+#if __has_include(<LittleFS.h>)
+  if (!write && !LittleFS.exists(path)) { return nullptr; }
+  auto stream = new fs_stream_t();
+  stream->file = LittleFS.open(path, write ? FILE_WRITE : FILE_READ);
+  if (!stream->file) {
+    delete stream;
+    return nullptr;
+  }
+  return stream;
+#else
+  return openStdioStream(path, write);
+#endif
 }
 
 //-------------------------------------------------------------------------
@@ -600,12 +888,12 @@ bool storage_incbin_t::makeDirectory(const char* path)
 
 int storage_incbin_t::removeFile(const char* path)
 {
-  return 0;
+  return -1;
 }
 
 int storage_incbin_t::renameFile(const char* path, const char* newpath)
 {
-  return 0;
+  return -1;
 }
 
 //-------------------------------------------------------------------------
@@ -730,11 +1018,11 @@ bool file_manage_t::saveFile(def::app::data_type_t dir_type, size_t memory_index
   }
 
   auto path = dir->makeFullPath(mem->filename.c_str());
-  auto result = st->saveFromMemoryToFile(path.c_str(), mem->data, mem->size);
+  auto result = st->saveFromMemoryToFileAtomic(path.c_str(), mem->data, mem->size);
   if (result != mem->size) {
     st->endStorage();
     st->beginStorage();
-    result = st->saveFromMemoryToFile(path.c_str(), mem->data, mem->size);
+    result = st->saveFromMemoryToFileAtomic(path.c_str(), mem->data, mem->size);
   }
 // M5_LOGV("save:%s size:%d result:%d", path.c_str(), mem->size, result);
 
@@ -751,6 +1039,45 @@ bool file_manage_t::saveFile(def::app::data_type_t dir_type, size_t memory_index
   return true;
 }
 
+//-------------------------------------------------------------------------
+
+static std::mutex storage_job_mutex;
+#if !defined (M5UNIFIED_PC_BUILD) && __has_include (<freertos/freertos.h>)
+static const std::function<bool(void)>* storage_job = nullptr;
+static bool storage_job_result = false;
+static SemaphoreHandle_t storage_job_done = nullptr;
+#endif
+
+bool file_manage_t::execStorageJob(const std::function<bool(void)>& job)
+{
+  // 依頼はひとつずつ処理する
+  std::lock_guard<std::mutex> lock(storage_job_mutex);
+#if !defined (M5UNIFIED_PC_BUILD) && __has_include (<freertos/freertos.h>)
+  if (_storage_task_handle == nullptr || xTaskGetCurrentTaskHandle() == (TaskHandle_t)_storage_task_handle) {
+    return job();
+  }
+  if (storage_job_done == nullptr) {
+    storage_job_done = xSemaphoreCreateBinary();
+  }
+  storage_job = &job;
+  xTaskNotifyGive((TaskHandle_t)_storage_task_handle);
+  xSemaphoreTake(storage_job_done, portMAX_DELAY);
+  return storage_job_result;
+#else
+  return job();
+#endif
+}
+
+void file_manage_t::procStorageJob(void)
+{
+#if !defined (M5UNIFIED_PC_BUILD) && __has_include (<freertos/freertos.h>)
+  auto job = storage_job;
+  if (job == nullptr) { return; }
+  storage_job_result = (*job)();
+  storage_job = nullptr;
+  xSemaphoreGive(storage_job_done);
+#endif
+}
 
 //-------------------------------------------------------------------------
 }; // namespace kanplay_ns
@@ -10,6 +10,7 @@
 
 #include <vector>
 #include <string>
+#include <functional>
 
 #include "common_define.hpp"
 
@@ -20,12 +21,29 @@ struct file_info_t {
   size_t filesize;
 };
 
+// ファイルを少しずつ読み書きするためのクラス (storage_base_t::openStream で取得し、delete で閉じる)
+class storage_stream_t
+{
+public:
+  virtual ~storage_stream_t() = default;
+  virtual int read(uint8_t* dst, size_t length) = 0;
+  virtual int write(const uint8_t* src, size_t length) = 0;
+  virtual size_t size(void) = 0;
+};
+
 // SDカードなどのファイル入出力を管理するクラス
 class storage_base_t
 {
 protected:
   bool _is_begin = false;
 
+  // 置き換え先のファイルが存在してもリネームで上書きできるか (上書きは不可分に行われること)
+  virtual bool canRenameOver(void) const { return false; }
+
+  // 前回の書込みの途中で電源が切れた場合に残った一時ファイル・退避ファイルを整理する (beginStorage で呼ぶ)
+  void recoverAtomicWrite(void);
+  void recoverAtomicWrite(const char* path);
+
 public:
   virtual ~storage_base_t() = default;
   storage_base_t() = default;
@@ -55,6 +73,20 @@ public:
 
   // ファイルをリネームする
   virtual int renameFile(const char* path, const char* newpath) { return 0; }
+
+  // ファイルを読み書き用に開く。失敗時は nullptr
+  virtual storage_stream_t* openStream(const char* path, bool write) { return nullptr; }
+
+  // 一時ファイルに書き込み、全て書き終えてから元のファイルと置き換えるための書込み処理
+  // 途中で失敗した場合や電源が切れた場合は、元のファイルか書き終えた新しいファイルのどちらかが残る
+  // (置き換えの途中で電源が切れた場合は、次回の beginStorage で復旧する)
+  storage_stream_t* beginAtomicWrite(const char* path);
+  // 書込みを完了し、一時ファイルを指定のファイル名に置き換える (stream は閉じられる)
+  bool commitAtomicWrite(storage_stream_t* stream, const char* path);
+  // 書込みを中止し、一時ファイルを削除する (stream は閉じられる)
+  void abortAtomicWrite(storage_stream_t* stream, const char* path);
+  // メモリのデータを beginAtomicWrite から commitAtomicWrite までの手順で保存する
+  int saveFromMemoryToFileAtomic(const char* path, const uint8_t* data, size_t length);
 };
 
 class storage_sd_t : public storage_base_t
@@ -69,6 +101,7 @@ public:
   bool makeDirectory(const char* path) override;
   int removeFile(const char* path) override;
   int renameFile(const char* path, const char* newpath) override;
+  storage_stream_t* openStream(const char* path, bool write) override;
 };
 extern storage_sd_t storage_sd;
 
@@ -85,6 +118,9 @@ public:
   bool makeDirectory(const char* path) override;
   int removeFile(const char* path) override;
   int renameFile(const char* path, const char* newpath) override;
+  storage_stream_t* openStream(const char* path, bool write) override;
+protected:
+  bool canRenameOver(void) const override { return true; }
 };
 extern storage_littlefs_t storage_littlefs;
 
@@ -169,6 +205,19 @@ public:
 
   // ファイル保存用のメモリバッファを取得する
   // memory_info_t* getSaveMemory(size_t length);
+
+  // ストレージへの処理を task_spi で実行させ、完了するまで待つ。戻り値は job の戻り値
+  // SDカードは画面とSPIバスを共有しているため、task_spi 以外のタスクからのアクセスはこれを経由する
+  bool execStorageJob(const std::function<bool(void)>& job);
+
+  // task_spi から呼び、依頼された処理があれば実行する
+  void procStorageJob(void);
+
+  // execStorageJob の依頼を通知するタスクを設定する
+  void setStorageTaskHandle(void* task_handle) { _storage_task_handle = task_handle; }
+
+private:
+  void* _storage_task_handle = nullptr;
 };
 
 extern file_manage_t file_manage;
@@ -455,6 +455,8 @@ public:
         t = "All Reset : "; break;
       case def::notify_type_t::NOTIFY_DEVELOPER_MODE:
         t = "Developer : "; break;
+      case def::notify_type_t::NOTIFY_MIDI_LEARN:
+        t = "MIDI Learn : "; break;
       }
       if (t) {
         _text = t;
@@ -783,11 +785,14 @@ struct ui_icon_sequance_play_t : public ui_base_t
 {
 protected:
   def::play::auto_play_mode_t _mode;
+  bool _sequence = false;
 public:
   void update_impl(draw_param_t *param, int offset_x, int offset_y) override {
     auto mode = system_registry.runtime_info.getChordAutoplayState();
-    if (_mode != mode) {
+    auto sequence = system_registry.runtime_info.getSequencePlay();
+    if (_mode != mode || _sequence != sequence) {
       _mode = mode;
+      _sequence = sequence;
       if (mode == def::play::auto_play_mode_t::auto_play_none) {
         _target_rect.w = 0;
       } else {
@@ -810,7 +815,8 @@ public:
     x = x + (w >> 1);
     y = y + (h >> 1);
     if (_mode != def::play::auto_play_mode_t::auto_play_none) {
-      canvas->fillTriangle(x - 5, y - 5, x - 5, y + 5, x + 5, y, TFT_GREEN);
+      // コード進行トラックの再生中は色を変えて区別する
+      canvas->fillTriangle(x - 5, y - 5, x - 5, y + 5, x + 5, y, _sequence ? TFT_CYAN : TFT_GREEN);
     }
   }
 };
@@ -2972,6 +2978,116 @@ public:
 };
 ui_raw_wave_t ui_raw_wave;
 
+// タスクごとのCPU使用率・起床回数・最大稼働時間を表示する診断画面
+struct ui_diagnostics_t : public ui_base_t
+{
+protected:
+  static constexpr const size_t max_line = system_registry_t::reg_task_status_t::MAX_TASK + 3;
+  static constexpr const size_t line_height = 11;
+  static constexpr const uint32_t update_interval_msec = 500;
+
+  char _text[max_line][48];
+  uint32_t _prev_run_usec[system_registry_t::reg_task_status_t::MAX_TASK];
+  uint32_t _prev_wake_count[system_registry_t::reg_task_status_t::MAX_TASK];
+  uint32_t _prev_core_usec[system_registry_t::reg_task_status_t::max_core];
+  uint32_t _prev_high_usec = 0;
+  uint32_t _prev_low_usec = 0;
+  uint32_t _prev_usec = 0;
+  uint32_t _prev_msec = 0;
+  bool _is_visible = false;
+
+  void updateText(void)
+  {
+    using task_status_t = system_registry_t::reg_task_status_t;
+    auto &task_status = system_registry.task_status;
+    uint32_t usec = M5.micros();
+    uint32_t elapsed = usec - _prev_usec;
+    _prev_usec = usec;
+    if (elapsed == 0) { elapsed = 1; }
+
+    // 割合は 0.1% 単位で求める
+    auto permil = [elapsed](uint32_t diff) { return (uint32_t)(((uint64_t)diff * 1000) / elapsed); };
+
+    uint32_t high = task_status.getHighPowerCounter();
+    uint32_t low = task_status.getLowPowerCounter();
+    uint32_t high_diff = high - _prev_high_usec;
+    uint32_t low_diff = low - _prev_low_usec;
+    _prev_high_usec = high;
+    _prev_low_usec = low;
+    uint32_t total = high_diff + low_diff;
+    uint32_t c[task_status_t::max_core];
+    for (size_t i = 0; i < task_status_t::max_core; ++i) {
+      auto v = task_status.getCoreRunUsec(i);
+      c[i] = permil(v - _prev_core_usec[i]);
+      _prev_core_usec[i] = v;
+    }
+    snprintf(_text[0], sizeof(_text[0]), "160MHz:%3lu%%  core0:%3lu.%lu%% core1:%3lu.%lu%%"
+            , (unsigned long)(total ? (uint64_t)high_diff * 100 / total : 0)
+            , (unsigned long)(c[0] / 10), (unsigned long)(c[0] % 10)
+            , (unsigned long)(c[1] / 10), (unsigned long)(c[1] % 10));
+    snprintf(_text[1], sizeof(_text[1]), "%-10s %4s %5s %6s %6s", "task", "core", "cpu%", "wake/s", "max_us");
+
+    for (int i = 0; i < task_status_t::MAX_TASK; ++i) {
+      auto index = (task_status_t::bitindex_t)i;
+      auto &counter = task_status.getTaskCounter(index);
+      uint32_t run = counter.run_usec.load(std::memory_order_relaxed);
+      uint32_t wake = counter.wake_count.load(std::memory_order_relaxed);
+      uint32_t cpu = permil(run - _prev_run_usec[i]);
+      uint32_t wake_per_sec = (uint32_t)(((uint64_t)(wake - _prev_wake_count[i]) * 1000000) / elapsed);
+      _prev_run_usec[i] = run;
+      _prev_wake_count[i] = wake;
+      snprintf(_text[i + 2], sizeof(_text[0]), "%-10s %4u %3lu.%lu %6lu %6lu"
+              , task_status_t::getTaskName(index)
+              , (unsigned)counter.core.load(std::memory_order_relaxed)
+              , (unsigned long)(cpu / 10), (unsigned long)(cpu % 10)
+              , (unsigned long)wake_per_sec
+              , (unsigned long)task_status.takeMaxSliceUsec(index));
+    }
+    // コード演奏の1ステップ分の処理時間の最大値 (起動後の累計) と、許容する処理時間
+    snprintf(_text[task_status_t::MAX_TASK + 2], sizeof(_text[0]), "step play max:%5lu us  budget:%5lu us"
+            , (unsigned long)task_status.getStepPlayUsecMax()
+            , (unsigned long)def::app::step_play_usec_budget);
+  }
+
+public:
+  void update_impl(draw_param_t *param, int offset_x, int offset_y) override {
+    bool visible = system_registry.runtime_info.getGuiDiagView();
+    if (_is_visible != visible) {
+      _is_visible = visible;
+      if (_is_visible) {
+        // 表示開始時点を基準にするため、一度読み捨てる
+        updateText();
+        _prev_msec = param->current_msec;
+        setTargetRect({ 0, header_height, disp_width, disp_height - (header_height + main_btns_height + sub_btns_height) });
+      } else {
+        setTargetRect({ 0, header_height, disp_width, 0 });
+      }
+    }
+
+    ui_base_t::update_impl(param, offset_x, offset_y);
+
+    if (_is_visible && param->current_msec - _prev_msec >= update_interval_msec) {
+      _prev_msec = param->current_msec;
+      updateText();
+      param->addInvalidatedRect({offset_x, offset_y, _client_rect.w, _client_rect.h});
+    }
+  }
+  void draw_impl(draw_param_t *param, M5Canvas *canvas, int32_t offset_x,
+                          int32_t offset_y, const rect_t *clip_rect) override {
+    canvas->fillRect(offset_x, offset_y, _client_rect.w, _client_rect.h, 0);
+    canvas->setFont(&fonts::Font0);
+    canvas->setTextDatum(m5gfx::datum_t::top_left);
+    for (size_t i = 0; i < max_line; ++i) {
+      int y = offset_y + 2 + i * line_height;
+      if (y + (int)line_height > offset_y + _client_rect.h) { break; }
+      canvas->setTextColor(i < 2 ? 0xFFFF00u : 0xFFFFFFu);
+      canvas->drawString(_text[i], offset_x + 2, y);
+    }
+    canvas->setFont(&fonts::efontJA_16_b);
+  }
+};
+ui_diagnostics_t ui_diagnostics;
+
 void gui_t::init(void)
 {
   _gfx = &M5.Display;
@@ -2998,6 +3114,8 @@ void gui_t::init(void)
 
   ui_raw_wave.setTargetRect({ 0, disp_height - (main_btns_height >> 1), disp_width, 0 });
 
+  ui_diagnostics.setTargetRect({ 0, header_height, disp_width, 0 });
+
   ui_sub_buttons.setTargetRect({ 0, disp_height - main_btns_height - sub_btns_height, disp_width, sub_btns_height });
   ui_sub_buttons.setClientRect({ 0, disp_height, disp_width, 0 });
 
@@ -3077,6 +3195,7 @@ void gui_t::init(void)
   ui_background.addChild(&ui_main_buttons);
   ui_background.addChild(&ui_sub_buttons);
   ui_background.addChild(&ui_raw_wave);
+  ui_background.addChild(&ui_diagnostics);
   ui_background.addChild(&ui_left_icon_container);
   ui_background.addChild(&ui_right_icon_container);
   for (auto &ui : ui_menu_bodys) {
@@ -96,6 +96,40 @@ void internal_bmi270_t::clearFifo(void)
   writeRegister8(0x7E, 0xB0); // FIFO_FLUSH
 }
 
+void internal_bmi270_t::pushAccel(const uint8_t* data)
+{
+  // 集計範囲から外れるサンプルの分を差し引き、新しいサンプルの分を加える
+  const auto& old = getAccel(accel_window - 1);
+  const int16_t old_value[3] = { old.x, old.y, old.z };
+
+  int fifo_idx = _accel_fifo_index + 1;
+  if (fifo_idx >= fifo_size) { fifo_idx = 0; }
+  auto& accel = _accel_fifo[fifo_idx];
+  accel.x = (int16_t)(data[0] | (data[1] << 8));
+  accel.y = (int16_t)(data[2] | (data[3] << 8));
+  accel.z = (int16_t)(data[4] | (data[5] << 8));
+  _accel_fifo_index = fifo_idx;
+
+  const int16_t new_value[3] = { accel.x, accel.y, accel.z };
+  for (int axis = 0; axis < 3; ++axis) {
+    int32_t o = old_value[axis];
+    int32_t n = new_value[axis];
+    _accel_sum[axis] += n - o;
+    _accel_sum_sq[axis] += (int64_t)(n * n) - (int64_t)(o * o);
+  }
+}
+
+uint32_t internal_bmi270_t::getAccelDeviation(void) const
+{
+  // 偏差平方和 = 二乗和 - 合計^2 / サンプル数
+  uint64_t result = 0;
+  for (int axis = 0; axis < 3; ++axis) {
+    int64_t sum = _accel_sum[axis];
+    result += _accel_sum_sq[axis] - (uint64_t)((sum * sum) / (int64_t)accel_window);
+  }
+  return result > UINT32_MAX ? UINT32_MAX : (uint32_t)result;
+}
+
 // internal_bmi270_t::sensor_mask_t internal_bmi270_t::update(void)
 uint32_t internal_bmi270_t::update(void)
 {
@@ -105,8 +139,13 @@ uint32_t internal_bmi270_t::update(void)
     // M5_LOGE("FIFO_LEN: %d", len);
     if (len) {
       uint8_t buffer[256];
-      if (len > sizeof(buffer)) { len = sizeof(buffer); }
-      readRegister(FIFO_DATA, buffer, len);
+      if (len > sizeof(buffer)) {
+        len = sizeof(buffer);
+        // ヘッダ無しモードでは読み出しがフレームの途中で途切れないよう、フレーム長の倍数に揃える
+        if (!_fifo_header_enable) { len -= len % 6; }
+      }
+      // 溜まっているデータは1回の通信でまとめて読み出す
+      if (!readRegister(FIFO_DATA, buffer, len)) { return 0; }
       auto b = buffer;
       auto b_end = b + len;
 
@@ -144,29 +183,17 @@ uint32_t internal_bmi270_t::update(void)
               M5_LOGE("IMU Gyro");
             }
             if (fh_parm & 0x01) { // accel data
-              int fifo_idx = _accel_fifo_index + 1;
-              if (fifo_idx >= fifo_size) { fifo_idx = 0; }
-              auto& accel = _accel_fifo[fifo_idx];
-              accel.x = (int16_t)(b[0] | (b[1] << 8));
-              accel.y = (int16_t)(b[2] | (b[3] << 8));
-              accel.z = (int16_t)(b[4] | (b[5] << 8));
+              pushAccel(b);
               b += 6;
-              _accel_fifo_index = fifo_idx;
               ++result;
             }
           }
         }
       } else {
         // non header mode
-        while (b < b_end) {
-          int fifo_idx = _accel_fifo_index + 1;
-          if (fifo_idx >= fifo_size) { fifo_idx = 0; }
-          auto& accel = _accel_fifo[fifo_idx];
-          accel.x = (int16_t)(b[0] | (b[1] << 8));
-          accel.y = (int16_t)(b[2] | (b[3] << 8));
-          accel.z = (int16_t)(b[4] | (b[5] << 8));
+        while (b + 6 <= b_end) {
+          pushAccel(b);
           b += 6;
-          _accel_fifo_index = fifo_idx;
           ++result;
         }
       }
@@ -12,6 +12,8 @@ namespace kanplay_ns {
 class internal_bmi270_t {
 public:
   static constexpr const size_t fifo_size = 32;
+  // 加速度の偏差を求める対象とする直近のサンプル数 (fifo_size 未満であること)
+  static constexpr const size_t accel_window = 16;
   struct imu_3d_t {
     int16_t x;
     int16_t y;
@@ -29,7 +31,16 @@ public:
   const imu_3d_t& getGyro(uint8_t index) const { return _gyro_fifo[(_gyro_fifo_index - index) & (fifo_size - 1)]; };
   void clearFifo(void);
 
+  // 直近 accel_window 個の加速度の偏差平方和 (3軸の合計)
+  uint32_t getAccelDeviation(void) const;
+
 private:
+  void pushAccel(const uint8_t* data);
+
+  // 直近 accel_window 個の加速度の軸ごとの合計と二乗和 (サンプル追加ごとに差分更新する)
+  int32_t _accel_sum[3] = { 0, 0, 0 };
+  uint64_t _accel_sum_sq[3] = { 0, 0, 0 };
+
   imu_3d_t _accel_fifo[fifo_size];
   imu_3d_t _gyro_fifo[fifo_size];
   uint8_t _accel_fifo_index;
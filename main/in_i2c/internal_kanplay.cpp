@@ -10,8 +10,11 @@
 #include "internal_bmi270.hpp"
 #include "../system_registry.hpp"
 #include "../common_define.hpp"
+#include "../latency_trace.hpp"
 #include "firmware_kanplay.h"
 
+#include <string.h>
+
 namespace kanplay_ns {
 //-------------------------------------------------------------------------
 
@@ -19,23 +22,48 @@ static constexpr const uint32_t i2c_freq = 800000;
 static constexpr const uint8_t i2c_addr = 0x56;
 static constexpr const uint8_t i2c_bootloader_addr = 0x54;
 
+// IMUのFIFOを読み出す間隔 (800Hzのサンプルが約20個溜まる時間)
+static constexpr const uint32_t imu_poll_usec = 24000;
+// 入力に変化の無い状態がこの回数続いたらポーリング間隔を延ばす
+static constexpr const uint16_t idle_backoff_count = 256;
+// 入力に変化の無い状態でのポーリング間隔
+static constexpr const uint32_t idle_poll_msec = 4;
+
 static internal_es8388_t internal_es8388;
 static internal_si5351_t internal_si5351;
 static internal_bmi270_t internal_bmi270;
 
+// I2Cバスの使用状況の統計 (STM32およびIMUとの通信)
+struct i2c_bus_stat_t {
+  uint32_t transaction = 0;
+  uint32_t busy_usec = 0;
+  uint32_t start_usec = 0;
+  void add(uint32_t usec, uint32_t count = 1) { busy_usec += usec; transaction += count; }
+};
+static i2c_bus_stat_t bus_stat;
+
 static bool writeRegister8(uint8_t reg, uint8_t data)
 {
-    return M5.In_I2C.writeRegister8(i2c_addr, reg, data, i2c_freq);
+    uint32_t usec = M5.micros();
+    bool result = M5.In_I2C.writeRegister8(i2c_addr, reg, data, i2c_freq);
+    bus_stat.add(M5.micros() - usec);
+    return result;
 }
 
 static bool writeRegister(uint8_t reg, const uint8_t* data, size_t length)
 {
-    return M5.In_I2C.writeRegister(i2c_addr, reg, data, length, i2c_freq);
+    uint32_t usec = M5.micros();
+    bool result = M5.In_I2C.writeRegister(i2c_addr, reg, data, length, i2c_freq);
+    bus_stat.add(M5.micros() - usec);
+    return result;
 }
 
 static bool readRegister(uint8_t reg, uint8_t* result, size_t length)
 {
-    return M5.In_I2C.readRegister(i2c_addr, reg, result, length, i2c_freq);
+    uint32_t usec = M5.micros();
+    bool res = M5.In_I2C.readRegister(i2c_addr, reg, result, length, i2c_freq);
+    bus_stat.add(M5.micros() - usec);
+    return res;
 }
 
 #if !defined ( M5UNIFIED_PC_BUILD )
@@ -114,6 +142,8 @@ bool internal_kanplay_t::init(void)
 
   // SAM reset release
   writeRegister8(0x50, 1);
+  // 音源の設定値が初期化されたため、送信済みとして保持している値を破棄して次回の送信時に再設定させる
+  system_registry.midi_out_control.invalidateShadow();
 
   // Encoder counter reset
   writeRegister(0x30, (const uint8_t[]){1,1,1}, 3);
@@ -127,42 +157,82 @@ bool internal_kanplay_t::init(void)
   return true;
 }
 
-static uint32_t calcImuStandardDeviation(void)
+static void updateImuVelocity(void)
 {
-  // 過去サンプルの加速度の平均値を求める
-  int32_t avg_x = 0;
-  int32_t avg_y = 0;
-  int32_t avg_z = 0;
-  for (int i = 0; i < 16; ++i) {
-    auto accel = internal_bmi270.getAccel(i);
-    avg_x += accel.x;
-    avg_y += accel.y;
-    avg_z += accel.z;
+  // FIFO長の取得とFIFOデータの一括読出しの2回分の通信
+  uint32_t usec = M5.micros();
+  auto count = internal_bmi270.update();
+  bus_stat.add(M5.micros() - usec, count ? 2 : 1);
+  if (count) {
+    // IMUの偏差平方和をsystem_registryに保存 (サンプル追加時に逐次更新済みの値)
+    uint32_t sd = internal_bmi270.getAccelDeviation();
+    system_registry.internal_imu.setImuStandardDeviation(sd);
   }
-  avg_x = (avg_x + 8) >> 4;
-  avg_y = (avg_y + 8) >> 4;
-  avg_z = (avg_z + 8) >> 4;
-
-  // 標準偏差を求める
-  uint32_t sd = 0;
-  for (int i = 0; i < 16; ++i) {
-    auto accel = internal_bmi270.getAccel(i);
-    int diff_x = accel.x - avg_x;   sd += diff_x * diff_x;
-    int diff_y = accel.y - avg_y;   sd += diff_y * diff_y;
-    int diff_z = accel.z - avg_z;   sd += diff_z * diff_z;
+}
+
+// RGB LEDの変更指示を全て取り出し、送信待ちの色を更新する (I2C通信は行わない)
+// アニメーション中に同じLEDへ複数回の指示があった場合は最新の色のみが送信される
+void internal_kanplay_t::collectRgbLed(void)
+{
+  // ハード側のLED番号と、かんぷれシステムのLED番号の対応
+  static constexpr const uint8_t led_index_mapping[] = {
+  14, 15, 16, 17, 18,
+    9, 10, 11, 12, 13,
+    4,  5,  6,  7,  8,
+      0,  1,  2,  3,
+  };
+  static constexpr const uint8_t brightness_table[] = { 21, 34, 55, 89, 144 };
+
+  const registry_t::history_t* history;
+  while (nullptr != (history = system_registry.rgbled_control.getHistory(rgbled_history_code))) {
+    uint32_t rgb_reg_index = history->index >> 2;
+    if (rgb_reg_index >= def::hw::max_rgb_led) { continue; }
+    // RGB LEDは全開で点灯させない。設定に応じて輝度を下げる。
+    uint32_t color = history->value;
+    uint8_t brightness = brightness_table[system_registry.user_setting.getLedBrightness()];
+    uint32_t r = (color & 0xFF) * brightness >> 8;
+    uint32_t g = ((color >> 8) & 0xFF) * brightness >> 8;
+    uint32_t b = ((color >> 16) & 0xFF) * brightness >> 8;
+    color = r | (g << 8) | (b << 16);
+
+    uint_fast8_t hw_index = led_index_mapping[rgb_reg_index];
+    _rgbled_color[hw_index] = color;
+    _rgbled_dirty_mask |= 1u << hw_index;
   }
-  return sd;
 }
 
-static void updateImuVelocity(void)
+// 送信待ちのRGB LEDのうち1個を書き込む
+// RGB LEDの変更指示は連続して実行するとSTM32側がハングアップすることがあるため、一度に1個だけ処理する。
+// 同じLEDへの複数回の変更は collectRgbLed で最新の色にまとめられているため、書込み回数は変更のあったLEDの数で済む
+// (全19個のLEDが変化した場合は19回の起床、ポーリング間隔1msで約19msに分けて送信される)
+void internal_kanplay_t::flushRgbLed(void)
 {
-  if (internal_bmi270.update()) {
-    // IMUの標準偏差をsystem_registryに保存
-    uint32_t sd = calcImuStandardDeviation();
-    system_registry.internal_imu.setImuStandardDeviation(sd);
+  uint32_t mask = _rgbled_dirty_mask;
+  if (mask == 0) { return; }
+  // 前回書き込んだLEDの次から探し、特定のLEDの変更が続いても他のLEDが後回しにならないようにする
+  uint32_t upper = mask & ~((2u << _rgbled_flush_index) - 1);
+  uint_fast8_t index = __builtin_ctz(upper ? upper : mask);
+  if (writeRegister(0x70 + index * 4, (const uint8_t*)&_rgbled_color[index], 3)) {
+    _rgbled_dirty_mask = mask & ~(1u << index);
+    _rgbled_flush_index = index;
   }
 }
 
+void internal_kanplay_t::updateBusStat(void)
+{
+  static constexpr const uint32_t report_usec = 10 * 1000 * 1000;
+  uint32_t elapsed = M5.micros() - bus_stat.start_usec;
+  if (elapsed < report_usec) { return; }
+  uint32_t permil = (uint64_t)bus_stat.busy_usec * 1000 / elapsed;
+  M5_LOGD("I2C bus: %lu trans/s  busy %lu.%lu%%  poll %ums"
+         , (unsigned long)((uint64_t)bus_stat.transaction * 1000000 / elapsed)
+         , (unsigned long)(permil / 10), (unsigned long)(permil % 10)
+         , _idle_count >= idle_backoff_count ? idle_poll_msec : 1);
+  bus_stat.transaction = 0;
+  bus_stat.busy_usec = 0;
+  bus_stat.start_usec += elapsed;
+}
+
 #define DEBUGGING_TEST 0
 #define DEBUGGING_RANDUM 0
 
@@ -173,7 +243,14 @@ bool internal_kanplay_t::update(void)
 #if defined ( M5UNIFIED_PC_BUILD )
     M5.delay(1);
 #else
-    flg_int = (ulTaskNotifyTake(pdTRUE, 1));
+    // 入力に変化が無くLEDの送信待ちも無い状態が続いた場合はポーリング間隔を延ばす。
+    // ボタン操作はSTM32からの割込み通知で即座に起床する
+    TickType_t wait_ticks = 1;
+    if (_idle_count >= idle_backoff_count && _rgbled_dirty_mask == 0) {
+      wait_ticks = pdMS_TO_TICKS(idle_poll_msec);
+      if (wait_ticks == 0) { wait_ticks = 1; }
+    }
+    flg_int = (ulTaskNotifyTake(pdTRUE, wait_ticks));
 #endif
 #if DEBUGGING_TEST
 bool debuging_lv = (millis() >> 7) & 1;
@@ -183,70 +260,27 @@ prev_debuging_lv = debuging_lv;
 flg_int = true;
 }
 #endif
-  if (!flg_int) {
+  if (flg_int) {
+    _idle_count = 0;
+  } else {
     // I2C通信に時間が掛かる場面なのでSuspend申告してCPUクロックを下げることを許可しておく
     // (CPUクロックを高くしてもI2Cの通信時間が短くなるわけではないので)
     system_registry.task_status.setSuspend(system_registry_t::reg_task_status_t::bitindex_t::TASK_I2C);
 
-    for (int loop = 0; loop < 3; ++loop) {
-      static uint8_t proc_index = 0;
-      if (++proc_index > 5) proc_index = 0;
-      switch (proc_index) {
-      case 0:
-      case 3:
-        updateImuVelocity();
-        break;
+    collectRgbLed();
+    flushRgbLed();
 
-      default:
-// RGB LEDの変更指示は連続して実行するとSTM32側がハングアップすることがあるため、一度に処理しない。
-        {
-          auto history = system_registry.rgbled_control.getHistory(rgbled_history_code);
-          if (history != nullptr) {
-            uint32_t rgb_reg_index = history->index >> 2;
-            if (rgb_reg_index < def::hw::max_rgb_led) {
-              // RGB LEDは全開で点灯させない。1/4に輝度を下げる。
-              // uint32_t color = (history->value >> 2) & 0x3F3F3F;
-              uint32_t color = history->value;
-              uint8_t brightness = system_registry.user_setting.getLedBrightness();
-              static constexpr const uint8_t brightness_table[] = { 21, 34, 55, 89, 144 };
-              brightness = brightness_table[brightness];
-              uint32_t r = (color & 0xFF) * brightness >> 8;
-              uint32_t g = ((color >> 8) & 0xFF) * brightness >> 8;
-              uint32_t b = ((color >> 16) & 0xFF) * brightness >> 8;
-              color = r | (g << 8) | (b << 16);
-
-              // ハード側のLED番号と、かんぷれシステムのLED番号の対応
-              static constexpr const uint8_t led_index_mapping[] = {
-              14, 15, 16, 17, 18,
-                9, 10, 11, 12, 13,
-                4,  5,  6,  7,  8,
-                  0,  1,  2,  3,
-              };
-              writeRegister(0x70 + led_index_mapping[rgb_reg_index] * 4, (const uint8_t*)&color, 3);
-            }
-          }
-        }
-        break;
-      }
-#if !defined ( M5UNIFIED_PC_BUILD )
-      flg_int = (ulTaskNotifyTake(pdTRUE, 1));
-
-#if DEBUGGING_TEST
-debuging_lv = (millis() >> 7) & 1;
-if (prev_debuging_lv != debuging_lv) {
-prev_debuging_lv = debuging_lv;
-flg_int = true;
-}
-#endif
-      
-      if (flg_int) {
-        break;
-      }
-#endif
+    // IMUのFIFOは蓄積されたサンプルを一括で読み出すため、一定間隔おきに読めば良い
+    uint32_t usec = M5.micros();
+    if (usec - _imu_usec >= imu_poll_usec) {
+      _imu_usec = usec;
+      updateImuVelocity();
     }
+
     // I2C通信が終わったらCPUクロックを上げる
     system_registry.task_status.setWorking(system_registry_t::reg_task_status_t::bitindex_t::TASK_I2C);
   }
+  updateBusStat();
 
   static uint32_t btns = ~0u;
   static uint8_t reg62[4] = {0, 0, 0, 0};
@@ -268,7 +302,9 @@ if (debuging_lv) {
 #endif
     if (btns != tmp[0]) {
       btns = tmp[0];
+      _idle_count = 0;
     } else {
+      if (_idle_count < idle_backoff_count) { ++_idle_count; }
       // メインのボタン状態が変化していなければエンコーダとノブの状態も取得する
       if (readRegister(0x10, (uint8_t*)tmp, 12)) {
         encoder[0] = tmp[0];
@@ -311,7 +347,9 @@ if (debuging_lv) {
 
       static uint32_t prev_btnmask = 0;
       if (prev_btnmask != button_bitmap) {
+        _idle_count = 0;
         if (button_bitmap & ~prev_btnmask & 0x7FFFu) {
+          latency_trace.markInput();
           // 演奏に関わるボタンが押された場合はIMUの値を取得、ベロシティを更新する
           updateImuVelocity();
         }
@@ -331,6 +369,7 @@ if (debuging_lv) {
         // エンコーダの回転操作をボタンビットマスクに反映
         int8_t diff = encoder[enc] - prev_enc[enc];
         if (diff) {
+          _idle_count = 0;
           prev_enc[enc] = encoder[enc];
           system_registry.internal_input.setEncValue(enc, encoder[enc]);
           uint32_t enc_bitmap = button_bitmap + ((diff < 0) ? enc_mask_table[enc][0] : enc_mask_table[enc][1]);
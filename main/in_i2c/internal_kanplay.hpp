@@ -32,7 +32,22 @@ public:
     bool execFirmwareUpdate(void) override;
     void mute(void) override;
 protected:
+    void collectRgbLed(void);
+    void flushRgbLed(void);
+    void updateBusStat(void);
+
     registry_t::history_code_t rgbled_history_code = 0;
+
+    // ハード側のLED番号順に並べた送信待ちの色 (4Byte目は未使用)
+    uint32_t _rgbled_color[def::hw::max_rgb_led] = { 0, };
+    // 送信が必要なLEDのビットマスク (初回は全LEDを送信する)
+    uint32_t _rgbled_dirty_mask = (1u << def::hw::max_rgb_led) - 1;
+    // 最後に書き込んだLEDの番号
+    uint8_t _rgbled_flush_index = 0;
+
+    // 入力に変化の無い状態が続いた回数 (ポーリング間隔の調整用)
+    uint16_t _idle_count = 0;
+    uint32_t _imu_usec = 0;
 };
 
 //-------------------------------------------------------------------------
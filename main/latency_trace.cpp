@@ -0,0 +1,216 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 InstaChord Corp.
+
+#include <M5Unified.h>
+
+#include "latency_trace.hpp"
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+#if __has_include(<freertos/freertos.h>)
+ #include <freertos/FreeRTOS.h>
+ #include <freertos/task.h>
+#endif
+
+namespace kanplay_ns {
+//-------------------------------------------------------------------------
+// extern instance
+latency_trace_t latency_trace;
+
+static inline uint8_t getCoreId(void)
+{
+#if defined (M5UNIFIED_PC_BUILD) || !__has_include(<freertos/freertos.h>)
+  return 0;
+#else
+  return xPortGetCoreID();
+#endif
+}
+
+const char* latency_trace_t::getHopName(uint8_t hop)
+{
+  static constexpr const char* const name_table[] = {
+    "input", "commander", "operator", "player", "midi_out", "transport",
+  };
+  return hop < hop_max ? name_table[hop] : "";
+}
+
+uint16_t latency_trace_t::issueId(void)
+{
+  uint16_t id;
+  do {
+    id = _id_counter.fetch_add(1, std::memory_order_relaxed) + 1;
+  } while (id == 0);
+  return id;
+}
+
+void latency_trace_t::record(hop_t hop, uint16_t id, uint16_t command)
+{
+  auto core = getCoreId();
+  if (core >= max_core) { core = 0; }
+  auto ring = &_ring[core];
+  // 同じコアで動作する複数のタスクから書き込まれるため、書込み位置はアトミックに確保する
+  uint32_t index = ring->write_index.fetch_add(1, std::memory_order_relaxed) & (max_event - 1);
+  auto ev = &ring->event[index];
+  ev->id = 0;
+  ev->usec = M5.micros();
+  ev->command = command;
+  ev->hop = hop;
+  ev->core = core;
+  ev->id = id;
+}
+
+void latency_trace_t::markInput(void)
+{
+  if (!isEnabled()) { return; }
+  auto id = issueId();
+  _input_id.store(id, std::memory_order_relaxed);
+  record(hop_input, id, 0);
+}
+
+void latency_trace_t::bindCommand(uint16_t command)
+{
+  if (!isEnabled()) { return; }
+  uint16_t id = _input_id.exchange(0, std::memory_order_relaxed);
+  if (id == 0) { id = issueId(); }
+  uint32_t slot = _binding_index.fetch_add(1, std::memory_order_relaxed) % max_binding;
+  _binding[slot].store((uint32_t)command << 16 | id, std::memory_order_relaxed);
+  // 同じ入力から複数のコマンドが発行される場合は以降のコマンドにも同じIDを引き継ぐ
+  _input_id.store(id, std::memory_order_relaxed);
+  record(hop_commander, id, command);
+}
+
+uint16_t latency_trace_t::markCommand(hop_t hop, uint16_t command)
+{
+  if (!isEnabled()) { return 0; }
+  // 新しく結び付けたものから順に探す
+  uint32_t last = _binding_index.load(std::memory_order_relaxed);
+  for (size_t i = 1; i <= max_binding; ++i) {
+    uint32_t bind = _binding[(last - i) % max_binding].load(std::memory_order_relaxed);
+    if ((bind >> 16) == command && (bind & 0xFFFF)) {
+      uint16_t id = bind & 0xFFFF;
+      record(hop, id, command);
+      return id;
+    }
+  }
+  return 0;
+}
+
+void latency_trace_t::markNoteOut(void)
+{
+  if (!isEnabled()) { return; }
+  uint16_t id = _note_context.exchange(0, std::memory_order_relaxed);
+  if (id == 0) { return; }
+  record(hop_midi_out, id, 0);
+  _transport_id.store(id, std::memory_order_relaxed);
+}
+
+void latency_trace_t::markTransport(void)
+{
+  if (!isEnabled()) { return; }
+  // 複数のトランスポートがある場合は最初に送信したものを記録する
+  uint16_t id = _transport_id.exchange(0, std::memory_order_relaxed);
+  if (id == 0) { return; }
+  record(hop_transport, id, 0);
+}
+
+uint32_t latency_trace_t::getRecordCount(void) const
+{
+  uint32_t count = 0;
+  for (auto &ring : _ring) {
+    count += ring.write_index.load(std::memory_order_relaxed);
+  }
+  return count;
+}
+
+size_t latency_trace_t::getEvents(event_t* dst, size_t max_count) const
+{
+  size_t count = 0;
+  for (auto &ring : _ring) {
+    uint32_t write_index = ring.write_index.load(std::memory_order_relaxed);
+    size_t len = write_index < max_event ? write_index : max_event;
+    for (size_t i = 0; i < len && count < max_count; ++i) {
+      auto ev = ring.event[(write_index - len + i) & (max_event - 1)];
+      if (ev.id == 0 || ev.hop >= hop_max) { continue; }
+      dst[count++] = ev;
+    }
+  }
+  std::sort(dst, dst + count, [](const event_t& a, const event_t& b) {
+    return (int32_t)(a.usec - b.usec) < 0;
+  });
+  return count;
+}
+
+void latency_trace_t::getHopStats(hop_stat_t* stat) const
+{
+  std::vector<event_t> events(max_event * max_core);
+  size_t count = getEvents(events.data(), events.size());
+  events.resize(count);
+  // IDごとに時刻順に並べ、同じIDの直前の記録地点からの経過時間を集計する
+  std::stable_sort(events.begin(), events.end(), [](const event_t& a, const event_t& b) { return a.id < b.id; });
+
+  std::vector<uint32_t> diff[hop_max];
+  for (size_t i = 1; i < count; ++i) {
+    auto &prev = events[i - 1];
+    auto &ev = events[i];
+    if (prev.id != ev.id || prev.hop >= ev.hop) { continue; }
+    diff[ev.hop].push_back(ev.usec - prev.usec);
+  }
+  for (int hop = 0; hop < hop_max; ++hop) {
+    auto &d = diff[hop];
+    stat[hop].count = d.size();
+    stat[hop].p50_usec = 0;
+    stat[hop].p99_usec = 0;
+    if (d.empty()) { continue; }
+    std::sort(d.begin(), d.end());
+    stat[hop].p50_usec = d[(d.size() - 1) * 50 / 100];
+    stat[hop].p99_usec = d[(d.size() - 1) * 99 / 100];
+  }
+}
+
+size_t latency_trace_t::writeChromeTrace(char* dst, size_t length) const
+{
+  std::vector<event_t> events(max_event * max_core);
+  size_t count = getEvents(events.data(), events.size());
+  events.resize(count);
+  std::stable_sort(events.begin(), events.end(), [](const event_t& a, const event_t& b) { return a.id < b.id; });
+
+  static constexpr const char trailer[] = "\n]}\n";
+  if (length <= sizeof(trailer)) { return 0; }
+  // 末尾の閉じ括弧と終端文字の分を残しておき、入りきらないイベントは途中まで書かずに打ち切る
+  // (バッファが不足しても常に閉じたJSONを出力する)
+  const size_t limit = length - (sizeof(trailer) - 1);
+  size_t pos = 0;
+  auto append = [&](const char* fmt, auto... args) {
+    int len = snprintf(&dst[pos], limit - pos, fmt, args...);
+    if (len < 0 || (size_t)len >= limit - pos) {
+      dst[pos] = 0;
+      return false;
+    }
+    pos += len;
+    return true;
+  };
+
+  if (!append("%s", "{\"traceEvents\":[\n")) { return 0; }
+  bool first = true;
+  for (size_t i = 0; i < count; ++i) {
+    auto &ev = events[i];
+    // 直前の記録地点から今回の記録地点までを1区間として出力する (tidはCPUコア番号)
+    bool has_prev = (i > 0 && events[i - 1].id == ev.id && events[i - 1].hop < ev.hop);
+    uint32_t ts = has_prev ? events[i - 1].usec : ev.usec;
+    uint32_t dur = has_prev ? ev.usec - ts : 0;
+    if (!append("%s{\"name\":\"%s\",\"cat\":\"latency\",\"ph\":\"X\",\"ts\":%lu,\"dur\":%lu,\"pid\":1,\"tid\":%u,\"args\":{\"id\":%u,\"command\":%u}}"
+          , first ? "" : ",\n", getHopName(ev.hop), (unsigned long)ts, (unsigned long)dur
+          , (unsigned)ev.core, (unsigned)ev.id, (unsigned)ev.command)) {
+      break;
+    }
+    first = false;
+  }
+  memcpy(&dst[pos], trailer, sizeof(trailer));
+  return pos + sizeof(trailer) - 1;
+}
+
+//-------------------------------------------------------------------------
+}; // namespace kanplay_ns
@@ -0,0 +1,108 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 InstaChord Corp.
+
+#ifndef KANPLAY_LATENCY_TRACE_HPP
+#define KANPLAY_LATENCY_TRACE_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+
+namespace kanplay_ns {
+//-------------------------------------------------------------------------
+// ボタン操作から発音までの各タスク間の経過時間を記録するトレース機能
+// 押下操作ごとにIDを発行し、各タスクの通過時刻をCPUコアごとのリングバッファに記録する
+// 記録はロックを使用せず、無効時はフラグ確認のみで戻る
+class latency_trace_t
+{
+public:
+  enum hop_t : uint8_t {
+    hop_input,      // internal_kanplay : ボタンの押下を検出した時点
+    hop_commander,  // task_commander   : コマンドを発行した時点
+    hop_operator,   // task_operator    : コマンドを受け取った時点
+    hop_player,     // task_kantanplay  : コマンドを受け取った時点
+    hop_midi_out,   // task_kantanplay  : 発音をMIDI出力レジストリに書き込んだ時点
+    hop_transport,  // task_midi        : 発音をMIDIトランスポートへ送信した時点
+    hop_max,
+  };
+
+  struct event_t {
+    uint32_t usec;
+    uint16_t id;      // 0 は未使用
+    uint16_t command; // command_param_t::raw
+    uint8_t hop;
+    uint8_t core;
+  };
+
+  struct hop_stat_t {
+    uint32_t count;
+    uint32_t p50_usec;  // 前の記録地点からの経過時間の中央値
+    uint32_t p99_usec;  // 前の記録地点からの経過時間の99パーセンタイル
+  };
+
+  static constexpr const size_t max_core = 2;
+  static constexpr const size_t max_event = 256;  // コアあたりの記録数 (2の累乗)
+
+  void setEnabled(bool enabled) { _enabled.store(enabled, std::memory_order_relaxed); }
+  bool isEnabled(void) const { return _enabled.load(std::memory_order_relaxed); }
+
+  // ボタンの押下を検出した時点で呼ぶ。新しいIDを発行して次のコマンド発行に引き継ぐ
+  void markInput(void);
+
+  // 押下時のコマンド発行時に呼ぶ。入力時のIDをコマンドに結び付ける (入力時のIDが無ければ新規発行する)
+  void bindCommand(uint16_t command);
+
+  // コマンドを受け取った時点で呼ぶ。結び付けられたIDを返す (トレース対象外の場合は 0)
+  uint16_t markCommand(hop_t hop, uint16_t command);
+
+  // 次に発音した時点を記録する対象のIDを設定する
+  void setNoteContext(uint16_t id) { if (id) { _note_context.store(id, std::memory_order_relaxed); } }
+
+  // 発音をMIDI出力レジストリに書き込んだ時点で呼ぶ
+  void markNoteOut(void);
+
+  // 発音をMIDIトランスポートへ送信した時点で呼ぶ
+  void markTransport(void);
+
+  // 記録された内容を時刻順に取得する。戻り値は取得した件数
+  size_t getEvents(event_t* dst, size_t max_count) const;
+
+  // 記録地点ごとの経過時間の統計を取得する (stat は hop_max 個の配列)
+  void getHopStats(hop_stat_t* stat) const;
+
+  // Chrome trace (chrome://tracing , Perfetto) 形式の JSON を出力する。戻り値は書き込んだバイト数
+  size_t writeChromeTrace(char* dst, size_t length) const;
+
+  // 記録の総数 (統計を更新すべきかの判定用)
+  uint32_t getRecordCount(void) const;
+
+  static const char* getHopName(uint8_t hop);
+
+private:
+  void record(hop_t hop, uint16_t id, uint16_t command);
+  uint16_t issueId(void);
+
+  struct ring_t {
+    event_t event[max_event];
+    std::atomic<uint32_t> write_index { 0 };
+  };
+  ring_t _ring[max_core];
+
+  // コマンドとIDの対応表 (上位16bit:コマンド 下位16bit:ID)
+  static constexpr const size_t max_binding = 8;
+  std::atomic<uint32_t> _binding[max_binding];
+  std::atomic<uint32_t> _binding_index { 0 };
+
+  std::atomic<uint16_t> _id_counter { 0 };
+  std::atomic<uint16_t> _input_id { 0 };
+  std::atomic<uint16_t> _note_context { 0 };
+  std::atomic<uint16_t> _transport_id { 0 };
+  std::atomic<bool> _enabled { false };
+};
+
+extern latency_trace_t latency_trace;
+
+//-------------------------------------------------------------------------
+}; // namespace kanplay_ns
+
+#endif
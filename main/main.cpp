@@ -16,6 +16,7 @@
 #include "task_commander.hpp"
 #include "task_kantanplay.hpp"
 #include "system_registry.hpp"
+#include "latency_trace.hpp"
 
 static kanplay_ns::task_spi_t task_spi;
 static kanplay_ns::task_i2c_t task_i2c;
@@ -43,6 +44,51 @@ static void log_memory(int index = 0)
 #endif
 }
 
+static void log_midi_out(void)
+{
+#if CORE_DEBUG_LEVEL > 3
+  // MIDI出力レジストリへの書込み数・通知数と、シャドウ/バッチ処理で省略できた数 (前回呼出しからの差分)
+  static uint32_t prev[4];
+  auto &midi_out = kanplay_ns::system_registry.midi_out_control;
+  uint32_t current[4] = {
+    midi_out.getWriteCount(),
+    midi_out.getWriteSkipCount(),
+    midi_out.getNotifyCount(),
+    midi_out.getNotifySkipCount(),
+  };
+  M5_LOGV("midi_out write:%d (saved:%d)  notify:%d (saved:%d)"
+    , current[0] - prev[0], current[1] - prev[1], current[2] - prev[2], current[3] - prev[3]);
+  memcpy(prev, current, sizeof(prev));
+#endif
+}
+
+static void log_latency_trace(void)
+{
+  // レイテンシトレースは開発者モードの間だけ有効にする (PCビルドでは常に有効)
+#if defined ( M5UNIFIED_PC_BUILD )
+  bool enabled = true;
+#else
+  bool enabled = kanplay_ns::system_registry.runtime_info.getDeveloperMode();
+#endif
+  auto &trace = kanplay_ns::latency_trace;
+  trace.setEnabled(enabled);
+  if (!enabled) { return; }
+
+  // 新しい記録があった場合のみ、記録地点ごとの経過時間を出力する
+  static uint32_t prev_count;
+  auto count = trace.getRecordCount();
+  if (prev_count == count) { return; }
+  prev_count = count;
+
+  kanplay_ns::latency_trace_t::hop_stat_t stat[kanplay_ns::latency_trace_t::hop_max];
+  trace.getHopStats(stat);
+  for (int hop = 1; hop < kanplay_ns::latency_trace_t::hop_max; ++hop) {
+    if (stat[hop].count == 0) { continue; }
+    M5_LOGI("latency %-9s n:%4lu  p50:%6luus  p99:%6luus", kanplay_ns::latency_trace_t::getHopName(hop)
+      , (unsigned long)stat[hop].count, (unsigned long)stat[hop].p50_usec, (unsigned long)stat[hop].p99_usec);
+  }
+}
+
 void setup() {
   log_memory(1); 
   auto cfg = M5.config();
@@ -89,8 +135,10 @@ void setup() {
 
 void loop() {
   M5.delay(1024);
+  log_latency_trace();
 #if !defined ( M5UNIFIED_PC_BUILD )
   log_memory(); 
+  log_midi_out();
 /*
   {
     auto t = time(nullptr);
@@ -104,16 +152,26 @@ void loop() {
 //*/
 #endif
 /*
-  M5_LOGV("perf: %d %d  spi:%d i2c:%d i2s:%d midi:%d cmd:%d kanplay:%d"
-    , kanplay_ns::system_registry.task_status.getLowPowerCounter() >> 10
-    , kanplay_ns::system_registry.task_status.getHighPowerCounter() >> 10
-    , kanplay_ns::system_registry.task_status.getWorkingCounter(kanplay_ns::system_registry_t::reg_task_status_t::index_t::TASK_SPI_COUNTER) >> 10
-    , kanplay_ns::system_registry.task_status.getWorkingCounter(kanplay_ns::system_registry_t::reg_task_status_t::index_t::TASK_I2C_COUNTER) >> 10
-    , kanplay_ns::system_registry.task_status.getWorkingCounter(kanplay_ns::system_registry_t::reg_task_status_t::index_t::TASK_I2S_COUNTER) >> 10
-    , kanplay_ns::system_registry.task_status.getWorkingCounter(kanplay_ns::system_registry_t::reg_task_status_t::index_t::TASK_MIDI_INTERNAL_COUNTER) >> 10
-    , kanplay_ns::system_registry.task_status.getWorkingCounter(kanplay_ns::system_registry_t::reg_task_status_t::index_t::TASK_COMMANDER_COUNTER) >> 10
-    , kanplay_ns::system_registry.task_status.getWorkingCounter(kanplay_ns::system_registry_t::reg_task_status_t::index_t::TASK_KANTANPLAY_COUNTER) >> 10
-  );
+  {
+    using task_status_t = kanplay_ns::system_registry_t::reg_task_status_t;
+    auto &task_status = kanplay_ns::system_registry.task_status;
+    M5_LOGV("perf: low:%d high:%d core0:%d core1:%d"
+      , task_status.getLowPowerCounter() >> 10
+      , task_status.getHighPowerCounter() >> 10
+      , task_status.getCoreRunUsec(0) >> 10
+      , task_status.getCoreRunUsec(1) >> 10
+    );
+    for (int i = 0; i < task_status_t::MAX_TASK; ++i) {
+      auto index = (task_status_t::bitindex_t)i;
+      auto &counter = task_status.getTaskCounter(index);
+      M5_LOGV("perf: %s run:%d wake:%d max:%d"
+        , task_status_t::getTaskName(index)
+        , counter.run_usec.load() >> 10
+        , counter.wake_count.load()
+        , counter.max_slice_usec.load()
+      );
+    }
+  }
 //*/
 }
 
@@ -492,6 +492,24 @@ struct mi_wave_view_t : public mi_enable_selector_t {
     }
   };
 
+struct mi_diag_view_t : public mi_enable_selector_t {
+  public:
+    constexpr mi_diag_view_t( def::menu_category_t cate, uint8_t seq, uint8_t level, const localize_text_t& title )
+    : mi_enable_selector_t { cate, seq, level, title } {}
+
+    int getValue(void) const override
+    {
+      return getMinValue() + static_cast<uint8_t>(system_registry.runtime_info.getGuiDiagView());
+    }
+    bool setValue(int value) const override
+    {
+      if (mi_selector_t::setValue(value) == false) { return false; }
+      value -= getMinValue();
+      system_registry.runtime_info.setGuiDiagView(value);
+      return true;
+    }
+  };
+
 
 struct mi_usewifi_t : public mi_enable_selector_t {
 public:
@@ -936,6 +954,35 @@ struct mi_slot_step_beat_t : public mi_selector_t {
   }
 };
 
+struct mi_layer_slot_t : public mi_selector_t {
+  static constexpr const localize_text_array_t name_array = { 9, (const localize_text_t[]){
+    { "Off"   , "なし"     },
+    { "Slot 1", "スロット1" },
+    { "Slot 2", "スロット2" },
+    { "Slot 3", "スロット3" },
+    { "Slot 4", "スロット4" },
+    { "Slot 5", "スロット5" },
+    { "Slot 6", "スロット6" },
+    { "Slot 7", "スロット7" },
+    { "Slot 8", "スロット8" },
+  }};
+
+  constexpr mi_layer_slot_t( def::menu_category_t cate, uint8_t seq, uint8_t level, const localize_text_t& title )
+  : mi_selector_t { cate, seq, level, title, &name_array }
+  {}
+
+  int getValue(void) const override
+  {
+    return getMinValue() + system_registry.runtime_info.getLayerSlot(1);
+  }
+  bool setValue(int value) const override
+  {
+    if (mi_selector_t::setValue(value) == false) { return false; }
+    system_registry.runtime_info.setLayerSlot(1, value - getMinValue());
+    return true;
+  }
+};
+
 struct mi_slot_clipboard_t : public mi_selector_t {
   static constexpr const localize_text_array_t name_array = { 2, (const localize_text_t[]){
     { "Copy Setting"  , "設定コピー" },
@@ -1549,229 +1596,231 @@ static constexpr menu_item_ptr menu_system[] = {
   (const mi_slot_key_t      []){{ def::menu_category_t::menu_system,  9,  2  , { "Key Modulation" , "キー転調"      }}},
   (const mi_slot_step_beat_t[]){{ def::menu_category_t::menu_system, 10,  2  , { "Step / Beat"    , "ステップ／ビート"}}},
   (const mi_slot_clipboard_t[]){{ def::menu_category_t::menu_system, 11,  2  , { "Clipboard"      , "クリップボード" }}},
-  (const mi_tree_t          []){{ def::menu_category_t::menu_system, 12, 1   , { "Tempo & Groove" , "テンポ＆グルーヴ設定"  }}},
-  (const mi_song_tempo_t    []){{ def::menu_category_t::menu_system, 13,  2  , { "BPM"            , "テンポ(BPM)"   }}},
-  (const mi_song_swing_t    []){{ def::menu_category_t::menu_system, 14,  2  , { "Swing"          , "スウィング"    }}},
-  (const mi_offbeat_style_t []){{ def::menu_category_t::menu_system, 15,  2  , { "Offbeat Control", "裏拍演奏"     }}},
-  (const mi_tree_t          []){{ def::menu_category_t::menu_system, 16, 1   , { "System"         , "システム"     }}},
-  (const mi_tree_t          []){{ def::menu_category_t::menu_system, 17,  2  , { "WiFi"           , "WiFi通信"     }}},
-  (const mi_usewifi_t       []){{ def::menu_category_t::menu_system, 18,   3 , { "Connection"     , "接続"         }}},
-  (const mi_otaupdate_t     []){{ def::menu_category_t::menu_system, 19,   3 , { "Firm Update"    , "ファーム更新" }}},
-  (const mi_wifiap_t        []){{ def::menu_category_t::menu_system, 20,   3 , { "WiFi Setup"     , "WiFi設定"     }}},
-  (const mi_tree_t          []){{ def::menu_category_t::menu_system, 21,  2   , { "Control Assignment", "操作割り当て"   }}},
-  (const mi_tree_t          []){{ def::menu_category_t::menu_system, 22,   3  , { "Play Button"   , "プレイボタン" }}},
-  (const mi_ca_internal_t   []){{ def::menu_category_t::menu_system, 23,    4 , { "Button 1"      , "ボタン 1"     },  1 - 1}},
-  (const mi_ca_internal_t   []){{ def::menu_category_t::menu_system, 24,    4 , { "Button 2"      , "ボタン 2"     },  2 - 1}},
-  (const mi_ca_internal_t   []){{ def::menu_category_t::menu_system, 25,    4 , { "Button 3"      , "ボタン 3"     },  3 - 1}},
-  (const mi_ca_internal_t   []){{ def::menu_category_t::menu_system, 26,    4 , { "Button 4"      , "ボタン 4"     },  4 - 1}},
-  (const mi_ca_internal_t   []){{ def::menu_category_t::menu_system, 27,    4 , { "Button 5"      , "ボタン 5"     },  5 - 1}},
-  (const mi_ca_internal_t   []){{ def::menu_category_t::menu_system, 28,    4 , { "Button 6"      , "ボタン 6"     },  6 - 1}},
-  (const mi_ca_internal_t   []){{ def::menu_category_t::menu_system, 29,    4 , { "Button 7"      , "ボタン 7"     },  7 - 1}},
-  (const mi_ca_internal_t   []){{ def::menu_category_t::menu_system, 30,    4 , { "Button 8"      , "ボタン 8"     },  8 - 1}},
-  (const mi_ca_internal_t   []){{ def::menu_category_t::menu_system, 31,    4 , { "Button 9"      , "ボタン 9"     },  9 - 1}},
-  (const mi_ca_internal_t   []){{ def::menu_category_t::menu_system, 32,    4 , { "Button 10"     , "ボタン 10"    }, 10 - 1}},
-  (const mi_ca_internal_t   []){{ def::menu_category_t::menu_system, 33,    4 , { "Button 11"     , "ボタン 11"    }, 11 - 1}},
-  (const mi_ca_internal_t   []){{ def::menu_category_t::menu_system, 34,    4 , { "Button 12"     , "ボタン 12"    }, 12 - 1}},
-  (const mi_ca_internal_t   []){{ def::menu_category_t::menu_system, 35,    4 , { "Button 13"     , "ボタン 13"    }, 13 - 1}},
-  (const mi_ca_internal_t   []){{ def::menu_category_t::menu_system, 36,    4 , { "Button 14"     , "ボタン 14"    }, 14 - 1}},
-  (const mi_ca_internal_t   []){{ def::menu_category_t::menu_system, 37,    4 , { "Button 15"     , "ボタン 15"    }, 15 - 1}},
-  (const mi_tree_t          []){{ def::menu_category_t::menu_system, 38,   3  , { "Ext Input"     , "拡張入力"     }}},
-  (const mi_ca_external_t   []){{ def::menu_category_t::menu_system, 39,    4 , { " Ext 1"        , "拡張 1"       },   1 - 1}},
-  (const mi_ca_external_t   []){{ def::menu_category_t::menu_system, 40,    4 , { " Ext 2"        , "拡張 2"       },   2 - 1}},
-  (const mi_ca_external_t   []){{ def::menu_category_t::menu_system, 41,    4 , { " Ext 3"        , "拡張 3"       },   3 - 1}},
-  (const mi_ca_external_t   []){{ def::menu_category_t::menu_system, 42,    4 , { " Ext 4"        , "拡張 4"       },   4 - 1}},
-  (const mi_ca_external_t   []){{ def::menu_category_t::menu_system, 43,    4 , { " Ext 5"        , "拡張 5"       },   5 - 1}},
-  (const mi_ca_external_t   []){{ def::menu_category_t::menu_system, 44,    4 , { " Ext 6"        , "拡張 6"       },   6 - 1}},
-  (const mi_ca_external_t   []){{ def::menu_category_t::menu_system, 45,    4 , { " Ext 7"        , "拡張 7"       },   7 - 1}},
-  (const mi_ca_external_t   []){{ def::menu_category_t::menu_system, 46,    4 , { " Ext 8"        , "拡張 8"       },   8 - 1}},
-  (const mi_ca_external_t   []){{ def::menu_category_t::menu_system, 47,    4 , { " Ext 9"        , "拡張 9"       },   9 - 1}},
-  (const mi_ca_external_t   []){{ def::menu_category_t::menu_system, 48,    4 , { " Ext 10"       , "拡張 10"      },  10 - 1}},
-  (const mi_ca_external_t   []){{ def::menu_category_t::menu_system, 49,    4 , { " Ext 11"       , "拡張 11"      },  11 - 1}},
-  (const mi_ca_external_t   []){{ def::menu_category_t::menu_system, 50,    4 , { " Ext 12"       , "拡張 12"      },  12 - 1}},
-  (const mi_ca_external_t   []){{ def::menu_category_t::menu_system, 51,    4 , { " Ext 13"       , "拡張 13"      },  13 - 1}},
-  (const mi_ca_external_t   []){{ def::menu_category_t::menu_system, 52,    4 , { " Ext 14"       , "拡張 14"      },  14 - 1}},
-  (const mi_ca_external_t   []){{ def::menu_category_t::menu_system, 53,    4 , { " Ext 15"       , "拡張 15"      },  15 - 1}},
-  (const mi_ca_external_t   []){{ def::menu_category_t::menu_system, 54,    4 , { " Ext 16"       , "拡張 16"      },  16 - 1}},
-  (const mi_ca_external_t   []){{ def::menu_category_t::menu_system, 55,    4 , { " Ext 17"       , "拡張 17"      },  17 - 1}},
-  (const mi_ca_external_t   []){{ def::menu_category_t::menu_system, 56,    4 , { " Ext 18"       , "拡張 18"      },  18 - 1}},
-  (const mi_ca_external_t   []){{ def::menu_category_t::menu_system, 57,    4 , { " Ext 19"       , "拡張 19"      },  19 - 1}},
-  (const mi_ca_external_t   []){{ def::menu_category_t::menu_system, 58,    4 , { " Ext 20"       , "拡張 20"      },  20 - 1}},
-  (const mi_ca_external_t   []){{ def::menu_category_t::menu_system, 59,    4 , { " Ext 21"       , "拡張 21"      },  21 - 1}},
-  (const mi_ca_external_t   []){{ def::menu_category_t::menu_system, 60,    4 , { " Ext 22"       , "拡張 22"      },  22 - 1}},
-  (const mi_ca_external_t   []){{ def::menu_category_t::menu_system, 61,    4 , { " Ext 23"       , "拡張 23"      },  23 - 1}},
-  (const mi_ca_external_t   []){{ def::menu_category_t::menu_system, 62,    4 , { " Ext 24"       , "拡張 24"      },  24 - 1}},
-  (const mi_ca_external_t   []){{ def::menu_category_t::menu_system, 63,    4 , { " Ext 25"       , "拡張 25"      },  25 - 1}},
-  (const mi_ca_external_t   []){{ def::menu_category_t::menu_system, 64,    4 , { " Ext 26"       , "拡張 26"      },  26 - 1}},
-  (const mi_ca_external_t   []){{ def::menu_category_t::menu_system, 65,    4 , { " Ext 27"       , "拡張 27"      },  27 - 1}},
-  (const mi_ca_external_t   []){{ def::menu_category_t::menu_system, 66,    4 , { " Ext 28"       , "拡張 28"      },  28 - 1}},
-  (const mi_ca_external_t   []){{ def::menu_category_t::menu_system, 67,    4 , { " Ext 29"       , "拡張 29"      },  29 - 1}},
-  (const mi_ca_external_t   []){{ def::menu_category_t::menu_system, 68,    4 , { " Ext 30"       , "拡張 30"      },  30 - 1}},
-  (const mi_ca_external_t   []){{ def::menu_category_t::menu_system, 69,    4 , { " Ext 31"       , "拡張 31"      },  31 - 1}},
-  (const mi_ca_external_t   []){{ def::menu_category_t::menu_system, 70,    4 , { " Ext 32"       , "拡張 32"      },  32 - 1}},
-  (const mi_tree_t          []){{ def::menu_category_t::menu_system, 71,   3  , { "MIDI Note"     , "MIDI Note"    }}},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system, 72,    4 , { "  C#-1" , nullptr },   1 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system, 73,    4 , { "  D -1" , nullptr },   2 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system, 74,    4 , { "  D#-1" , nullptr },   3 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system, 75,    4 , { "  E -1" , nullptr },   4 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system, 76,    4 , { "  F -1" , nullptr },   5 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system, 77,    4 , { "  F#-1" , nullptr },   6 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system, 78,    4 , { "  G -1" , nullptr },   7 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system, 79,    4 , { "  G#-1" , nullptr },   8 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system, 80,    4 , { "  A -1" , nullptr },   9 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system, 81,    4 , { "  A#-1" , nullptr },  10 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system, 82,    4 , { "  B -1" , nullptr },  11 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system, 83,    4 , { "  C  0" , nullptr },  12 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system, 84,    4 , { "  C# 0" , nullptr },  13 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system, 85,    4 , { "  D  0" , nullptr },  14 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system, 86,    4 , { "  D# 0" , nullptr },  15 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system, 87,    4 , { "  E  0" , nullptr },  16 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system, 88,    4 , { "  F  0" , nullptr },  17 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system, 89,    4 , { "  F# 0" , nullptr },  18 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system, 90,    4 , { "  G  0" , nullptr },  19 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system, 91,    4 , { "  G# 0" , nullptr },  20 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system, 92,    4 , { "  A  0" , nullptr },  21 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system, 93,    4 , { "  A# 0" , nullptr },  22 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system, 94,    4 , { "  B  0" , nullptr },  23 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system, 95,    4 , { "  C  1" , nullptr },  24 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system, 96,    4 , { "  C# 1" , nullptr },  25 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system, 97,    4 , { "  D  1" , nullptr },  26 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system, 98,    4 , { "  D# 1" , nullptr },  27 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system, 99,    4 , { "  E  1" , nullptr },  28 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,100,    4 , { "  F  1" , nullptr },  29 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,101,    4 , { "  F# 1" , nullptr },  30 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,102,    4 , { "  G  1" , nullptr },  31 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,103,    4 , { "  G# 1" , nullptr },  32 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,104,    4 , { "  A  1" , nullptr },  33 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,105,    4 , { "  A# 1" , nullptr },  34 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,106,    4 , { "  B  1" , nullptr },  35 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,107,    4 , { "  C  2" , nullptr },  36 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,108,    4 , { "  C# 2" , nullptr },  37 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,109,    4 , { "  D  2" , nullptr },  38 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,110,    4 , { "  D# 2" , nullptr },  39 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,111,    4 , { "  E  2" , nullptr },  40 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,112,    4 , { "  F  2" , nullptr },  41 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,113,    4 , { "  F# 2" , nullptr },  42 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,114,    4 , { "  G  2" , nullptr },  43 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,115,    4 , { "  G# 2" , nullptr },  44 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,116,    4 , { "  A  2" , nullptr },  45 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,117,    4 , { "  A# 2" , nullptr },  46 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,118,    4 , { "  B  2" , nullptr },  47 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,119,    4 , { "  C  3" , nullptr },  48 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,120,    4 , { "  C# 3" , nullptr },  49 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,121,    4 , { "  D  3" , nullptr },  50 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,122,    4 , { "  D# 3" , nullptr },  51 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,123,    4 , { "  E  3" , nullptr },  52 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,124,    4 , { "  F  3" , nullptr },  53 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,125,    4 , { "  F# 3" , nullptr },  54 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,126,    4 , { "  G  3" , nullptr },  55 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,127,    4 , { "  G# 3" , nullptr },  56 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,128,    4 , { "  A  3" , nullptr },  57 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,129,    4 , { "  A# 3" , nullptr },  58 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,130,    4 , { "  B  3" , nullptr },  59 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,131,    4 , { "  C  4" , nullptr },  60 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,132,    4 , { "  C# 4" , nullptr },  61 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,133,    4 , { "  D  4" , nullptr },  62 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,134,    4 , { "  D# 4" , nullptr },  63 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,135,    4 , { "  E  4" , nullptr },  64 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,136,    4 , { "  F  4" , nullptr },  65 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,137,    4 , { "  F# 4" , nullptr },  66 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,138,    4 , { "  G  4" , nullptr },  67 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,139,    4 , { "  G# 4" , nullptr },  68 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,140,    4 , { "  A  4" , nullptr },  69 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,141,    4 , { "  A# 4" , nullptr },  70 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,142,    4 , { "  B  4" , nullptr },  71 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,143,    4 , { "  C  5" , nullptr },  72 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,144,    4 , { "  C# 5" , nullptr },  73 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,145,    4 , { "  D  5" , nullptr },  74 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,146,    4 , { "  D# 5" , nullptr },  75 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,147,    4 , { "  E  5" , nullptr },  76 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,148,    4 , { "  F  5" , nullptr },  77 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,149,    4 , { "  F# 5" , nullptr },  78 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,150,    4 , { "  G  5" , nullptr },  79 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,151,    4 , { "  G# 5" , nullptr },  80 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,152,    4 , { "  A  5" , nullptr },  81 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,153,    4 , { "  A# 5" , nullptr },  82 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,154,    4 , { "  B  5" , nullptr },  83 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,155,    4 , { "  C  6" , nullptr },  84 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,156,    4 , { "  C# 6" , nullptr },  85 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,157,    4 , { "  D  6" , nullptr },  86 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,158,    4 , { "  D# 6" , nullptr },  87 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,159,    4 , { "  E  6" , nullptr },  88 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,160,    4 , { "  F  6" , nullptr },  89 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,161,    4 , { "  F# 6" , nullptr },  90 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,162,    4 , { "  G  6" , nullptr },  91 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,163,    4 , { "  G# 6" , nullptr },  92 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,164,    4 , { "  A  6" , nullptr },  93 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,165,    4 , { "  A# 6" , nullptr },  94 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,166,    4 , { "  B  6" , nullptr },  95 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,167,    4 , { "  C  7" , nullptr },  96 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,168,    4 , { "  C# 7" , nullptr },  97 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,169,    4 , { "  D  7" , nullptr },  98 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,170,    4 , { "  D# 7" , nullptr },  99 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,171,    4 , { "  E  7" , nullptr }, 100 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,172,    4 , { "  F  7" , nullptr }, 101 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,173,    4 , { "  F# 7" , nullptr }, 102 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,174,    4 , { "  G  7" , nullptr }, 103 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,175,    4 , { "  G# 7" , nullptr }, 104 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,176,    4 , { "  A  7" , nullptr }, 105 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,177,    4 , { "  A# 7" , nullptr }, 106 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,178,    4 , { "  B  7" , nullptr }, 107 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,179,    4 , { "  C  8" , nullptr }, 108 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,180,    4 , { "  C# 8" , nullptr }, 109 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,181,    4 , { "  D  8" , nullptr }, 110 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,182,    4 , { "  D# 8" , nullptr }, 111 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,183,    4 , { "  E  8" , nullptr }, 112 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,184,    4 , { "  F  8" , nullptr }, 113 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,185,    4 , { "  F# 8" , nullptr }, 114 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,186,    4 , { "  G  8" , nullptr }, 115 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,187,    4 , { "  G# 8" , nullptr }, 116 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,188,    4 , { "  A  8" , nullptr }, 117 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,189,    4 , { "  A# 8" , nullptr }, 118 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,190,    4 , { "  B  8" , nullptr }, 119 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,191,    4 , { "  C  9" , nullptr }, 120 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,192,    4 , { "  C# 9" , nullptr }, 121 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,193,    4 , { "  D  9" , nullptr }, 122 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,194,    4 , { "  D# 9" , nullptr }, 123 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,195,    4 , { "  E  9" , nullptr }, 124 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,196,    4 , { "  F  9" , nullptr }, 125 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,197,    4 , { "  F# 9" , nullptr }, 126 }},
-  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,198,    4 , { "  G  9" , nullptr }, 127 }},
-  (const mi_tree_t          []){{ def::menu_category_t::menu_system,199,  2   , { "External Device", "外部デバイス" }}},
-  (const mi_portc_midi_t    []){{ def::menu_category_t::menu_system,200,   3  , { "PortC MIDI"     , "ポートC MIDI" }}},
-  (const mi_ble_midi_t      []){{ def::menu_category_t::menu_system,201,   3  , { "BLE MIDI"       , "BLE MIDI"     }}},
-
-//(const mi_tree_t          []){{ def::menu_category_t::menu_system,202,  2   , { "MIDI Input Setting", "MIDI入力設定" }}},
-//(const mi_midi_input_t    []){{ def::menu_category_t::menu_system,203,   3  , { "CH  1"         , nullptr       },  1 }},
-//(const mi_midi_input_t    []){{ def::menu_category_t::menu_system,204,   3  , { "CH  2"         , nullptr       },  2 }},
-//(const mi_midi_input_t    []){{ def::menu_category_t::menu_system,205,   3  , { "CH  3"         , nullptr       },  3 }},
-//(const mi_midi_input_t    []){{ def::menu_category_t::menu_system,206,   3  , { "CH  4"         , nullptr       },  4 }},
-//(const mi_midi_input_t    []){{ def::menu_category_t::menu_system,207,   3  , { "CH  5"         , nullptr       },  5 }},
-//(const mi_midi_input_t    []){{ def::menu_category_t::menu_system,208,   3  , { "CH  6"         , nullptr       },  6 }},
-//(const mi_midi_input_t    []){{ def::menu_category_t::menu_system,209,   3  , { "CH  7"         , nullptr       },  7 }},
-//(const mi_midi_input_t    []){{ def::menu_category_t::menu_system,210,   3  , { "CH  8"         , nullptr       },  8 }},
-//(const mi_midi_input_t    []){{ def::menu_category_t::menu_system,211,   3  , { "CH  9"         , nullptr       },  9 }},
-//(const mi_midi_input_t    []){{ def::menu_category_t::menu_system,212,   3  , { "CH 10"         , nullptr       }, 10 }},
-//(const mi_midi_input_t    []){{ def::menu_category_t::menu_system,213,   3  , { "CH 11"         , nullptr       }, 11 }},
-//(const mi_midi_input_t    []){{ def::menu_category_t::menu_system,214,   3  , { "CH 12"         , nullptr       }, 12 }},
-//(const mi_midi_input_t    []){{ def::menu_category_t::menu_system,215,   3  , { "CH 13"         , nullptr       }, 13 }},
-//(const mi_midi_input_t    []){{ def::menu_category_t::menu_system,216,   3  , { "CH 14"         , nullptr       }, 14 }},
-//(const mi_midi_input_t    []){{ def::menu_category_t::menu_system,217,   3  , { "CH 15"         , nullptr       }, 15 }},
-//(const mi_midi_input_t    []){{ def::menu_category_t::menu_system,218,   3  , { "CH 16"         , nullptr       }, 16 }},
+  (const mi_layer_slot_t    []){{ def::menu_category_t::menu_system, 12,  2  , { "Layer Slot"     , "レイヤー"       }}},
+  (const mi_tree_t          []){{ def::menu_category_t::menu_system, 13, 1   , { "Tempo & Groove" , "テンポ＆グルーヴ設定"  }}},
+  (const mi_song_tempo_t    []){{ def::menu_category_t::menu_system, 14,  2  , { "BPM"            , "テンポ(BPM)"   }}},
+  (const mi_song_swing_t    []){{ def::menu_category_t::menu_system, 15,  2  , { "Swing"          , "スウィング"    }}},
+  (const mi_offbeat_style_t []){{ def::menu_category_t::menu_system, 16,  2  , { "Offbeat Control", "裏拍演奏"     }}},
+  (const mi_tree_t          []){{ def::menu_category_t::menu_system, 17, 1   , { "System"         , "システム"     }}},
+  (const mi_tree_t          []){{ def::menu_category_t::menu_system, 18,  2  , { "WiFi"           , "WiFi通信"     }}},
+  (const mi_usewifi_t       []){{ def::menu_category_t::menu_system, 19,   3 , { "Connection"     , "接続"         }}},
+  (const mi_otaupdate_t     []){{ def::menu_category_t::menu_system, 20,   3 , { "Firm Update"    , "ファーム更新" }}},
+  (const mi_wifiap_t        []){{ def::menu_category_t::menu_system, 21,   3 , { "WiFi Setup"     , "WiFi設定"     }}},
+  (const mi_tree_t          []){{ def::menu_category_t::menu_system, 22,  2   , { "Control Assignment", "操作割り当て"   }}},
+  (const mi_tree_t          []){{ def::menu_category_t::menu_system, 23,   3  , { "Play Button"   , "プレイボタン" }}},
+  (const mi_ca_internal_t   []){{ def::menu_category_t::menu_system, 24,    4 , { "Button 1"      , "ボタン 1"     },  1 - 1}},
+  (const mi_ca_internal_t   []){{ def::menu_category_t::menu_system, 25,    4 , { "Button 2"      , "ボタン 2"     },  2 - 1}},
+  (const mi_ca_internal_t   []){{ def::menu_category_t::menu_system, 26,    4 , { "Button 3"      , "ボタン 3"     },  3 - 1}},
+  (const mi_ca_internal_t   []){{ def::menu_category_t::menu_system, 27,    4 , { "Button 4"      , "ボタン 4"     },  4 - 1}},
+  (const mi_ca_internal_t   []){{ def::menu_category_t::menu_system, 28,    4 , { "Button 5"      , "ボタン 5"     },  5 - 1}},
+  (const mi_ca_internal_t   []){{ def::menu_category_t::menu_system, 29,    4 , { "Button 6"      , "ボタン 6"     },  6 - 1}},
+  (const mi_ca_internal_t   []){{ def::menu_category_t::menu_system, 30,    4 , { "Button 7"      , "ボタン 7"     },  7 - 1}},
+  (const mi_ca_internal_t   []){{ def::menu_category_t::menu_system, 31,    4 , { "Button 8"      , "ボタン 8"     },  8 - 1}},
+  (const mi_ca_internal_t   []){{ def::menu_category_t::menu_system, 32,    4 , { "Button 9"      , "ボタン 9"     },  9 - 1}},
+  (const mi_ca_internal_t   []){{ def::menu_category_t::menu_system, 33,    4 , { "Button 10"     , "ボタン 10"    }, 10 - 1}},
+  (const mi_ca_internal_t   []){{ def::menu_category_t::menu_system, 34,    4 , { "Button 11"     , "ボタン 11"    }, 11 - 1}},
+  (const mi_ca_internal_t   []){{ def::menu_category_t::menu_system, 35,    4 , { "Button 12"     , "ボタン 12"    }, 12 - 1}},
+  (const mi_ca_internal_t   []){{ def::menu_category_t::menu_system, 36,    4 , { "Button 13"     , "ボタン 13"    }, 13 - 1}},
+  (const mi_ca_internal_t   []){{ def::menu_category_t::menu_system, 37,    4 , { "Button 14"     , "ボタン 14"    }, 14 - 1}},
+  (const mi_ca_internal_t   []){{ def::menu_category_t::menu_system, 38,    4 , { "Button 15"     , "ボタン 15"    }, 15 - 1}},
+  (const mi_tree_t          []){{ def::menu_category_t::menu_system, 39,   3  , { "Ext Input"     , "拡張入力"     }}},
+  (const mi_ca_external_t   []){{ def::menu_category_t::menu_system, 40,    4 , { " Ext 1"        , "拡張 1"       },   1 - 1}},
+  (const mi_ca_external_t   []){{ def::menu_category_t::menu_system, 41,    4 , { " Ext 2"        , "拡張 2"       },   2 - 1}},
+  (const mi_ca_external_t   []){{ def::menu_category_t::menu_system, 42,    4 , { " Ext 3"        , "拡張 3"       },   3 - 1}},
+  (const mi_ca_external_t   []){{ def::menu_category_t::menu_system, 43,    4 , { " Ext 4"        , "拡張 4"       },   4 - 1}},
+  (const mi_ca_external_t   []){{ def::menu_category_t::menu_system, 44,    4 , { " Ext 5"        , "拡張 5"       },   5 - 1}},
+  (const mi_ca_external_t   []){{ def::menu_category_t::menu_system, 45,    4 , { " Ext 6"        , "拡張 6"       },   6 - 1}},
+  (const mi_ca_external_t   []){{ def::menu_category_t::menu_system, 46,    4 , { " Ext 7"        , "拡張 7"       },   7 - 1}},
+  (const mi_ca_external_t   []){{ def::menu_category_t::menu_system, 47,    4 , { " Ext 8"        , "拡張 8"       },   8 - 1}},
+  (const mi_ca_external_t   []){{ def::menu_category_t::menu_system, 48,    4 , { " Ext 9"        , "拡張 9"       },   9 - 1}},
+  (const mi_ca_external_t   []){{ def::menu_category_t::menu_system, 49,    4 , { " Ext 10"       , "拡張 10"      },  10 - 1}},
+  (const mi_ca_external_t   []){{ def::menu_category_t::menu_system, 50,    4 , { " Ext 11"       , "拡張 11"      },  11 - 1}},
+  (const mi_ca_external_t   []){{ def::menu_category_t::menu_system, 51,    4 , { " Ext 12"       , "拡張 12"      },  12 - 1}},
+  (const mi_ca_external_t   []){{ def::menu_category_t::menu_system, 52,    4 , { " Ext 13"       , "拡張 13"      },  13 - 1}},
+  (const mi_ca_external_t   []){{ def::menu_category_t::menu_system, 53,    4 , { " Ext 14"       , "拡張 14"      },  14 - 1}},
+  (const mi_ca_external_t   []){{ def::menu_category_t::menu_system, 54,    4 , { " Ext 15"       , "拡張 15"      },  15 - 1}},
+  (const mi_ca_external_t   []){{ def::menu_category_t::menu_system, 55,    4 , { " Ext 16"       , "拡張 16"      },  16 - 1}},
+  (const mi_ca_external_t   []){{ def::menu_category_t::menu_system, 56,    4 , { " Ext 17"       , "拡張 17"      },  17 - 1}},
+  (const mi_ca_external_t   []){{ def::menu_category_t::menu_system, 57,    4 , { " Ext 18"       , "拡張 18"      },  18 - 1}},
+  (const mi_ca_external_t   []){{ def::menu_category_t::menu_system, 58,    4 , { " Ext 19"       , "拡張 19"      },  19 - 1}},
+  (const mi_ca_external_t   []){{ def::menu_category_t::menu_system, 59,    4 , { " Ext 20"       , "拡張 20"      },  20 - 1}},
+  (const mi_ca_external_t   []){{ def::menu_category_t::menu_system, 60,    4 , { " Ext 21"       , "拡張 21"      },  21 - 1}},
+  (const mi_ca_external_t   []){{ def::menu_category_t::menu_system, 61,    4 , { " Ext 22"       , "拡張 22"      },  22 - 1}},
+  (const mi_ca_external_t   []){{ def::menu_category_t::menu_system, 62,    4 , { " Ext 23"       , "拡張 23"      },  23 - 1}},
+  (const mi_ca_external_t   []){{ def::menu_category_t::menu_system, 63,    4 , { " Ext 24"       , "拡張 24"      },  24 - 1}},
+  (const mi_ca_external_t   []){{ def::menu_category_t::menu_system, 64,    4 , { " Ext 25"       , "拡張 25"      },  25 - 1}},
+  (const mi_ca_external_t   []){{ def::menu_category_t::menu_system, 65,    4 , { " Ext 26"       , "拡張 26"      },  26 - 1}},
+  (const mi_ca_external_t   []){{ def::menu_category_t::menu_system, 66,    4 , { " Ext 27"       , "拡張 27"      },  27 - 1}},
+  (const mi_ca_external_t   []){{ def::menu_category_t::menu_system, 67,    4 , { " Ext 28"       , "拡張 28"      },  28 - 1}},
+  (const mi_ca_external_t   []){{ def::menu_category_t::menu_system, 68,    4 , { " Ext 29"       , "拡張 29"      },  29 - 1}},
+  (const mi_ca_external_t   []){{ def::menu_category_t::menu_system, 69,    4 , { " Ext 30"       , "拡張 30"      },  30 - 1}},
+  (const mi_ca_external_t   []){{ def::menu_category_t::menu_system, 70,    4 , { " Ext 31"       , "拡張 31"      },  31 - 1}},
+  (const mi_ca_external_t   []){{ def::menu_category_t::menu_system, 71,    4 , { " Ext 32"       , "拡張 32"      },  32 - 1}},
+  (const mi_tree_t          []){{ def::menu_category_t::menu_system, 72,   3  , { "MIDI Note"     , "MIDI Note"    }}},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system, 73,    4 , { "  C#-1" , nullptr },   1 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system, 74,    4 , { "  D -1" , nullptr },   2 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system, 75,    4 , { "  D#-1" , nullptr },   3 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system, 76,    4 , { "  E -1" , nullptr },   4 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system, 77,    4 , { "  F -1" , nullptr },   5 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system, 78,    4 , { "  F#-1" , nullptr },   6 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system, 79,    4 , { "  G -1" , nullptr },   7 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system, 80,    4 , { "  G#-1" , nullptr },   8 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system, 81,    4 , { "  A -1" , nullptr },   9 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system, 82,    4 , { "  A#-1" , nullptr },  10 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system, 83,    4 , { "  B -1" , nullptr },  11 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system, 84,    4 , { "  C  0" , nullptr },  12 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system, 85,    4 , { "  C# 0" , nullptr },  13 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system, 86,    4 , { "  D  0" , nullptr },  14 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system, 87,    4 , { "  D# 0" , nullptr },  15 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system, 88,    4 , { "  E  0" , nullptr },  16 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system, 89,    4 , { "  F  0" , nullptr },  17 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system, 90,    4 , { "  F# 0" , nullptr },  18 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system, 91,    4 , { "  G  0" , nullptr },  19 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system, 92,    4 , { "  G# 0" , nullptr },  20 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system, 93,    4 , { "  A  0" , nullptr },  21 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system, 94,    4 , { "  A# 0" , nullptr },  22 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system, 95,    4 , { "  B  0" , nullptr },  23 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system, 96,    4 , { "  C  1" , nullptr },  24 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system, 97,    4 , { "  C# 1" , nullptr },  25 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system, 98,    4 , { "  D  1" , nullptr },  26 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system, 99,    4 , { "  D# 1" , nullptr },  27 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,100,    4 , { "  E  1" , nullptr },  28 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,101,    4 , { "  F  1" , nullptr },  29 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,102,    4 , { "  F# 1" , nullptr },  30 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,103,    4 , { "  G  1" , nullptr },  31 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,104,    4 , { "  G# 1" , nullptr },  32 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,105,    4 , { "  A  1" , nullptr },  33 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,106,    4 , { "  A# 1" , nullptr },  34 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,107,    4 , { "  B  1" , nullptr },  35 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,108,    4 , { "  C  2" , nullptr },  36 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,109,    4 , { "  C# 2" , nullptr },  37 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,110,    4 , { "  D  2" , nullptr },  38 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,111,    4 , { "  D# 2" , nullptr },  39 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,112,    4 , { "  E  2" , nullptr },  40 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,113,    4 , { "  F  2" , nullptr },  41 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,114,    4 , { "  F# 2" , nullptr },  42 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,115,    4 , { "  G  2" , nullptr },  43 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,116,    4 , { "  G# 2" , nullptr },  44 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,117,    4 , { "  A  2" , nullptr },  45 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,118,    4 , { "  A# 2" , nullptr },  46 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,119,    4 , { "  B  2" , nullptr },  47 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,120,    4 , { "  C  3" , nullptr },  48 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,121,    4 , { "  C# 3" , nullptr },  49 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,122,    4 , { "  D  3" , nullptr },  50 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,123,    4 , { "  D# 3" , nullptr },  51 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,124,    4 , { "  E  3" , nullptr },  52 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,125,    4 , { "  F  3" , nullptr },  53 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,126,    4 , { "  F# 3" , nullptr },  54 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,127,    4 , { "  G  3" , nullptr },  55 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,128,    4 , { "  G# 3" , nullptr },  56 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,129,    4 , { "  A  3" , nullptr },  57 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,130,    4 , { "  A# 3" , nullptr },  58 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,131,    4 , { "  B  3" , nullptr },  59 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,132,    4 , { "  C  4" , nullptr },  60 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,133,    4 , { "  C# 4" , nullptr },  61 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,134,    4 , { "  D  4" , nullptr },  62 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,135,    4 , { "  D# 4" , nullptr },  63 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,136,    4 , { "  E  4" , nullptr },  64 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,137,    4 , { "  F  4" , nullptr },  65 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,138,    4 , { "  F# 4" , nullptr },  66 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,139,    4 , { "  G  4" , nullptr },  67 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,140,    4 , { "  G# 4" , nullptr },  68 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,141,    4 , { "  A  4" , nullptr },  69 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,142,    4 , { "  A# 4" , nullptr },  70 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,143,    4 , { "  B  4" , nullptr },  71 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,144,    4 , { "  C  5" , nullptr },  72 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,145,    4 , { "  C# 5" , nullptr },  73 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,146,    4 , { "  D  5" , nullptr },  74 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,147,    4 , { "  D# 5" , nullptr },  75 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,148,    4 , { "  E  5" , nullptr },  76 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,149,    4 , { "  F  5" , nullptr },  77 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,150,    4 , { "  F# 5" , nullptr },  78 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,151,    4 , { "  G  5" , nullptr },  79 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,152,    4 , { "  G# 5" , nullptr },  80 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,153,    4 , { "  A  5" , nullptr },  81 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,154,    4 , { "  A# 5" , nullptr },  82 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,155,    4 , { "  B  5" , nullptr },  83 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,156,    4 , { "  C  6" , nullptr },  84 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,157,    4 , { "  C# 6" , nullptr },  85 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,158,    4 , { "  D  6" , nullptr },  86 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,159,    4 , { "  D# 6" , nullptr },  87 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,160,    4 , { "  E  6" , nullptr },  88 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,161,    4 , { "  F  6" , nullptr },  89 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,162,    4 , { "  F# 6" , nullptr },  90 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,163,    4 , { "  G  6" , nullptr },  91 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,164,    4 , { "  G# 6" , nullptr },  92 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,165,    4 , { "  A  6" , nullptr },  93 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,166,    4 , { "  A# 6" , nullptr },  94 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,167,    4 , { "  B  6" , nullptr },  95 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,168,    4 , { "  C  7" , nullptr },  96 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,169,    4 , { "  C# 7" , nullptr },  97 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,170,    4 , { "  D  7" , nullptr },  98 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,171,    4 , { "  D# 7" , nullptr },  99 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,172,    4 , { "  E  7" , nullptr }, 100 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,173,    4 , { "  F  7" , nullptr }, 101 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,174,    4 , { "  F# 7" , nullptr }, 102 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,175,    4 , { "  G  7" , nullptr }, 103 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,176,    4 , { "  G# 7" , nullptr }, 104 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,177,    4 , { "  A  7" , nullptr }, 105 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,178,    4 , { "  A# 7" , nullptr }, 106 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,179,    4 , { "  B  7" , nullptr }, 107 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,180,    4 , { "  C  8" , nullptr }, 108 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,181,    4 , { "  C# 8" , nullptr }, 109 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,182,    4 , { "  D  8" , nullptr }, 110 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,183,    4 , { "  D# 8" , nullptr }, 111 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,184,    4 , { "  E  8" , nullptr }, 112 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,185,    4 , { "  F  8" , nullptr }, 113 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,186,    4 , { "  F# 8" , nullptr }, 114 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,187,    4 , { "  G  8" , nullptr }, 115 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,188,    4 , { "  G# 8" , nullptr }, 116 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,189,    4 , { "  A  8" , nullptr }, 117 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,190,    4 , { "  A# 8" , nullptr }, 118 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,191,    4 , { "  B  8" , nullptr }, 119 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,192,    4 , { "  C  9" , nullptr }, 120 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,193,    4 , { "  C# 9" , nullptr }, 121 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,194,    4 , { "  D  9" , nullptr }, 122 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,195,    4 , { "  D# 9" , nullptr }, 123 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,196,    4 , { "  E  9" , nullptr }, 124 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,197,    4 , { "  F  9" , nullptr }, 125 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,198,    4 , { "  F# 9" , nullptr }, 126 }},
+  (const mi_ca_midinote_t   []){{ def::menu_category_t::menu_system,199,    4 , { "  G  9" , nullptr }, 127 }},
+  (const mi_tree_t          []){{ def::menu_category_t::menu_system,200,  2   , { "External Device", "外部デバイス" }}},
+  (const mi_portc_midi_t    []){{ def::menu_category_t::menu_system,201,   3  , { "PortC MIDI"     , "ポートC MIDI" }}},
+  (const mi_ble_midi_t      []){{ def::menu_category_t::menu_system,202,   3  , { "BLE MIDI"       , "BLE MIDI"     }}},
+
+//(const mi_tree_t          []){{ def::menu_category_t::menu_system,203,  2   , { "MIDI Input Setting", "MIDI入力設定" }}},
+//(const mi_midi_input_t    []){{ def::menu_category_t::menu_system,204,   3  , { "CH  1"         , nullptr       },  1 }},
+//(const mi_midi_input_t    []){{ def::menu_category_t::menu_system,205,   3  , { "CH  2"         , nullptr       },  2 }},
+//(const mi_midi_input_t    []){{ def::menu_category_t::menu_system,206,   3  , { "CH  3"         , nullptr       },  3 }},
+//(const mi_midi_input_t    []){{ def::menu_category_t::menu_system,207,   3  , { "CH  4"         , nullptr       },  4 }},
+//(const mi_midi_input_t    []){{ def::menu_category_t::menu_system,208,   3  , { "CH  5"         , nullptr       },  5 }},
+//(const mi_midi_input_t    []){{ def::menu_category_t::menu_system,209,   3  , { "CH  6"         , nullptr       },  6 }},
+//(const mi_midi_input_t    []){{ def::menu_category_t::menu_system,210,   3  , { "CH  7"         , nullptr       },  7 }},
+//(const mi_midi_input_t    []){{ def::menu_category_t::menu_system,211,   3  , { "CH  8"         , nullptr       },  8 }},
+//(const mi_midi_input_t    []){{ def::menu_category_t::menu_system,212,   3  , { "CH  9"         , nullptr       },  9 }},
+//(const mi_midi_input_t    []){{ def::menu_category_t::menu_system,213,   3  , { "CH 10"         , nullptr       }, 10 }},
+//(const mi_midi_input_t    []){{ def::menu_category_t::menu_system,214,   3  , { "CH 11"         , nullptr       }, 11 }},
+//(const mi_midi_input_t    []){{ def::menu_category_t::menu_system,215,   3  , { "CH 12"         , nullptr       }, 12 }},
+//(const mi_midi_input_t    []){{ def::menu_category_t::menu_system,216,   3  , { "CH 13"         , nullptr       }, 13 }},
+//(const mi_midi_input_t    []){{ def::menu_category_t::menu_system,217,   3  , { "CH 14"         , nullptr       }, 14 }},
+//(const mi_midi_input_t    []){{ def::menu_category_t::menu_system,218,   3  , { "CH 15"         , nullptr       }, 15 }},
+//(const mi_midi_input_t    []){{ def::menu_category_t::menu_system,219,   3  , { "CH 16"         , nullptr       }, 16 }},
 
 // TODO:これ追加  OFF,80,81-89,90 (初期値80)
-//(const mi_ble_midi_t      []){{ def::menu_category_t::menu_system,202,   3 , { "#CC Assignment" , "#CC割当"     }}},
-  (const mi_imu_velocity_t  []){{ def::menu_category_t::menu_system,202,  2  , { "IMU Velocity"   , "IMUベロシティ"}}},
-  (const mi_tree_t          []){{ def::menu_category_t::menu_system,203,  2  , { "Display"        , "表示"        }}},
-  (const mi_lcd_backlight_t []){{ def::menu_category_t::menu_system,204,   3 , { "Backlight"      , "画面の輝度"  }}},
-  (const mi_led_brightness_t[]){{ def::menu_category_t::menu_system,205,   3 , { "LED Brightness" , "LEDの輝度"   }}},
-  (const mi_detail_view_t   []){{ def::menu_category_t::menu_system,206,   3 , { "Detail View"    , "詳細表示"    }}},
-  (const mi_wave_view_t     []){{ def::menu_category_t::menu_system,207,   3 , { "Wave View"      , "波形表示"    }}},
-  (const mi_language_t      []){{ def::menu_category_t::menu_system,208,  2  , { "Language"       , "言語"        }}},
-  (const mi_tree_t          []){{ def::menu_category_t::menu_system,209,  2  , { "Volume"         , "音量"        }}},
-  (const mi_vol_midi_t      []){{ def::menu_category_t::menu_system,210,   3 , { "MIDI Mastervol" , "MIDIマスター音量"}}},
-  (const mi_vol_adcmic_t    []){{ def::menu_category_t::menu_system,211,   3 , { "ADC MicAmp"     , "ADCマイクアンプ" }}},
-  (const mi_all_reset_t     []){{ def::menu_category_t::menu_system,212,  2  , { "Reset All Settings", "全設定リセット"    }}},
-  (const mi_manual_qr_t     []){{ def::menu_category_t::menu_system,213, 1   , { "Manual QR"      , "説明書QR"     }}},
+//(const mi_ble_midi_t      []){{ def::menu_category_t::menu_system,203,   3 , { "#CC Assignment" , "#CC割当"     }}},
+  (const mi_imu_velocity_t  []){{ def::menu_category_t::menu_system,203,  2  , { "IMU Velocity"   , "IMUベロシティ"}}},
+  (const mi_tree_t          []){{ def::menu_category_t::menu_system,204,  2  , { "Display"        , "表示"        }}},
+  (const mi_lcd_backlight_t []){{ def::menu_category_t::menu_system,205,   3 , { "Backlight"      , "画面の輝度"  }}},
+  (const mi_led_brightness_t[]){{ def::menu_category_t::menu_system,206,   3 , { "LED Brightness" , "LEDの輝度"   }}},
+  (const mi_detail_view_t   []){{ def::menu_category_t::menu_system,207,   3 , { "Detail View"    , "詳細表示"    }}},
+  (const mi_wave_view_t     []){{ def::menu_category_t::menu_system,208,   3 , { "Wave View"      , "波形表示"    }}},
+  (const mi_diag_view_t     []){{ def::menu_category_t::menu_system,209,   3 , { "Diagnostics"    , "診断表示"    }}},
+  (const mi_language_t      []){{ def::menu_category_t::menu_system,210,  2  , { "Language"       , "言語"        }}},
+  (const mi_tree_t          []){{ def::menu_category_t::menu_system,211,  2  , { "Volume"         , "音量"        }}},
+  (const mi_vol_midi_t      []){{ def::menu_category_t::menu_system,212,   3 , { "MIDI Mastervol" , "MIDIマスター音量"}}},
+  (const mi_vol_adcmic_t    []){{ def::menu_category_t::menu_system,213,   3 , { "ADC MicAmp"     , "ADCマイクアンプ" }}},
+  (const mi_all_reset_t     []){{ def::menu_category_t::menu_system,214,  2  , { "Reset All Settings", "全設定リセット"    }}},
+  (const mi_manual_qr_t     []){{ def::menu_category_t::menu_system,215, 1   , { "Manual QR"      , "説明書QR"     }}},
   nullptr, // end of menu
 };
 // const size_t menu_system_size = sizeof(menu_system) / sizeof(menu_system[0]) - 1;
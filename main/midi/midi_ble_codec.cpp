@@ -0,0 +1,244 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 InstaChord Corp.
+
+#include "midi_ble_codec.hpp"
+
+namespace midi_driver {
+
+//-------------------------------------------------------------------------
+
+void BLE_MIDI_Encoder::setPacketSize(size_t size)
+{
+  if (size < min_packet_size) { size = min_packet_size; }
+  if (size > max_packet_size) { size = max_packet_size; }
+  if (_packet_size != size) {
+    flush();
+    _packet_size = size;
+  }
+}
+
+void BLE_MIDI_Encoder::reset(void)
+{
+  _length = 0;
+  _last_timestamp = -1;
+  _out_status = 0;
+  _in_status = 0;
+  _msg_len = 0;
+  _msg_need = 0;
+  _in_sysex = false;
+}
+
+void BLE_MIDI_Encoder::flush(void)
+{
+  if (_length > 1 && _output != nullptr) {
+    _output(_output_user, _packet, _length);
+  }
+  _length = 0;
+}
+
+void BLE_MIDI_Encoder::beginPacket(void)
+{
+  _packet[0] = 0x80 | ((_timestamp >> 7) & 0x3F);
+  _length = 1;
+  _last_timestamp = -1;
+  // ランニングステータスはパケットを跨がない
+  _out_status = 0;
+}
+
+void BLE_MIDI_Encoder::putTimestamp(void)
+{
+  _packet[_length++] = 0x80 | (_timestamp & 0x7F);
+  _last_timestamp = _timestamp;
+}
+
+void BLE_MIDI_Encoder::putMessage(const uint8_t* msg, size_t length, bool running_status_allowed)
+{
+  // ヘッダに記録した時刻の上位bitと異なる場合は新しいパケットにする
+  bool same_high = _length && ((_packet[0] & 0x3F) == ((_timestamp >> 7) & 0x3F));
+  bool running = running_status_allowed && same_high && msg[0] == _out_status;
+  bool same_ts = running && _last_timestamp == _timestamp;
+  size_t need = length - (running ? 1 : 0) + (same_ts ? 0 : 1);
+  if (!same_high || _length + need > _packet_size) {
+    flush();
+    beginPacket();
+    running = false;
+    same_ts = false;
+  }
+  if (!same_ts) { putTimestamp(); }
+  for (size_t i = running ? 1 : 0; i < length; ++i) {
+    _packet[_length++] = msg[i];
+  }
+  if (running_status_allowed) {
+    _out_status = msg[0];
+  } else if (msg[0] >= 0xF8) {
+    // リアルタイムメッセージはランニングステータスに影響しないが、
+    // 直後のデータバイトと区別するため次のメッセージには必ずタイムスタンプを付ける
+    _last_timestamp = -1;
+  } else {
+    _out_status = 0;
+  }
+}
+
+void BLE_MIDI_Encoder::putSysExData(uint8_t value)
+{
+  if (_length == 0 || _length >= _packet_size) {
+    // 続きは次のパケットのヘッダの直後から送る
+    flush();
+    beginPacket();
+  }
+  _packet[_length++] = value;
+}
+
+void BLE_MIDI_Encoder::push(const uint8_t* data, size_t length, uint16_t timestamp)
+{
+  _timestamp = timestamp & 0x1FFF;
+  for (size_t i = 0; i < length; ++i) {
+    uint8_t value = data[i];
+    if (value >= 0xF8) {
+      putMessage(&value, 1, false);
+      continue;
+    }
+    if (value & 0x80) {
+      if (_in_sysex) {
+        // F7 以外のステータスでも SysEx は終了する
+        _in_sysex = false;
+        static constexpr const uint8_t eox = 0xF7;
+        putMessage(&eox, 1, false);
+        if (value == 0xF7) { continue; }
+      } else if (value == 0xF7) {
+        continue;
+      }
+      _msg_len = 0;
+      if (value == 0xF0) {
+        _in_sysex = true;
+        _in_status = 0;
+        putMessage(&value, 1, false);
+        continue;
+      }
+      int n = getDataByteLength(value);
+      _in_status = (value < 0xF0) ? value : 0;
+      if (n <= 0) {
+        putMessage(&value, 1, false);
+        continue;
+      }
+      _msg[0] = value;
+      _msg_len = 1;
+      _msg_need = n + 1;
+      continue;
+    }
+    if (_in_sysex) {
+      putSysExData(value);
+      continue;
+    }
+    if (_msg_len == 0) {
+      // 入力側のランニングステータス
+      if (_in_status == 0) { continue; }
+      _msg[0] = _in_status;
+      _msg_len = 1;
+      _msg_need = getDataByteLength(_in_status) + 1;
+    }
+    _msg[_msg_len++] = value;
+    if (_msg_len >= _msg_need) {
+      putMessage(_msg, _msg_len, _msg[0] < 0xF0);
+      _msg_len = 0;
+    }
+  }
+}
+
+//-------------------------------------------------------------------------
+
+void BLE_MIDI_Decoder::reset(void)
+{
+  _msg_len = 0;
+  _msg_need = 0;
+  _status = 0;
+  _timestamp = 0;
+  _in_sysex = false;
+}
+
+void BLE_MIDI_Decoder::emit(void)
+{
+  if (_msg_len && _output != nullptr) {
+    _output(_output_user, _msg, _msg_len, _timestamp);
+  }
+  _msg_len = 0;
+}
+
+bool BLE_MIDI_Decoder::decode(const uint8_t* packet, size_t length)
+{
+  if (length < 2 || (packet[0] & 0xC0) != 0x80) {
+    ++_error_count;
+    return false;
+  }
+  uint16_t high = packet[0] & 0x3F;
+  uint8_t last_low = 0;
+  bool has_timestamp = false;
+  // タイムスタンプの直後の最上位bitが立ったバイトはステータス、それ以外はタイムスタンプ
+  bool expect_status = false;
+
+  for (size_t i = 1; i < length; ++i) {
+    uint8_t value = packet[i];
+    if (value & 0x80) {
+      if (!expect_status) {
+        uint8_t low = value & 0x7F;
+        // パケット内で下位7bitが戻った場合は上位bitが1増えたものとする
+        if (has_timestamp && low < last_low) { high = (high + 1) & 0x3F; }
+        has_timestamp = true;
+        last_low = low;
+        _timestamp = high << 7 | low;
+        expect_status = true;
+        continue;
+      }
+      expect_status = false;
+      if (value >= 0xF8) {
+        if (_in_sysex) { emit(); }
+        if (_output != nullptr) { _output(_output_user, &value, 1, _timestamp); }
+        continue;
+      }
+      if (_in_sysex) {
+        _in_sysex = false;
+        if (_msg_len == sizeof(_msg)) { emit(); }
+        _msg[_msg_len++] = 0xF7;
+        emit();
+        if (value == 0xF7) { continue; }
+      }
+      _msg_len = 0;
+      if (value == 0xF7) { continue; }
+      _msg[0] = value;
+      _msg_len = 1;
+      if (value == 0xF0) {
+        _in_sysex = true;
+        _status = 0;
+        continue;
+      }
+      int n = getDataByteLength(value);
+      _status = (value < 0xF0) ? value : 0;
+      _msg_need = n + 1;
+      if (n <= 0) { emit(); }
+      continue;
+    }
+
+    expect_status = false;
+    if (_in_sysex) {
+      if (_msg_len == sizeof(_msg)) { emit(); }
+      _msg[_msg_len++] = value;
+      continue;
+    }
+    if (_msg_len == 0) {
+      // ランニングステータスを展開する
+      if (_status == 0) { continue; }
+      _msg[0] = _status;
+      _msg_len = 1;
+      _msg_need = getDataByteLength(_status) + 1;
+    }
+    _msg[_msg_len++] = value;
+    if (_msg_len >= _msg_need) { emit(); }
+  }
+  // 受信途中の SysEx はパケット単位で出力する
+  if (_in_sysex) { emit(); }
+  return true;
+}
+
+//-------------------------------------------------------------------------
+
+} // namespace midi_driver
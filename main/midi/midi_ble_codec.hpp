@@ -0,0 +1,98 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 InstaChord Corp.
+
+#ifndef MIDI_BLE_CODEC_HPP
+#define MIDI_BLE_CODEC_HPP
+
+#include "midi_driver.hpp"
+
+namespace midi_driver {
+
+// BLE-MIDI のパケット形式 (ヘッダ , タイムスタンプ , MIDIメッセージ) との変換
+// タイムスタンプはミリ秒単位の13bit値で、ヘッダに上位6bit、各メッセージの直前に下位7bitを置く
+//  パケット : [1 0 上位6bit] { [1 下位7bit] [ステータス] [データ...] }...
+//  ランニングステータス : 直前と同じステータスのメッセージはステータスを省略し、
+//                        タイムスタンプも同じ場合はタイムスタンプも省略する
+//  SysEx : F0 からパケットに収まる分を送り、続きは次のパケットでヘッダの直後から送る。
+//          F7 の直前にはタイムスタンプを置く
+class BLE_MIDI_Encoder {
+public:
+  // パケットが完成した時に呼ばれる
+  typedef void (*output_func_t)(void* user, const uint8_t* packet, size_t length);
+
+  static constexpr const size_t min_packet_size = 5;    // ヘッダ + タイムスタンプ + 3byteメッセージ
+  static constexpr const size_t max_packet_size = 244;  // ATT_MTU 247 - 3
+  static constexpr const size_t default_packet_size = 20; // ATT_MTU 23 (既定値) - 3
+
+  void setOutput(output_func_t func, void* user) { _output = func; _output_user = user; }
+
+  // 1パケットの最大長を設定する (通常は ATT_MTU - 3)
+  void setPacketSize(size_t size);
+  size_t getPacketSize(void) const { return _packet_size; }
+
+  void reset(void);
+
+  // MIDIバイト列を追加する。timestamp は追加時点の時刻(ミリ秒)
+  // パケットが満杯になった時点で出力され、残りは flush を呼ぶまで保持する
+  void push(const uint8_t* data, size_t length, uint16_t timestamp);
+
+  // 保持しているパケットを出力する
+  void flush(void);
+
+  bool hasPending(void) const { return _length > 1; }
+
+private:
+  void putMessage(const uint8_t* msg, size_t length, bool running_status_allowed);
+  void putSysExData(uint8_t value);
+  void beginPacket(void);
+  void putTimestamp(void);
+
+  output_func_t _output = nullptr;
+  void* _output_user = nullptr;
+  uint8_t _packet[max_packet_size];
+  size_t _packet_size = default_packet_size;
+  size_t _length = 0;         // パケットに書き込んだ長さ (0 はパケット未開始)
+  uint16_t _timestamp = 0;    // 処理中のデータの時刻
+  int16_t _last_timestamp = -1; // パケット内で最後に書いたタイムスタンプ
+  uint8_t _out_status = 0;    // パケット内のランニングステータス
+  uint8_t _in_status = 0;     // 入力バイト列のランニングステータス
+  uint8_t _msg[3];
+  uint8_t _msg_len = 0;
+  uint8_t _msg_need = 0;
+  bool _in_sysex = false;
+};
+
+class BLE_MIDI_Decoder {
+public:
+  // MIDIメッセージ1件分(SysExは分割される場合がある)を取り出した時に呼ばれる
+  // timestamp はパケットから復元した13bitの時刻
+  typedef void (*output_func_t)(void* user, const uint8_t* data, size_t length, uint16_t timestamp);
+
+  void setOutput(output_func_t func, void* user) { _output = func; _output_user = user; }
+
+  void reset(void);
+
+  // 受信したパケットを1件分処理する。形式が正しくない場合は false を返す
+  // 出力されるメッセージはランニングステータスを展開して必ずステータスから始まる
+  bool decode(const uint8_t* packet, size_t length);
+
+  // 形式が正しくなく破棄したパケットの数
+  uint32_t getErrorCount(void) const { return _error_count; }
+
+private:
+  void emit(void);
+
+  output_func_t _output = nullptr;
+  void* _output_user = nullptr;
+  uint8_t _msg[16];
+  uint8_t _msg_len = 0;
+  uint8_t _msg_need = 0;
+  uint8_t _status = 0;
+  uint16_t _timestamp = 0;
+  bool _in_sysex = false;
+  uint32_t _error_count = 0;
+};
+
+} // namespace midi_driver
+
+#endif // MIDI_BLE_CODEC_HPP
@@ -9,7 +9,7 @@ namespace midi_driver {
 
 // MIDI ステータスバイトに基づいてデータバイトの長さを取得
 // エラー時は -1 を返す
-static int getDataByteLength(uint8_t status) {
+int getDataByteLength(uint8_t status) {
   if (status < 0x80) { return -1; }
   static constexpr const uint8_t dataByteLengths_0x80_0xE0[] = {
     2, // 0x80 Note Off
@@ -49,9 +49,14 @@ void MIDIDriver::sendMessage(uint8_t status_byte, uint8_t data1, uint8_t data2)
   if (_send_data.size() >= _send_buffer_size - 3) {
     sendFlush();
   }
-  if (_send_runningStatus != status_byte) {
+  // ステータスが変わっても送信はまとめて行う (1回の送信に複数のメッセージを含める)
+  if (status_byte >= 0xF0) {
+    // システムメッセージはランニングステータスを使わない。
+    // リアルタイムメッセージはランニングステータスに影響せず、システムコモンはランニングステータスを解除する
+    _send_data.push_back(status_byte);
+    if (status_byte < 0xF8) { _send_runningStatus = 0; }
+  } else if (_send_runningStatus != status_byte) {
     _send_runningStatus = status_byte;
-    sendFlush();
     _send_data.push_back(status_byte);
   }
   size_t dataByteLength = getDataByteLength(status_byte);
@@ -62,6 +67,17 @@ void MIDIDriver::sendMessage(uint8_t status_byte, uint8_t data1, uint8_t data2)
     }
   }
 }
+
+bool MIDIDriver::sendSysEx(const uint8_t* data, size_t length)
+{
+  // 送信待ちのメッセージを先に送り、SysEx は1回の送信にまとめる
+  sendFlush();
+  _send_data.reserve(length + 2);
+  _send_data.push_back(0xF0);
+  _send_data.insert(_send_data.end(), data, data + length);
+  _send_data.push_back(0xF7);
+  return sendFlush();
+}
 /*
 void MIDI_Encoder::pushMessage(const MIDI_Message& message)
 {
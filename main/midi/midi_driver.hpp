@@ -4,6 +4,7 @@
 #ifndef MIDI_DRIVER_HPP
 #define MIDI_DRIVER_HPP
 
+#include <atomic>
 #include <vector>
 #include <stdint.h>
 #include <stddef.h>
@@ -11,6 +12,46 @@
 
 namespace midi_driver {
 
+  // MIDI ステータスバイトに続くデータバイトの長さ (エラー時は -1)
+  int getDataByteLength(uint8_t status);
+
+  // 固定長のバイトリングバッファ (書込み側と読出し側がそれぞれ1タスクの場合に排他なしで使用できる)
+  template <size_t N>
+  class MIDI_ByteRing {
+    static_assert((N & (N - 1)) == 0, "N must be a power of two");
+  public:
+    size_t available(void) const { return _write.load(std::memory_order_acquire) - _read.load(std::memory_order_relaxed); }
+    size_t space(void) const { return N - (_write.load(std::memory_order_relaxed) - _read.load(std::memory_order_acquire)); }
+
+    // 全て書き込める場合のみ書き込む。書き込めない場合は何もせず false を返す
+    bool push(const uint8_t* data, size_t length) {
+      if (space() < length) { return false; }
+      size_t w = _write.load(std::memory_order_relaxed);
+      for (size_t i = 0; i < length; ++i) {
+        _buf[(w + i) & (N - 1)] = data[i];
+      }
+      _write.store(w + length, std::memory_order_release);
+      return true;
+    }
+    size_t pop(uint8_t* dst, size_t length) {
+      size_t r = _read.load(std::memory_order_relaxed);
+      size_t len = available();
+      if (len > length) { len = length; }
+      for (size_t i = 0; i < len; ++i) {
+        dst[i] = _buf[(r + i) & (N - 1)];
+      }
+      _read.store(r + len, std::memory_order_release);
+      return len;
+    }
+    // 読出し側から呼ぶこと
+    void clear(void) { _read.store(_write.load(std::memory_order_acquire), std::memory_order_release); }
+
+  private:
+    uint8_t _buf[N];
+    std::atomic<size_t> _write { 0 };
+    std::atomic<size_t> _read { 0 };
+  };
+
   // MIDI Message structure
   struct MIDI_Message {
     std::vector<uint8_t> data;
@@ -67,6 +108,8 @@ namespace midi_driver {
     virtual void end(void) = 0;
     virtual size_t write(const uint8_t* data, size_t length) = 0;
     virtual size_t read(uint8_t* data, size_t length) = 0;
+    // write で保持したデータを出力する (まとめて転送するトランスポートのみ。1回の処理の最後に呼ぶ)
+    virtual void flush(void) {}
 
     bool getEnableTx(void) const { return _tx_enable; }
     bool getEnableRx(void) const { return _rx_enable; }
@@ -95,6 +138,9 @@ namespace midi_driver {
 
     void sendMessage(uint8_t status_byte, uint8_t data1, uint8_t data2);
 
+    // SysEx メッセージを送信する (data は F0 と F7 を含まない本体)
+    bool sendSysEx(const uint8_t* data, size_t length);
+
     void sendNoteOn(uint8_t channel, uint8_t note, uint8_t velocity) {
       sendMessage(0x90 | channel, note, velocity);
     }
@@ -107,6 +153,9 @@ namespace midi_driver {
     void sendProgramChange(uint8_t channel, uint8_t program) {
       sendMessage(0xC0 | channel, program, 0);
     }
+    void sendChannelPressure(uint8_t channel, uint8_t pressure) {
+      sendMessage(0xD0 | channel, pressure, 0);
+    }
 
     bool sendFlush(void) {
       if (_send_data.size() == 0) { return true; }
@@ -115,6 +164,9 @@ namespace midi_driver {
       _send_data.clear();
       return result;
     }
+    void flushTransport(void) {
+      _transport->flush();
+    }
     void receive(void) {
       uint8_t data[32];
       int len = _transport->read(data, sizeof(data));
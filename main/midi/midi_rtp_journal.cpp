@@ -0,0 +1,385 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 InstaChord Corp.
+
+#include "midi_rtp_journal.hpp"
+
+#include <string.h>
+
+namespace midi_driver {
+
+//-------------------------------------------------------------------------
+
+// 16bitのシーケンス番号の比較 (a が b 以降なら true)
+static inline bool seq_ge(uint16_t a, uint16_t b) { return (int16_t)(a - b) >= 0; }
+
+void RTP_MIDI_Send_State::reset(void)
+{
+  memset(channel, 0, sizeof(channel));
+  for (auto& ch : channel) { ch.pitch = 0x2000; }
+}
+
+void RTP_MIDI_Send_State::update(const uint8_t* msg, size_t length)
+{
+  uint8_t status = msg[0];
+  if (status < 0x80 || status >= 0xF0 || length < 2) { return; }
+  auto ch = &channel[status & 0x0F];
+  switch (status & 0xF0) {
+  default: break;
+  case 0x80: ch->note[msg[1]] = 0; break;
+  case 0x90: if (length > 2) { ch->note[msg[1]] = msg[2]; } break;
+  case 0xB0:
+    if (length < 3) { break; }
+    ch->control[msg[1]] = msg[2];
+    // All Sound Off / All Notes Off
+    if (msg[1] == 120 || msg[1] == 123) { memset(ch->note, 0, sizeof(ch->note)); }
+    break;
+  case 0xC0: ch->program = msg[1]; break;
+  case 0xE0: if (length > 2) { ch->pitch = msg[1] | (msg[2] << 7); } break;
+  }
+}
+
+//-------------------------------------------------------------------------
+
+void RTP_MIDI_Journal_Writer::clear(generation_t& gen)
+{
+  memset(&gen, 0, sizeof(gen));
+}
+
+void RTP_MIDI_Journal_Writer::reset(uint16_t next_seq)
+{
+  clear(_gen[0]);
+  clear(_gen[1]);
+  _checkpoint = next_seq - 1;
+  _gen_seq = next_seq;
+}
+
+void RTP_MIDI_Journal_Writer::mark(const uint8_t* msg, size_t length)
+{
+  uint8_t status = msg[0];
+  if (status < 0x80 || status >= 0xF0 || length < 2) { return; }
+  uint8_t ch = status & 0x0F;
+  auto gen = &_gen[1];
+  switch (status & 0xF0) {
+  default: return;
+  case 0x80:
+  case 0x90:
+    gen->note[ch][msg[1] >> 3] |= 0x80 >> (msg[1] & 7);
+    break;
+  case 0xB0:
+    gen->control[ch][msg[1] >> 3] |= 0x80 >> (msg[1] & 7);
+    // 全消音は全てのノートの変化として扱う
+    if (msg[1] == 120 || msg[1] == 123) { memset(gen->note[ch], 0xFF, sizeof(gen->note[ch])); }
+    break;
+  case 0xC0: gen->program_mask |= 1 << ch; break;
+  case 0xE0: gen->pitch_mask |= 1 << ch; break;
+  }
+  gen->channel_mask |= 1 << ch;
+}
+
+void RTP_MIDI_Journal_Writer::acknowledge(uint16_t seq, uint16_t next_seq)
+{
+  if (seq_ge(seq, next_seq - 1)) {
+    // 送信済みのパケットを全て受け取っている
+    if (seq_ge(next_seq - 1, seq)) { reset(next_seq); }
+    return;
+  }
+  if (!seq_ge(seq, _gen_seq - 1)) { return; }
+  // 古い世代の範囲は全て受け取っているため、新しい世代をチェックポイント以降の記録にする
+  _checkpoint = _gen_seq - 1;
+  _gen[0] = _gen[1];
+  clear(_gen[1]);
+  _gen_seq = next_seq;
+}
+
+size_t RTP_MIDI_Journal_Writer::encode(const RTP_MIDI_Send_State& state, uint8_t* dst, size_t max_length) const
+{
+  const uint16_t channel_mask = _gen[0].channel_mask | _gen[1].channel_mask;
+  if (channel_mask == 0 || max_length < 3) { return 0; }
+  size_t pos = 3;
+  int count = 0;
+  for (int ch = 0; ch < 16; ++ch) {
+    if (!(channel_mask & (1 << ch))) { continue; }
+    auto st = &state.channel[ch];
+    size_t start = pos;
+    if (pos + 3 > max_length) { return 0; }
+    pos += 3;
+    uint8_t chapters = 0;
+
+    // Chapter P : [S PROGRAM] [B BANK-MSB] [X BANK-LSB]
+    if ((_gen[0].program_mask | _gen[1].program_mask) & (1 << ch)) {
+      if (pos + 3 > max_length) { return 0; }
+      dst[pos++] = st->program & 0x7F;
+      dst[pos++] = 0;
+      dst[pos++] = 0;
+      chapters |= 0x80;
+    }
+
+    // Chapter C : [S LEN] { [S NUMBER] [A VALUE] }...
+    uint8_t control[16];
+    uint8_t note[16];
+    int control_count = 0;
+    for (int i = 0; i < 16; ++i) {
+      control[i] = _gen[0].control[ch][i] | _gen[1].control[ch][i];
+      note[i] = _gen[0].note[ch][i] | _gen[1].note[ch][i];
+      control_count += __builtin_popcount(control[i]);
+    }
+    if (control_count) {
+      if (pos + 1 + control_count * 2 > max_length) { return 0; }
+      dst[pos++] = control_count - 1;
+      for (int n = 0; n < 128; ++n) {
+        if (!(control[n >> 3] & (0x80 >> (n & 7)))) { continue; }
+        dst[pos++] = n;
+        dst[pos++] = st->control[n] & 0x7F;
+      }
+      chapters |= 0x40;
+    }
+
+    // Chapter W : [S FIRST] [R SECOND]
+    if ((_gen[0].pitch_mask | _gen[1].pitch_mask) & (1 << ch)) {
+      if (pos + 2 > max_length) { return 0; }
+      dst[pos++] = st->pitch & 0x7F;
+      dst[pos++] = (st->pitch >> 7) & 0x7F;
+      chapters |= 0x10;
+    }
+
+    // Chapter N : [B LEN] [LOW HIGH] { [S NOTENUM] [Y VELOCITY] }... [オフビット...]
+    // 発音中のノートはログに、消音したノートはオフビットに記録する
+    int log_count = 0;
+    int low = 16, high = -1;
+    for (int n = 0; n < 128; ++n) {
+      if (!(note[n >> 3] & (0x80 >> (n & 7)))) { continue; }
+      if (st->note[n]) {
+        ++log_count;
+      } else {
+        if (low > (n >> 3)) { low = n >> 3; }
+        high = n >> 3;
+      }
+    }
+    // LEN=127 かつ LOW=15, HIGH=0 は 128件を表すため、ログは 126件までとする
+    if (log_count > 126) { log_count = 126; }
+    if (log_count || high >= 0) {
+      size_t offbit_len = (high >= 0) ? high - low + 1 : 0;
+      if (pos + 2 + log_count * 2 + offbit_len > max_length) { return 0; }
+      dst[pos++] = log_count;
+      dst[pos++] = (high >= 0) ? (low << 4 | high) : 0xF0;
+      int remain = log_count;
+      for (int n = 0; n < 128 && remain; ++n) {
+        if (!(note[n >> 3] & (0x80 >> (n & 7))) || !st->note[n]) { continue; }
+        dst[pos++] = n;
+        // Y : 受信側で発音すべきノート
+        dst[pos++] = 0x80 | (st->note[n] & 0x7F);
+        --remain;
+      }
+      for (int i = low; i <= high; ++i) {
+        uint8_t bits = 0;
+        for (int b = 0; b < 8; ++b) {
+          int n = i * 8 + b;
+          if ((note[i] & (0x80 >> b)) && !st->note[n]) { bits |= 0x80 >> b; }
+        }
+        dst[pos++] = bits;
+      }
+      chapters |= 0x08;
+    }
+
+    if (chapters == 0) {
+      pos = start;
+      continue;
+    }
+    size_t length = pos - start;
+    if (length > 0x3FF) { return 0; }
+    dst[start    ] = (ch << 3) | (length >> 8);
+    dst[start + 1] = length & 0xFF;
+    dst[start + 2] = chapters;
+    ++count;
+  }
+  if (count == 0) { return 0; }
+
+  // A : チャンネルジャーナルあり
+  dst[0] = 0x20 | (count - 1);
+  dst[1] = _checkpoint >> 8;
+  dst[2] = _checkpoint & 0xFF;
+  return pos;
+}
+
+//-------------------------------------------------------------------------
+
+void RTP_MIDI_Journal_Reader::reset(void)
+{
+  for (auto& ch : _channel) {
+    memset(ch.note, 0, sizeof(ch.note));
+    memset(ch.control, 0xFF, sizeof(ch.control));
+    ch.program = 0xFF;
+    ch.pitch = 0xFFFF;
+  }
+}
+
+void RTP_MIDI_Journal_Reader::track(const uint8_t* msg, size_t length)
+{
+  uint8_t status = msg[0];
+  if (status < 0x80 || status >= 0xF0 || length < 2) { return; }
+  auto ch = &_channel[status & 0x0F];
+  uint8_t bit = 0x80 >> (msg[1] & 7);
+  switch (status & 0xF0) {
+  default: break;
+  case 0x80:
+    ch->note[msg[1] >> 3] &= ~bit;
+    break;
+  case 0x90:
+    if (length > 2 && msg[2]) { ch->note[msg[1] >> 3] |= bit; }
+    else { ch->note[msg[1] >> 3] &= ~bit; }
+    break;
+  case 0xB0:
+    if (length < 3) { break; }
+    ch->control[msg[1]] = msg[2];
+    if (msg[1] == 120 || msg[1] == 123) { memset(ch->note, 0, sizeof(ch->note)); }
+    break;
+  case 0xC0: ch->program = msg[1]; break;
+  case 0xE0: if (length > 2) { ch->pitch = msg[1] | (msg[2] << 7); } break;
+  }
+}
+
+void RTP_MIDI_Journal_Reader::emit(output_func_t output, void* user, uint8_t status, uint8_t data1, uint8_t data2, size_t length)
+{
+  const uint8_t msg[3] = { status, data1, data2 };
+  track(msg, length);
+  if (output != nullptr) { output(user, msg, length); }
+}
+
+size_t RTP_MIDI_Journal_Reader::getLength(const uint8_t* journal, size_t length)
+{
+  if (length < 3) { return 0; }
+  uint8_t header = journal[0];
+  size_t pos = 3;
+  // Y : システムジャーナル [S D V Q F X LENGTH(10)]
+  if (header & 0x40) {
+    if (pos + 2 > length) { return 0; }
+    size_t len = ((journal[pos] & 0x03) << 8) | journal[pos + 1];
+    if (len < 2 || pos + len > length) { return 0; }
+    pos += len;
+  }
+  // A : チャンネルジャーナル
+  if (header & 0x20) {
+    int count = (header & 0x0F) + 1;
+    for (int i = 0; i < count; ++i) {
+      if (pos + 3 > length) { return 0; }
+      size_t len = ((journal[pos] & 0x03) << 8) | journal[pos + 1];
+      if (len < 3 || pos + len > length) { return 0; }
+      pos += len;
+    }
+  }
+  return pos;
+}
+
+size_t RTP_MIDI_Journal_Reader::recover(const uint8_t* journal, size_t length, output_func_t output, void* user)
+{
+  size_t total = getLength(journal, length);
+  if (total == 0) { return 0; }
+  uint8_t header = journal[0];
+  size_t pos = 3;
+  if (header & 0x40) {
+    pos += ((journal[pos] & 0x03) << 8) | journal[pos + 1];
+  }
+  if (header & 0x20) {
+    int count = (header & 0x0F) + 1;
+    for (int i = 0; i < count; ++i) {
+      size_t len = ((journal[pos] & 0x03) << 8) | journal[pos + 1];
+      uint8_t ch = (journal[pos] >> 3) & 0x0F;
+      if (!recoverChannel(ch, &journal[pos], len, output, user)) { return 0; }
+      pos += len;
+    }
+  }
+  return total;
+}
+
+bool RTP_MIDI_Journal_Reader::recoverChannel(uint8_t ch, const uint8_t* data, size_t length, output_func_t output, void* user)
+{
+  auto st = &_channel[ch];
+  uint8_t chapters = data[2];
+  size_t pos = 3;
+
+  // Chapter P
+  if (chapters & 0x80) {
+    if (pos + 3 > length) { return false; }
+    uint8_t program = data[pos] & 0x7F;
+    bool bank = data[pos + 1] & 0x80;
+    if (bank) {
+      emit(output, user, 0xB0 | ch, 0x00, data[pos + 1] & 0x7F);
+      emit(output, user, 0xB0 | ch, 0x20, data[pos + 2] & 0x7F);
+    }
+    if (bank || st->program != program) {
+      emit(output, user, 0xC0 | ch, program, 0, 2);
+    }
+    pos += 3;
+  }
+
+  // Chapter C
+  if (chapters & 0x40) {
+    if (pos + 1 > length) { return false; }
+    size_t count = (data[pos] & 0x7F) + 1;
+    if (pos + 1 + count * 2 > length) { return false; }
+    ++pos;
+    for (size_t i = 0; i < count; ++i, pos += 2) {
+      uint8_t number = data[pos] & 0x7F;
+      // A=1 (トグル・カウント形式) は扱わない
+      if (data[pos + 1] & 0x80) { continue; }
+      uint8_t value = data[pos + 1] & 0x7F;
+      if (st->control[number] != value) {
+        emit(output, user, 0xB0 | ch, number, value);
+      }
+    }
+  }
+
+  // Chapter M (読み飛ばす)
+  if (chapters & 0x20) {
+    if (pos + 2 > length) { return false; }
+    size_t len = ((data[pos] & 0x03) << 8) | data[pos + 1];
+    if (len < 2 || pos + len > length) { return false; }
+    pos += len;
+  }
+
+  // Chapter W
+  if (chapters & 0x10) {
+    if (pos + 2 > length) { return false; }
+    uint16_t pitch = (data[pos] & 0x7F) | ((data[pos + 1] & 0x7F) << 7);
+    if (st->pitch != pitch) {
+      emit(output, user, 0xE0 | ch, pitch & 0x7F, pitch >> 7);
+    }
+    pos += 2;
+  }
+
+  // Chapter N
+  if (chapters & 0x08) {
+    if (pos + 2 > length) { return false; }
+    size_t log_count = data[pos] & 0x7F;
+    uint8_t low = data[pos + 1] >> 4;
+    uint8_t high = data[pos + 1] & 0x0F;
+    if (log_count == 127 && low == 15 && high == 0) { log_count = 128; }
+    size_t offbit_len = (low <= high) ? high - low + 1 : 0;
+    if (pos + 2 + log_count * 2 + offbit_len > length) { return false; }
+    pos += 2;
+    for (size_t i = 0; i < log_count; ++i, pos += 2) {
+      uint8_t note = data[pos] & 0x7F;
+      uint8_t velocity = data[pos + 1] & 0x7F;
+      bool is_on = st->note[note >> 3] & (0x80 >> (note & 7));
+      // 取りこぼしたノートオンは Y が立っている (まだ鳴らすべき) 場合のみ発音する
+      if (velocity && !is_on && (data[pos + 1] & 0x80)) {
+        emit(output, user, 0x90 | ch, note, velocity);
+      }
+    }
+    for (size_t i = 0; i < offbit_len; ++i, ++pos) {
+      for (int b = 0; b < 8; ++b) {
+        if (!(data[pos] & (0x80 >> b))) { continue; }
+        uint8_t note = (low + i) * 8 + b;
+        if (st->note[note >> 3] & (0x80 >> (note & 7))) {
+          emit(output, user, 0x80 | ch, note, 0x40);
+        }
+      }
+    }
+  }
+  // Chapter E, T, A は扱わない
+  return true;
+}
+
+//-------------------------------------------------------------------------
+
+} // namespace midi_driver
@@ -0,0 +1,98 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 InstaChord Corp.
+
+#ifndef MIDI_RTP_JOURNAL_HPP
+#define MIDI_RTP_JOURNAL_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+
+namespace midi_driver {
+
+// RTP-MIDI (RFC 6295) のリカバリージャーナル
+// パケットが欠落しても受信側が状態を復元できるよう、送信側は受信確認 (チェックポイント) 以降に変化した項目の
+// 最新の状態を毎パケットに付ける。対応するチャプターは P (プログラム) C (コントローラ) W (ピッチベンド) N (ノート) で、
+// それ以外のチャプターとシステムジャーナルは受信時に読み飛ばす
+//  ジャーナルヘッダ     : [S Y A H TOTCHAN(4)] [チェックポイントのシーケンス番号 16bit]
+//  チャンネルジャーナル : [S CHAN(4) H LENGTH(10)] [P C M W N E T A] [チャプター...]
+
+// 送信したチャンネルメッセージによる現在の状態 (全ての送信先で共有する)
+struct RTP_MIDI_Send_State {
+  struct channel_t {
+    uint8_t note[128];      // 発音中のノートのベロシティ (0:消音)
+    uint8_t control[128];
+    uint8_t program;
+    uint16_t pitch;         // 14bit
+  };
+  channel_t channel[16];
+
+  void reset(void);
+  // 送信したチャンネルメッセージを反映する
+  void update(const uint8_t* msg, size_t length);
+};
+
+// 送信先ごとのジャーナル生成
+// 変化した項目を2世代に分けて記録し、受信確認が古い世代の範囲に達した時点で古い世代を捨てる
+class RTP_MIDI_Journal_Writer {
+public:
+  // next_seq : 次に送るパケットのシーケンス番号
+  void reset(uint16_t next_seq);
+
+  // 送信したチャンネルメッセージを記録する (パケットのジャーナルを生成した後に、そのパケットのメッセージを記録すること)
+  void mark(const uint8_t* msg, size_t length);
+
+  // 受信側からの受信確認 (RS) を反映する
+  void acknowledge(uint16_t seq, uint16_t next_seq);
+
+  // ジャーナルを生成する。記録が無い場合や max_length に収まらない場合は 0 を返す
+  size_t encode(const RTP_MIDI_Send_State& state, uint8_t* dst, size_t max_length) const;
+
+private:
+  struct generation_t {
+    uint8_t note[16][16];     // 変化したノート (128bit)
+    uint8_t control[16][16];  // 変化したコントローラ (128bit)
+    uint16_t program_mask;
+    uint16_t pitch_mask;
+    uint16_t channel_mask;
+  };
+  void clear(generation_t& gen);
+
+  generation_t _gen[2];       // [0]:チェックポイントから _gen_seq の直前まで [1]:_gen_seq 以降
+  uint16_t _checkpoint = 0;
+  uint16_t _gen_seq = 0;
+};
+
+// 受信側の状態追跡とジャーナルによる復元
+class RTP_MIDI_Journal_Reader {
+public:
+  // 復元したメッセージを出力する
+  typedef void (*output_func_t)(void* user, const uint8_t* msg, size_t length);
+
+  void reset(void);
+
+  // 受信したチャンネルメッセージを反映する
+  void track(const uint8_t* msg, size_t length);
+
+  // ジャーナルと追跡中の状態を比較し、差分を補うメッセージを出力する
+  // 戻り値はジャーナルの長さ (形式が正しくない場合は 0)
+  size_t recover(const uint8_t* journal, size_t length, output_func_t output, void* user);
+
+  // ジャーナルの長さだけを求める (復元は行わない)
+  static size_t getLength(const uint8_t* journal, size_t length);
+
+private:
+  struct channel_t {
+    uint8_t note[16];       // 発音中のノート (128bit)
+    uint8_t control[128];   // 0xFF:不明
+    uint8_t program;        // 0xFF:不明
+    uint16_t pitch;         // 0xFFFF:不明
+  };
+  bool recoverChannel(uint8_t ch, const uint8_t* data, size_t length, output_func_t output, void* user);
+  void emit(output_func_t output, void* user, uint8_t status, uint8_t data1, uint8_t data2, size_t length = 3);
+
+  channel_t _channel[16];
+};
+
+} // namespace midi_driver
+
+#endif // MIDI_RTP_JOURNAL_HPP
@@ -0,0 +1,721 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 InstaChord Corp.
+
+#include "midi_rtp_session.hpp"
+#include "midi_driver.hpp"
+
+#include <string.h>
+
+namespace midi_driver {
+
+//----------------------------------------------------------------
+
+static constexpr const uint32_t protocol_version = 2;
+static constexpr const uint8_t rtp_payload_type = 0x61;
+
+static inline uint16_t cmd16(const char* command) { return (command[0] << 8) | command[1]; }
+
+static inline void put16(uint8_t* p, uint16_t v) { p[0] = v >> 8; p[1] = v; }
+static inline void put32(uint8_t* p, uint32_t v) { put16(p, v >> 16); put16(&p[2], v); }
+static inline void put64(uint8_t* p, uint64_t v) { put32(p, v >> 32); put32(&p[4], v); }
+static inline uint16_t get16(const uint8_t* p) { return (p[0] << 8) | p[1]; }
+static inline uint32_t get32(const uint8_t* p) { return ((uint32_t)get16(p) << 16) | get16(&p[2]); }
+static inline uint64_t get64(const uint8_t* p) { return ((uint64_t)get32(p) << 32) | get32(&p[4]); }
+
+// RTPタイムスタンプ (100μs単位)
+static inline uint64_t toTicks(uint64_t usec) { return usec / 100; }
+
+//----------------------------------------------------------------
+
+void RTP_MIDI_Session::begin(uint32_t ssrc, uint64_t usec)
+{
+  _ssrc = ssrc;
+  _seq = (uint16_t)(ssrc ^ (ssrc >> 16) ^ usec);
+  for (auto& p : _participant) { release(&p); }
+  _tx_state.reset();
+  _cmd_len = 0;
+  _tx_status = 0;
+  _tx_msg_len = 0;
+  _tx_in_sysex = false;
+  _tx_sysex_open = false;
+  _peer_retry_usec = usec;
+  clearReceive();
+}
+
+void RTP_MIDI_Session::end(void)
+{
+  for (auto& p : _participant) {
+    if (p.state == state_free) { continue; }
+    if (p.state != state_invite_control) { sendBye(&p); }
+    release(&p);
+  }
+}
+
+RTP_MIDI_Session::participant_t* RTP_MIDI_Session::findBySSRC(uint32_t ssrc)
+{
+  for (auto& p : _participant) {
+    if (p.state != state_free && p.state != state_invite_control && p.ssrc == ssrc) { return &p; }
+  }
+  return nullptr;
+}
+
+RTP_MIDI_Session::participant_t* RTP_MIDI_Session::allocate(void)
+{
+  for (auto& p : _participant) {
+    if (p.state != state_free) { continue; }
+    p.control = p.data = address_t();
+    p.ssrc = 0;
+    p.token = 0;
+    p.retry = 0;
+    p.is_initiator = false;
+    return &p;
+  }
+  return nullptr;
+}
+
+void RTP_MIDI_Session::connect(participant_t* p, uint64_t usec)
+{
+  p->state = state_connected;
+  p->last_recv_usec = usec;
+  p->next_usec = usec;
+  p->feedback_usec = usec + feedback_usec;
+  p->offset = 0;
+  p->synced = false;
+  p->transit_valid = false;
+  p->recv_valid = false;
+  p->sync_count = 0;
+  p->writer.reset(_seq);
+  p->reader.reset();
+}
+
+void RTP_MIDI_Session::release(participant_t* p)
+{
+  p->state = state_free;
+}
+
+size_t RTP_MIDI_Session::getConnectedCount(void) const
+{
+  size_t result = 0;
+  for (auto& p : _participant) {
+    if (p.state == state_connected) { ++result; }
+  }
+  return result;
+}
+
+//----------------------------------------------------------------
+
+void RTP_MIDI_Session::sendInvitation(const char* command, port_kind_t kind, const address_t& to, uint32_t token)
+{
+  uint8_t buf[16 + 64];
+  buf[0] = buf[1] = 0xFF;
+  put16(&buf[2], cmd16(command));
+  put32(&buf[4], protocol_version);
+  put32(&buf[8], token);
+  put32(&buf[12], _ssrc);
+  size_t len = 16;
+  if (command[0] != 'N') {
+    // 拒否 (NO) 以外はセッション名を付ける
+    size_t name_len = strnlen(_config.session_name, sizeof(buf) - 17);
+    memcpy(&buf[len], _config.session_name, name_len);
+    len += name_len;
+    buf[len++] = 0;
+  }
+  if (_send) { _send(_send_user, kind, to, buf, len); }
+}
+
+void RTP_MIDI_Session::sendBye(participant_t* p)
+{
+  uint8_t buf[16];
+  buf[0] = buf[1] = 0xFF;
+  put16(&buf[2], cmd16("BY"));
+  put32(&buf[4], protocol_version);
+  put32(&buf[8], p->token);
+  put32(&buf[12], _ssrc);
+  if (_send) { _send(_send_user, port_control, p->control, buf, sizeof(buf)); }
+}
+
+void RTP_MIDI_Session::sendSync(participant_t* p, uint8_t count, const uint64_t* ts)
+{
+  uint8_t buf[36];
+  buf[0] = buf[1] = 0xFF;
+  put16(&buf[2], cmd16("CK"));
+  put32(&buf[4], _ssrc);
+  buf[8] = count;
+  buf[9] = buf[10] = buf[11] = 0;
+  for (int i = 0; i < 3; ++i) { put64(&buf[12 + i * 8], ts[i]); }
+  if (_send) { _send(_send_user, port_data, p->data, buf, sizeof(buf)); }
+}
+
+void RTP_MIDI_Session::sendFeedback(participant_t* p)
+{
+  uint8_t buf[12];
+  buf[0] = buf[1] = 0xFF;
+  put16(&buf[2], cmd16("RS"));
+  put32(&buf[4], _ssrc);
+  put16(&buf[8], p->recv_seq);
+  buf[10] = buf[11] = 0;
+  p->ack_seq = p->recv_seq;
+  if (_send) { _send(_send_user, port_control, p->control, buf, sizeof(buf)); }
+}
+
+//----------------------------------------------------------------
+
+void RTP_MIDI_Session::receive(port_kind_t kind, const address_t& from, const uint8_t* data, size_t length, uint64_t usec)
+{
+  if (length >= 4 && data[0] == 0xFF && data[1] == 0xFF) {
+    receiveControl(kind, from, data, length, usec);
+  } else if (kind == port_data) {
+    receiveRTP(data, length, usec);
+  }
+}
+
+void RTP_MIDI_Session::receiveControl(port_kind_t kind, const address_t& from, const uint8_t* data, size_t length, uint64_t usec)
+{
+  uint16_t command = get16(&data[2]);
+
+  if (command == cmd16("CK")) {
+    if (length < 36) { return; }
+    auto p = findBySSRC(get32(&data[4]));
+    if (p && p->state == state_connected) { receiveSync(p, data, usec); }
+    return;
+  }
+  if (command == cmd16("RS")) {
+    if (length < 10) { return; }
+    auto p = findBySSRC(get32(&data[4]));
+    if (p && p->state == state_connected) {
+      p->last_recv_usec = usec;
+      p->writer.acknowledge(get16(&data[8]), _seq);
+    }
+    return;
+  }
+
+  if (length < 16) { return; }
+  uint32_t token = get32(&data[8]);
+  uint32_t ssrc = get32(&data[12]);
+
+  if (command == cmd16("IN")) {
+    auto p = findBySSRC(ssrc);
+    if (kind == port_control) {
+      // 既に接続中の相手からの招待は、相手が再起動したものとして接続し直す
+      if (p == nullptr) { p = allocate(); }
+      if (p == nullptr) {
+        sendInvitation("NO", kind, from, token);
+        return;
+      }
+      p->control = from;
+      p->ssrc = ssrc;
+      p->token = token;
+      p->is_initiator = false;
+      p->state = state_accept_data;
+      p->next_usec = usec + invite_retry_usec * invite_retry_max;
+      sendInvitation("OK", kind, from, token);
+    } else {
+      if (p == nullptr || (p->state != state_accept_data && p->state != state_connected)) {
+        sendInvitation("NO", kind, from, token);
+        return;
+      }
+      p->data = from;
+      sendInvitation("OK", kind, from, token);
+      if (p->state != state_connected) { connect(p, usec); }
+    }
+    return;
+  }
+
+  if (command == cmd16("OK") || command == cmd16("NO")) {
+    for (auto& p : _participant) {
+      if (p.token != token || (p.state != state_invite_control && p.state != state_invite_data)) { continue; }
+      if (command == cmd16("NO")) {
+        release(&p);
+      } else if (p.state == state_invite_control && kind == port_control) {
+        p.ssrc = ssrc;
+        p.state = state_invite_data;
+        p.data = p.control;
+        ++p.data.port;
+        p.retry = 0;
+        p.next_usec = usec + invite_retry_usec;
+        sendInvitation("IN", port_data, p.data, p.token);
+      } else if (p.state == state_invite_data && kind == port_data && p.ssrc == ssrc) {
+        connect(&p, usec);
+      }
+      return;
+    }
+    return;
+  }
+
+  if (command == cmd16("BY")) {
+    auto p = findBySSRC(ssrc);
+    if (p) { release(p); }
+    return;
+  }
+}
+
+void RTP_MIDI_Session::receiveSync(participant_t* p, const uint8_t* data, uint64_t usec)
+{
+  uint8_t count = data[8];
+  uint64_t ts[3] = { get64(&data[12]), get64(&data[20]), get64(&data[28]) };
+  uint64_t now = toTicks(usec);
+  p->last_recv_usec = usec;
+
+  int64_t offset;
+  switch (count) {
+  default: return;
+  case 0:
+    ts[1] = now;
+    sendSync(p, 1, ts);
+    return;
+
+  case 1:
+    // 自機が始めた時刻合わせ : 往復の中間時刻と相手の時刻の差
+    ts[2] = now;
+    sendSync(p, 2, ts);
+    offset = (int64_t)((ts[0] + ts[2]) >> 1) - (int64_t)ts[1];
+    break;
+
+  case 2:
+    offset = (int64_t)ts[1] - (int64_t)((ts[0] + ts[2]) >> 1);
+    break;
+  }
+  if (p->synced && p->transit_valid) {
+    // 時刻の差が変わった分だけ、到着までの時間の平均を補正する
+    int32_t diff = (int32_t)(offset - p->offset) * 100;
+    p->transit_usec -= diff;
+    p->prev_transit_usec -= diff;
+  }
+  p->offset = offset;
+  p->synced = true;
+}
+
+void RTP_MIDI_Session::receiveRTP(const uint8_t* data, size_t length, uint64_t usec)
+{
+  if (length < 13 || (data[0] & 0xC0) != 0x80 || (data[1] & 0x7F) != rtp_payload_type) { return; }
+  uint16_t seq = get16(&data[2]);
+  uint32_t ts = get32(&data[4]);
+  auto p = findBySSRC(get32(&data[8]));
+  if (p == nullptr || p->state != state_connected) { return; }
+
+  size_t pos = 12 + (data[0] & 0x0F) * 4;
+  if (data[0] & 0x10) {
+    // 拡張ヘッダ
+    if (pos + 4 > length) { return; }
+    pos += 4 + get16(&data[pos + 2]) * 4;
+  }
+  if (data[0] & 0x20) {
+    // パディング
+    if (data[length - 1] > length) { return; }
+    length -= data[length - 1];
+  }
+  if (pos >= length) { return; }
+
+  // MIDIコマンドセクションのヘッダ [B J Z P LEN(4)] ([LEN 下位8bit])
+  uint8_t flags = data[pos++];
+  size_t cmd_len = flags & 0x0F;
+  if (flags & 0x80) {
+    if (pos >= length) { return; }
+    cmd_len = (cmd_len << 8) | data[pos++];
+  }
+  if (pos + cmd_len > length) { return; }
+
+  p->last_recv_usec = usec;
+  int lost = 0;
+  if (p->recv_valid) {
+    int16_t diff = seq - p->recv_seq;
+    // 重複したパケットや、後続より遅れて届いたパケットは破棄する
+    if (diff <= 0) { return; }
+    lost = diff - 1;
+  }
+  p->recv_seq = seq;
+  p->recv_valid = true;
+
+  _rx_participant = p;
+  _rx_now_usec = usec;
+  _rx_immediate = !p->synced;
+  if (p->synced) {
+    // 送信時刻を自機の時刻に換算する (32bitのタイムスタンプは現在時刻に近い値として拡張する)
+    int64_t remote_now = (int64_t)toTicks(usec) - p->offset;
+    int64_t remote_ts = remote_now + (int32_t)(ts - (uint32_t)remote_now);
+    int64_t local_usec = (remote_ts + p->offset) * 100;
+    int32_t transit = (int32_t)((int64_t)usec - local_usec);
+    if (!p->transit_valid) {
+      p->transit_valid = true;
+      p->transit_usec = transit;
+      p->prev_transit_usec = transit;
+      p->jitter_usec = 0;
+    } else {
+      // RFC 3550 のジッタ推定 (到着間隔の揺らぎの平均) と、到着までの時間の平均
+      int32_t d = transit - p->prev_transit_usec;
+      if (d < 0) { d = -d; }
+      p->prev_transit_usec = transit;
+      p->jitter_usec += (d - (int32_t)p->jitter_usec) / 16;
+      p->transit_usec += (transit - p->transit_usec) / 16;
+    }
+    uint32_t delay = p->jitter_usec * 3;
+    if (delay < _config.min_latency_usec) { delay = _config.min_latency_usec; }
+    if (delay > _config.max_latency_usec) { delay = _config.max_latency_usec; }
+    _rx_base_usec = local_usec + p->transit_usec + delay;
+  }
+
+  size_t journal_pos = pos + cmd_len;
+  if (lost > 0) {
+    _lost_count += lost;
+    // 欠落したパケットの分はジャーナルから状態を復元し、このパケットのコマンドより先に出力する
+    if ((flags & 0x40) && journal_pos < length) {
+      p->reader.recover(&data[journal_pos], length - journal_pos, rx_recover, this);
+    }
+  }
+  parseCommands(&data[pos], cmd_len, flags & 0x20, rx_command, this);
+  _rx_participant = nullptr;
+}
+
+//----------------------------------------------------------------
+
+size_t RTP_MIDI_Session::parseCommands(const uint8_t* data, size_t length, bool first_delta, command_func_t func, void* user)
+{
+  size_t pos = 0;
+  uint32_t time = 0;
+  uint8_t running_status = 0;
+  bool has_delta = first_delta;
+  uint8_t msg[3];
+  while (pos < length) {
+    size_t start = pos;
+    if (has_delta) {
+      // 可変長のデルタタイム (最大4byte)
+      uint32_t delta = 0;
+      for (int i = 0; ; ++i) {
+        if (pos >= length || i == 4) { return start; }
+        uint8_t b = data[pos++];
+        delta = (delta << 7) | (b & 0x7F);
+        if (!(b & 0x80)) { break; }
+      }
+      time += delta;
+      if (pos >= length) { return start; }
+    }
+    has_delta = true;
+
+    uint8_t status = data[pos];
+    if (status == 0xF0 || status == 0xF7) {
+      // SysEx の分割単位は区切りのバイトまで
+      size_t end = pos + 1;
+      while (end < length && data[end] != 0xF0 && data[end] != 0xF7 && data[end] != 0xF4) { ++end; }
+      if (end >= length) { return start; }
+      func(user, time, &data[pos], end + 1 - pos);
+      pos = end + 1;
+      running_status = 0;
+      continue;
+    }
+    if (status & 0x80) {
+      int len = getDataByteLength(status);
+      if (pos + 1 + len > length) { return start; }
+      if (status < 0xF0) { running_status = status; }
+      else if (status < 0xF8) { running_status = 0; }
+      func(user, time, &data[pos], 1 + len);
+      pos += 1 + len;
+      continue;
+    }
+    // ランニングステータス
+    if (running_status == 0) { return start; }
+    int len = getDataByteLength(running_status);
+    if (pos + len > length) { return start; }
+    msg[0] = running_status;
+    memcpy(&msg[1], &data[pos], len);
+    func(user, time, msg, 1 + len);
+    pos += len;
+  }
+  return pos;
+}
+
+void RTP_MIDI_Session::rx_command(void* user, uint32_t delta, const uint8_t* msg, size_t length)
+{
+  auto me = (RTP_MIDI_Session*)user;
+  uint32_t due = (uint32_t)me->_rx_now_usec;
+  if (!me->_rx_immediate) {
+    uint64_t d = me->_rx_base_usec + (uint64_t)delta * 100;
+    uint64_t limit = me->_rx_now_usec + me->_config.max_latency_usec;
+    // 時刻の換算が大きくずれている場合でも、最大遅延を超えて保持しない
+    due = (uint32_t)(d > limit ? limit : d);
+  }
+
+  uint8_t status = msg[0];
+  if (status < 0xF0) {
+    me->_rx_participant->reader.track(msg, length);
+  } else if (status == 0xF0 || status == 0xF7) {
+    // SysEx の分割単位をMIDIバイト列に戻す
+    //  F0...F0 : 先頭 , F7...F0 : 途中 , F7...F7 : 末尾 , F0...F7 : 分割なし , ...F4 : 中止
+    uint8_t tail = msg[length - 1];
+    size_t begin = (status == 0xF0) ? 0 : 1;
+    size_t end = (tail == 0xF7) ? length : length - 1;
+    me->pushReceive(&msg[begin], end - begin, due);
+    if (tail == 0xF4) {
+      static constexpr const uint8_t eox = 0xF7;
+      me->pushReceive(&eox, 1, due);
+    }
+    return;
+  }
+  me->pushReceive(msg, length, due);
+}
+
+void RTP_MIDI_Session::rx_recover(void* user, const uint8_t* msg, size_t length)
+{
+  auto me = (RTP_MIDI_Session*)user;
+  ++me->_recover_count;
+  uint32_t due = (uint32_t)(me->_rx_immediate ? me->_rx_now_usec : me->_rx_base_usec);
+  me->pushReceive(msg, length, due);
+}
+
+void RTP_MIDI_Session::pushReceive(const uint8_t* msg, size_t length, uint32_t due)
+{
+  if (length == 0) { return; }
+  size_t used = _rx_write - _rx_read;
+  // 出力順が入れ替わらないよう、出力時刻は直前のメッセージより前にしない
+  if (used && (int32_t)(due - _rx_last_due) < 0) { due = _rx_last_due; }
+  if (rx_buffer_size - used < 6 + length) {
+    ++_rx_drop_count;
+    return;
+  }
+  uint8_t header[6];
+  memcpy(header, &due, 4);
+  header[4] = length;
+  header[5] = length >> 8;
+  size_t w = _rx_write;
+  for (size_t i = 0; i < 6; ++i) { _rx_buf[(w++) & (rx_buffer_size - 1)] = header[i]; }
+  for (size_t i = 0; i < length; ++i) { _rx_buf[(w++) & (rx_buffer_size - 1)] = msg[i]; }
+  _rx_write = w;
+  _rx_last_due = due;
+}
+
+size_t RTP_MIDI_Session::read(uint8_t* dst, size_t length, uint64_t usec)
+{
+  uint32_t now = (uint32_t)usec;
+  size_t result = 0;
+  while (_rx_read != _rx_write && result < length) {
+    uint8_t header[6];
+    for (size_t i = 0; i < 6; ++i) { header[i] = _rx_buf[(_rx_read + i) & (rx_buffer_size - 1)]; }
+    uint32_t due;
+    memcpy(&due, header, 4);
+    if (_rx_offset == 0 && (int32_t)(due - now) > 0) { break; }
+    size_t len = header[4] | (header[5] << 8);
+    size_t r = _rx_read + 6 + _rx_offset;
+    while (_rx_offset < len && result < length) {
+      dst[result++] = _rx_buf[(r++) & (rx_buffer_size - 1)];
+      ++_rx_offset;
+    }
+    if (_rx_offset == len) {
+      _rx_read += 6 + len;
+      _rx_offset = 0;
+    }
+  }
+  return result;
+}
+
+void RTP_MIDI_Session::clearReceive(void)
+{
+  _rx_read = _rx_write;
+  _rx_offset = 0;
+}
+
+//----------------------------------------------------------------
+
+void RTP_MIDI_Session::send(const uint8_t* data, size_t length, uint64_t usec)
+{
+  for (size_t i = 0; i < length; ++i) {
+    uint8_t b = data[i];
+    if (b >= 0xF8) {
+      // リアルタイムメッセージは SysEx の途中でも単独のコマンドとして送る
+      if (_tx_sysex_open) {
+        _cmd[_cmd_len++] = 0xF0;
+        _tx_sysex_open = false;
+      }
+      putCommand(&b, 1, usec);
+      continue;
+    }
+    if (b == 0xF0) {
+      if (_tx_in_sysex) { putSysExByte(0xF7, usec); }
+      _tx_status = 0;
+      _tx_msg_len = 0;
+      _tx_in_sysex = true;
+      // 区切り無しの SysEx を F0 から始める (区切りの F0 を置く余地を残す)
+      if (_cmd_len + 4 > max_command_size) { flushPacket(usec); }
+      if (_cmd_len) { _cmd[_cmd_len++] = 0; }
+      _cmd[_cmd_len++] = 0xF0;
+      _tx_sysex_open = true;
+      continue;
+    }
+    if (_tx_in_sysex) {
+      if (b < 0x80) {
+        putSysExByte(b, usec);
+        continue;
+      }
+      // F7 以外のステータスで終わった SysEx も F7 で閉じる
+      putSysExByte(0xF7, usec);
+      _tx_in_sysex = false;
+      _tx_sysex_open = false;
+      if (b == 0xF7) { continue; }
+    }
+    if (b & 0x80) {
+      int need = getDataByteLength(b);
+      _tx_status = (b < 0xF0) ? b : 0;
+      _tx_msg[0] = b;
+      _tx_msg_len = 1;
+      _tx_msg_need = need;
+      if (need <= 0) {
+        if (b != 0xF7) { putCommand(_tx_msg, 1, usec); }
+        _tx_msg_len = 0;
+      }
+      continue;
+    }
+    if (_tx_msg_len == 0) {
+      if (_tx_status == 0) { continue; }
+      _tx_msg[0] = _tx_status;
+      _tx_msg_len = 1;
+      _tx_msg_need = getDataByteLength(_tx_status);
+    }
+    _tx_msg[_tx_msg_len++] = b;
+    if (_tx_msg_len > _tx_msg_need) {
+      putCommand(_tx_msg, _tx_msg_len, usec);
+      _tx_msg_len = 0;
+    }
+  }
+  // 送信の度にパケットを送り出す。SysEx が続く場合は区切りを付けて、続きは次のパケットで送る
+  if (_tx_sysex_open) {
+    _cmd[_cmd_len++] = 0xF0;
+    _tx_sysex_open = false;
+  }
+  flushPacket(usec);
+}
+
+void RTP_MIDI_Session::putCommand(const uint8_t* msg, size_t length, uint64_t usec)
+{
+  // 2件目以降のコマンドにはデルタタイム 0 を付ける
+  if (_cmd_len + 1 + length > max_command_size) { flushPacket(usec); }
+  if (_cmd_len) { _cmd[_cmd_len++] = 0; }
+  memcpy(&_cmd[_cmd_len], msg, length);
+  _cmd_len += length;
+}
+
+void RTP_MIDI_Session::putSysExByte(uint8_t value, uint64_t usec)
+{
+  if (_tx_sysex_open && _cmd_len + 2 > max_command_size) {
+    _cmd[_cmd_len++] = 0xF0;
+    _tx_sysex_open = false;
+    flushPacket(usec);
+  }
+  if (!_tx_sysex_open) {
+    // 続きの SysEx は F7 から始める
+    if (_cmd_len + 4 > max_command_size) { flushPacket(usec); }
+    if (_cmd_len) { _cmd[_cmd_len++] = 0; }
+    _cmd[_cmd_len++] = 0xF7;
+    _tx_sysex_open = true;
+  }
+  _cmd[_cmd_len++] = value;
+}
+
+void RTP_MIDI_Session::flushPacket(uint64_t usec)
+{
+  if (_cmd_len == 0) { return; }
+  uint32_t ts = (uint32_t)toTicks(usec);
+  size_t header_len = (_cmd_len > 0x0F) ? 2 : 1;
+  for (auto& p : _participant) {
+    if (p.state != state_connected) { continue; }
+    uint8_t* buf = _packet;
+    buf[0] = 0x80;
+    buf[1] = rtp_payload_type;
+    put16(&buf[2], _seq);
+    put32(&buf[4], ts);
+    put32(&buf[8], _ssrc);
+    size_t pos = 12 + header_len;
+    memcpy(&buf[pos], _cmd, _cmd_len);
+    pos += _cmd_len;
+    // ジャーナルはこのパケットより前の状態を表すため、コマンドを反映する前に生成する
+    size_t journal_len = p.writer.encode(_tx_state, &buf[pos], max_journal_size);
+    uint8_t flags = journal_len ? 0x40 : 0x00;
+    if (header_len == 2) {
+      buf[12] = 0x80 | flags | (_cmd_len >> 8);
+      buf[13] = _cmd_len;
+    } else {
+      buf[12] = flags | _cmd_len;
+    }
+    if (_send) { _send(_send_user, port_data, p.data, buf, pos + journal_len); }
+  }
+  parseCommands(_cmd, _cmd_len, false, tx_mark, this);
+  ++_seq;
+  _cmd_len = 0;
+}
+
+void RTP_MIDI_Session::tx_mark(void* user, uint32_t, const uint8_t* msg, size_t length)
+{
+  auto me = (RTP_MIDI_Session*)user;
+  if (msg[0] >= 0xF0) { return; }
+  for (auto& p : me->_participant) {
+    if (p.state == state_connected) { p.writer.mark(msg, length); }
+  }
+  me->_tx_state.update(msg, length);
+}
+
+//----------------------------------------------------------------
+
+void RTP_MIDI_Session::proc(uint64_t usec)
+{
+  // 接続先が指定されていて未接続の場合は招待を始める
+  if (_peer.ip && usec >= _peer_retry_usec) {
+    _peer_retry_usec = usec + peer_retry_usec;
+    bool found = false;
+    for (auto& p : _participant) {
+      found |= (p.state != state_free && p.control.ip == _peer.ip);
+    }
+    participant_t* p;
+    if (!found && nullptr != (p = allocate())) {
+      p->control = _peer;
+      p->token = _ssrc ^ (uint32_t)usec ^ (uint32_t)(p - _participant) * 0x9E3779B9u;
+      p->is_initiator = true;
+      p->state = state_invite_control;
+      p->next_usec = usec + invite_retry_usec;
+      sendInvitation("IN", port_control, p->control, p->token);
+    }
+  }
+
+  for (auto& p : _participant) {
+    switch (p.state) {
+    default: break;
+
+    case state_invite_control:
+    case state_invite_data:
+      if (usec < p.next_usec) { break; }
+      if (++p.retry > invite_retry_max) {
+        release(&p);
+        break;
+      }
+      p.next_usec = usec + invite_retry_usec;
+      if (p.state == state_invite_control) {
+        sendInvitation("IN", port_control, p.control, p.token);
+      } else {
+        sendInvitation("IN", port_data, p.data, p.token);
+      }
+      break;
+
+    case state_accept_data:
+      if (usec >= p.next_usec) { release(&p); }
+      break;
+
+    case state_connected:
+      if (usec - p.last_recv_usec >= timeout_usec) {
+        sendBye(&p);
+        release(&p);
+        break;
+      }
+      if (p.is_initiator && usec >= p.next_usec) {
+        const uint64_t ts[3] = { toTicks(usec), 0, 0 };
+        sendSync(&p, 0, ts);
+        p.next_usec = usec + ((p.sync_count < sync_fast_count) ? sync_fast_usec : sync_usec);
+        if (p.sync_count < sync_fast_count) { ++p.sync_count; }
+      }
+      if (p.recv_valid && p.ack_seq != p.recv_seq && usec >= p.feedback_usec) {
+        p.feedback_usec = usec + feedback_usec;
+        sendFeedback(&p);
+      }
+      break;
+    }
+  }
+}
+
+//----------------------------------------------------------------
+
+} // namespace midi_driver
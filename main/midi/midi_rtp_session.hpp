@@ -0,0 +1,200 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 InstaChord Corp.
+
+#ifndef MIDI_RTP_SESSION_HPP
+#define MIDI_RTP_SESSION_HPP
+
+#include "midi_rtp_journal.hpp"
+
+namespace midi_driver {
+
+// RTP-MIDI (RFC 6295) の AppleMIDI セッション管理
+// 通信経路には依存せず、受信したデータグラムを receive に渡し、送信は send_func_t で行う。
+// 時刻はマイクロ秒単位の単調増加する値を呼び出し側から渡す (RTPタイムスタンプは 10kHz = 100μs 単位)
+//
+// 制御パケット : [FF FF] [コマンド 2文字] ...
+//  IN/OK/NO : [プロトコルバージョン 32bit] [トークン 32bit] [SSRC 32bit] [セッション名 NUL終端]
+//  BY       : [プロトコルバージョン 32bit] [トークン 32bit] [SSRC 32bit]
+//  CK       : [SSRC 32bit] [カウント 8bit] [予約 24bit] [時刻1 64bit] [時刻2 64bit] [時刻3 64bit]
+//  RS       : [SSRC 32bit] [受信済みシーケンス番号 16bit] [予約 16bit]
+// 接続はコントロールポートとデータポート (コントロールポート + 1) の順に IN/OK を交わして確立し、
+// 以後データポートで CK による時刻合わせと RTP パケットの送受信を行う。
+//
+// 受信したメッセージはジッタバッファに積み、送信側の時刻を自機の時刻に換算した上で、
+// 到着の揺らぎ (RFC 3550 のジッタ推定値) に応じた遅延を加えた時刻に read で取り出せるようにする
+class RTP_MIDI_Session {
+public:
+  enum port_kind_t : uint8_t {
+    port_control,
+    port_data,
+  };
+
+  // IPアドレスとポート番号 (いずれもホストバイトオーダー)
+  struct address_t {
+    uint32_t ip = 0;
+    uint16_t port = 0;
+    bool operator==(const address_t& rhs) const { return ip == rhs.ip && port == rhs.port; }
+  };
+
+  struct config_t {
+    const char* session_name = "KANTAN-Play";
+    uint32_t min_latency_usec = 1000;   // ジッタバッファの最小遅延
+    uint32_t max_latency_usec = 15000;  // ジッタバッファの最大遅延
+  };
+
+  typedef void (*send_func_t)(void* user, port_kind_t kind, const address_t& to, const uint8_t* data, size_t length);
+
+  static constexpr const size_t max_participant = 4;
+  static constexpr const size_t max_datagram_size = 1024;  // 受信できるデータグラムの最大長
+  static constexpr const size_t max_command_size = 256;    // 1パケットに積むコマンドセクションの最大長
+  static constexpr const size_t max_journal_size = 512;
+  static constexpr const size_t rx_buffer_size = 2048;     // ジッタバッファ (2の累乗)
+
+  static constexpr const uint32_t invite_retry_usec = 1000000;
+  static constexpr const uint8_t invite_retry_max = 12;
+  static constexpr const uint32_t peer_retry_usec = 10000000;  // 接続先への再接続の間隔
+  static constexpr const uint32_t sync_fast_usec = 1500000;    // 接続直後の時刻合わせの間隔
+  static constexpr const uint8_t sync_fast_count = 3;
+  static constexpr const uint32_t sync_usec = 10000000;
+  static constexpr const uint32_t feedback_usec = 1000000;     // 受信確認 (RS) の送信間隔
+  static constexpr const uint32_t timeout_usec = 60000000;     // 無通信で切断するまでの時間
+
+  void setConfig(const config_t& config) { _config = config; }
+  void setSender(send_func_t func, void* user) { _send = func; _send_user = user; }
+
+  // 接続を要求する相手のコントロールポート (ip が 0 の場合は相手からの接続のみ受け付ける)
+  void setPeer(const address_t& peer) { _peer = peer; _peer_retry_usec = 0; }
+
+  void begin(uint32_t ssrc, uint64_t usec);
+  // 全ての相手に切断 (BY) を送る
+  void end(void);
+
+  // 受信したデータグラムを処理する
+  void receive(port_kind_t kind, const address_t& from, const uint8_t* data, size_t length, uint64_t usec);
+
+  // 招待の再送・時刻合わせ・受信確認・タイムアウトの処理を行う。定期的に呼ぶこと
+  void proc(uint64_t usec);
+
+  // MIDIバイト列 (ランニングステータス可) を接続中の全ての相手へ送る
+  void send(const uint8_t* data, size_t length, uint64_t usec);
+
+  // 出力時刻に達した受信メッセージをMIDIバイト列として取り出す
+  size_t read(uint8_t* dst, size_t length, uint64_t usec);
+
+  // 受信したメッセージを全て破棄する
+  void clearReceive(void);
+
+  size_t getConnectedCount(void) const;
+
+  // 欠落したパケット数と、ジャーナルから復元したメッセージ数
+  uint32_t getLostCount(void) const { return _lost_count; }
+  uint32_t getRecoverCount(void) const { return _recover_count; }
+  // ジッタバッファの空きが足りず破棄したメッセージの数
+  uint32_t getReceiveDropCount(void) const { return _rx_drop_count; }
+
+  // コマンドセクションを解析し、コマンド1件ごとに func を呼ぶ (戻り値は解析できた長さ)
+  // delta は先頭からの経過時間 (RTPタイムスタンプ単位)、msg はステータスを補ったメッセージ
+  // SysEx は区切りのバイト (F0/F7/F4) を含めた分割単位で渡す
+  typedef void (*command_func_t)(void* user, uint32_t delta, const uint8_t* msg, size_t length);
+  static size_t parseCommands(const uint8_t* data, size_t length, bool first_delta, command_func_t func, void* user);
+
+private:
+  enum state_t : uint8_t {
+    state_free,
+    state_invite_control, // 自機から招待: コントロールポートの OK 待ち
+    state_invite_data,    // 自機から招待: データポートの OK 待ち
+    state_accept_data,    // 相手から招待: データポートの IN 待ち
+    state_connected,
+  };
+
+  struct participant_t {
+    address_t control;
+    address_t data;
+    uint64_t last_recv_usec;
+    uint64_t next_usec;       // 招待の再送 / 次の時刻合わせ
+    uint64_t feedback_usec;   // 次の受信確認
+    int64_t offset;           // 時刻の差 (自機 - 相手 , RTPタイムスタンプ単位)
+    int32_t transit_usec;     // 送信から到着までの時間の平均
+    int32_t prev_transit_usec;
+    uint32_t jitter_usec;
+    uint32_t ssrc;
+    uint32_t token;
+    uint16_t recv_seq;        // 最後に受信したシーケンス番号
+    uint16_t ack_seq;         // 最後に受信確認を送ったシーケンス番号
+    state_t state;
+    uint8_t retry;
+    uint8_t sync_count;
+    bool synced;
+    bool transit_valid;
+    bool recv_valid;
+    bool is_initiator;        // 自機から招待した相手 (時刻合わせを自機から始める)
+    RTP_MIDI_Journal_Writer writer;
+    RTP_MIDI_Journal_Reader reader;
+  };
+
+  participant_t* findBySSRC(uint32_t ssrc);
+  participant_t* allocate(void);
+  void connect(participant_t* p, uint64_t usec);
+  void release(participant_t* p);
+
+  void receiveControl(port_kind_t kind, const address_t& from, const uint8_t* data, size_t length, uint64_t usec);
+  void receiveSync(participant_t* p, const uint8_t* data, uint64_t usec);
+  void receiveRTP(const uint8_t* data, size_t length, uint64_t usec);
+
+  void sendInvitation(const char* command, port_kind_t kind, const address_t& to, uint32_t token);
+  void sendBye(participant_t* p);
+  void sendSync(participant_t* p, uint8_t count, const uint64_t* ts);
+  void sendFeedback(participant_t* p);
+
+  // 送信するコマンドの追加と、パケットの送出
+  void putCommand(const uint8_t* msg, size_t length, uint64_t usec);
+  void putSysExByte(uint8_t value, uint64_t usec);
+  void flushPacket(uint64_t usec);
+
+  // ジッタバッファ
+  void pushReceive(const uint8_t* msg, size_t length, uint32_t due);
+  static void rx_command(void* user, uint32_t delta, const uint8_t* msg, size_t length);
+  static void rx_recover(void* user, const uint8_t* msg, size_t length);
+  static void tx_mark(void* user, uint32_t delta, const uint8_t* msg, size_t length);
+
+  config_t _config;
+  send_func_t _send = nullptr;
+  void* _send_user = nullptr;
+  participant_t _participant[max_participant];
+  RTP_MIDI_Send_State _tx_state;
+  address_t _peer;
+  uint64_t _peer_retry_usec = 0;
+  uint32_t _ssrc = 0;
+  uint16_t _seq = 0;        // 次に送るパケットのシーケンス番号
+
+  // 送信中のパケット
+  uint8_t _packet[12 + 2 + max_command_size + max_journal_size];
+  uint8_t _cmd[max_command_size];
+  size_t _cmd_len = 0;
+  uint8_t _tx_status = 0;   // 入力バイト列のランニングステータス
+  uint8_t _tx_msg[3];
+  uint8_t _tx_msg_len = 0;
+  uint8_t _tx_msg_need = 0;
+  bool _tx_in_sysex = false;   // 入力バイト列が SysEx の途中
+  bool _tx_sysex_open = false; // コマンドセクションの末尾が区切りの無い SysEx
+
+  // 受信中のパケットの処理状態 (コマンド解析のコールバックで使用する)
+  participant_t* _rx_participant = nullptr;
+  uint64_t _rx_base_usec = 0;   // コマンドの時刻の基準 (自機の時刻に換算した送信時刻 + 遅延)
+  uint64_t _rx_now_usec = 0;
+  bool _rx_immediate = false;   // 時刻合わせ前は受信次第出力する
+
+  // ジッタバッファ [出力時刻 32bit] [長さ 16bit] [データ...] の繰り返し
+  uint8_t _rx_buf[rx_buffer_size];
+  size_t _rx_write = 0;
+  size_t _rx_read = 0;
+  size_t _rx_offset = 0;        // 先頭のメッセージのうち取り出し済みの長さ
+  uint32_t _rx_last_due = 0;
+  uint32_t _rx_drop_count = 0;
+  uint32_t _lost_count = 0;
+  uint32_t _recover_count = 0;
+};
+
+} // namespace midi_driver
+
+#endif // MIDI_RTP_SESSION_HPP
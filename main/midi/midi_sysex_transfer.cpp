@@ -0,0 +1,374 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 InstaChord Corp.
+
+#include "midi_sysex_transfer.hpp"
+
+#include <string.h>
+
+namespace midi_driver {
+
+//----------------------------------------------------------------
+
+size_t MIDI_SysEx_Transfer::pack7(const uint8_t* src, size_t length, uint8_t* dst)
+{
+  size_t result = 0;
+  for (size_t i = 0; i < length; i += 7) {
+    size_t len = (length - i < 7) ? length - i : 7;
+    uint8_t msb = 0;
+    for (size_t j = 0; j < len; ++j) {
+      msb |= (src[i + j] >> 7) << j;
+      dst[result + 1 + j] = src[i + j] & 0x7F;
+    }
+    dst[result] = msb;
+    result += len + 1;
+  }
+  return result;
+}
+
+size_t MIDI_SysEx_Transfer::unpack7(const uint8_t* src, size_t length, uint8_t* dst)
+{
+  size_t result = 0;
+  for (size_t i = 0; i < length; i += 8) {
+    size_t len = (length - i < 8) ? length - i : 8;
+    uint8_t msb = src[i];
+    for (size_t j = 1; j < len; ++j) {
+      dst[result++] = src[i + j] | (((msb >> (j - 1)) & 1) << 7);
+    }
+  }
+  return result;
+}
+
+uint32_t MIDI_SysEx_Transfer::getChunkLength(uint16_t seq) const
+{
+  uint32_t offset = seq * chunk_size;
+  return (_size - offset < chunk_size) ? _size - offset : chunk_size;
+}
+
+void MIDI_SysEx_Transfer::sendMessage(command_t cmd, uint16_t seq, const uint8_t* payload, size_t payload_length)
+{
+  if (_output == nullptr) { return; }
+  uint8_t buf[max_message_size];
+  size_t len = sizeof(header_id);
+  memcpy(buf, header_id, len);
+  buf[len++] = cmd;
+  buf[len++] = _target;
+  buf[len++] = seq & 0x7F;
+  buf[len++] = (seq >> 7) & 0x7F;
+  if (payload_length) {
+    memcpy(&buf[len], payload, payload_length);
+    len += payload_length;
+  }
+  uint8_t sum = 0;
+  for (size_t i = sizeof(header_id); i < len; ++i) { sum += buf[i]; }
+  buf[len++] = (0x80 - (sum & 0x7F)) & 0x7F;
+  _output(_output_user, buf, len);
+}
+
+void MIDI_SysEx_Transfer::sendHeader(void)
+{
+  const uint8_t payload[] = {
+    (uint8_t)(_size & 0x7F), (uint8_t)((_size >> 7) & 0x7F), (uint8_t)((_size >> 14) & 0x7F), (uint8_t)chunk_size,
+  };
+  sendMessage(cmd_header, 0, payload, sizeof(payload));
+}
+
+void MIDI_SysEx_Transfer::sendChunk(uint16_t seq)
+{
+  uint8_t raw[chunk_size];
+  uint8_t packed[packed_chunk_size];
+  auto len = getChunkLength(seq);
+  readData(_target, seq * chunk_size, raw, len);
+  // 合計値は初回送信時にだけ加算する (再送時は加算済み)
+  if (seq == _sum_seq) {
+    ++_sum_seq;
+    for (size_t i = 0; i < len; ++i) { _sum += raw[i]; }
+  }
+  sendMessage(cmd_data, seq, packed, pack7(raw, len, packed));
+}
+
+void MIDI_SysEx_Transfer::sendComplete(void)
+{
+  const uint8_t payload[] = { (uint8_t)(_sum & 0x7F), (uint8_t)((_sum >> 7) & 0x7F) };
+  sendMessage(cmd_complete, _chunk_count, payload, sizeof(payload));
+}
+
+void MIDI_SysEx_Transfer::finish(bool success)
+{
+  bool is_sender = (_state == state_send_header || _state == state_send_data || _state == state_send_complete);
+  if (_state == state_receive) {
+    endWrite(_target, success);
+  }
+  _state = state_idle;
+  onFinish(_target, is_sender, success, _size, _last_msec - _start_msec);
+}
+
+void MIDI_SysEx_Transfer::abort(void)
+{
+  if (_state == state_idle) { return; }
+  sendMessage(cmd_abort, 0);
+  finish(false);
+}
+
+bool MIDI_SysEx_Transfer::requestDump(uint8_t target, uint32_t msec)
+{
+  if (_state != state_idle) { return false; }
+  _target = target;
+  _size = 0;
+  _start_msec = _last_msec = msec;
+  _retry = 0;
+  _completed = false;
+  _state = state_wait_header;
+  sendMessage(cmd_request, 0);
+  return true;
+}
+
+bool MIDI_SysEx_Transfer::startSend(uint8_t target, uint32_t msec)
+{
+  if (_state != state_idle) { return false; }
+  _target = target;
+  _size = getDataSize(target);
+  // シーケンス番号は14bitのため、送信できるのは chunk_size × 16384 byte まで
+  if (_size == 0 || _size > (chunk_size << 14)) {
+    sendMessage(cmd_abort, 0);
+    return false;
+  }
+  _chunk_count = (_size + chunk_size - 1) / chunk_size;
+  _acked = 0;
+  _next = 0;
+  _sum_seq = 0;
+  _sum = 0;
+  _retry = 0;
+  _start_msec = _last_msec = msec;
+  _completed = false;
+  _state = state_send_header;
+  sendHeader();
+  return true;
+}
+
+void MIDI_SysEx_Transfer::onReceiveHeader(uint8_t target, const uint8_t* payload, size_t length)
+{
+  if (length != 4) { return; }
+  uint32_t size = payload[0] | (payload[1] << 7) | (payload[2] << 14);
+  if (_state == state_receive) {
+    // ACK が届かず HEADER が再送された場合は、受信状態をそのままにして ACK を返し直す
+    if (target == _target && size == _size && _acked == 0) {
+      sendMessage(cmd_ack, 0);
+    }
+    return;
+  }
+  if (_state != state_idle && _state != state_wait_header) { return; }
+
+  _target = target;
+  _completed = false;
+  // データ長が一致しない (データ構造が異なる) 場合は受け付けない
+  if (payload[3] != chunk_size || size == 0 || size != getDataSize(target) || !beginWrite(target)) {
+    _state = state_idle;
+    sendMessage(cmd_abort, 0);
+    return;
+  }
+  _size = size;
+  _chunk_count = (_size + chunk_size - 1) / chunk_size;
+  _acked = 0;
+  _sum = 0;
+  _nak_sent = false;
+  _start_msec = _last_msec;
+  _state = state_receive;
+  sendMessage(cmd_ack, 0);
+}
+
+void MIDI_SysEx_Transfer::onReceiveData(uint16_t seq, const uint8_t* payload, size_t length)
+{
+  if (_state != state_receive) { return; }
+  if (seq != _acked) {
+    // 取りこぼしがあった場合は、最初の1回だけ再送要求を返す (後続の先行送信分は読み捨てる)
+    if (!_nak_sent && seq > _acked) {
+      _nak_sent = true;
+      sendMessage(cmd_nak, _acked);
+    } else if (seq < _acked) {
+      // ACK が失われて再送された場合
+      sendMessage(cmd_ack, _acked);
+    }
+    return;
+  }
+  uint8_t raw[chunk_size];
+  auto len = getChunkLength(seq);
+  if (length != len + (len + 6) / 7 || unpack7(payload, length, raw) != len) {
+    _nak_sent = true;
+    sendMessage(cmd_nak, _acked);
+    return;
+  }
+  writeData(_target, seq * chunk_size, raw, len);
+  for (size_t i = 0; i < len; ++i) { _sum += raw[i]; }
+  ++_acked;
+  _nak_sent = false;
+  sendMessage(cmd_ack, _acked);
+}
+
+void MIDI_SysEx_Transfer::onReceiveAck(command_t cmd, uint16_t seq, uint32_t msec)
+{
+  switch (_state) {
+  default: return;
+
+  case state_send_header:
+    if (cmd != cmd_ack || seq != 0) { return; }
+    _state = state_send_data;
+    _retry = 0;
+    _last_msec = msec;
+    return;
+
+  case state_send_data:
+    if (seq > _chunk_count) { return; }
+    if (seq > _acked) {
+      _acked = seq;
+      _retry = 0;
+      _last_msec = msec;
+    } else if (cmd == cmd_ack) {
+      return;
+    }
+    if (cmd == cmd_nak || _next < _acked) {
+      _next = _acked;
+    }
+    if (_acked == _chunk_count) {
+      _state = state_send_complete;
+      sendComplete();
+    }
+    return;
+
+  case state_send_complete:
+    if (cmd == cmd_complete && seq == _chunk_count) {
+      _last_msec = msec;
+      finish(true);
+    }
+    return;
+  }
+}
+
+bool MIDI_SysEx_Transfer::receive(const uint8_t* data, size_t length, uint32_t msec)
+{
+  static constexpr const size_t min_length = sizeof(header_id) + 5;
+  if (length < min_length || memcmp(data, header_id, sizeof(header_id)) != 0) { return false; }
+
+  uint8_t sum = 0;
+  for (size_t i = sizeof(header_id); i < length; ++i) { sum += data[i]; }
+  auto cmd = (command_t)data[3];
+  uint8_t target = data[4];
+  uint16_t seq = data[5] | (data[6] << 7);
+  auto payload = &data[7];
+  size_t payload_length = length - min_length;
+
+  if (sum & 0x7F) {
+    // チェックサム不一致のデータは再送を求める。それ以外のメッセージは破棄し、相手の再送を待つ
+    if (cmd == cmd_data && _state == state_receive && !_nak_sent) {
+      _nak_sent = true;
+      sendMessage(cmd_nak, _acked);
+    }
+    return true;
+  }
+
+  // 送信側の再送タイマーは ACK で転送が進んだ時だけ更新する
+  bool is_sender = (_state == state_send_header || _state == state_send_data || _state == state_send_complete);
+  if (!is_sender) { _last_msec = msec; }
+  if (_state != state_idle && cmd != cmd_request && target != _target) { return true; }
+
+  switch (cmd) {
+  default: break;
+
+  case cmd_request:
+    if (_state == state_idle) {
+      startSend(target, msec);
+    }
+    break;
+
+  case cmd_header:
+    onReceiveHeader(target, payload, payload_length);
+    break;
+
+  case cmd_data:
+    onReceiveData(seq, payload, payload_length);
+    break;
+
+  case cmd_ack:
+  case cmd_nak:
+    onReceiveAck(cmd, seq, msec);
+    break;
+
+  case cmd_complete:
+    if (payload_length == 0) {
+      // 受信側からの完了確認
+      onReceiveAck(cmd, seq, msec);
+    } else if (_state == state_receive) {
+      if (payload_length == 2 && _acked == _chunk_count && seq == _chunk_count
+       && (payload[0] | (payload[1] << 7)) == (_sum & 0x3FFF)) {
+        finish(true);
+        _completed = true;
+        sendMessage(cmd_complete, seq);
+      } else {
+        sendMessage(cmd_abort, 0);
+        finish(false);
+      }
+    } else if (_state == state_idle && _completed && target == _target && seq == _chunk_count) {
+      // 完了確認が失われて COMPLETE が再送された場合
+      sendMessage(cmd_complete, seq);
+    }
+    break;
+
+  case cmd_abort:
+    if (_state != state_idle) {
+      finish(false);
+    }
+    break;
+  }
+  return true;
+}
+
+void MIDI_SysEx_Transfer::proc(uint32_t msec)
+{
+  switch (_state) {
+  default: return;
+
+  case state_wait_header:
+    // 要求が届かなかった場合に備えて、HEADER が届くまで要求を送り直す
+    if (msec - _last_msec >= retry_msec) {
+      if (++_retry > retry_max) {
+        abort();
+        return;
+      }
+      _last_msec = msec;
+      sendMessage(cmd_request, 0);
+    }
+    return;
+
+  case state_receive:
+    if (msec - _last_msec >= receive_timeout_msec) {
+      abort();
+    }
+    return;
+
+  case state_send_header:
+  case state_send_data:
+  case state_send_complete:
+    break;
+  }
+
+  if (msec - _last_msec >= retry_msec) {
+    // ACK が進まない場合は、相手が受け取った位置から送り直す
+    if (++_retry > retry_max) {
+      abort();
+      return;
+    }
+    _last_msec = msec;
+    if (_state == state_send_header) { sendHeader(); }
+    else if (_state == state_send_complete) { sendComplete(); }
+    else { _next = _acked; }
+  }
+
+  if (_state == state_send_data) {
+    while (_next < _chunk_count && _next < _acked + window) {
+      sendChunk(_next++);
+    }
+  }
+}
+
+//----------------------------------------------------------------
+
+} // namespace midi_driver
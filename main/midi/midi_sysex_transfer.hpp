@@ -0,0 +1,121 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 InstaChord Corp.
+
+#ifndef MIDI_SYSEX_TRANSFER_HPP
+#define MIDI_SYSEX_TRANSFER_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+
+namespace midi_driver {
+
+// SysEx によるバルクデータ転送
+// メッセージの本体 (F0 と F7 の間) は以下の形式
+//  [7D] [4B] [50] [コマンド] [対象] [シーケンス番号 下位7bit] [上位7bit] [ペイロード...] [チェックサム]
+//  チェックサムはコマンドからペイロード末尾までの合計の下位7bitを 0 にする値
+//
+// データは chunk_size 毎に区切り、7byte を MSB 1byte + 下位7bit×7byte の 8byte に変換して送る。
+// 受信側は受け取ったチャンクの次の番号を ACK で返し、送信側は ACK を待たずに window 件まで先行して送る。
+// 番号の飛びやチェックサムの不一致を検出した場合は NAK で再送開始位置を返す (Go-Back-N)。
+// 全チャンクの ACK を受けたら、データ全体の合計値を COMPLETE で送り、受信側はこれを確認してから反映し、ペイロードなしの COMPLETE を返す。
+class MIDI_SysEx_Transfer {
+public:
+  enum command_t : uint8_t {
+    cmd_request = 0x01,  // 相手にダンプを要求する (ペイロードなし)
+    cmd_header,          // 送信開始 (ペイロード: データ長 7bit×3, チャンク長)
+    cmd_data,            // データ (ペイロード: 7bitに変換したチャンク)
+    cmd_ack,             // 受信済みチャンク数の通知 (シーケンス番号 = 次に受け取るチャンク番号)
+    cmd_nak,             // 再送要求 (シーケンス番号 = 再送を開始するチャンク番号)
+    cmd_complete,        // 送信完了 (ペイロード: データ全体の合計値 7bit×2) / 受信側からの完了確認 (ペイロードなし)
+    cmd_abort,           // 中止
+  };
+
+  static constexpr const uint8_t header_id[] = { 0x7D, 0x4B, 0x50 };  // 非営利用ID + "KP"
+  static constexpr const size_t chunk_size = 64;
+  static constexpr const size_t packed_chunk_size = chunk_size + (chunk_size + 6) / 7;
+  static constexpr const size_t max_message_size = sizeof(header_id) + 4 + packed_chunk_size + 1;
+  static constexpr const uint8_t window = 4;              // ACK を待たずに送るチャンク数
+  static constexpr const uint32_t retry_msec = 500;       // 送信側: ACK が進まない場合に再送するまでの時間
+  static constexpr const uint8_t retry_max = 8;
+  static constexpr const uint32_t receive_timeout_msec = 3000;  // 受信側: 次のメッセージを待つ時間
+
+  // SysEx メッセージの本体 (F0 と F7 を含まない) を送る関数
+  typedef void (*output_func_t)(void* user, const uint8_t* data, size_t length);
+
+  virtual ~MIDI_SysEx_Transfer() = default;
+
+  void setOutput(output_func_t func, void* user) { _output = func; _output_user = user; }
+
+  // 受信した SysEx メッセージの本体 (F0 と F7 を含まない) を渡す。このプロトコルのメッセージでなければ false を返す
+  bool receive(const uint8_t* data, size_t length, uint32_t msec);
+
+  // 先行送信・再送・タイムアウトの処理を行う。転送中は定期的に呼ぶこと
+  void proc(uint32_t msec);
+
+  // 相手へダンプを要求する
+  bool requestDump(uint8_t target, uint32_t msec);
+
+  // 相手へデータの送信を開始する
+  bool startSend(uint8_t target, uint32_t msec);
+
+  // 転送を中止する
+  void abort(void);
+
+  bool isBusy(void) const { return _state != state_idle; }
+
+  // 7bit変換 (戻り値は変換後の長さ)
+  static size_t pack7(const uint8_t* src, size_t length, uint8_t* dst);
+  static size_t unpack7(const uint8_t* src, size_t length, uint8_t* dst);
+
+protected:
+  // 転送対象のデータ長を返す。0 の場合は転送できない対象として扱う
+  virtual uint32_t getDataSize(uint8_t target) = 0;
+  virtual void readData(uint8_t target, uint32_t offset, uint8_t* dst, size_t length) = 0;
+  // 受信開始時に呼ばれる。false を返すと受信を拒否する
+  virtual bool beginWrite(uint8_t target) = 0;
+  virtual void writeData(uint8_t target, uint32_t offset, const uint8_t* src, size_t length) = 0;
+  // 受信終了時に呼ばれる。success が true の場合はデータ全体の受信と合計値の確認が済んでいる
+  virtual void endWrite(uint8_t target, bool success) = 0;
+  // 転送終了時に呼ばれる (送信・受信とも)
+  virtual void onFinish(uint8_t /*target*/, bool /*is_sender*/, bool /*success*/, uint32_t /*bytes*/, uint32_t /*msec*/) {}
+
+private:
+  enum state_t : uint8_t {
+    state_idle,
+    state_send_header,    // HEADER の ACK 待ち
+    state_send_data,
+    state_send_complete,  // COMPLETE の ACK 待ち
+    state_wait_header,    // ダンプ要求後の HEADER 待ち
+    state_receive,
+  };
+
+  void sendMessage(command_t cmd, uint16_t seq, const uint8_t* payload = nullptr, size_t payload_length = 0);
+  void sendHeader(void);
+  void sendChunk(uint16_t seq);
+  void sendComplete(void);
+  void finish(bool success);
+  void onReceiveHeader(uint8_t target, const uint8_t* payload, size_t length);
+  void onReceiveData(uint16_t seq, const uint8_t* payload, size_t length);
+  void onReceiveAck(command_t cmd, uint16_t seq, uint32_t msec);
+  uint32_t getChunkLength(uint16_t seq) const;
+
+  output_func_t _output = nullptr;
+  void* _output_user = nullptr;
+  uint32_t _size = 0;
+  uint32_t _start_msec = 0;
+  uint32_t _last_msec = 0;   // 最後に転送が進んだ時刻
+  uint16_t _chunk_count = 0;
+  uint16_t _acked = 0;       // 送信側: 相手が受け取ったチャンク数 / 受信側: 受け取ったチャンク数
+  uint16_t _next = 0;        // 送信側: 次に送るチャンク番号
+  uint16_t _sum_seq = 0;     // 送信側: 合計値に加算済みのチャンク数
+  uint16_t _sum = 0;         // データ全体の合計値 (14bit)
+  uint8_t _target = 0;
+  uint8_t _retry = 0;
+  state_t _state = state_idle;
+  bool _nak_sent = false;
+  bool _completed = false;   // 受信側: 直前の受信が正常に完了した
+};
+
+} // namespace midi_driver
+
+#endif // MIDI_SYSEX_TRANSFER_HPP
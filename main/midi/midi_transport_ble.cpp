@@ -7,9 +7,11 @@
 
 #if __has_include(<esp_bt.h>)
 
+#include "midi_ble_codec.hpp"
+
+#include <M5Unified.h>
 #include <BLEDevice.h>
 #include <BLE2902.h>
-#include <deque>
 #include <vector>
 
 #include <esp_bt.h>
@@ -29,14 +31,36 @@ static BLEService *pService = nullptr;
 static BLEAdvertising *pAdvertising = nullptr;
 static BLECharacteristic *pCharacteristic = nullptr;
 static int _conn_id = -1;
-static std::deque<std::vector<uint8_t> > _rx_queue;
 
-static constexpr const size_t _tx_queue_size = 4;
-static int _tx_queue_index = 0;
-static std::vector<uint8_t> _tx_queue[_tx_queue_size];
+// 接続相手とのATT_MTU (BLEのコールバックで更新し、送信時に反映する)
+static constexpr const uint16_t _default_mtu = 23;
+static std::atomic<uint16_t> _peer_mtu { _default_mtu };
+
+// 受信データはBLEのコールバック内で復号し、MIDIバイト列としてリングバッファに積む
+// 空きが足りないメッセージは途中で切れないようメッセージ単位で破棄する
+static MIDI_ByteRing<512> _rx_ring;
+static std::atomic<uint32_t> _rx_drop_count { 0 };
+static BLE_MIDI_Decoder _rx_decoder_server; // 相手からの書込み
+static BLE_MIDI_Decoder _rx_decoder_client; // 接続先からの通知
+static BLE_MIDI_Encoder _tx_encoder;
+
+static void rx_output(void*, const uint8_t* data, size_t length, uint16_t)
+{
+  if (!_rx_ring.push(data, length)) {
+    _rx_drop_count.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+static void tx_output(void*, const uint8_t* packet, size_t length)
+{
+  pCharacteristic->setValue(const_cast<uint8_t*>(packet), length);
+  pCharacteristic->notify();
+}
 
 class MyServerCallbacks: public BLEServerCallbacks {
   void onConnect(BLEServer* pServer) {
+    _peer_mtu.store(_default_mtu);
+    _rx_decoder_server.reset();
     _conn_id = pServer->getConnId();
     // M5.Lcd.setTextSize(1);
     // M5.Lcd.setCursor(10, 0);
@@ -48,65 +72,14 @@ class MyServerCallbacks: public BLEServerCallbacks {
     // M5.Lcd.setCursor(10, 0);
     // M5.Lcd.printf("BLE MIDI Disconnect.");
   }
-};
-
-static void decodeReceive(const uint8_t* data, size_t length)
-{
-  if (length < 2) { return; }
-
-  printf("receive data length : %d  data:", length);
-  for (int i = 0; i < length; i++) {
-    printf("%02x ", data[i]);
-  }
-  printf("\n");
-
-  // uint8_t timestamp_high = data[0];
-  int timestamp_low_index = 1;
-
-  std::vector<uint8_t> rxtmp;
-  for (int i = 3; i <= length; ++i) {
-    if (i == length || data[i] & 0x80) {
-      if (timestamp_low_index + 1 < i) {
-        // rxtmpの末尾にdata[timestamp_low_index+1]からrxValue[i]までを追加
-        rxtmp.insert(rxtmp.end(), data + timestamp_low_index + 1, data + i);
-        timestamp_low_index = i;
-
-        if (_rx_queue.size() > 16) {
-          _rx_queue.pop_front();
-        }
-        _rx_queue.push_back(rxtmp);
-      }
-    }
+  void onMtuChanged(BLEServer* pServer, esp_ble_gatts_cb_param_t* param) {
+    _peer_mtu.store(param->mtu.mtu);
   }
-}
+};
 
 class MyCallbacks: public BLECharacteristicCallbacks {
   void onWrite(BLECharacteristic *pCharacteristic) {
-    decodeReceive(pCharacteristic->getData(), pCharacteristic->getLength());
-/*
-    auto rxValue = pCharacteristic->getData();
-    auto rxValueLen = pCharacteristic->getLength();
-// printf("rxValue:%d : %s\n", rxValueLen, (char*)rxValue);
-    if (rxValueLen < 2) { return; }
-
-    // uint8_t timestamp_high = rxValue[0];
-    int timestamp_low_index = 1;
-    std::vector<uint8_t> rxtmp;
-    for (int i = 3; i <= rxValueLen; ++i) {
-      if (i == rxValueLen || rxValue[i] & 0x80) {
-        if (timestamp_low_index + 1 < i) {
-          // rxtmpの末尾にrxValue[timestamp_low_index+1]からrxValue[i]までを追加
-          rxtmp.insert(rxtmp.end(), rxValue + timestamp_low_index + 1, rxValue + i);
-          timestamp_low_index = i;
-// printf("rxValueVec:%d : %s\n", rxValueVec.size(), (char*)rxValueVec.data());
-          if (_rx_queue.size() > 16) {
-            _rx_queue.pop_front();
-          }
-          _rx_queue.push_back(rxtmp);
-        }
-      }
-    }
-*/
+    _rx_decoder_server.decode(pCharacteristic->getData(), pCharacteristic->getLength());
   }
 };
 
@@ -125,19 +98,19 @@ static bool ble_scan(void)
   pBLEScan->clearResults();
   foundMidiDevices.clear();
   auto foundDevices = pBLEScan->start(1);
-  printf("Found %d BLE device(s)\n", foundDevices->getCount());
+  M5_LOGD("ble scan: found %d device(s)", foundDevices->getCount());
   for (int i=0; i < foundDevices->getCount(); i++) {
     BLEAdvertisedDevice device = foundDevices->getDevice(i);
     auto deviceStr = "name = \"" + device.getName() + "\", address = "  + device.getAddress().toString();
     if (device.haveServiceUUID() && device.isAdvertisingService(serviceUUID)) {
-      printf(" - BLE MIDI device : %s\n", deviceStr.c_str());
+      M5_LOGD("ble scan: MIDI device %s", deviceStr.c_str());
       foundMidiDevices.push_back(device);
     }
     else {
-      printf(" - Other type of BLE device : %s\n", deviceStr.c_str());
+      M5_LOGD("ble scan: other device %s", deviceStr.c_str());
     }
   }
-  printf("Total of BLE MIDI devices : %d\n", foundMidiDevices.size());
+  M5_LOGD("ble scan: %d MIDI device(s)", (int)foundMidiDevices.size());
   return true;
 /*
   pBLEScan->setActiveScan(true);
@@ -181,21 +154,10 @@ size_t MIDI_Transport_BLE::write(const uint8_t* data, size_t length)
   if (_tx_enable == false) { return 0; }
   if (_conn_id < 0) { return 0; }
 
-  std::vector<uint8_t> txbuf;
-  txbuf.clear();
-  txbuf.push_back(0x80); // TODO:BLEMIDI TimeStamp High
-  txbuf.push_back(0x80); // TODO:BLEMIDI TimeStamp Low
-  txbuf.insert(txbuf.end(), data, data + length);
-  pCharacteristic->setValue( txbuf.data(), txbuf.size());
-  // pCharacteristic->setValue( const_cast<uint8_t*>(data), length);
-  pCharacteristic->notify();
-/*
-  std::vector<uint8_t> txValueVec(data, data + length);
-  if (_tx_queue.size() > 16) {
-    _tx_queue.pop_front();
-  }
-  _tx_queue.push_back(txValueVec);
-*/
+  // 1回の書込みに含まれるメッセージをMTUに収まる限り1回の通知にまとめる
+  _tx_encoder.setPacketSize(_peer_mtu.load() - 3);
+  _tx_encoder.push(data, length, millis());
+  _tx_encoder.flush();
   return length;
 }
 
@@ -203,24 +165,16 @@ size_t MIDI_Transport_BLE::read(uint8_t* data, size_t length)
 {
   if (_rx_enable == false) { return 0; }
   if (_conn_id < 0) { return 0; }
-  size_t result = 0;
-
-  while (!_rx_queue.empty())
-  {
-    std::vector<uint8_t> rxValueVec = _rx_queue.front();
-    _rx_queue.pop_front();
-    size_t copy_length = std::min(length, rxValueVec.size());
-    std::copy(rxValueVec.begin(), rxValueVec.begin() + copy_length, data);
-    result += copy_length;
-    length -= copy_length;
-    data += copy_length;
-    if (length == 0) { break; }
-  }
-  return result;
+  return _rx_ring.pop(data, length);
+}
+
+uint32_t MIDI_Transport_BLE::getReceiveDropCount(void) const
+{
+  return _rx_drop_count.load(std::memory_order_relaxed);
 }
 
 static void notifyCallback(BLERemoteCharacteristic* pBLERemoteCharacteristic, uint8_t* pData, size_t length, bool isNotify) {
-  decodeReceive(pData, length);
+  _rx_decoder_client.decode(pData, length);
   // printf("Notify callback for characteristic ");
   // printf(pBLERemoteCharacteristic->getUUID().toString().c_str());
   // printf(" of data length : %d  data:", length);
@@ -232,12 +186,12 @@ static void notifyCallback(BLERemoteCharacteristic* pBLERemoteCharacteristic, ui
 
 class MyClientCallback : public BLEClientCallbacks {
   void onConnect(BLEClient* pclient) {
-    printf("ble client: onConnect\n");
+    M5_LOGD("ble client: onConnect");
   }
 
   void onDisconnect(BLEClient* pclient) {
     // connected = false;
-    printf("ble client: onDisconnect\n");
+    M5_LOGD("ble client: onDisconnect");
   }
 };
 
@@ -251,11 +205,17 @@ void MIDI_Transport_BLE::setEnable(bool tx_enable, bool rx_enable)
   bool prev_en = _tx_enable || _rx_enable;
   bool new_en = tx_enable || rx_enable;
   if (prev_en != new_en) {
-    _rx_queue.clear();
+    _rx_ring.clear();
+    _tx_encoder.reset();
     if (new_en) {
       if (!_is_begin) {
         _is_begin = true;
+        _tx_encoder.setOutput(tx_output, nullptr);
+        _rx_decoder_server.setOutput(rx_output, nullptr);
+        _rx_decoder_client.setOutput(rx_output, nullptr);
         BLEDevice::init(_config.device_name);
+        // 1回の通知に多くのメッセージを含められるよう大きなMTUを要求する
+        BLEDevice::setMTU(BLE_MIDI_Encoder::max_packet_size + 3);
         pServer = BLEDevice::createServer();
         pServer->setCallbacks(new MyServerCallbacks());
 
@@ -305,17 +265,21 @@ void MIDI_Transport_BLE::setEnable(bool tx_enable, bool rx_enable)
 
       pClient->setClientCallbacks(new MyClientCallback());
 
-printf("try connect :%s\n", foundMidiDevices[0].getName().c_str());
+      M5_LOGD("ble client: try connect %s", foundMidiDevices[0].getName().c_str());
       pClient->connect(&foundMidiDevices[0]);
       auto remoteservice = pClient->getService(midi_service_uuid);
-printf("remoteservice:%p\n", remoteservice);
+      if (remoteservice == nullptr) {
+        M5_LOGD("ble client: MIDI service not found");
+        return;
+      }
       auto remotecharacteristic = remoteservice->getCharacteristic(midi_characteristic_uuid);
-printf("remotecharacteristic:%p\n", remotecharacteristic);
-
-if (remotecharacteristic->canRead()) {  printf("canRead\n"); }
-if (remotecharacteristic->canWrite()) {  printf("canWrite\n"); }
-if (remotecharacteristic->canNotify()) {  printf("canNotify\n"); }
-if (remotecharacteristic->canIndicate()) { printf("canIndicate\n"); }
+      if (remotecharacteristic == nullptr) {
+        M5_LOGD("ble client: MIDI characteristic not found");
+        return;
+      }
+      M5_LOGD("ble client: read:%d write:%d notify:%d indicate:%d"
+             , remotecharacteristic->canRead(), remotecharacteristic->canWrite()
+             , remotecharacteristic->canNotify(), remotecharacteristic->canIndicate());
 
       remotecharacteristic->registerForNotify(notifyCallback);
 
@@ -25,6 +25,9 @@ public:
   size_t read(uint8_t* data, size_t length) override;
   void setEnable(bool tx_enable, bool rx_enable) override;
 
+  // 受信バッファの空きが足りず破棄したメッセージの数
+  uint32_t getReceiveDropCount(void) const;
+
 private:
   config_t _config;
   bool _is_begin;
@@ -32,4 +35,4 @@ private:
 
 } // namespace midi_driver
 
-#endif // MIDI_TRANSPORT_UART_HPP
+#endif // MIDI_TRANSPORT_BLE_HPP
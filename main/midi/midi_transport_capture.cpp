@@ -0,0 +1,67 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 InstaChord Corp.
+
+#include "midi_transport_capture.hpp"
+
+#include <string.h>
+
+namespace midi_driver {
+
+//----------------------------------------------------------------
+
+MIDI_Transport_Capture::~MIDI_Transport_Capture()
+{
+  end();
+}
+
+bool MIDI_Transport_Capture::begin(void)
+{
+  _receive_data.clear();
+  _write_total = 0;
+  return true;
+}
+
+void MIDI_Transport_Capture::end(void)
+{
+  if (_config.file) {
+    fflush(_config.file);
+  }
+}
+
+size_t MIDI_Transport_Capture::write(const uint8_t* data, size_t length)
+{
+  if (_tx_enable == false) { return 0; }
+  _write_total += length;
+  auto file = _config.file;
+  if (file == nullptr) { return length; }
+
+  // 1回の送信を1行とし、先頭に送信時刻(usec)を付けて16進数で記録する
+  fprintf(file, "%10lu", (unsigned long)(_config.get_usec ? _config.get_usec() : 0));
+  for (size_t i = 0; i < length; ++i) {
+    fprintf(file, " %02X", data[i]);
+  }
+  fputc('\n', file);
+  return length;
+}
+
+size_t MIDI_Transport_Capture::read(uint8_t* data, size_t length)
+{
+  if (_rx_enable == false) { return 0; }
+  if (length > _receive_data.size()) {
+    length = _receive_data.size();
+  }
+  if (length) {
+    memcpy(data, _receive_data.data(), length);
+    _receive_data.erase(_receive_data.begin(), _receive_data.begin() + length);
+  }
+  return length;
+}
+
+void MIDI_Transport_Capture::pushReceiveData(const uint8_t* data, size_t length)
+{
+  _receive_data.insert(_receive_data.end(), data, data + length);
+}
+
+//----------------------------------------------------------------
+
+} // namespace midi_driver
@@ -0,0 +1,46 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 InstaChord Corp.
+
+#ifndef MIDI_TRANSPORT_CAPTURE_HPP
+#define MIDI_TRANSPORT_CAPTURE_HPP
+
+#include "midi_driver.hpp"
+
+#include <stdio.h>
+
+namespace midi_driver {
+
+// 送信データを時刻付きでファイルに記録し、受信データは外部から与えるトランスポート
+// ヘッドレスシミュレータで演奏エンジンの出力を検証するために使用する
+class MIDI_Transport_Capture : public MIDI_Transport {
+public:
+  struct config_t {
+    FILE* file = nullptr;                 // 送信データの記録先 (nullptr の場合は記録しない)
+    uint32_t (*get_usec)(void) = nullptr; // 記録する時刻の取得関数
+  };
+
+  MIDI_Transport_Capture(void) = default;
+  ~MIDI_Transport_Capture();
+
+  void setConfig(const config_t& config) { _config = config; }
+
+  bool begin(void) override;
+  void end(void) override;
+  size_t write(const uint8_t* data, size_t length) override;
+  size_t read(uint8_t* data, size_t length) override;
+
+  // 受信データとして read で読み出されるデータを追加する
+  void pushReceiveData(const uint8_t* data, size_t length);
+
+  // 送信データの総バイト数
+  size_t getWriteTotal(void) const { return _write_total; }
+
+private:
+  config_t _config;
+  std::vector<uint8_t> _receive_data;
+  size_t _write_total = 0;
+};
+
+} // namespace midi_driver
+
+#endif // MIDI_TRANSPORT_CAPTURE_HPP
@@ -0,0 +1,217 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 InstaChord Corp.
+
+#include "midi_transport_rtp.hpp"
+
+#if defined (MIDI_TRANSPORT_RTP_ENABLED)
+
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#if __has_include(<lwip/sockets.h>)
+ #include <lwip/sockets.h>
+#else
+ #include <sys/socket.h>
+ #include <netinet/in.h>
+#endif
+
+#if __has_include(<esp_netif.h>)
+ #include <esp_netif.h>
+#endif
+
+#if __has_include(<esp_timer.h>)
+ #include <esp_timer.h>
+ #include <esp_system.h>
+#else
+ #include <chrono>
+ #include <random>
+#endif
+
+namespace midi_driver {
+
+//----------------------------------------------------------------
+
+// 1回の受信処理で読み出すデータグラムの上限 (他のポートの処理を止めないため)
+static constexpr const int max_receive_per_poll = 16;
+
+static bool isNetworkReady(void)
+{
+#if __has_include(<esp_netif.h>)
+  // Wi-Fi を開始する前は TCP/IP スタックが初期化されていないため、インターフェイスが立ち上がるまで待つ
+  static constexpr const char* ifkey_table[] = { "WIFI_STA_DEF", "WIFI_AP_DEF" };
+  for (auto key : ifkey_table) {
+    auto netif = esp_netif_get_handle_from_ifkey(key);
+    if (netif != nullptr && esp_netif_is_netif_up(netif)) { return true; }
+  }
+  return false;
+#else
+  return true;
+#endif
+}
+
+uint64_t MIDI_Transport_RTP::getUsec(void)
+{
+#if __has_include(<esp_timer.h>)
+  return esp_timer_get_time();
+#else
+  return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+MIDI_Transport_RTP::~MIDI_Transport_RTP()
+{
+  end();
+}
+
+void MIDI_Transport_RTP::setPeer(uint32_t ip, uint16_t port)
+{
+  _peer_request.store(ip ? ((uint64_t)ip << 16 | port) : 0);
+}
+
+bool MIDI_Transport_RTP::begin(void)
+{
+  RTP_MIDI_Session::config_t config;
+  config.session_name = _config.session_name;
+  config.min_latency_usec = _config.min_latency_usec;
+  config.max_latency_usec = _config.max_latency_usec;
+  _session.setConfig(config);
+  _session.setSender(send_func, this);
+
+#if __has_include(<esp_timer.h>)
+  uint32_t ssrc = esp_random();
+#else
+  uint32_t ssrc = std::random_device()();
+#endif
+  _session.begin(ssrc, getUsec());
+  _open_usec = 0;
+  _is_begin = true;
+  return true;
+}
+
+void MIDI_Transport_RTP::end(void)
+{
+  if (_sock[0] >= 0) {
+    _session.end();
+  }
+  closeSockets();
+  _is_begin = false;
+}
+
+bool MIDI_Transport_RTP::openSockets(void)
+{
+  for (int i = 0; i < 2; ++i) {
+    int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (sock < 0) {
+      closeSockets();
+      return false;
+    }
+    int reuse = 1;
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(_config.port + i);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (bind(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+      close(sock);
+      closeSockets();
+      return false;
+    }
+    fcntl(sock, F_SETFL, fcntl(sock, F_GETFL, 0) | O_NONBLOCK);
+    _sock[i] = sock;
+  }
+  return true;
+}
+
+void MIDI_Transport_RTP::closeSockets(void)
+{
+  for (auto& sock : _sock) {
+    if (sock >= 0) {
+      close(sock);
+      sock = -1;
+    }
+  }
+}
+
+void MIDI_Transport_RTP::send_func(void* user, RTP_MIDI_Session::port_kind_t kind, const RTP_MIDI_Session::address_t& to, const uint8_t* data, size_t length)
+{
+  auto me = (MIDI_Transport_RTP*)user;
+  int sock = me->_sock[kind == RTP_MIDI_Session::port_data ? 1 : 0];
+  if (sock < 0) { return; }
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(to.port);
+  addr.sin_addr.s_addr = htonl(to.ip);
+  sendto(sock, data, length, 0, (struct sockaddr*)&addr, sizeof(addr));
+}
+
+void MIDI_Transport_RTP::poll(uint64_t usec)
+{
+  if (_sock[0] < 0) {
+    if (usec < _open_usec) { return; }
+    _open_usec = usec + open_retry_usec;
+    if (!isNetworkReady() || !openSockets()) { return; }
+  }
+
+  auto peer = _peer_request.load();
+  if (_peer_current != peer) {
+    _peer_current = peer;
+    RTP_MIDI_Session::address_t addr;
+    addr.ip = peer >> 16;
+    addr.port = peer & 0xFFFF;
+    _session.setPeer(addr);
+  }
+
+  for (int i = 0; i < 2; ++i) {
+    for (int n = 0; n < max_receive_per_poll; ++n) {
+      struct sockaddr_in from;
+      socklen_t from_len = sizeof(from);
+      int len = recvfrom(_sock[i], _datagram, sizeof(_datagram), 0, (struct sockaddr*)&from, &from_len);
+      if (len <= 0) { break; }
+      RTP_MIDI_Session::address_t addr;
+      addr.ip = ntohl(from.sin_addr.s_addr);
+      addr.port = ntohs(from.sin_port);
+      _session.receive(i ? RTP_MIDI_Session::port_data : RTP_MIDI_Session::port_control, addr, _datagram, len, usec);
+    }
+  }
+  _session.proc(usec);
+}
+
+size_t MIDI_Transport_RTP::write(const uint8_t* data, size_t length)
+{
+  if (_tx_enable == false) { return 0; }
+  if (!_is_begin || _sock[0] < 0) { return 0; }
+
+  _session.send(data, length, getUsec());
+  return length;
+}
+
+size_t MIDI_Transport_RTP::read(uint8_t* data, size_t length)
+{
+  if (_rx_enable == false) { return 0; }
+  if (!_is_begin) { return 0; }
+
+  auto usec = getUsec();
+  poll(usec);
+  if (!_rx_accept) {
+    _session.clearReceive();
+    return 0;
+  }
+  return _session.read(data, length, usec);
+}
+
+void MIDI_Transport_RTP::setEnable(bool tx_enable, bool rx_enable)
+{
+  _tx_enable = tx_enable;
+  _rx_accept = rx_enable;
+  _rx_enable = tx_enable || rx_enable;
+}
+
+//----------------------------------------------------------------
+
+} // namespace midi_driver
+
+#endif
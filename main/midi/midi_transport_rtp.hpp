@@ -0,0 +1,71 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 InstaChord Corp.
+
+#ifndef MIDI_TRANSPORT_RTP_HPP
+#define MIDI_TRANSPORT_RTP_HPP
+
+#include "midi_driver.hpp"
+#include "midi_rtp_session.hpp"
+
+// BSD ソケットが使える環境 (ESP32 の lwIP , POSIX) の場合のみ有効
+#if __has_include(<lwip/sockets.h>) || __has_include(<sys/socket.h>)
+ #define MIDI_TRANSPORT_RTP_ENABLED
+#endif
+
+namespace midi_driver {
+
+// Wi-Fi (UDP) 経由の RTP-MIDI (AppleMIDI) トランスポート
+// コントロールポートとデータポートの2つのUDPソケットを開き、read の呼出し毎に受信とセッションの処理を行う。
+// ネットワークが使用可能になるまではソケットを開かず、開けた時点から相手の招待を受け付ける
+class MIDI_Transport_RTP : public MIDI_Transport {
+public:
+  struct config_t {
+    const char* session_name = "KANTAN-Play";
+    uint16_t port = 5004;         // コントロールポート (データポートは +1)
+    uint32_t min_latency_usec = 1000;
+    uint32_t max_latency_usec = 15000;
+  };
+
+  static constexpr const uint32_t open_retry_usec = 1000000;
+
+  MIDI_Transport_RTP(void) = default;
+  ~MIDI_Transport_RTP();
+
+  void setConfig(const config_t& config) { _config = config; }
+
+  // 自機から接続する相手 (ip はホストバイトオーダー , 0 で解除)
+  void setPeer(uint32_t ip, uint16_t port = 5004);
+
+  bool begin(void) override;
+  void end(void) override;
+  size_t write(const uint8_t* data, size_t length) override;
+  size_t read(uint8_t* data, size_t length) override;
+  // 相手との接続を保つため、送信のみ有効な場合も受信処理は続ける (受信したメッセージは破棄する)
+  void setEnable(bool tx_enable, bool rx_enable) override;
+
+  size_t getConnectedCount(void) const { return _session.getConnectedCount(); }
+  const RTP_MIDI_Session& getSession(void) const { return _session; }
+
+private:
+  static void send_func(void* user, RTP_MIDI_Session::port_kind_t kind, const RTP_MIDI_Session::address_t& to, const uint8_t* data, size_t length);
+  static uint64_t getUsec(void);
+
+  bool openSockets(void);
+  void closeSockets(void);
+  void poll(uint64_t usec);
+
+  config_t _config;
+  RTP_MIDI_Session _session;
+  uint8_t _datagram[RTP_MIDI_Session::max_datagram_size];
+  uint64_t _open_usec = 0;    // 次にソケットを開こうとする時刻
+  // 接続先の指定は他のタスクから行われるため、受信処理の中でセッションへ反映する (ip << 16 | port)
+  std::atomic<uint64_t> _peer_request { 0 };
+  uint64_t _peer_current = 0;
+  int _sock[2] = { -1, -1 };  // [0]:コントロールポート [1]:データポート
+  bool _rx_accept = false;    // 受信したメッセージを出力する
+  bool _is_begin = false;
+};
+
+} // namespace midi_driver
+
+#endif // MIDI_TRANSPORT_RTP_HPP
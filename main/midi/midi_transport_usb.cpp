@@ -0,0 +1,105 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 InstaChord Corp.
+
+#include "midi_transport_usb.hpp"
+
+#if defined (MIDI_TRANSPORT_USB_ENABLED)
+
+#include <USB.h>
+#include <USBMIDI.h>
+#include <esp32-hal-tinyusb.h>
+
+namespace midi_driver {
+
+//----------------------------------------------------------------
+
+// インスタンスの生成時に USB ディスクリプタへ MIDI インターフェイスが登録されるため、
+// USB の開始 (ARDUINO_USB_CDC_ON_BOOT 有効時は setup より前) に間に合うよう静的に確保する
+static USBMIDI _usb_midi;
+
+// USB は一度開始すると停止できないため、開始済みかどうかをトランスポートのインスタンスとは別に保持する
+static bool _usb_started = false;
+
+MIDI_Transport_USB::~MIDI_Transport_USB()
+{
+  end();
+}
+
+bool MIDI_Transport_USB::begin(void)
+{
+  _encoder.setCable(_config.cable);
+  _encoder.setOutput(tx_output, this);
+  _usb_midi.begin();
+  // USB の開始は setEnable で送受信が有効にされるまで遅らせる
+  _is_begin = true;
+  return true;
+}
+
+void MIDI_Transport_USB::end(void)
+{
+  _is_begin = false;
+}
+
+void MIDI_Transport_USB::tx_output(void* user, const uint8_t* packets, size_t length)
+{
+  auto me = (MIDI_Transport_USB*)user;
+  // TinyUSB の送信FIFOに積んだパケットは、転送中であれば完了後にまとめてバルク転送される
+  for (size_t i = 0; i < length; i += 4) {
+    if (!tud_midi_n_packet_write(0, &packets[i])) {
+      me->_tx_drop_count += (length - i) >> 2;
+      break;
+    }
+  }
+}
+
+size_t MIDI_Transport_USB::write(const uint8_t* data, size_t length)
+{
+  if (_tx_enable == false) { return 0; }
+  if (!_is_begin || !tud_midi_mounted()) { return 0; }
+
+  // 64byteに満たないパケットは flush まで保持し、1回の処理で送信したデータをまとめて転送する
+  _encoder.push(data, length);
+  return length;
+}
+
+void MIDI_Transport_USB::flush(void)
+{
+  if (!_is_begin || !tud_midi_mounted()) { return; }
+  _encoder.flush();
+}
+
+size_t MIDI_Transport_USB::read(uint8_t* data, size_t length)
+{
+  if (_rx_enable == false) { return 0; }
+  if (!_is_begin || !tud_midi_mounted()) { return 0; }
+
+  size_t result = 0;
+  uint8_t packet[4];
+  // 1パケットは最大3byteになるため、書込み先に3byte以上の空きがある間だけ読み出す
+  while (result + 3 <= length && tud_midi_n_packet_read(0, packet)) {
+    result += USB_MIDI_Decoder::decode(packet, &data[result]);
+  }
+  return result;
+}
+
+void MIDI_Transport_USB::setEnable(bool tx_enable, bool rx_enable)
+{
+  if (_tx_enable != tx_enable) {
+    _encoder.reset();
+  }
+  _tx_enable = tx_enable;
+  _rx_enable = rx_enable;
+
+  // USB-MIDI を使用しない設定の間はホストに USB デバイスとして接続しない
+  // (CDC_ON_BOOT 無効時。以後に無効にされた場合は接続したまま送受信のみ止める)
+  if ((tx_enable || rx_enable) && _is_begin && !_usb_started) {
+    _usb_started = true;
+    USB.begin();
+  }
+}
+
+//----------------------------------------------------------------
+
+} // namespace midi_driver
+
+#endif
@@ -0,0 +1,56 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 InstaChord Corp.
+
+#ifndef MIDI_TRANSPORT_USB_HPP
+#define MIDI_TRANSPORT_USB_HPP
+
+#include "midi_driver.hpp"
+#include "midi_usb_codec.hpp"
+
+#if __has_include(<sdkconfig.h>)
+ #include <sdkconfig.h>
+#endif
+
+// USB OTG を TinyUSB で使用する構成 (ESP32-S3 で ARDUINO_USB_MODE=0) の場合のみ有効
+#if defined (CONFIG_TINYUSB_MIDI_ENABLED) && defined (ARDUINO_USB_MODE)
+ #if CONFIG_TINYUSB_MIDI_ENABLED && (ARDUINO_USB_MODE == 0)
+  #define MIDI_TRANSPORT_USB_ENABLED
+ #endif
+#endif
+
+namespace midi_driver {
+
+// USB-MIDI クラスコンプライアントデバイスとしてホスト(DAW等)と接続するトランスポート
+class MIDI_Transport_USB : public MIDI_Transport {
+public:
+  struct config_t {
+    uint8_t cable = 0;  // 送信に使用する仮想ケーブル番号
+  };
+
+  MIDI_Transport_USB(void) = default;
+  ~MIDI_Transport_USB();
+
+  void setConfig(const config_t& config) { _config = config; }
+
+  bool begin(void) override;
+  void end(void) override;
+  size_t write(const uint8_t* data, size_t length) override;
+  size_t read(uint8_t* data, size_t length) override;
+  void flush(void) override;
+  void setEnable(bool tx_enable, bool rx_enable) override;
+
+  // 送信バッファの空きが足りず破棄したパケットの数
+  uint32_t getSendDropCount(void) const { return _tx_drop_count; }
+
+private:
+  static void tx_output(void* user, const uint8_t* packets, size_t length);
+
+  config_t _config;
+  USB_MIDI_Encoder _encoder;
+  uint32_t _tx_drop_count = 0;
+  bool _is_begin = false;
+};
+
+} // namespace midi_driver
+
+#endif // MIDI_TRANSPORT_USB_HPP
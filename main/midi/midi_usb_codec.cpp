@@ -0,0 +1,132 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 InstaChord Corp.
+
+#include "midi_usb_codec.hpp"
+#include "midi_driver.hpp"
+
+namespace midi_driver {
+
+//-------------------------------------------------------------------------
+
+void USB_MIDI_Encoder::reset(void)
+{
+  _count = 0;
+  _status = 0;
+  _msg_len = 0;
+  _msg_need = 0;
+  _sysex_len = 0;
+  _in_sysex = false;
+}
+
+void USB_MIDI_Encoder::flush(void)
+{
+  if (_count && _output != nullptr) {
+    _output(_output_user, _packets, _count * 4);
+  }
+  _count = 0;
+}
+
+void USB_MIDI_Encoder::putPacket(uint8_t cin, uint8_t b0, uint8_t b1, uint8_t b2)
+{
+  auto dst = &_packets[_count * 4];
+  dst[0] = _cable << 4 | cin;
+  dst[1] = b0;
+  dst[2] = b1;
+  dst[3] = b2;
+  if (++_count == max_packet_count) { flush(); }
+}
+
+// 保持している SysEx の残りに F7 を付けて終了パケットを出力する
+void USB_MIDI_Encoder::putSysExEnd(void)
+{
+  _sysex[_sysex_len++] = 0xF7;
+  putPacket(0x04 + _sysex_len
+           , _sysex[0]
+           , _sysex_len > 1 ? _sysex[1] : 0
+           , _sysex_len > 2 ? _sysex[2] : 0);
+  _sysex_len = 0;
+  _in_sysex = false;
+}
+
+void USB_MIDI_Encoder::push(const uint8_t* data, size_t length)
+{
+  for (size_t i = 0; i < length; ++i) {
+    uint8_t value = data[i];
+    if (value >= 0xF8) {
+      // リアルタイムメッセージは SysEx の途中でも単独で送る
+      putPacket(0x0F, value, 0, 0);
+      continue;
+    }
+    if (value & 0x80) {
+      if (_in_sysex) {
+        // F7 以外のステータスでも SysEx は終了する
+        putSysExEnd();
+        if (value == 0xF7) { continue; }
+      } else if (value == 0xF7) {
+        continue;
+      }
+      _msg_len = 0;
+      if (value == 0xF0) {
+        _in_sysex = true;
+        _status = 0;
+        _sysex[0] = value;
+        _sysex_len = 1;
+        continue;
+      }
+      int n = getDataByteLength(value);
+      _status = (value < 0xF0) ? value : 0;
+      if (n <= 0) {
+        // F6 (Tune Request) など1byteのシステムコモン
+        if (value >= 0xF0) { putPacket(0x05, value, 0, 0); }
+        continue;
+      }
+      _msg[0] = value;
+      _msg_len = 1;
+      _msg_need = n + 1;
+      continue;
+    }
+    if (_in_sysex) {
+      _sysex[_sysex_len++] = value;
+      if (_sysex_len == 3) {
+        putPacket(0x04, _sysex[0], _sysex[1], _sysex[2]);
+        _sysex_len = 0;
+      }
+      continue;
+    }
+    if (_msg_len == 0) {
+      // 入力側のランニングステータスを展開する
+      if (_status == 0) { continue; }
+      _msg[0] = _status;
+      _msg_len = 1;
+      _msg_need = getDataByteLength(_status) + 1;
+    }
+    _msg[_msg_len++] = value;
+    if (_msg_len >= _msg_need) {
+      uint8_t status = _msg[0];
+      uint8_t cin = (status < 0xF0)
+                  ? (status >> 4)
+                  : (_msg_need == 2 ? 0x02 : 0x03);
+      putPacket(cin, status, _msg[1], _msg_need > 2 ? _msg[2] : 0);
+      _msg_len = 0;
+    }
+  }
+}
+
+//-------------------------------------------------------------------------
+
+size_t USB_MIDI_Decoder::decode(const uint8_t* packet, uint8_t* dst)
+{
+  // CIN ごとの MIDI バイト数 (0x0,0x1 は予約のため使用しない)
+  static constexpr const uint8_t cin_length[16] = {
+    0, 0, 2, 3, 3, 1, 2, 3, 3, 3, 3, 3, 2, 2, 3, 1
+  };
+  size_t len = cin_length[packet[0] & 0x0F];
+  for (size_t i = 0; i < len; ++i) {
+    dst[i] = packet[1 + i];
+  }
+  return len;
+}
+
+//-------------------------------------------------------------------------
+
+} // namespace midi_driver
@@ -0,0 +1,68 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 InstaChord Corp.
+
+#ifndef MIDI_USB_CODEC_HPP
+#define MIDI_USB_CODEC_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+
+namespace midi_driver {
+
+// USB-MIDI 1.0 のイベントパケット (4byte) との変換
+//  [ケーブル番号(上位4bit) | CIN(下位4bit)] [MIDI_0] [MIDI_1] [MIDI_2]
+//  CIN 0x8-0xE : チャンネルメッセージ (ステータスの上位4bitと同じ値)
+//  CIN 0x2,0x3 : 2byte,3byteのシステムコモン
+//  CIN 0x4     : SysEx の開始・継続 (3byte)
+//  CIN 0x5-0x7 : 1byteのシステムコモン、または SysEx の終了 (1-3byte)
+//  CIN 0xF     : 1byte (リアルタイムメッセージ)
+class USB_MIDI_Encoder {
+public:
+  // パケットがまとまった時に呼ばれる (length は4の倍数)
+  typedef void (*output_func_t)(void* user, const uint8_t* packets, size_t length);
+
+  // フルスピードのバルク転送1回分 (64byte = 16パケット)
+  static constexpr const size_t max_packet_count = 16;
+
+  void setOutput(output_func_t func, void* user) { _output = func; _output_user = user; }
+  void setCable(uint8_t cable) { _cable = cable & 0x0F; }
+
+  void reset(void);
+
+  // MIDIバイト列を追加する。バルク転送1回分がまとまった時点で出力し、残りは flush を呼ぶまで保持する
+  void push(const uint8_t* data, size_t length);
+
+  // 保持しているパケットを出力する
+  void flush(void);
+
+private:
+  void putPacket(uint8_t cin, uint8_t b0, uint8_t b1, uint8_t b2);
+  void putSysExEnd(void);
+
+  output_func_t _output = nullptr;
+  void* _output_user = nullptr;
+  uint8_t _packets[max_packet_count * 4];
+  uint8_t _count = 0;
+  uint8_t _cable = 0;
+  uint8_t _status = 0;      // 入力バイト列のランニングステータス
+  uint8_t _msg[3];
+  uint8_t _msg_len = 0;
+  uint8_t _msg_need = 0;
+  uint8_t _sysex[3];
+  uint8_t _sysex_len = 0;
+  bool _in_sysex = false;
+};
+
+class USB_MIDI_Decoder {
+public:
+  // イベントパケット1件を MIDI バイト列に変換して dst に書き込み、その長さ(0-3)を返す
+  // ランニングステータスは使わず、チャンネルメッセージは必ずステータスから始まる
+  static size_t decode(const uint8_t* packet, uint8_t* dst);
+
+  // パケットのケーブル番号
+  static uint8_t getCable(const uint8_t* packet) { return packet[0] >> 4; }
+};
+
+} // namespace midi_driver
+
+#endif // MIDI_USB_CODEC_HPP
@@ -0,0 +1,183 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 InstaChord Corp.
+
+#include <M5Unified.h>
+
+#include "midi_bulk_transfer.hpp"
+
+#include "system_registry.hpp"
+
+#include <atomic>
+#include <string.h>
+
+namespace kanplay_ns {
+//-------------------------------------------------------------------------
+
+// 複数のポートから同時にロードされないよう、受信中のポートを1つに限定する
+static std::atomic<bool> write_busy { false };
+
+// 受信中のデータはここに溜め、全体の受信と合計値の確認が済んでからレジストリへ反映する
+// (途中で失敗・中止した場合に、設定やソングデータが途中まで書き換わった状態にならないようにする)
+static uint8_t* write_buffer = nullptr;
+static uint32_t write_size = 0;
+
+// ソングデータを構成するレジストリを転送順に返す (範囲外は nullptr)
+static registry_t* getSongSection(system_registry_t::song_data_t& song, int index)
+{
+  static constexpr const int per_slot = def::app::max_chord_part * 2 + 1;
+  if (index == 0) { return &song.song_info; }
+  --index;
+  if (index < def::app::max_slot * per_slot) {
+    auto& slot = song.slot[index / per_slot];
+    int i = index % per_slot;
+    if (i == def::app::max_chord_part * 2) { return &slot.slot_info; }
+    auto& part = slot.chord_part[i >> 1];
+    if (i & 1) { return &part.part_info; }
+    return &part.arpeggio;
+  }
+  index -= def::app::max_slot * per_slot;
+  if (index < def::app::max_chord_part) { return &song.chord_part_drum[index]; }
+  if (index == def::app::max_chord_part) { return &song.chord_sequence; }
+  return nullptr;
+}
+
+// 設定を構成するレジストリを転送順に返す (範囲外は nullptr)
+// MIDIノートの割当はレジストリの形式が異なるため、これらの後ろに 1ノート8byteで続ける
+static registry_t* getSettingSection(int index)
+{
+  switch (index) {
+  case 0: return &system_registry.user_setting;
+  case 1: return &system_registry.midi_port_setting;
+  case 2: return &system_registry.command_mapping_custom_main;
+  case 3: return &system_registry.command_mapping_external;
+  case 4: return &system_registry.midi_control_mapping;
+  default: return nullptr;
+  }
+}
+
+static constexpr const size_t midinote_mapping_size = def::midi::max_note * 8;
+
+void midi_bulk_transfer_t::access(uint8_t target, uint32_t offset, uint8_t* data, size_t length, bool write)
+{
+  auto song = write ? &system_registry.unchanged_song_data : &system_registry.song_data;
+  for (int i = 0; length; ++i) {
+    auto reg = (target == target_song) ? getSongSection(*song, i) : getSettingSection(i);
+    if (reg == nullptr) { break; }
+    uint32_t size = reg->getSize();
+    if (offset >= size) {
+      offset -= size;
+      continue;
+    }
+    size_t len = (size - offset < length) ? size - offset : length;
+    for (size_t j = 0; j < len; ++j) {
+      if (write) { reg->set8(offset + j, data[j]); }
+      else { data[j] = reg->get8(offset + j); }
+    }
+    data += len;
+    length -= len;
+    offset = 0;
+  }
+  if (target != target_setting) { return; }
+
+  auto& mapping = system_registry.command_mapping_midinote;
+  for (; length && offset < midinote_mapping_size; ++offset, ++data, --length) {
+    uint8_t note = offset >> 3;
+    uint8_t shift = (offset & 3) * 8;
+    auto command = mapping.getCommandParamArray(note);
+    auto& raw = (offset & 4) ? command.raw32_1 : command.raw32_0;
+    if (write) {
+      raw = (raw & ~(0xFFu << shift)) | (*data << shift);
+      mapping.setCommandParamArray(note, command);
+    } else {
+      *data = raw >> shift;
+    }
+  }
+}
+
+uint32_t midi_bulk_transfer_t::getDataSize(uint8_t target)
+{
+  uint32_t result = 0;
+  registry_t* reg;
+  switch (target) {
+  default: break;
+  case target_song:
+    for (int i = 0; nullptr != (reg = getSongSection(system_registry.song_data, i)); ++i) {
+      result += reg->getSize();
+    }
+    break;
+  case target_setting:
+    for (int i = 0; nullptr != (reg = getSettingSection(i)); ++i) {
+      result += reg->getSize();
+    }
+    result += midinote_mapping_size;
+    break;
+  }
+  return result;
+}
+
+void midi_bulk_transfer_t::readData(uint8_t target, uint32_t offset, uint8_t* dst, size_t length)
+{
+  access(target, offset, dst, length, false);
+}
+
+bool midi_bulk_transfer_t::beginWrite(uint8_t target)
+{
+  // パターン編集中はソングデータを差し替えない
+  if (target == target_song
+   && system_registry.runtime_info.getPlayMode() == def::playmode::playmode_t::chord_edit_mode) {
+    return false;
+  }
+  bool expected = false;
+  if (!write_busy.compare_exchange_strong(expected, true)) { return false; }
+
+  write_size = getDataSize(target);
+  write_buffer = (uint8_t*)m5gfx::heap_alloc_psram(write_size);
+  if (write_buffer == nullptr) {
+    write_buffer = (uint8_t*)m5gfx::heap_alloc(write_size);
+  }
+  if (write_buffer == nullptr) {
+    M5_LOGE("sysex load: heap_alloc failed. size:%lu", (unsigned long)write_size);
+    write_busy.store(false);
+    return false;
+  }
+  return true;
+}
+
+void midi_bulk_transfer_t::writeData(uint8_t /*target*/, uint32_t offset, const uint8_t* src, size_t length)
+{
+  if (offset >= write_size) { return; }
+  if (length > write_size - offset) { length = write_size - offset; }
+  memcpy(&write_buffer[offset], src, length);
+}
+
+void midi_bulk_transfer_t::endWrite(uint8_t target, bool success)
+{
+  if (success) {
+    access(target, 0, write_buffer, write_size, true);
+    if (target == target_song) {
+      // ファイルからの読込と同じく、unchanged_song_data の内容を演奏対象に反映する
+      system_registry.song_data.assign(system_registry.unchanged_song_data);
+      system_registry.operator_command.addQueue( { def::command::slot_select, 1 } );
+      system_registry.player_command.addQueue( { def::command::chord_step_reset_request, 1 } );
+      system_registry.checkSongModified();
+    }
+  }
+  m5gfx::heap_free(write_buffer);
+  write_buffer = nullptr;
+  write_size = 0;
+  write_busy.store(false);
+}
+
+void midi_bulk_transfer_t::onFinish(uint8_t target, bool is_sender, bool success, uint32_t bytes, uint32_t msec)
+{
+  M5_LOGI("sysex %s %s %s: %s %lu byte %lu msec (%lu byte/s)"
+         , def::midi::port_name_table[_port]
+         , is_sender ? "dump" : "load"
+         , target == target_song ? "song" : "setting"
+         , success ? "done" : "failed"
+         , (unsigned long)bytes, (unsigned long)msec
+         , (unsigned long)(msec ? bytes * 1000ull / msec : 0));
+}
+
+//-------------------------------------------------------------------------
+}; // namespace kanplay_ns
@@ -0,0 +1,47 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 InstaChord Corp.
+
+#ifndef KANPLAY_MIDI_BULK_TRANSFER_HPP
+#define KANPLAY_MIDI_BULK_TRANSFER_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "common_define.hpp"
+#include "registry.hpp"
+#include "midi/midi_sysex_transfer.hpp"
+
+namespace kanplay_ns {
+//-------------------------------------------------------------------------
+// SysEx によるソングデータ・設定のバルクダンプ / ロード
+// JSON には変換せず、レジストリの内容をチャンク単位で直接読み書きする。
+// データ長はレジストリ構成から求めるため、構成の異なるファームウェア間では転送を受け付けない
+class midi_bulk_transfer_t : public midi_driver::MIDI_SysEx_Transfer
+{
+public:
+  enum target_t : uint8_t {
+    target_song = 0,    // song_data (ロード時は受信完了後に unchanged_song_data へ書き込み、song_data へ反映する)
+    target_setting,     // user_setting, midi_port_setting, ボタン・MIDIノート・CCの割当
+    target_max,
+  };
+
+  midi_bulk_transfer_t(def::midi::port_t port) : _port { port } {}
+
+protected:
+  uint32_t getDataSize(uint8_t target) override;
+  void readData(uint8_t target, uint32_t offset, uint8_t* dst, size_t length) override;
+  bool beginWrite(uint8_t target) override;
+  void writeData(uint8_t target, uint32_t offset, const uint8_t* src, size_t length) override;
+  void endWrite(uint8_t target, bool success) override;
+  void onFinish(uint8_t target, bool is_sender, bool success, uint32_t bytes, uint32_t msec) override;
+
+private:
+  void access(uint8_t target, uint32_t offset, uint8_t* data, size_t length, bool write);
+
+  def::midi::port_t _port;
+};
+
+//-------------------------------------------------------------------------
+}; // namespace kanplay_ns
+
+#endif
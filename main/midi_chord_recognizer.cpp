@@ -0,0 +1,203 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 InstaChord Corp.
+
+#include <M5Unified.h>
+
+#include "midi_chord_recognizer.hpp"
+
+#include "system_registry.hpp"
+#include "velocity_curve.hpp"
+
+#include <string.h>
+
+namespace kanplay_ns {
+//-------------------------------------------------------------------------
+
+// キーからの相対音程クラス(12bit)ごとの判定結果
+//  bit0-2 : Degree (0:該当なし)
+//  bit3-4 : 半音変更 + 1
+//  bit5   : メジャーマイナー入替
+//  bit6-9 : Modifier
+static uint16_t chord_table[1 << 12];
+
+// Degree のルート音のキーからの音程
+static constexpr const uint8_t degree_interval_table[7] = { 0, 2, 4, 5, 7, 9, 11 };
+
+// キーからの音程 → ベース音の Degree と半音変更
+static constexpr const struct { uint8_t degree; int8_t semitone; } interval_degree_table[12] = {
+  { 1, 0 }, { 2, -1 }, { 2, 0 }, { 3, -1 }, { 3, 0 }, { 4, 0 },
+  { 5, -1 }, { 5, 0 }, { 6, -1 }, { 6, 0 }, { 7, -1 }, { 7, 0 },
+};
+
+// 同じ構成音になる組合せが複数ある場合は、先に登録したものを優先する
+// (半音変更なし → Modifierなし → メジャーマイナー入替なし の順に優先)
+static constexpr const int8_t semitone_order[] = { 0, -1, 1 };
+static constexpr const uint8_t modifier_order[] = {
+  KANTANMusic_Modifier_None,
+  KANTANMusic_Modifier_7,
+  KANTANMusic_Modifier_M7,
+  KANTANMusic_Modifier_6,
+  KANTANMusic_Modifier_sus4,
+  KANTANMusic_Modifier_7sus4,
+  KANTANMusic_Modifier_Add9,
+  KANTANMusic_Modifier_dim,
+  KANTANMusic_Modifier_m7_5,
+  KANTANMusic_Modifier_dim7,
+  KANTANMusic_Modifier_aug,
+};
+
+static int normalizeInterval(int value)
+{
+  while (value < 0) { value += 12; }
+  while (value >= 12) { value -= 12; }
+  return value;
+}
+
+void midi_chord_recognizer_t::initTable(void)
+{
+  static bool initialized = false;
+  if (initialized) { return; }
+  initialized = true;
+
+  // 1パス目で構成音どおりの組合せを登録し、2パス目で四和音以上の5度を省略した組合せを空いている箇所に登録する
+  for (int pass = 0; pass < 2; ++pass) {
+    for (auto semitone : semitone_order) {
+      for (auto modifier : modifier_order) {
+        for (int swap = 0; swap < 2; ++swap) {
+          for (int degree = 1; degree <= 7; ++degree) {
+            KANTANMusic_GetMidiNoteNumberOptions options;
+            KANTANMusic_GetMidiNoteNumber_SetDefaultOptions(&options);
+            options.modifier = (KANTANMusic_Modifier)modifier;
+            options.semitone_shift = semitone;
+            options.minor_swap = swap;
+
+            uint32_t mask = 0;
+            for (int pitch = 1; pitch <= 6; ++pitch) {
+              auto note = KANTANMusic_GetMidiNoteNumber(pitch, degree, 0, &options);
+              if (note) { mask |= 1 << (note % 12); }
+            }
+            int count = __builtin_popcount(mask);
+            if (pass) {
+              uint32_t fifth = 1 << normalizeInterval(degree_interval_table[degree - 1] + semitone + 7);
+              if (count < 4 || 0 == (mask & fifth)) { continue; }
+              mask &= ~fifth;
+            } else if (count < 3) { continue; }
+
+            if (chord_table[mask]) { continue; }
+            chord_table[mask] = degree
+                              | ((semitone + 1) << 3)
+                              | (swap << 5)
+                              | (modifier << 6);
+          }
+        }
+      }
+    }
+  }
+}
+
+bool midi_chord_recognizer_t::recognize(uint8_t channel, chord_t* result) const
+{
+  int key = system_registry.runtime_info.getMasterKey() + (int8_t)system_registry.current_slot->slot_info.getKeyOffset();
+  key = normalizeInterval(key);
+
+  uint32_t mask = _pc_mask[channel];
+  mask = ((mask >> key) | (mask << (12 - key))) & 0xFFF;
+  uint32_t entry = chord_table[mask];
+  if (entry == 0) { return false; }
+
+  result->degree = entry & 7;
+  result->semitone = ((entry >> 3) & 3) - 1;
+  result->minor_swap = (entry >> 5) & 1;
+  result->modifier = (entry >> 6) & 0x0F;
+
+  // 最も低い押鍵ノートがルート音と異なる場合はオンコードとして扱う
+  int lowest = 0;
+  for (int i = 0; i < 4; ++i) {
+    if (_held[channel][i]) {
+      lowest = i * 32 + __builtin_ctz(_held[channel][i]);
+      break;
+    }
+  }
+  int bass = normalizeInterval(lowest - key);
+  int root = normalizeInterval(degree_interval_table[result->degree - 1] + result->semitone);
+  if (bass != root) {
+    result->bass_degree = interval_degree_table[bass].degree;
+    result->bass_semitone = interval_degree_table[bass].semitone;
+  }
+  return true;
+}
+
+void midi_chord_recognizer_t::emit(const chord_t& chord)
+{
+  if (_current == chord) { return; }
+  const chord_t prev = _current;
+  _current = chord;
+
+  auto& queue = system_registry.operator_command;
+  auto semitone_param = [](int8_t semitone) -> uint8_t { return semitone < 0 ? 1 : 2; };
+
+  if (prev.degree && prev.degree != chord.degree) {
+    queue.addQueue( { def::command::chord_degree, prev.degree }, false);
+  }
+  // Degree より先に構成音に関わる操作を切り替えておき、Degree を押した時点で切替後のコードが発音されるようにする
+  if (prev.modifier != chord.modifier) {
+    if (prev.modifier) { queue.addQueue( { def::command::chord_modifier, prev.modifier }, false); }
+    if (chord.modifier) { queue.addQueue( { def::command::chord_modifier, chord.modifier }, true); }
+  }
+  if (prev.minor_swap != chord.minor_swap) {
+    queue.addQueue( { def::command::chord_minor_swap, 1 }, chord.minor_swap);
+  }
+  if (prev.semitone != chord.semitone) {
+    if (prev.semitone) { queue.addQueue( { def::command::chord_semitone, semitone_param(prev.semitone) }, false); }
+    if (chord.semitone) { queue.addQueue( { def::command::chord_semitone, semitone_param(chord.semitone) }, true); }
+  }
+  if (prev.bass_semitone != chord.bass_semitone) {
+    if (prev.bass_semitone) { queue.addQueue( { def::command::chord_bass_semitone, semitone_param(prev.bass_semitone) }, false); }
+    if (chord.bass_semitone) { queue.addQueue( { def::command::chord_bass_semitone, semitone_param(chord.bass_semitone) }, true); }
+  }
+  if (prev.bass_degree != chord.bass_degree) {
+    if (prev.bass_degree) { queue.addQueue( { def::command::chord_bass_degree, prev.bass_degree }, false); }
+    if (chord.bass_degree) { queue.addQueue( { def::command::chord_bass_degree, chord.bass_degree }, true); }
+  }
+  if (chord.degree && prev.degree != chord.degree) {
+    queue.addQueue( { def::command::set_velocity, velocity_curve::apply(def::play::velocity_source_midi, _velocity) } );
+    queue.addQueue( { def::command::chord_degree, chord.degree }, true);
+  }
+}
+
+void midi_chord_recognizer_t::noteEvent(uint8_t channel, uint8_t note, uint8_t velocity)
+{
+  channel &= 0x0F;
+  note &= 0x7F;
+  auto& held = _held[channel][note >> 5];
+  uint32_t bit = 1u << (note & 31);
+  uint8_t pc = note % 12;
+  if (velocity) {
+    if (held & bit) { return; }
+    held |= bit;
+    if (0 == _pc_count[channel][pc]++) { _pc_mask[channel] |= 1 << pc; }
+    _velocity = velocity;
+  } else {
+    if (0 == (held & bit)) { return; }
+    held &= ~bit;
+    if (0 == --_pc_count[channel][pc]) { _pc_mask[channel] &= ~(1 << pc); }
+  }
+
+  chord_t chord;
+  if (_pc_mask[channel] != 0 && !recognize(channel, &chord)) {
+    // 押し替えの途中などで判定できない間は直前のコードを維持する
+    return;
+  }
+  emit(chord);
+}
+
+void midi_chord_recognizer_t::reset(void)
+{
+  memset(_held, 0, sizeof(_held));
+  memset(_pc_count, 0, sizeof(_pc_count));
+  memset(_pc_mask, 0, sizeof(_pc_mask));
+  emit(chord_t {});
+}
+
+//-------------------------------------------------------------------------
+}; // namespace kanplay_ns
@@ -0,0 +1,57 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 InstaChord Corp.
+
+#ifndef KANPLAY_MIDI_CHORD_RECOGNIZER_HPP
+#define KANPLAY_MIDI_CHORD_RECOGNIZER_HPP
+
+#include <stdint.h>
+
+#include "common_define.hpp"
+
+namespace kanplay_ns {
+//-------------------------------------------------------------------------
+// MIDI入力の押鍵状態からコードを判定し、コード演奏の操作コマンドに変換する
+// 押鍵中のノートをチャンネルごとにビットセットで保持し、キーからの相対音程クラス(12bit)で判定テーブルを引く。
+// 判定テーブルは KANTANMusic が各 Degree / Modifier で生成する構成音から作るため、判定結果をそのまま演奏すると同じ構成音になる
+class midi_chord_recognizer_t
+{
+public:
+  // 判定テーブルを生成する (タスクの開始前に1回呼ぶこと)
+  static void initTable(void);
+
+  // ノートイベントを処理する。判定したコードが変化した場合は operator_command へコマンドを発行する
+  // velocity が 0 の場合はノートオフとして扱う
+  void noteEvent(uint8_t channel, uint8_t note, uint8_t velocity);
+
+  // 押鍵状態を破棄し、発行中のコマンドを全て離す
+  void reset(void);
+
+private:
+  struct chord_t {
+    uint8_t degree = 0;         // 0:なし 1-7
+    int8_t semitone = 0;        // -1:♭ 0:なし 1:♯
+    bool minor_swap = false;
+    uint8_t modifier = KANTANMusic_Modifier_None;
+    uint8_t bass_degree = 0;    // 0:なし (ルートがベース) 1-7
+    int8_t bass_semitone = 0;
+    bool operator==(const chord_t& rhs) const {
+      return degree == rhs.degree && semitone == rhs.semitone && minor_swap == rhs.minor_swap
+          && modifier == rhs.modifier && bass_degree == rhs.bass_degree && bass_semitone == rhs.bass_semitone;
+    }
+    bool operator!=(const chord_t& rhs) const { return !(*this == rhs); }
+  };
+
+  bool recognize(uint8_t channel, chord_t* result) const;
+  void emit(const chord_t& chord);
+
+  uint32_t _held[def::midi::channel_max][4] = {};     // 押鍵中のノート (128bit)
+  uint8_t _pc_count[def::midi::channel_max][12] = {}; // 音程クラスごとの押鍵数
+  uint16_t _pc_mask[def::midi::channel_max] = {};     // 押鍵中の音程クラス (12bit)
+  chord_t _current;
+  uint8_t _velocity = 0;
+};
+
+//-------------------------------------------------------------------------
+}; // namespace kanplay_ns
+
+#endif
@@ -0,0 +1,171 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 InstaChord Corp.
+
+#include <M5Unified.h>
+
+#include "midi_control_mapper.hpp"
+
+#include "system_registry.hpp"
+
+namespace kanplay_ns {
+//-------------------------------------------------------------------------
+
+std::atomic<uint32_t> midi_control_mapper_t::_pending[def::midi::max_control_map] = {};
+std::atomic<bool> midi_control_mapper_t::_pending_any { false };
+#if __has_include (<freertos/freertos.h>)
+TaskHandle_t midi_control_mapper_t::_task_handle = nullptr;
+#endif
+
+// 14bit の値を min ～ max の範囲へ割り当てる
+static int scaleValue(uint16_t value, int min, int max)
+{
+  return min + ((int32_t)value * (max - min) + 8191) / 16383;
+}
+
+void midi_control_mapper_t::controlChange(uint8_t channel, uint8_t number, uint8_t value)
+{
+  switch (number) {
+  case 99: // NRPN MSB
+    _nrpn_number[channel] = (value << 7) | (_nrpn_number[channel] & 0x7F);
+    return;
+
+  case 98: // NRPN LSB
+    _nrpn_number[channel] = (_nrpn_number[channel] & 0x3F80) | value;
+    return;
+
+  case 101: // RPN MSB / LSB (RPN を選択した時点で NRPN の選択は解除される)
+  case 100:
+    _nrpn_number[channel] = nrpn_null;
+    return;
+
+  case 6: // Data Entry MSB
+    if (_nrpn_number[channel] != nrpn_null) {
+      // LSB を送らない機器もあるため、MSB だけで全範囲に届くよう下位にも同じ値を入れておく
+      _nrpn_msb[channel] = value;
+      input(def::midi::control_map_t::source_nrpn, channel, _nrpn_number[channel], (value << 7) | value);
+    }
+    return;
+
+  case 38: // Data Entry LSB
+    if (_nrpn_number[channel] != nrpn_null) {
+      input(def::midi::control_map_t::source_nrpn, channel, _nrpn_number[channel], (_nrpn_msb[channel] << 7) | value);
+    }
+    return;
+
+  case 96: // Data Increment / Decrement は扱わない
+  case 97:
+    return;
+
+  default:
+    // 120 以降はチャンネルモードメッセージのため対象外
+    if (number < 120) {
+      input(def::midi::control_map_t::source_cc, channel, number, (value << 7) | value);
+    }
+    return;
+  }
+}
+
+void midi_control_mapper_t::input(def::midi::control_map_t::source_t source, uint8_t channel, uint16_t number, uint16_t value)
+{
+  auto learn_target = system_registry.runtime_info.getMidiLearnTarget();
+  if (learn_target != def::midi::control_map_t::target_none) {
+    system_registry.runtime_info.setMidiLearn(def::midi::control_map_t::target_none);
+    def::midi::control_map_t map { source, channel, number, learn_target, system_registry.runtime_info.getMidiLearnPart() };
+    system_registry.midi_control_mapping.learn(map);
+    system_registry.popup_notify.setPopup(true, def::notify_type_t::NOTIFY_MIDI_LEARN);
+    M5_LOGI("midi learn: %s ch%d %s %d", def::midi::control_target_name_table[learn_target]
+           , channel + 1, def::midi::control_source_name_table[source], number);
+  }
+
+  bool pending = false;
+  for (size_t i = 0; i < def::midi::max_control_map; ++i) {
+    auto map = system_registry.midi_control_mapping.getMap(i);
+    if (map.source != source || map.channel != channel || map.number != number) { continue; }
+    // 反映前に次の値が届いた場合は上書きし、最新値だけを反映する
+    _pending[i].store(pending_bit | value);
+    pending = true;
+  }
+  if (pending && !_pending_any.exchange(true)) {
+#if __has_include (<freertos/freertos.h>)
+    if (_task_handle != nullptr) { xTaskNotifyGive(_task_handle); }
+#endif
+  }
+}
+
+bool midi_control_mapper_t::apply(void)
+{
+  // フラグを先に下ろすことで、反映中に届いた値は次回の反映対象になる
+  if (!_pending_any.exchange(false)) { return false; }
+
+  bool song_modified = false;
+  for (size_t i = 0; i < def::midi::max_control_map; ++i) {
+    uint32_t pending = _pending[i].exchange(0);
+    if (!(pending & pending_bit)) { continue; }
+    auto map = system_registry.midi_control_mapping.getMap(i);
+    if (!map.isEnabled()) { continue; }
+    uint16_t value = pending & 0x3FFF;
+
+    auto part_info = &system_registry.current_slot->chord_part[map.part < def::app::max_chord_part ? map.part : 0].part_info;
+    auto song_info = &system_registry.song_data.song_info;
+    // 値の範囲と刻みは UI で操作する場合に合わせる
+    switch (map.target) {
+    default: continue;
+
+    case def::midi::control_map_t::target_part_volume:
+      {
+        int volume = scaleValue(value, 0, 100);
+        if (part_info->getVolume() == volume) { continue; }
+        part_info->setVolume(volume);
+      }
+      break;
+
+    case def::midi::control_map_t::target_part_position:
+      {
+        int position = scaleValue(value, def::app::min_position / 4, def::app::max_position / 4) * 4;
+        if (part_info->getPosition() == position) { continue; }
+        part_info->setPosition(position);
+      }
+      break;
+
+    case def::midi::control_map_t::target_part_voicing:
+      {
+        int voicing = scaleValue(value, 0, KANTANMusic_MAX_VOICING - 1);
+        if (part_info->getVoicing() == voicing) { continue; }
+        part_info->setVoicing(voicing);
+      }
+      break;
+
+    case def::midi::control_map_t::target_part_stroke:
+      {
+        int msec = scaleValue(value, 1, 10) * 5;
+        if (part_info->getStrokeSpeed() == msec) { continue; }
+        part_info->setStrokeSpeed(msec);
+      }
+      break;
+
+    case def::midi::control_map_t::target_tempo:
+      {
+        int bpm = scaleValue(value, def::app::tempo_bpm_min, def::app::tempo_bpm_max);
+        if (song_info->getTempo() == bpm) { continue; }
+        song_info->setTempo(bpm);
+      }
+      break;
+
+    case def::midi::control_map_t::target_swing:
+      {
+        int swing = scaleValue(value, def::app::swing_percent_min / 10, def::app::swing_percent_max / 10) * 10;
+        if (song_info->getSwing() == swing) { continue; }
+        song_info->setSwing(swing);
+      }
+      break;
+    }
+    song_modified = true;
+  }
+  if (song_modified) {
+    system_registry.checkSongModified();
+  }
+  return song_modified;
+}
+
+//-------------------------------------------------------------------------
+}; // namespace kanplay_ns
@@ -0,0 +1,62 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 InstaChord Corp.
+
+#ifndef KANPLAY_MIDI_CONTROL_MAPPER_HPP
+#define KANPLAY_MIDI_CONTROL_MAPPER_HPP
+
+#include <stdint.h>
+#include <atomic>
+
+#include "common_define.hpp"
+
+#if __has_include (<freertos/freertos.h>)
+ #include <freertos/FreeRTOS.h>
+ #include <freertos/task.h>
+#endif
+
+namespace kanplay_ns {
+//-------------------------------------------------------------------------
+// 受信したコントロールチェンジ / NRPN を midi_control_mapping の割当に従ってパラメータへ反映する
+// MIDI受信タスクでは割当ごとに最新値だけを保留し、演奏タスクが1ステップにつき1回まとめてレジストリへ書き込む。
+// フェーダー操作などで大量に届く値はここで間引かれるため、レジストリの変更履歴やGUIの再描画は増えない
+class midi_control_mapper_t
+{
+public:
+  // 受信したコントロールチェンジを処理する (MIDI受信タスクから呼ぶ)
+  // MIDIラーン中の場合は、受信したCC / NRPN をラーン対象のパラメータに割り当てる
+  void controlChange(uint8_t channel, uint8_t number, uint8_t value);
+
+  // 保留中の値をレジストリへ反映する (演奏タスクから呼ぶ)。ソングデータを変更した場合は true を返す
+  static bool apply(void);
+
+  // 反映待ちの値があるか否か
+  static bool hasPending(void) { return _pending_any.load(); }
+
+#if __has_include (<freertos/freertos.h>)
+  // 反映待ちの値が発生した時に通知するタスク (演奏タスク)
+  static void setNotifyTaskHandle(TaskHandle_t handle) { _task_handle = handle; }
+#endif
+
+private:
+  // value は 14bit (0-16383) に揃えた値
+  void input(def::midi::control_map_t::source_t source, uint8_t channel, uint16_t number, uint16_t value);
+
+  static constexpr const uint16_t nrpn_null = 0x3FFF;  // パラメータ番号が選択されていない状態 (CC99/98 = 127/127 と同じ)
+  static constexpr const uint32_t pending_bit = 1u << 31;
+
+  uint16_t _nrpn_number[def::midi::channel_max] = { nrpn_null, nrpn_null, nrpn_null, nrpn_null, nrpn_null, nrpn_null, nrpn_null, nrpn_null
+                                                  , nrpn_null, nrpn_null, nrpn_null, nrpn_null, nrpn_null, nrpn_null, nrpn_null, nrpn_null };
+  uint8_t _nrpn_msb[def::midi::channel_max] = {};
+
+  // 割当ごとの反映待ちの値 (pending_bit が立っている場合のみ有効)
+  static std::atomic<uint32_t> _pending[def::midi::max_control_map];
+  static std::atomic<bool> _pending_any;
+#if __has_include (<freertos/freertos.h>)
+  static TaskHandle_t _task_handle;
+#endif
+};
+
+//-------------------------------------------------------------------------
+}; // namespace kanplay_ns
+
+#endif
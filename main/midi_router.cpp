@@ -0,0 +1,268 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 InstaChord Corp.
+
+#include <M5Unified.h>
+
+#include "midi_router.hpp"
+
+#include "system_registry.hpp"
+#include "sim_host.hpp"
+
+#include <string.h>
+
+namespace kanplay_ns {
+//-------------------------------------------------------------------------
+
+midi_router_t::midi_router_t(void)
+{
+  // 最初の値は必ず送るよう、範囲外の値にしておく
+  memset(_channel_volume, 0xFF, sizeof(_channel_volume));
+  memset(_program_number, 0xFF, sizeof(_program_number));
+  memset(_note_map, 0, sizeof(_note_map));
+  memset(_pressure_sent, 0, sizeof(_pressure_sent));
+}
+
+void midi_router_t::updateRoutes(void)
+{
+  auto counter = system_registry.midi_port_setting.getChangeCounter();
+  if (_route_change_counter == counter) { return; }
+  _route_change_counter = counter;
+
+  uint8_t input_mask = 0;
+  for (int in = 0; in < def::midi::port_max; ++in) {
+    for (int out = 0; out < def::midi::port_max; ++out) {
+      auto route = system_registry.midi_port_setting.getRoute((def::midi::port_t)in, (def::midi::port_t)out);
+      _route[in][out] = route;
+      if (route.isEnabled() && in != def::midi::port_internal) {
+        input_mask |= 1 << in;
+      }
+    }
+  }
+  _input_route_mask.store(input_mask, std::memory_order_relaxed);
+}
+
+void midi_router_t::push(def::midi::port_t in_port, def::midi::port_t out_port, uint8_t status, uint8_t data1, uint8_t data2)
+{
+  const auto& route = _route[in_port][out_port];
+  if (!route.isEnabled()) { return; }
+
+  uint8_t type_bit = def::midi::route_t::type_system;
+  if (status < 0xF0) {
+    static constexpr const uint8_t type_table[] = {
+      def::midi::route_t::type_note,              // 0x80 Note Off
+      def::midi::route_t::type_note,              // 0x90 Note On
+      def::midi::route_t::type_poly_pressure,     // 0xA0
+      def::midi::route_t::type_control_change,    // 0xB0
+      def::midi::route_t::type_program_change,    // 0xC0
+      def::midi::route_t::type_channel_pressure,  // 0xD0
+      def::midi::route_t::type_pitch_bend,        // 0xE0
+    };
+    type_bit = type_table[(status >> 4) - 8];
+    if (0 == (route.channel_mask & (1 << (status & 0x0F)))) { return; }
+    if (route.channel_to) {
+      status = (status & 0xF0) | ((route.channel_to - 1) & 0x0F);
+    }
+  }
+  if (0 == (route.type_mask & type_bit)) { return; }
+
+  const uint8_t message[message_size] = { status, data1, data2 };
+  if (!_output_queue[out_port].push(message, message_size)) {
+    _drop_count.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  _pushed_mask |= 1 << out_port;
+}
+
+void midi_router_t::dispatch(def::midi::port_t in_port, uint8_t status, uint8_t data1, uint8_t data2)
+{
+  for (int out = 0; out < def::midi::port_max; ++out) {
+    if (_output_enable_mask & (1 << out)) {
+      push(in_port, (def::midi::port_t)out, status, data1, data2);
+    }
+  }
+}
+
+void midi_router_t::pushInitial(def::midi::port_t out_port)
+{
+  static constexpr const auto in = def::midi::port_internal;
+  for (int i = 0; i < def::midi::channel_max; ++i) {
+    // チャンネルボリュームおよびプログラムチェンジを設定
+    // 送信元では変化があった時しか値が届かないため、送信元が保持している最新値を使用する
+    uint8_t vol = system_registry.midi_out_control.getChannelVolume(i);
+    if (vol < 128) {
+      push(in, out_port, def::midi::control_change | i, 7, vol);
+    }
+    uint8_t prg = system_registry.midi_out_control.getProgramChange(i);
+    if (prg < 128) {
+      push(in, out_port, def::midi::program_change | i, prg, 0);
+    }
+  }
+  // マスターボリューム設定
+  auto midi_volume = system_registry.user_setting.getMIDIMasterVolume();
+  push(in, out_port, def::midi::control_change | def::midi::channel_1, 99, 55);
+  push(in, out_port, def::midi::control_change | def::midi::channel_1, 98,  7);
+  push(in, out_port, def::midi::control_change | def::midi::channel_1,  6, midi_volume);
+}
+
+void midi_router_t::setOutputEnable(def::midi::port_t port, bool enable)
+{
+  uint32_t bit = 1 << port;
+  if (((_output_enable_mask & bit) != 0) == enable) { return; }
+  if (enable) {
+    _output_enable_mask |= bit;
+    updateRoutes();
+    pushInitial(port);
+  } else {
+    _output_enable_mask &= ~bit;
+  }
+}
+
+bool midi_router_t::input(def::midi::port_t port, uint8_t status, uint8_t data1, uint8_t data2)
+{
+  if (0 == (_input_route_mask.load(std::memory_order_relaxed) & (1 << port))) { return false; }
+  const uint8_t message[message_size] = { status, data1, data2 };
+  if (!_input_queue[port].push(message, message_size)) {
+    _drop_count.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+  return true;
+}
+
+bool midi_router_t::popOutput(def::midi::port_t port, uint8_t* message)
+{
+  auto& queue = _output_queue[port];
+  if (queue.available() < message_size) { return false; }
+  queue.pop(message, message_size);
+  return true;
+}
+
+// かんぷれの演奏出力の変化分をMIDIメッセージにして振り分ける
+void midi_router_t::procMidiOut(void)
+{
+  static constexpr const auto in = def::midi::port_internal;
+  auto invalidate_count = system_registry.midi_out_control.getInvalidateCount();
+  if (_invalidate_count != invalidate_count) {
+    // 音源がリセットされたため、送信済みの値を破棄して次回は必ず送る
+    _invalidate_count = invalidate_count;
+    memset(_channel_volume, 0xFF, sizeof(_channel_volume));
+    memset(_program_number, 0xFF, sizeof(_program_number));
+    memset(_pressure_sent, 0, sizeof(_pressure_sent));
+    _prev_midi_volume = 0xFF;
+  }
+  auto midi_volume = system_registry.user_setting.getMIDIMasterVolume();
+  if (_prev_midi_volume != midi_volume) {
+    _prev_midi_volume = midi_volume;
+    // マスターボリューム設定
+    dispatch(in, def::midi::control_change | def::midi::channel_1, 99, 55);
+    dispatch(in, def::midi::control_change | def::midi::channel_1, 98,  7);
+    dispatch(in, def::midi::control_change | def::midi::channel_1,  6, midi_volume);
+  }
+
+  const registry_t::history_t* history;
+  while (nullptr != (history = system_registry.midi_out_control.getHistory(_history_code_midi_out))) {
+    if (system_registry_t::reg_midi_out_control_t::MIDI_CONTROL_NOTE_CH1 <= history->index && history->index < system_registry_t::reg_midi_out_control_t::MIDI_CONTROL_NOTE_END)
+    {
+      int index = history->index - system_registry_t::reg_midi_out_control_t::MIDI_CONTROL_NOTE_CH1;
+      auto channel = index >> 7;
+      auto note = index & 0x7F;
+      auto velocity = history->value;
+      velocity = (velocity > 0x80) ? velocity & 0x7F : 0;
+      procNote(channel, note, velocity);
+    }
+    else if (system_registry_t::reg_midi_out_control_t::MIDI_CONTROL_PROGRAM_CH1 <= history->index && history->index < system_registry_t::reg_midi_out_control_t::MIDI_CONTROL_PROGRAM_END) {
+      int channel = history->index - system_registry_t::reg_midi_out_control_t::MIDI_CONTROL_PROGRAM_CH1;
+      auto value = history->value & 0x7F;
+      if (_program_number[channel] != value) {
+        _program_number[channel] = value;
+        dispatch(in, def::midi::program_change | channel, value, 0);
+      }
+    }
+    else if (system_registry_t::reg_midi_out_control_t::MIDI_CONTROL_VOLUME_CH1 <= history->index && history->index < system_registry_t::reg_midi_out_control_t::MIDI_CONTROL_VOLUME_END) {
+      int channel = history->index - system_registry_t::reg_midi_out_control_t::MIDI_CONTROL_VOLUME_CH1;
+      auto value = history->value & 0x7F;
+      if (_channel_volume[channel] != value) {
+        _channel_volume[channel] = value;
+        dispatch(in, def::midi::control_change | channel, 7, value);
+      }
+    }
+    else if (system_registry_t::reg_midi_out_control_t::MIDI_CONTROL_CHANGE_START <= history->index && history->index < system_registry_t::reg_midi_out_control_t::MIDI_CONTROL_CHANGE_END) {
+      int cc = history->index - system_registry_t::reg_midi_out_control_t::MIDI_CONTROL_CHANGE_START;
+      auto value = history->value & 0x7F;
+      for (int channel = def::midi::channel_1; channel < def::midi::channel_max; ++channel) {
+        dispatch(in, def::midi::control_change | channel, cc, value);
+      }
+    }
+    else if (history->index == system_registry_t::reg_midi_out_control_t::MIDI_CONTROL_CHANNEL_PRESSURE) {
+      // 連続的に変化する値のため、最新値だけを保持して送信間隔を空けて送る
+      _pressure_value = history->value & 0x7F;
+      _pressure_pending = true;
+    }
+  }
+  if (_pressure_pending) {
+    procPressure();
+  }
+}
+
+void midi_router_t::procNote(uint8_t channel, uint8_t note, uint8_t velocity)
+{
+  static constexpr const auto in = def::midi::port_internal;
+  auto& map = _note_map[channel][note >> 5];
+  const uint32_t bit = 1u << (note & 31);
+  if (velocity) {
+    if (0 == (_active_channel_mask & (1 << channel)) && _pressure_sent[channel] != _pressure_value) {
+      // 発音していなかったチャンネルには、ノートオンの前に現在のプレッシャーを送っておく
+      _pressure_sent[channel] = _pressure_value;
+      dispatch(in, def::midi::channel_pressure | channel, _pressure_value, 0);
+    }
+    map |= bit;
+    _active_channel_mask |= 1 << channel;
+  } else {
+    map &= ~bit;
+    auto& m = _note_map[channel];
+    if (0 == (m[0] | m[1] | m[2] | m[3])) {
+      _active_channel_mask &= ~(1 << channel);
+    }
+  }
+  dispatch(in, def::midi::note_on | channel, note, velocity);
+}
+
+void midi_router_t::procPressure(void)
+{
+  static constexpr const auto in = def::midi::port_internal;
+  uint32_t msec = engine_millis();
+  if (msec - _pressure_msec < pressure_interval_msec) { return; }
+  _pressure_msec = msec;
+  _pressure_pending = false;
+
+  // 全チャンネルへ送ると帯域を使い切るため、発音中のチャンネルにだけ送る
+  // (発音していないチャンネルはノートオンの時点で送る)
+  for (int channel = def::midi::channel_1; channel < def::midi::channel_max; ++channel) {
+    if (0 == (_active_channel_mask & (1 << channel))) { continue; }
+    if (_pressure_sent[channel] == _pressure_value) { continue; }
+    _pressure_sent[channel] = _pressure_value;
+    dispatch(in, def::midi::channel_pressure | channel, _pressure_value, 0);
+  }
+}
+
+uint32_t midi_router_t::proc(void)
+{
+  updateRoutes();
+  procMidiOut();
+
+  // 各入力ポートの受信メッセージ
+  uint8_t message[message_size];
+  for (int in = 0; in < def::midi::port_max; ++in) {
+    auto& queue = _input_queue[in];
+    while (queue.available() >= message_size) {
+      queue.pop(message, message_size);
+      dispatch((def::midi::port_t)in, message[0], message[1], message[2]);
+    }
+  }
+
+  uint32_t result = _pushed_mask;
+  _pushed_mask = 0;
+  return result;
+}
+
+//-------------------------------------------------------------------------
+}; // namespace kanplay_ns
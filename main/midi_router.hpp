@@ -0,0 +1,86 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 InstaChord Corp.
+
+#ifndef KANPLAY_MIDI_ROUTER_HPP
+#define KANPLAY_MIDI_ROUTER_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "common_define.hpp"
+#include "registry.hpp"
+#include "midi/midi_driver.hpp"
+
+namespace kanplay_ns {
+//-------------------------------------------------------------------------
+// MIDIポート間のルーティング
+// かんぷれの演奏出力(midi_out_control)と各ポートの受信メッセージを、midi_port_setting のルート設定に従って
+// チャンネル変換・種類の絞り込みを行い、出力ポートごとのキューへ振り分ける。
+// 振り分けは1つのタスク(ルータ段)でまとめて行い、各ポートの送信タスクは自身のキューの内容だけを送信する。
+// キューのメッセージはステータスを省略せずに3byte単位で格納し、ランニングステータスは送信側で付け直す
+class midi_router_t
+{
+public:
+  static constexpr const size_t message_size = 3;
+  // チャンネルプレッシャーの送信間隔の最小値 (31.25kbpsのMIDIを連続値で埋めないため)
+  static constexpr const uint32_t pressure_interval_msec = 20;
+
+  midi_router_t(void);
+
+  // ルータ段の処理を1回行う。戻り値はメッセージを追加した出力ポートのビットマスク
+  uint32_t proc(void);
+
+  // 出力ポートの有効・無効を設定する (ルータ段から呼ぶこと)
+  // 有効になった時点で、そのポートへ各チャンネルの音量・音色とマスターボリュームを送る
+  void setOutputEnable(def::midi::port_t port, bool enable);
+
+  // 入力ポートで受信したメッセージを渡す (ポートの受信タスクから呼ぶ)
+  // 入力ポートからのルートが無い場合や、キューが一杯の場合は false を返す
+  bool input(def::midi::port_t port, uint8_t status, uint8_t data1, uint8_t data2);
+
+  // 出力ポートのキューからメッセージを1件取り出す (ポートの送信タスクから呼ぶ)
+  bool popOutput(def::midi::port_t port, uint8_t* message);
+
+  // キューが一杯で破棄したメッセージの数
+  uint32_t getDropCount(void) const { return _drop_count.load(std::memory_order_relaxed); }
+
+  // 送信間隔の制限により保留しているメッセージがある (pressure_interval_msec 後に proc を呼ぶこと)
+  bool isOutputPending(void) const { return _pressure_pending; }
+
+private:
+  void updateRoutes(void);
+  void procMidiOut(void);
+  void dispatch(def::midi::port_t in_port, uint8_t status, uint8_t data1, uint8_t data2);
+  void push(def::midi::port_t in_port, def::midi::port_t out_port, uint8_t status, uint8_t data1, uint8_t data2);
+  void pushInitial(def::midi::port_t out_port);
+  void procNote(uint8_t channel, uint8_t note, uint8_t velocity);
+  void procPressure(void);
+
+  def::midi::route_t _route[def::midi::port_max][def::midi::port_max];
+  midi_driver::MIDI_ByteRing<1024> _output_queue[def::midi::port_max];
+  midi_driver::MIDI_ByteRing<256> _input_queue[def::midi::port_max];
+  std::atomic<uint32_t> _drop_count { 0 };
+  std::atomic<uint8_t> _input_route_mask { 0 };  // ルートが存在する入力ポートのビットマスク
+  uint32_t _route_change_counter = ~0u;
+  uint32_t _output_enable_mask = 0;
+  uint32_t _pushed_mask = 0;
+  registry_t::history_code_t _history_code_midi_out = 0;
+  uint32_t _invalidate_count = 0;
+  uint8_t _prev_midi_volume = 0;
+  uint8_t _channel_volume[def::midi::channel_max];
+  uint8_t _program_number[def::midi::channel_max];
+
+  // 発音中のノートのビットマップ (チャンネルプレッシャーを発音中のチャンネルにだけ送るため)
+  uint32_t _note_map[def::midi::channel_max][4];
+  uint16_t _active_channel_mask = 0;
+  // チャンネルプレッシャーの最新値と、チャンネルごとの送信済みの値
+  uint8_t _pressure_value = 0;
+  uint8_t _pressure_sent[def::midi::channel_max];
+  bool _pressure_pending = false;
+  uint32_t _pressure_msec = 0;
+};
+
+//-------------------------------------------------------------------------
+}; // namespace kanplay_ns
+
+#endif
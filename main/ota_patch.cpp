@@ -0,0 +1,257 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 InstaChord Corp.
+
+#include "ota_patch.hpp"
+
+#include <string.h>
+
+namespace kanplay_ns {
+//-------------------------------------------------------------------------
+
+static constexpr const uint32_t sha256_k[64] = {
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+  0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+  0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+  0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+  0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+  0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static inline uint32_t rotr(uint32_t x, uint32_t n) { return (x >> n) | (x << (32 - n)); }
+
+void sha256_t::reset(void)
+{
+  static constexpr const uint32_t init[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+  };
+  memcpy(_state, init, sizeof(_state));
+  _total = 0;
+  _buffer_len = 0;
+}
+
+void sha256_t::transform(const uint8_t* block)
+{
+  uint32_t w[64];
+  for (int i = 0; i < 16; ++i) {
+    w[i] = (uint32_t)block[i * 4] << 24 | (uint32_t)block[i * 4 + 1] << 16 | (uint32_t)block[i * 4 + 2] << 8 | block[i * 4 + 3];
+  }
+  for (int i = 16; i < 64; ++i) {
+    uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+    uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+    w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+  }
+  uint32_t a = _state[0], b = _state[1], c = _state[2], d = _state[3];
+  uint32_t e = _state[4], f = _state[5], g = _state[6], h = _state[7];
+  for (int i = 0; i < 64; ++i) {
+    uint32_t t1 = h + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + sha256_k[i] + w[i];
+    uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+    h = g; g = f; f = e; e = d + t1;
+    d = c; c = b; b = a; a = t1 + t2;
+  }
+  _state[0] += a; _state[1] += b; _state[2] += c; _state[3] += d;
+  _state[4] += e; _state[5] += f; _state[6] += g; _state[7] += h;
+}
+
+void sha256_t::update(const void* data, size_t length)
+{
+  auto src = (const uint8_t*)data;
+  _total += length;
+  if (_buffer_len) {
+    size_t len = 64 - _buffer_len;
+    if (len > length) { len = length; }
+    memcpy(&_buffer[_buffer_len], src, len);
+    _buffer_len += len;
+    src += len;
+    length -= len;
+    if (_buffer_len < 64) { return; }
+    transform(_buffer);
+    _buffer_len = 0;
+  }
+  while (length >= 64) {
+    transform(src);
+    src += 64;
+    length -= 64;
+  }
+  if (length) {
+    memcpy(_buffer, src, length);
+    _buffer_len = length;
+  }
+}
+
+void sha256_t::finish(uint8_t* hash)
+{
+  uint64_t bits = _total << 3;
+  uint8_t pad[72] = { 0x80 };
+  size_t pad_len = ((_buffer_len < 56) ? 56 : 120) - _buffer_len;
+  for (int i = 0; i < 8; ++i) {
+    pad[pad_len + i] = bits >> (56 - i * 8);
+  }
+  update(pad, pad_len + 8);
+  for (int i = 0; i < 8; ++i) {
+    hash[i * 4    ] = _state[i] >> 24;
+    hash[i * 4 + 1] = _state[i] >> 16;
+    hash[i * 4 + 2] = _state[i] >> 8;
+    hash[i * 4 + 3] = _state[i];
+  }
+}
+
+//-------------------------------------------------------------------------
+
+constexpr const uint8_t ota_patch_t::magic[4];
+
+static inline uint32_t read32(const uint8_t* src)
+{
+  return src[0] | src[1] << 8 | src[2] << 16 | (uint32_t)src[3] << 24;
+}
+
+void ota_patch_t::begin(io_t* io)
+{
+  _io = io;
+  _sha256.reset();
+  _header_len = 0;
+  _target_written = 0;
+  _copy_end = 0;
+  _length = 0;
+  _varint = 0;
+  _varint_shift = 0;
+  _op = op_end;
+  _state = st_header;
+  _result = result_continue;
+}
+
+bool ota_patch_t::parseHeader(void)
+{
+  if (memcmp(_header_buf, magic, sizeof(magic)) != 0) { return false; }
+  _header.source_size = read32(&_header_buf[4]);
+  _header.target_size = read32(&_header_buf[8]);
+  memcpy(_header.source_sha256, &_header_buf[16], sha256_t::hash_size);
+  memcpy(_header.target_sha256, &_header_buf[16 + sha256_t::hash_size], sha256_t::hash_size);
+  return true;
+}
+
+// 可変長整数を1byte分読み進める。値が確定したら true を返す
+bool ota_patch_t::readVarint(uint8_t value)
+{
+  _varint |= (uint32_t)(value & 0x7F) << _varint_shift;
+  _varint_shift += 7;
+  return !(value & 0x80) || _varint_shift >= 35;
+}
+
+bool ota_patch_t::writeTarget(const uint8_t* src, size_t length)
+{
+  if (_target_written + length > _header.target_size) { return false; }
+  _sha256.update(src, length);
+  _target_written += length;
+  return _io->writeTarget(src, length);
+}
+
+ota_patch_t::result_t ota_patch_t::execCopy(void)
+{
+  if ((uint64_t)_copy_end + _length > _header.source_size) { return result_error_format; }
+  uint8_t buf[512];
+  while (_length) {
+    size_t len = _length < sizeof(buf) ? _length : sizeof(buf);
+    if (!_io->readSource(_copy_end, buf, len)) { return result_error_source; }
+    if (!writeTarget(buf, len)) { return result_error_write; }
+    _copy_end += len;
+    _length -= len;
+  }
+  return result_continue;
+}
+
+ota_patch_t::result_t ota_patch_t::finish(void)
+{
+  if (_target_written != _header.target_size) { return result_error_verify; }
+  uint8_t hash[sha256_t::hash_size];
+  _sha256.finish(hash);
+  if (memcmp(hash, _header.target_sha256, sha256_t::hash_size) != 0) { return result_error_verify; }
+  return result_done;
+}
+
+ota_patch_t::result_t ota_patch_t::feed(const uint8_t* data, size_t length)
+{
+  if (_io == nullptr) { return result_error_format; }
+  size_t pos = 0;
+  while (_result == result_continue && pos < length) {
+    switch (_state) {
+    case st_header:
+      {
+        size_t len = header_size - _header_len;
+        if (len > length - pos) { len = length - pos; }
+        memcpy(&_header_buf[_header_len], &data[pos], len);
+        _header_len += len;
+        pos += len;
+        if (_header_len == header_size) {
+          if (!parseHeader()) {
+            _result = result_error_format;
+          } else if (!_io->onHeader(_header)) {
+            _result = result_error_source;
+          } else {
+            _state = st_op;
+          }
+        }
+      }
+      break;
+
+    case st_op:
+      _op = (op_t)data[pos++];
+      _varint = 0;
+      _varint_shift = 0;
+      switch (_op) {
+      case op_end:  _state = st_finish; break;
+      case op_copy:
+      case op_data: _state = st_length; break;
+      default:      _result = result_error_format; break;
+      }
+      break;
+
+    case st_length:
+      if (readVarint(data[pos++])) {
+        _length = _varint;
+        _varint = 0;
+        _varint_shift = 0;
+        _state = (_op == op_copy) ? st_offset : st_data;
+        if (_state == st_data && _length == 0) { _state = st_op; }
+      }
+      break;
+
+    case st_offset:
+      if (readVarint(data[pos++])) {
+        // ジグザグ符号化を戻してソース位置へ加算する
+        int32_t diff = (int32_t)(_varint >> 1) ^ -(int32_t)(_varint & 1);
+        _copy_end += diff;
+        _result = execCopy();
+        _state = st_op;
+      }
+      break;
+
+    case st_data:
+      {
+        size_t len = length - pos;
+        if (len > _length) { len = _length; }
+        if (!writeTarget(&data[pos], len)) {
+          _result = result_error_write;
+          break;
+        }
+        pos += len;
+        _length -= len;
+        if (_length == 0) { _state = st_op; }
+      }
+      break;
+
+    case st_finish:
+      // 終端以降のデータは無視する
+      pos = length;
+      break;
+    }
+    if (_state == st_finish && _result == result_continue) {
+      _result = finish();
+    }
+  }
+  return _result;
+}
+
+//-------------------------------------------------------------------------
+}; // namespace kanplay_ns
@@ -0,0 +1,126 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 InstaChord Corp.
+
+#ifndef KANPLAY_OTA_PATCH_HPP
+#define KANPLAY_OTA_PATCH_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+
+namespace kanplay_ns {
+//-------------------------------------------------------------------------
+// SHA-256 (ESP-IDFに依存せずPC上でも同じ結果を得るための実装)
+class sha256_t
+{
+public:
+  static constexpr const size_t hash_size = 32;
+
+  sha256_t(void) { reset(); }
+  void reset(void);
+  void update(const void* data, size_t length);
+  void finish(uint8_t* hash);
+
+private:
+  void transform(const uint8_t* block);
+  uint32_t _state[8];
+  uint64_t _total;
+  uint8_t _buffer[64];
+  uint32_t _buffer_len;
+};
+
+//-------------------------------------------------------------------------
+// 差分OTA用パッチの適用処理
+// 動作中のファームウェア(ソース)と差分パッチから新しいファームウェア(ターゲット)を先頭から順に生成する。
+// パッチは任意の長さに分割して与えることができ、受信しながら適用できる。
+// 生成したターゲットは SHA-256 を逐次計算し、最後にヘッダに記録された値と照合する。
+//
+// パッチの形式 (数値は全てリトルエンディアン)
+//  ヘッダ : "KPD1" , ソースのサイズ (32bit) , ターゲットのサイズ (32bit) , 予約 (32bit)
+//           ソースの SHA-256 (32byte) , ターゲットの SHA-256 (32byte)
+//  命令列 : 命令 (1byte) に続き、各命令の引数を可変長整数 (7bit単位 , 最上位bitが継続フラグ) で記録する
+//    op_copy : 長さ , ソース位置の差分 (前回のコピー終了位置からの差 , ジグザグ符号化)
+//              ソースの指定範囲をターゲットへ書き込む
+//    op_data : 長さ , 続けて長さ分のデータ
+//              データをそのままターゲットへ書き込む
+//    op_end  : 終端
+class ota_patch_t
+{
+public:
+  struct header_t {
+    uint32_t source_size;
+    uint32_t target_size;
+    uint8_t source_sha256[sha256_t::hash_size];
+    uint8_t target_sha256[sha256_t::hash_size];
+  };
+
+  // ソースの読出しとターゲットの書込みを行う処理 (端末ではパーティション、PCではファイルに対して行う)
+  class io_t {
+  public:
+    virtual ~io_t(void) = default;
+    // ヘッダを受け取った時点で呼ばれる。ソースが一致しない場合は false を返すと適用を中止する
+    virtual bool onHeader(const header_t& header) = 0;
+    virtual bool readSource(size_t offset, uint8_t* dst, size_t length) = 0;
+    virtual bool writeTarget(const uint8_t* src, size_t length) = 0;
+  };
+
+  enum result_t : uint8_t {
+    result_continue,      // 続きのデータが必要
+    result_done,          // 適用とターゲットの照合が完了した
+    result_error_format,  // パッチの形式が正しくない
+    result_error_source,  // ソースが一致しない、または読出しに失敗した
+    result_error_write,   // ターゲットの書込みに失敗した
+    result_error_verify,  // 生成したターゲットのサイズまたは SHA-256 が一致しない
+  };
+
+  static constexpr const uint8_t magic[4] = { 'K', 'P', 'D', '1' };
+  static constexpr const size_t header_size = 16 + sha256_t::hash_size * 2;
+
+  void begin(io_t* io);
+
+  // 受信したパッチを与える。結果が result_continue 以外になった後は何もしない
+  result_t feed(const uint8_t* data, size_t length);
+
+  const header_t& getHeader(void) const { return _header; }
+  size_t getTargetWritten(void) const { return _target_written; }
+  result_t getResult(void) const { return _result; }
+
+private:
+  enum op_t : uint8_t {
+    op_end  = 0x00,
+    op_copy = 0x01,
+    op_data = 0x02,
+  };
+  enum state_t : uint8_t {
+    st_header,
+    st_op,
+    st_length,
+    st_offset,
+    st_data,
+    st_finish,
+  };
+
+  bool parseHeader(void);
+  bool readVarint(uint8_t value);
+  bool writeTarget(const uint8_t* src, size_t length);
+  result_t execCopy(void);
+  result_t finish(void);
+
+  io_t* _io = nullptr;
+  sha256_t _sha256;
+  header_t _header;
+  uint8_t _header_buf[header_size];
+  size_t _header_len = 0;
+  size_t _target_written = 0;
+  uint32_t _copy_end = 0;   // 前回のコピーの終了位置
+  uint32_t _length = 0;     // 処理中の命令の長さ
+  uint32_t _varint = 0;
+  uint8_t _varint_shift = 0;
+  op_t _op = op_end;
+  state_t _state = st_header;
+  result_t _result = result_continue;
+};
+
+//-------------------------------------------------------------------------
+}; // namespace kanplay_ns
+
+#endif
@@ -22,12 +22,13 @@ namespace kanplay_ns {
 //-------------------------------------------------------------------------
 
 #if __has_include (<freertos/freertos.h>)
-void registry_base_t::setNotifyTaskHandle(TaskHandle_t handle)
+void registry_base_t::setNotifyTaskHandle(TaskHandle_t handle, uint32_t notify_bits)
 {
   if (_task_handle != nullptr) {
     M5_LOGE("task handle already set");
     return;
   }
+  _notify_bits = notify_bits;
   _task_handle = handle;
 }
 #endif
@@ -71,6 +72,7 @@ void registry_base_t::_addHistory(uint16_t index, uint32_t value, data_size_t da
     history_seq++;
   }
   _history_code = history_index | history_seq << 16;
+  ++_change_counter;
 }
 
 
@@ -104,6 +106,7 @@ void registry_t::assign(const registry_t &src) {
   if (_history_count == 0) {
     _history_code += 1 << 16;
   }
+  ++_change_counter;
   _execNotify();
 }
 
@@ -336,6 +339,7 @@ void registry_map8_t::assign(const registry_map8_t &src)
   if (_history_count == 0) {
     _history_code += 1 << 16;
   }
+  ++_change_counter;
   _execNotify();
 }
 
@@ -367,6 +371,7 @@ void registry_map32_t::assign(const registry_map32_t &src)
   if (_history_count == 0) {
     _history_code += 1 << 16;
   }
+  ++_change_counter;
   _execNotify();
 }
 
@@ -42,21 +42,27 @@ public:
 
   const history_t* getHistory(history_code_t &code);
   history_code_t getHistoryCode(void) const { return _history_code; }
+  // 値が変更された回数 (履歴の有無に関わらず、変更の検出に使用できる)
+  uint32_t getChangeCounter(void) const { return _change_counter; }
 
 #if __has_include (<freertos/freertos.h>)
-  void setNotifyTaskHandle(TaskHandle_t handle);
+  // 値の変更時に通知するタスクを設定する。
+  // notify_bits は通知値にOR設定されるビット。ひとつのタスクが複数のレジストリから通知を受ける場合に通知元を識別できる
+  void setNotifyTaskHandle(TaskHandle_t handle, uint32_t notify_bits = 1);
 #endif
 
 protected:
   void _addHistory(uint16_t index, uint32_t value, data_size_t data_size);
 #if __has_include (<freertos/freertos.h>)
   TaskHandle_t _task_handle = nullptr;
-  void _execNotify(void) const { if (_task_handle != nullptr) { xTaskNotify(_task_handle, true, eNotifyAction::eSetValueWithOverwrite); } }
+  uint32_t _notify_bits = 1;
+  void _execNotify(void) const { if (_task_handle != nullptr) { xTaskNotify(_task_handle, _notify_bits, eNotifyAction::eSetBits); } }
 #else
   void _execNotify(void) const {}
 #endif
   history_t* _history = nullptr;
   history_code_t _history_code;
+  uint32_t _change_counter = 0;
   uint16_t _history_count;
 };
 
@@ -74,6 +80,7 @@ public:
   uint16_t get16(uint16_t index) const;
   uint32_t get32(uint16_t index) const;
   void* getBuffer(uint16_t index) const { return &_reg_data_8[index]; }
+  uint16_t getSize(void) const { return _registry_size; }
   void assign(const registry_t &src);
 
   // 比較オペレータ
@@ -132,6 +139,7 @@ public:
     if (_history_count == 0) {
       _history_code += 1 << 16;
     }
+    ++_change_counter;
     _execNotify();
   }
 
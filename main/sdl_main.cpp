@@ -2,7 +2,7 @@
 // Copyright (c) 2025 InstaChord Corp.
 
 #include <M5GFX.h>
-#if defined ( SDL_h_ )
+#if defined ( SDL_h_ ) && !defined ( KANPLAY_HEADLESS_SIM )
 
 void setup(void);
 void loop(void);
@@ -0,0 +1,467 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 InstaChord Corp.
+
+#include "sim_host.hpp"
+
+#if defined (KANPLAY_HEADLESS_SIM)
+
+#include "common_define.hpp"
+#include "system_registry.hpp"
+#include "task_midi.hpp"
+#include "task_operator.hpp"
+#include "task_commander.hpp"
+#include "task_kantanplay.hpp"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <chrono>
+
+namespace kanplay_ns {
+//-------------------------------------------------------------------------
+// extern instance
+sim_host_t sim_host;
+
+static task_midi_t task_midi;
+static task_operator_t task_operator;
+static task_commander_t task_commander;
+static task_kantanplay_t task_kantanplay;
+
+uint32_t engine_micros(void)
+{
+  return (uint32_t)sim_host.getMicros();
+}
+
+uint32_t engine_millis(void)
+{
+  return (uint32_t)(sim_host.getMicros() / 1000);
+}
+
+uint32_t engine_cpu_micros(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return (uint32_t)((uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000);
+}
+
+uint32_t sim_host_t::getCaptureMicros(void)
+{
+  return (uint32_t)(sim_host._now_usec - sim_host._capture_base_usec);
+}
+
+bool sim_host_t::loadScript(const char* path)
+{
+  auto fp = fopen(path, "r");
+  if (fp == nullptr) {
+    M5_LOGE("sim: script open error: %s", path);
+    return false;
+  }
+  _event.clear();
+  char line[512];
+  int line_number = 0;
+  while (fgets(line, sizeof(line), fp)) {
+    ++line_number;
+    auto comment = strchr(line, '#');
+    if (comment) { *comment = 0; }
+
+    char* cursor = line;
+    char* token = strtok_r(cursor, " \t\r\n", &cursor);
+    if (token == nullptr) { continue; }
+
+    event_t event;
+    event.usec = strtoull(token, nullptr, 10);
+    event.value = 0;
+    const char* type = strtok_r(nullptr, " \t\r\n", &cursor);
+    if (type == nullptr) {
+      M5_LOGE("sim: %s:%d: missing event type", path, line_number);
+      continue;
+    }
+    if (strcmp(type, "button") == 0) {
+      event.type = event_t::ev_button;
+      auto arg = strtok_r(nullptr, " \t\r\n", &cursor);
+      event.value = arg ? strtoul(arg, nullptr, 0) : 0;
+    } else
+    if (strcmp(type, "midi") == 0) {
+      event.type = event_t::ev_midi_in;
+      while (nullptr != (token = strtok_r(nullptr, " \t\r\n", &cursor))) {
+        event.data.push_back(strtoul(token, nullptr, 16));
+      }
+    } else
+    if (strcmp(type, "song") == 0) {
+      event.type = event_t::ev_song;
+      auto arg = strtok_r(nullptr, "\r\n", &cursor);
+      while (arg && (*arg == ' ' || *arg == '\t')) { ++arg; }
+      event.path = arg ? arg : "";
+    } else
+    if (strcmp(type, "end") == 0) {
+      event.type = event_t::ev_end;
+    } else {
+      M5_LOGE("sim: %s:%d: unknown event type: %s", path, line_number, type);
+      continue;
+    }
+    _event.push_back(event);
+  }
+  fclose(fp);
+
+  // 同じ時刻のイベントは記述順に処理する
+  std::stable_sort(_event.begin(), _event.end(), [](const event_t& a, const event_t& b) { return a.usec < b.usec; });
+  M5_LOGI("sim: %d events loaded", (int)_event.size());
+  return true;
+}
+
+bool sim_host_t::loadSong(const char* path)
+{
+  auto fp = fopen(path, "rb");
+  if (fp == nullptr) {
+    M5_LOGE("sim: song open error: %s", path);
+    return false;
+  }
+  std::vector<uint8_t> data;
+  uint8_t buf[1024];
+  size_t len;
+  while (0 < (len = fread(buf, 1, sizeof(buf), fp))) {
+    data.insert(data.end(), buf, buf + len);
+  }
+  fclose(fp);
+
+  // task_operator の load_memory と同じ手順で反映する
+  bool result = system_registry.unchanged_song_data.loadSongJSON(data.data(), data.size());
+  if (!result) {
+    result = system_registry.unchanged_song_data.loadText(data.data(), data.size());
+  }
+  if (result) {
+    system_registry.song_data.assign(system_registry.unchanged_song_data);
+  }
+  system_registry.operator_command.addQueue( { def::command::slot_select, 1 } );
+  system_registry.player_command.addQueue( { def::command::chord_step_reset_request, 1 } );
+  return result;
+}
+
+bool sim_host_t::apply(const event_t& event)
+{
+  switch (event.type) {
+  case event_t::ev_button:
+    system_registry.internal_input.setButtonBitmask(event.value);
+    break;
+
+  case event_t::ev_midi_in:
+    task_midi.pushReceiveData(event.data.data(), event.data.size());
+    break;
+
+  case event_t::ev_song:
+    loadSong(event.path.c_str());
+    break;
+
+  case event_t::ev_end:
+    return false;
+  }
+  return true;
+}
+
+void sim_host_t::initTasks(FILE* capture)
+{
+  // main.cpp の setup と同じ順序で初期化する (画面・I2C・SPI・WiFi等のタスクは使用しない)
+  system_registry.init();
+  task_midi.setCapture(capture, getCaptureMicros);
+  task_midi.start();
+  task_operator.start();
+  task_kantanplay.start();
+
+  system_registry.internal_input.setButtonBitmask(0x00);
+  system_registry.runtime_info.setPressVelocity(100);
+  system_registry.operator_command.addQueue( { def::command::slot_select, 1 } );
+
+  task_commander.start();
+}
+
+uint32_t sim_host_t::procTasks(void)
+{
+  // 実機では各タスクがレジストリの通知で起床する。ここでは通知の流れる順に実行し、
+  // タスク間のキューに新たな書込みが無くなるまで繰り返す
+  static constexpr const int max_pass = 8;
+  uint32_t next_usec = _tick_usec;
+  for (int pass = 0; pass < max_pass; ++pass) {
+    auto operator_change = system_registry.operator_command.getChangeCounter();
+    auto player_change = system_registry.player_command.getChangeCounter();
+    auto midi_out_change = system_registry.midi_out_control.getChangeCounter();
+
+    uint32_t commander_msec = task_commander.proc();
+    if (commander_msec < next_usec / 1000) {
+      next_usec = commander_msec * 1000;
+    }
+    task_operator.proc();
+    uint32_t kantanplay_usec = task_kantanplay.proc();
+    if (next_usec > kantanplay_usec) {
+      next_usec = kantanplay_usec;
+    }
+    task_midi.proc();
+
+    if (operator_change == system_registry.operator_command.getChangeCounter()
+     && player_change == system_registry.player_command.getChangeCounter()
+     && midi_out_change == system_registry.midi_out_control.getChangeCounter()) {
+      break;
+    }
+  }
+  return next_usec;
+}
+
+void sim_host_t::step(uint64_t limit_usec)
+{
+  uint64_t next_usec = procTasks();
+  if (next_usec > limit_usec - _now_usec) { next_usec = limit_usec - _now_usec; }
+  if (next_usec == 0) { next_usec = 1; }
+  _now_usec += next_usec;
+}
+
+void sim_host_t::advance(uint64_t duration_usec)
+{
+  uint64_t end_usec = _now_usec + duration_usec;
+  while (_now_usec < end_usec) {
+    step(end_usec);
+  }
+}
+
+int sim_host_t::run(FILE* capture)
+{
+  initTasks(capture);
+
+  auto wall_start = std::chrono::steady_clock::now();
+  uint32_t step_count = 0;
+  size_t cursor = 0;
+  bool running = true;
+  while (running) {
+    while (cursor < _event.size() && _event[cursor].usec <= _now_usec) {
+      if (!apply(_event[cursor++])) {
+        running = false;
+        break;
+      }
+    }
+    if (!running) {
+      procTasks();
+      break;
+    }
+    if (cursor >= _event.size()) {
+      M5_LOGW("sim: script has no end event");
+      break;
+    }
+    // 次の入力イベントの時刻を超えないように仮想時刻を進める
+    step(_event[cursor].usec);
+    ++step_count;
+  }
+  if (capture) { fflush(capture); }
+
+  auto wall_usec = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - wall_start).count();
+  if (wall_usec < 1) { wall_usec = 1; }
+  M5_LOGI("sim: virtual %llu us  wall %lld us  steps %lu  x%llu"
+         , (unsigned long long)_now_usec, (long long)wall_usec, (unsigned long)step_count
+         , (unsigned long long)(_now_usec / wall_usec));
+  return 0;
+}
+
+// 1件目が一致しない行番号を返す (一致した場合は 0 、基準出力が無い場合は -1)
+static int compareFile(const char* path, const char* golden_path)
+{
+  auto golden = fopen(golden_path, "r");
+  if (golden == nullptr) { return -1; }
+  auto fp = fopen(path, "r");
+  if (fp == nullptr) {
+    fclose(golden);
+    return 1;
+  }
+  int result = 0;
+  int line_number = 0;
+  char line_a[256];
+  char line_b[256];
+  for (;;) {
+    ++line_number;
+    auto a = fgets(line_a, sizeof(line_a), fp);
+    auto b = fgets(line_b, sizeof(line_b), golden);
+    if (a == nullptr && b == nullptr) { break; }
+    if (a == nullptr || b == nullptr || strcmp(a, b) != 0) {
+      result = line_number;
+      break;
+    }
+  }
+  fclose(fp);
+  fclose(golden);
+  return result;
+}
+
+int sim_host_t::bench(const char* out_dir, const char* golden_dir, const std::vector<std::string>& songs, bool layer, uint32_t step_budget_usec)
+{
+  static constexpr const uint16_t bench_tempo[] = { 80, 120, 200 };
+  static constexpr const uint8_t bench_swing[] = { 0, 50 };
+  // 1小節ごとに切り替えるコード進行 (度数)
+  static constexpr const uint8_t bench_progression[] = { 1, 6, 4, 5 };
+  static constexpr const size_t bench_bars = sizeof(bench_progression) / sizeof(bench_progression[0]);
+  // 演奏終了後に余韻の消音まで記録する時間
+  static constexpr const uint32_t tail_usec = 2000000;
+  // _midi_pitch_manage の要素数 (トラック数 × ピッチ数 × 履歴数 3)
+  static constexpr const uint32_t pitch_manage_size = def::app::max_chord_track * def::app::max_pitch_with_drum * 3;
+
+  initTasks(nullptr);
+  advance(100000);
+
+  int case_count = 0;
+  int diff_count = 0;
+  int over_count = 0;
+  const int layer_count = layer ? def::app::max_layer : 1;
+  // wr_save/s, nt_save/s は送信済みの値と同じためにMIDI出力レジストリへの書込みを省略した回数と、
+  // バッチ処理によりまとめた通知の回数 (仮想時刻1秒あたり)
+  printf("%-32s %4s %6s %5s %5s %6s %6s %8s %8s %7s %9s %9s %9s %s\n"
+        , "case", "slot", "layers", "tempo", "swing", "steps", "beats", "avg_us", "max_us", "ev/beat", "pitch_max", "wr_save/s", "nt_save/s", "golden");
+  for (auto &song : songs) {
+    if (!loadSong(song.c_str())) { continue; }
+    advance(100000);
+
+    // ファイル名から拡張子を除いたものをケース名の先頭にする
+    std::string base = song;
+    auto pos = base.find_last_of("/\\");
+    if (pos != std::string::npos) { base = base.substr(pos + 1); }
+    pos = base.rfind('.');
+    if (pos != std::string::npos) { base = base.substr(0, pos); }
+
+    for (int slot = 1; slot <= def::app::max_slot; ++slot) {
+      // 後続のスロットを順にレイヤーとして重ねる
+      for (int l = 1; l < def::app::max_layer; ++l) {
+        system_registry.runtime_info.setLayerSlot(l, layer ? ((slot + l - 1) % def::app::max_slot) + 1 : 0);
+      }
+      for (auto tempo : bench_tempo) {
+        for (auto swing : bench_swing) {
+          auto &song_data = system_registry.song_data;
+          song_data.song_info.setTempo(tempo);
+          song_data.song_info.setSwing(swing);
+          auto &sequence = song_data.chord_sequence;
+          sequence.reset();
+          for (size_t bar = 0; bar < bench_bars; ++bar) {
+            sequence.addEvent( { (uint16_t)bar, 0, bench_progression[bar], 0, 0, (uint8_t)(bar == 0 ? slot : 0) } );
+          }
+
+          char name[128];
+          if (layer) {
+            snprintf(name, sizeof(name), "%s_s%d_t%d_w%d_l%d.txt", base.c_str(), slot, tempo, swing, layer_count);
+          } else {
+            snprintf(name, sizeof(name), "%s_s%d_t%d_w%d.txt", base.c_str(), slot, tempo, swing);
+          }
+          std::string path = std::string(out_dir) + "/" + name;
+          auto capture = fopen(path.c_str(), "w");
+          if (capture == nullptr) {
+            M5_LOGE("sim: capture open error: %s", path.c_str());
+            return -1;
+          }
+          _capture_base_usec = _now_usec;
+          task_midi.setCapture(capture, getCaptureMicros);
+          task_kantanplay.resetEngineStat();
+          auto &midi_out = system_registry.midi_out_control;
+          const uint32_t write_skip_start = midi_out.getWriteSkipCount();
+          const uint32_t notify_skip_start = midi_out.getNotifySkipCount();
+
+          system_registry.operator_command.addQueue( { def::command::sequence_control, def::command::sequence_control_t::sequence_start } );
+          advance(1000);
+          // 全小節の演奏時間に余裕を持たせた時間で打ち切る
+          const uint64_t timeout_usec = _now_usec + (uint64_t)60000000 * (bench_bars + 1) * def::app::sequence_beat_per_bar / tempo;
+          while (system_registry.runtime_info.getSequencePlay() && _now_usec < timeout_usec) {
+            step(timeout_usec);
+          }
+          system_registry.operator_command.addQueue( { def::command::sequence_control, def::command::sequence_control_t::sequence_stop } );
+          system_registry.player_command.addQueue( { def::command::chord_step_reset_request, 1 } );
+          advance(tail_usec);
+
+          task_midi.setCapture(nullptr, nullptr);
+          fclose(capture);
+          const uint64_t case_usec = (_now_usec - _capture_base_usec) ? (_now_usec - _capture_base_usec) : 1;
+          const uint32_t write_save = (uint32_t)((uint64_t)(midi_out.getWriteSkipCount() - write_skip_start) * 1000000 / case_usec);
+          const uint32_t notify_save = (uint32_t)((uint64_t)(midi_out.getNotifySkipCount() - notify_skip_start) * 1000000 / case_usec);
+
+          auto stat = task_kantanplay.getEngineStat();
+          const char* result = "-";
+          if (golden_dir) {
+            std::string golden_path = std::string(golden_dir) + "/" + name;
+            int line = compareFile(path.c_str(), golden_path.c_str());
+            if (line == 0) {
+              result = "ok";
+            } else if (line < 0) {
+              result = "new";
+            } else {
+              result = "DIFF";
+              ++diff_count;
+              M5_LOGE("sim: %s differs from golden at line %d", name, line);
+            }
+          }
+          if (stat.step_usec_max > step_budget_usec) {
+            ++over_count;
+            M5_LOGE("sim: %s step time %lu us exceeds budget %lu us", name, (unsigned long)stat.step_usec_max, (unsigned long)step_budget_usec);
+          }
+          uint32_t beats = stat.beat_count ? stat.beat_count : 1;
+          printf("%-32s %4d %6d %5d %5d %6lu %6lu %8lu %8lu %7.2f %4u/%-4u %9lu %9lu %s\n"
+                , base.c_str(), slot, layer_count, tempo, swing
+                , (unsigned long)stat.step_count, (unsigned long)stat.beat_count
+                , (unsigned long)(stat.step_count ? stat.step_usec_total / stat.step_count : 0)
+                , (unsigned long)stat.step_usec_max
+                , (float)(stat.note_on_count + stat.note_off_count) / beats
+                , (unsigned)stat.pitch_manage_peak, (unsigned)pitch_manage_size
+                , (unsigned long)write_save, (unsigned long)notify_save
+                , result);
+          ++case_count;
+        }
+      }
+    }
+  }
+  for (int l = 1; l < def::app::max_layer; ++l) {
+    system_registry.runtime_info.setLayerSlot(l, 0);
+  }
+  printf("%d cases, %d differ from golden, %d over step budget (%lu us)\n", case_count, diff_count, over_count, (unsigned long)step_budget_usec);
+  return diff_count + over_count;
+}
+
+//-------------------------------------------------------------------------
+}; // namespace kanplay_ns
+
+// usage: <program> <script> <capture_output> [tick_usec]
+//        <program> --bench <output_dir> [--golden <golden_dir>] [--layer] [--budget <usec>] <song.json> ...
+int main(int argc, char** argv)
+{
+  auto &sim = kanplay_ns::sim_host;
+  if (argc >= 4 && strcmp(argv[1], "--bench") == 0) {
+    const char* out_dir = argv[2];
+    const char* golden_dir = nullptr;
+    bool layer = false;
+    uint32_t budget = kanplay_ns::def::app::step_play_usec_budget;
+    std::vector<std::string> songs;
+    for (int i = 3; i < argc; ++i) {
+      if (strcmp(argv[i], "--golden") == 0 && i + 1 < argc) {
+        golden_dir = argv[++i];
+      } else if (strcmp(argv[i], "--layer") == 0) {
+        layer = true;
+      } else if (strcmp(argv[i], "--budget") == 0 && i + 1 < argc) {
+        budget = strtoul(argv[++i], nullptr, 10);
+      } else {
+        songs.push_back(argv[i]);
+      }
+    }
+    std::sort(songs.begin(), songs.end());
+    return sim.bench(out_dir, golden_dir, songs, layer, budget) == 0 ? 0 : 1;
+  }
+  if (argc < 3) {
+    fprintf(stderr, "usage: %s <script> <capture_output> [tick_usec]\n", argv[0]);
+    fprintf(stderr, "       %s --bench <output_dir> [--golden <golden_dir>] [--layer] [--budget <usec>] <song.json> ...\n", argv[0]);
+    return 1;
+  }
+  if (argc > 3) {
+    sim.setTickUsec(strtoul(argv[3], nullptr, 10));
+  }
+  if (!sim.loadScript(argv[1])) {
+    return 1;
+  }
+  auto capture = fopen(argv[2], "w");
+  if (capture == nullptr) {
+    fprintf(stderr, "capture open error: %s\n", argv[2]);
+    return 1;
+  }
+  int result = sim.run(capture);
+  fclose(capture);
+  return result;
+}
+
+#endif
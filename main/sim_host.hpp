@@ -0,0 +1,99 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 InstaChord Corp.
+
+#ifndef KANPLAY_SIM_HOST_HPP
+#define KANPLAY_SIM_HOST_HPP
+
+#include <M5Unified.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+namespace kanplay_ns {
+//-------------------------------------------------------------------------
+// 演奏エンジン (commander / operator / kantanplay / midi) が参照する時刻
+// ヘッドレスシミュレータでは仮想時刻を返すため、実時間に依存せず同じ結果を再現できる
+// engine_cpu_micros は処理時間の計測用。ヘッドレスシミュレータでは他のスレッドやプロセスに
+// 割り込まれた時間を含まないよう、呼出し元スレッドのCPU時間を返す
+#if defined (KANPLAY_HEADLESS_SIM)
+uint32_t engine_micros(void);
+uint32_t engine_millis(void);
+uint32_t engine_cpu_micros(void);
+#else
+static inline uint32_t engine_micros(void) { return M5.micros(); }
+static inline uint32_t engine_millis(void) { return M5.millis(); }
+static inline uint32_t engine_cpu_micros(void) { return M5.micros(); }
+#endif
+
+#if defined (KANPLAY_HEADLESS_SIM)
+// 画面とスレッドを使わずに演奏エンジンを実行するヘッドレスシミュレータ
+// スクリプトに記述した入力を仮想時刻に沿って与え、MIDI出力を時刻付きでファイルに記録する
+//
+// スクリプトは1行に1イベントを記述する ( # 以降はコメント )
+//   <usec> button <bitmask>       本体ボタンの押下状態 (16進数可)
+//   <usec> midi <byte> ...        MIDI入力として受信させるデータ (16進数)
+//   <usec> song <path>            ソングデータ(JSON)を読み込む
+//   <usec> end                    シミュレーションを終了する
+//
+// ベンチマークでは各ソングの全スロットを複数のテンポ・スウィングで固定のコード進行で演奏し、
+// ケースごとのMIDI出力を保存して基準出力 (golden) と比較する。あわせて処理量の集計値と、
+// MIDI出力レジストリへの書込み・通知を省略できた回数 (1秒あたり) を出力する
+// --layer を指定した場合は、後続のスロットをレイヤーとして重ねた状態 (max_layer 枚) で演奏する
+// 1ステップ分の演奏処理の最大時間 (max_us) が予算 (既定値は def::app::step_play_usec_budget) を超えたケースは失敗とする
+class sim_host_t {
+public:
+  struct event_t {
+    enum type_t : uint8_t {
+      ev_button,
+      ev_midi_in,
+      ev_song,
+      ev_end,
+    };
+    uint64_t usec;
+    type_t type;
+    uint32_t value;
+    std::vector<uint8_t> data;
+    std::string path;
+  };
+
+  bool loadScript(const char* path);
+
+  // 仮想時刻を進める最大の刻み幅 (実機のタスクの最小待機時間に相当)
+  void setTickUsec(uint32_t usec) { _tick_usec = usec ? usec : 1; }
+
+  // スクリプトの終端まで実行する。capture には MIDI出力を記録する
+  int run(FILE* capture);
+
+  // ソングごとのベンチマークを実行する。golden_dir が nullptr でなければ同名のファイルと比較する
+  // layer が true の場合は各スロットに後続のスロットをレイヤーとして重ねる
+  // 戻り値は基準出力と一致しなかったケースと、処理時間が step_budget_usec を超えたケースの数
+  int bench(const char* out_dir, const char* golden_dir, const std::vector<std::string>& songs, bool layer, uint32_t step_budget_usec);
+
+  uint64_t getMicros(void) const { return _now_usec; }
+
+private:
+  bool apply(const event_t& event);
+  bool loadSong(const char* path);
+  void initTasks(FILE* capture);
+  uint32_t procTasks(void);
+  // タスクを1回処理し、仮想時刻を次の処理時刻まで進める (limit_usec を超えない)
+  void step(uint64_t limit_usec);
+  void advance(uint64_t duration_usec);
+  static uint32_t getCaptureMicros(void);
+
+  std::vector<event_t> _event;
+  uint64_t _now_usec = 0;
+  // MIDI出力の記録に使用する時刻の基準 (ベンチマークのケース開始時刻)
+  uint64_t _capture_base_usec = 0;
+  uint32_t _tick_usec = 1000;
+};
+
+extern sim_host_t sim_host;
+#endif
+
+//-------------------------------------------------------------------------
+}; // namespace kanplay_ns
+
+#endif
@@ -19,17 +19,12 @@
 #include <spinlock.h>
 static rtc_cpu_freq_config_t conf_80mhz;
 static rtc_cpu_freq_config_t conf_160mhz;
-static std::mutex mutex_debug;
 
 #if CORE_DEBUG_LEVEL > 3
-#define DEBUG_PERFOMANCE_CHECK
 #define DEBUG_GPIO_MONITORING
 #endif
 
 
-#if defined (DEBUG_PERFOMANCE_CHECK)
-static uint32_t prev_msec;
-#endif
 #if defined (DEBUG_GPIO_MONITORING)
 static uint8_t pin_debug[6] = { 0, 0, 0, 0, 0, 0 };
 #endif
@@ -45,6 +40,12 @@ system_registry_t system_registry;
 static std::set<def::command::command_param_t> working_command_param;
 static std::mutex mtx_working_command_param;
 
+// MIDIルーティングの初期値 (演奏出力を全ての出力ポートへそのまま送り、受信したメッセージは他のポートへ送らない)
+static def::midi::route_t getDefaultRoute(def::midi::port_t in_port, def::midi::port_t out_port)
+{
+  return (in_port == def::midi::port_internal) ? def::midi::route_t::thru() : def::midi::route_t {};
+}
+
 #if __has_include (<freertos/freertos.h>)
 void system_registry_t::reg_working_command_t::setNotifyTaskHandle(TaskHandle_t handle)
 {
@@ -77,11 +78,22 @@ bool system_registry_t::reg_working_command_t::check(const def::command::command
   std::lock_guard<std::mutex> lock(mtx_working_command_param);
   return working_command_param.find(command_param) != working_command_param.end();
 }
+size_t system_registry_t::reg_working_command_t::getList(def::command::command_param_t* dst, size_t max_count) const
+{
+  std::lock_guard<std::mutex> lock(mtx_working_command_param);
+  size_t count = 0;
+  for (auto &command_param : working_command_param) {
+    if (count >= max_count) { break; }
+    dst[count++] = command_param;
+  }
+  return count;
+}
 
 void system_registry_t::init(void)
 {
   user_setting.init();
   midi_port_setting.init();
+  midi_control_mapping.init();
 
   runtime_info.init();
   popup_notify.init();
@@ -139,9 +151,6 @@ void system_registry_t::init(void)
     m5gfx::pinMode(pin_debug[i], m5gfx::output);
   }
 #endif
-#if defined (DEBUG_PERFOMANCE_CHECK)
-  prev_msec = M5.micros();
-#endif
 #endif
 }
 
@@ -180,6 +189,35 @@ void system_registry_t::reset(void)
   // タイムゾーン +9 (JST)
   user_setting.setTimeZone(9);
 
+  // 内部音源の同時発音数上限
+  user_setting.setPolyphonyLimit(def::app::polyphony_default);
+
+  // 入力元ごとのベロシティカーブ
+  for (int i = 0; i < def::play::velocity_source_max; ++i) {
+    user_setting.setVelocityCurve((def::play::velocity_source_t)i, def::play::velocity_curve_linear);
+  }
+  user_setting.setPortBAftertouch(false);
+
+  // USB MIDI (ホストと接続された時のみ動作するため入出力とも有効にしておく)
+  midi_port_setting.setUSBMIDI(def::command::ex_midi_mode_t::midi_input_output);
+
+  // RTP-MIDI (Wi-Fi接続が必要なため初期状態では無効)
+  midi_port_setting.setRTPMIDI(def::command::ex_midi_mode_t::midi_off);
+  midi_port_setting.setRTPPeerIP(0);
+
+  // MIDI入力のコード判定 (初期状態ではノート番号ごとのコマンド割当を使用する)
+  midi_port_setting.setChordInputChannel(0);
+
+  // MIDIルーティング
+  for (int in = 0; in < def::midi::port_max; ++in) {
+    for (int out = 0; out < def::midi::port_max; ++out) {
+      midi_port_setting.setRoute((def::midi::port_t)in, (def::midi::port_t)out, getDefaultRoute((def::midi::port_t)in, (def::midi::port_t)out));
+    }
+  }
+
+  // CC / NRPN の割当 (初期状態では割当なし。MIDIラーンで登録する)
+  midi_control_mapping.reset();
+
   // パターン編集時ベロシティ設定
   runtime_info.setEditVelocity(100);
 
@@ -304,87 +342,102 @@ void system_registry_t::load(void)
 
 //-------------------------------------------------------------------------
 
+static inline uint8_t getCoreId(void)
+{
+#if defined (M5UNIFIED_PC_BUILD)
+  return 0;
+#else
+  return xPortGetCoreID();
+#endif
+}
+
+const char* system_registry_t::reg_task_status_t::getTaskName(bitindex_t index)
+{
+  static constexpr const char* const name_table[] = {
+    "spi", "i2s", "i2c", "commander", "operator", "kantanplay",
+    "midi_in", "midi_ext", "midi_usb", "midi_ble", "midi_rtp", "wifi",
+  };
+  return index < MAX_TASK ? name_table[index] : "";
+}
+
 void system_registry_t::reg_task_status_t::setWorking(bitindex_t index)
 {
-#if !defined (M5UNIFIED_PC_BUILD)
 #if defined (DEBUG_GPIO_MONITORING)
   if (TASK_I2C <= index && index < TASK_I2C + 5) {
     m5gfx::gpio_hi(pin_debug[index - TASK_I2C]);
   }
 #endif
-  std::lock_guard<std::mutex> lock(mutex_debug);
-#endif
-  uint32_t bitmask = _reg_data_32[TASK_STATUS >> 2];
-  bool working = bitmask;
-
-#if defined (DEBUG_PERFOMANCE_CHECK)
-  uint32_t msec = M5.micros();
-  int diff = msec - prev_msec;
-  prev_msec = msec;
-  uint32_t mask_shift = 1;
-  for (int i = 0; i < MAX_TASK; ++i) {
-    if (bitmask & mask_shift) {
-      uint32_t dst = (HIGH_POWER_COUNTER + 4 + i * 4) >> 2;
-      _reg_data_32[dst] += diff;
-    }
-    mask_shift <<= 1;
-  }
-  _reg_data_32[(working ? HIGH_POWER_COUNTER : LOW_POWER_COUNTER) >> 2] += diff;
-#endif
-  bitmask |= 1 << index;
-  _reg_data_32[TASK_STATUS >> 2] = bitmask;
-
-#if !defined (M5UNIFIED_PC_BUILD)
-  if (!working) {
-    rtc_clk_cpu_freq_set_config_fast(&conf_160mhz);
-
-#if defined (DEBUG_GPIO_MONITORING)
-    m5gfx::gpio_hi(pin_debug[5]);
-#endif
+  const uint32_t bit = 1u << index;
+  const uint32_t prev = _working_mask.fetch_or(bit, std::memory_order_acq_rel);
+  if (prev & bit) { return; }
+
+  auto counter = &_task_counter[index];
+  counter->start_usec.store(M5.micros(), std::memory_order_relaxed);
+  counter->core.store(getCoreId(), std::memory_order_relaxed);
+  counter->wake_count.fetch_add(1, std::memory_order_relaxed);
+
+  // 全タスクが停止していた状態からの起床であればクロックを上げる
+  if (prev == 0) {
+    updateCpuFreq();
   }
-#endif
 }
 
 void system_registry_t::reg_task_status_t::setSuspend(bitindex_t index)
 {
-#if !defined (M5UNIFIED_PC_BUILD)
-  std::lock_guard<std::mutex> lock(mutex_debug);
-#endif
-  uint32_t bitmask = _reg_data_32[TASK_STATUS >> 2];
-#if defined (DEBUG_PERFOMANCE_CHECK)
-  uint32_t msec = M5.micros();
-  bool working = bitmask;
-  int diff = msec - prev_msec;
-  prev_msec = msec;
-  uint32_t mask_shift = 1;
-  for (int i = 0; i < MAX_TASK; ++i) {
-    if (bitmask & mask_shift) {
-      uint32_t dst = (HIGH_POWER_COUNTER + 4 + i * 4) >> 2;
-      _reg_data_32[dst] += diff;
+  const uint32_t bit = 1u << index;
+  const uint32_t prev = _working_mask.fetch_and(~bit, std::memory_order_acq_rel);
+  if (prev & bit) {
+    auto counter = &_task_counter[index];
+    uint32_t slice = M5.micros() - counter->start_usec.load(std::memory_order_relaxed);
+    counter->run_usec.fetch_add(slice, std::memory_order_relaxed);
+    if (counter->max_slice_usec.load(std::memory_order_relaxed) < slice) {
+      counter->max_slice_usec.store(slice, std::memory_order_relaxed);
+    }
+    auto core = counter->core.load(std::memory_order_relaxed);
+    if (core < max_core) {
+      // 同じコアの複数のタスクから加算されるため fetch_add で加算する
+      _core_run_usec[core].fetch_add(slice, std::memory_order_relaxed);
+    }
+    // 最後に稼働していたタスクが停止したらクロックを下げる
+    if (prev == bit) {
+      updateCpuFreq();
     }
-    mask_shift <<= 1;
   }
-  _reg_data_32[(working ? HIGH_POWER_COUNTER : LOW_POWER_COUNTER) >> 2] += diff;
+#if defined (DEBUG_GPIO_MONITORING)
+  if (TASK_I2C <= index && index < TASK_I2C + 5) {
+    m5gfx::gpio_lo(pin_debug[index - TASK_I2C]);
+  }
 #endif
+}
 
-  bitmask &= ~(1 << index);
-  _reg_data_32[TASK_STATUS >> 2] = bitmask;
-
+void system_registry_t::reg_task_status_t::updateCpuFreq(void)
+{
+  for (;;) {
+    // 他のタスクが判定中の場合は待機せずに戻る。判定中のタスクが最後に状態を再確認する
+    if (_freq_busy.test_and_set(std::memory_order_acquire)) { return; }
+
+    const bool high = _working_mask.load(std::memory_order_acquire) != 0;
+    if (_cpu_high != high) {
+      uint32_t usec = M5.micros();
+      (_cpu_high ? _high_power_usec : _low_power_usec).fetch_add(usec - _freq_change_usec, std::memory_order_relaxed);
+      _freq_change_usec = usec;
+      _cpu_high = high;
 #if !defined (M5UNIFIED_PC_BUILD)
-  if (!isWorking()) {
-    rtc_clk_cpu_freq_set_config_fast(&conf_80mhz);
+      rtc_clk_cpu_freq_set_config_fast(high ? &conf_160mhz : &conf_80mhz);
 #if defined (DEBUG_GPIO_MONITORING)
-    m5gfx::gpio_lo(pin_debug[5]);
+      if (high) {
+        m5gfx::gpio_hi(pin_debug[5]);
+      } else {
+        m5gfx::gpio_lo(pin_debug[5]);
+      }
 #endif
-  }
-#if defined (DEBUG_GPIO_MONITORING)
-// 割り込みを再度許可する
+#endif
+    }
+    _freq_busy.clear(std::memory_order_release);
 
-  if (TASK_I2C <= index && index < TASK_I2C + 5) {
-    m5gfx::gpio_lo(pin_debug[index - TASK_I2C]);
+    // 判定中にタスクの稼働状況が変化していなければ完了
+    if ((_working_mask.load(std::memory_order_acquire) != 0) == high) { return; }
   }
-#endif
-#endif
 }
 
 //-------------------------------------------------------------------------
@@ -447,6 +500,19 @@ size_t system_registry_t::saveSettingJSON(uint8_t* data, size_t data_length)
     json["imu_velocity_level"]   = user_setting.getImuVelocityLevel();
     json["chattering_threshold"] = user_setting.getChatteringThreshold();
     json["timezone"]             = user_setting.getTimeZone();
+    json["polyphony_limit"]      = user_setting.getPolyphonyLimit();
+    json["velocity_curve_internal"] = user_setting.getVelocityCurve(def::play::velocity_source_internal);
+    json["velocity_curve_port_a"]   = user_setting.getVelocityCurve(def::play::velocity_source_port_a);
+    json["velocity_curve_port_b"]   = user_setting.getVelocityCurve(def::play::velocity_source_port_b);
+    json["velocity_curve_midi"]     = user_setting.getVelocityCurve(def::play::velocity_source_midi);
+    json["port_b_aftertouch"]       = user_setting.getPortBAftertouch();
+    json["midi_chord_input_channel"] = midi_port_setting.getChordInputChannel();
+    json["midi_rtp"]                 = (uint8_t)midi_port_setting.getRTPMIDI();
+    if (auto ip = midi_port_setting.getRTPPeerIP()) {
+      char buf[16];
+      snprintf(buf, sizeof(buf), "%u.%u.%u.%u", (uint8_t)(ip >> 24), (uint8_t)(ip >> 16), (uint8_t)(ip >> 8), (uint8_t)ip);
+      json["midi_rtp_peer"] = buf;
+    }
   }
   auto json_key_mapping = json_root["key_mapping"].to<JsonObject>();
   {
@@ -481,6 +547,45 @@ size_t system_registry_t::saveSettingJSON(uint8_t* data, size_t data_length)
     }
   }
 
+  // MIDIルーティング (有効なルートのみ保存する)
+  // 保存時点で存在したポートの一覧も記録し、後の版で追加されたポートと、全てのルートを無効にしたポートを区別する
+  {
+    auto json_ports = json_root["midi_route_ports"].to<JsonArray>();
+    for (int port = 0; port < def::midi::port_max; ++port) {
+      json_ports.add(def::midi::port_name_table[port]);
+    }
+    auto json_route = json_root["midi_route"].to<JsonArray>();
+    for (int in = 0; in < def::midi::port_max; ++in) {
+      for (int out = 0; out < def::midi::port_max; ++out) {
+        auto route = midi_port_setting.getRoute((def::midi::port_t)in, (def::midi::port_t)out);
+        if (!route.isEnabled()) { continue; }
+        auto json = json_route.add<JsonObject>();
+        json["in"]         = def::midi::port_name_table[in];
+        json["out"]        = def::midi::port_name_table[out];
+        json["channels"]   = route.channel_mask;
+        json["types"]      = route.type_mask;
+        json["to_channel"] = route.channel_to;
+      }
+    }
+  }
+
+  // CC / NRPN の割当 (有効な割当のみ保存する)
+  {
+    auto json_control = json_root["midi_control"].to<JsonArray>();
+    for (int i = 0; i < def::midi::max_control_map; ++i) {
+      auto map = midi_control_mapping.getMap(i);
+      if (!map.isEnabled()) { continue; }
+      auto json = json_control.add<JsonObject>();
+      json["source"]  = def::midi::control_source_name_table[map.source];
+      json["channel"] = map.channel + 1;
+      json["number"]  = map.number;
+      json["target"]  = def::midi::control_target_name_table[map.target];
+      if (map.isPartTarget()) {
+        json["part"] = map.part + 1;
+      }
+    }
+  }
+
   auto result = serializeJson(json_root, (char*)data, data_length);
 printf("saveSettingJSON result: %d\n", result);
 
@@ -530,6 +635,38 @@ bool system_registry_t::loadSettingJSON(const uint8_t* data, size_t data_length)
     user_setting.setImuVelocityLevel(                        json["imu_velocity_level"  ].as<uint8_t>());
     user_setting.setChatteringThreshold(                     json["chattering_threshold"].as<uint8_t>());
     user_setting.setTimeZone(                                json["timezone"            ].as<int8_t>());
+    if (json["polyphony_limit"].is<uint8_t>()) {
+      user_setting.setPolyphonyLimit(                        json["polyphony_limit"     ].as<uint8_t>());
+    }
+    {
+      static constexpr const char* velocity_curve_key[def::play::velocity_source_max] = {
+        "velocity_curve_internal", "velocity_curve_port_a", "velocity_curve_port_b", "velocity_curve_midi",
+      };
+      for (int i = 0; i < def::play::velocity_source_max; ++i) {
+        if (json[velocity_curve_key[i]].is<uint8_t>()) {
+          user_setting.setVelocityCurve((def::play::velocity_source_t)i, (def::play::velocity_curve_t)json[velocity_curve_key[i]].as<uint8_t>());
+        }
+      }
+    }
+    if (json["port_b_aftertouch"].is<bool>()) {
+      user_setting.setPortBAftertouch(                       json["port_b_aftertouch"   ].as<bool>());
+    }
+    if (json["midi_chord_input_channel"].is<uint8_t>()) {
+      midi_port_setting.setChordInputChannel(                json["midi_chord_input_channel"].as<uint8_t>());
+    }
+    if (json["midi_rtp"].is<uint8_t>()) {
+      midi_port_setting.setRTPMIDI((def::command::ex_midi_mode_t)(json["midi_rtp"].as<uint8_t>() & 3));
+    }
+    {
+      // 接続先は "192.168.0.10" 形式で記録する (記録が無い場合は相手からの接続のみ)
+      unsigned int a, b, c, d;
+      auto peer = json["midi_rtp_peer"].as<const char*>();
+      uint32_t ip = 0;
+      if (peer != nullptr && 4 == sscanf(peer, "%u.%u.%u.%u", &a, &b, &c, &d) && (a | b | c | d) < 256) {
+        ip = a << 24 | b << 16 | c << 8 | d;
+      }
+      midi_port_setting.setRTPPeerIP(ip);
+    }
   }
 
   // control_assignment::play button ( 旧名 key mapping )
@@ -582,6 +719,83 @@ bool system_registry_t::loadSettingJSON(const uint8_t* data, size_t data_length)
     }
   }
 
+  // MIDIルーティング (記録が無い場合は初期値のままにする)
+  // 記録に含まれないポート (保存後の版で追加されたポート) が関わるルートは初期値にする
+  {
+    auto json_route = json_root["midi_route"].as<JsonArray>();
+    if (!json_route.isNull())
+    {
+      auto get_port = [](const char* name) -> int {
+        if (name == nullptr) { return -1; }
+        for (int i = 0; i < def::midi::port_max; ++i) {
+          if (strcmp(def::midi::port_name_table[i], name) == 0) { return i; }
+        }
+        return -1;
+      };
+      bool known[def::midi::port_max] = {};
+      auto json_ports = json_root["midi_route_ports"].as<JsonArray>();
+      if (!json_ports.isNull()) {
+        for (JsonVariant json : json_ports) {
+          int port = get_port(json.as<const char*>());
+          if (port >= 0) { known[port] = true; }
+        }
+      } else {
+        // ポート一覧の無い記録は、ルートに現れるポートのみ記録済みとみなす
+        for (JsonObject json : json_route) {
+          int in = get_port(json["in"].as<const char*>());
+          int out = get_port(json["out"].as<const char*>());
+          if (in >= 0) { known[in] = true; }
+          if (out >= 0) { known[out] = true; }
+        }
+      }
+      for (int in = 0; in < def::midi::port_max; ++in) {
+        for (int out = 0; out < def::midi::port_max; ++out) {
+          midi_port_setting.setRoute((def::midi::port_t)in, (def::midi::port_t)out
+                                   , (known[in] && known[out]) ? def::midi::route_t {} : getDefaultRoute((def::midi::port_t)in, (def::midi::port_t)out));
+        }
+      }
+      for (JsonObject json : json_route) {
+        int in = get_port(json["in"].as<const char*>());
+        int out = get_port(json["out"].as<const char*>());
+        if (in < 0 || out < 0) { continue; }
+        if (!known[in] || !known[out]) { continue; }
+        def::midi::route_t route { json["channels"].as<uint16_t>(), json["types"].as<uint8_t>(), json["to_channel"].as<uint8_t>() };
+        if (route.channel_to > def::midi::channel_max) { route.channel_to = 0; }
+        midi_port_setting.setRoute((def::midi::port_t)in, (def::midi::port_t)out, route);
+      }
+    }
+  }
+
+  // CC / NRPN の割当 (記録が無い場合は初期値のままにする)
+  {
+    auto json_control = json_root["midi_control"].as<JsonArray>();
+    if (!json_control.isNull())
+    {
+      auto get_index = [](const char* const* table, size_t count, const char* name) -> int {
+        if (name == nullptr) { return -1; }
+        for (size_t i = 1; i < count; ++i) {
+          if (strcmp(table[i], name) == 0) { return (int)i; }
+        }
+        return -1;
+      };
+      midi_control_mapping.reset();
+      int index = 0;
+      for (JsonObject json : json_control) {
+        if (index >= def::midi::max_control_map) { break; }
+        int source = get_index(def::midi::control_source_name_table, sizeof(def::midi::control_source_name_table) / sizeof(def::midi::control_source_name_table[0]), json["source"].as<const char*>());
+        int target = get_index(def::midi::control_target_name_table, def::midi::control_map_t::target_max, json["target"].as<const char*>());
+        int channel = json["channel"].as<int>() - 1;
+        int part = json["part"].is<int>() ? json["part"].as<int>() - 1 : 0;
+        if (source < 0 || target < 0 || channel < 0 || channel >= def::midi::channel_max
+         || part < 0 || part >= def::app::max_chord_part) { continue; }
+        uint16_t number = json["number"].as<uint16_t>();
+        if (number > ((source == def::midi::control_map_t::source_cc) ? 127 : 0x3FFF)) { continue; }
+        midi_control_mapping.setMap(index++, def::midi::control_map_t {
+          (def::midi::control_map_t::source_t)source, (uint8_t)channel, number, (def::midi::control_map_t::target_t)target, (uint8_t)part });
+      }
+    }
+  }
+
   return true;
 }
 
@@ -1107,6 +1321,26 @@ size_t system_registry_t::song_data_t::saveSongJSON(uint8_t* data_buffer, size_t
     }
   }
 
+  // コード進行トラックはイベントがある場合のみ保存する
+  if (chord_sequence.getEventCount())
+  {
+    auto sequence = json["sequence"].to<JsonObject>();
+    sequence["loop_start"] = chord_sequence.getLoopStartBar();
+    sequence["loop_end"] = chord_sequence.getLoopEndBar();
+    auto event_array = sequence["event"].to<JsonArray>();
+    for (int i = 0; i < chord_sequence.getEventCount(); ++i)
+    {
+      auto ev = chord_sequence.getEvent(i);
+      auto event = event_array.add<JsonObject>();
+      event["bar"] = ev.bar;
+      event["beat"] = ev.beat;
+      event["degree"] = ev.degree;
+      event["modifier"] = ev.modifier;
+      event["bass"] = ev.bass_degree;
+      event["slot"] = ev.slot;
+    }
+  }
+
   auto result = serializeJson(json, (char*)data_buffer, data_length);
   return result;
 }
@@ -1225,6 +1459,24 @@ bool system_registry_t::song_data_t::loadSongJSON(const uint8_t* data, size_t da
       }
     }
   }
+
+  // コード進行トラック (省略されている場合は空のまま)
+  if (json["sequence"].is<JsonObject>()) {
+    auto sequence = json["sequence"].as<JsonObject>();
+    chord_sequence.setLoop(sequence["loop_start"].as<int>(), sequence["loop_end"].as<int>());
+    auto event_array = sequence["event"].as<JsonArray>();
+    for (auto event : event_array)
+    {
+      reg_chord_sequence_t::event_t ev;
+      ev.bar = event["bar"].as<int>();
+      ev.beat = event["beat"].as<int>();
+      ev.degree = event["degree"].as<int>();
+      ev.modifier = event["modifier"].as<int>();
+      ev.bass_degree = event["bass"].as<int>();
+      ev.slot = event["slot"].as<int>();
+      if (!chord_sequence.addEvent(ev)) { break; }
+    }
+  }
   return true;
 }
 
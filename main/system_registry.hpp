@@ -14,6 +14,7 @@
 #include <vector>
 #include <map>
 #include <algorithm>
+#include <atomic>
 
 namespace kanplay_ns {
 //-------------------------------------------------------------------------
@@ -37,6 +38,8 @@ public:
         void set(const def::command::command_param_t& command_param);
         void clear(const def::command::command_param_t& command_param);
         bool check(const def::command::command_param_t& command_param) const;
+        // 現在実行中のコマンドを最大 max_count 個まで取得する。戻り値は取得した個数
+        size_t getList(def::command::command_param_t* dst, size_t max_count) const;
         uint32_t getChangeCounter(void) const { return _working_command_change_counter; }
 
 #if __has_include (<freertos/freertos.h>)
@@ -54,7 +57,7 @@ protected:
     // ユーザー設定で変更される情報
     // ユーザーが設定する情報で、終了時に保存され起動時に再現される情報
     struct reg_user_setting_t : public registry_t {
-        reg_user_setting_t(void) : registry_t(16, 0, DATA_SIZE_8) {}
+        reg_user_setting_t(void) : registry_t(32, 0, DATA_SIZE_8) {}
         enum index_t : uint16_t {
             LED_BRIGHTNESS,
             DISPLAY_BRIGHTNESS,
@@ -68,6 +71,12 @@ protected:
             IMU_VELOCITY_LEVEL,
             CHATTERING_THRESHOLD,
             TIMEZONE,
+            POLYPHONY_LIMIT,
+            VELOCITY_CURVE_INTERNAL,
+            VELOCITY_CURVE_PORT_A,
+            VELOCITY_CURVE_PORT_B,
+            VELOCITY_CURVE_MIDI,
+            PORTB_AFTERTOUCH,
         };
 
         // ディスプレイの明るさ
@@ -118,25 +127,89 @@ protected:
         int8_t getTimeZone15min(void) const { return get8(TIMEZONE); }
         void setTimeZone(int8_t offset) { setTimeZone15min(offset * 4); }
         int8_t getTimeZone(void) const { return get8(TIMEZONE) / 4; }
+
+        // 内部音源の同時発音数の上限 (超過時は古い音から停止する)
+        void setPolyphonyLimit(uint8_t voices) { set8(POLYPHONY_LIMIT, std::min<uint8_t>(def::app::polyphony_max, std::max<uint8_t>(def::app::polyphony_min, voices))); }
+        uint8_t getPolyphonyLimit(void) const { return get8(POLYPHONY_LIMIT); }
+
+        // 入力元ごとのベロシティカーブ
+        void setVelocityCurve(def::play::velocity_source_t source, def::play::velocity_curve_t curve) { if (source < def::play::velocity_source_max) { set8(VELOCITY_CURVE_INTERNAL + source, curve < def::play::velocity_curve_max ? curve : def::play::velocity_curve_linear); } }
+        def::play::velocity_curve_t getVelocityCurve(def::play::velocity_source_t source) const { return (source < def::play::velocity_source_max) ? (def::play::velocity_curve_t)get8(VELOCITY_CURVE_INTERNAL + source) : def::play::velocity_curve_linear; }
+
+        // ポートBのアナログ入力をチャンネルアフタータッチとして送信する
+        void setPortBAftertouch(bool enabled) { set8(PORTB_AFTERTOUCH, enabled); }
+        bool getPortBAftertouch(void) const { return get8(PORTB_AFTERTOUCH); }
     } user_setting;
 
-    // ポートCに関する設定情報
+    // MIDIポートの入出力設定およびポート間のルーティング
     struct reg_midi_port_setting_t : public registry_t {
-        reg_midi_port_setting_t(void) : registry_t(4, 0, DATA_SIZE_8) {}
+        reg_midi_port_setting_t(void) : registry_t(ROUTE_START + def::midi::port_max * def::midi::port_max * 4, 0, DATA_SIZE_8) {}
         enum index_t : uint16_t {
             PORT_C_MIDI,
             BLE_MIDI,
+            USB_MIDI,
+            CHORD_INPUT_CHANNEL,  // コード判定に使用する受信チャンネル (0:無効 1-16)
+            RTP_MIDI,
+            RTP_PEER_IP = 8,  // RTP-MIDI で自機から接続する相手のIPアドレス (32bit , 0:相手からの接続のみ)
+            ROUTE_START = 12, // 入力ポート×出力ポートのルート設定 (各32bit)
         };
         void setPortCMIDI(def::command::ex_midi_mode_t mode) { set8(PORT_C_MIDI, static_cast<uint8_t>(mode)); }
         def::command::ex_midi_mode_t getPortCMIDI(void) const { return static_cast<def::command::ex_midi_mode_t>(get8(PORT_C_MIDI)); }
 
         void setBLEMIDI(def::command::ex_midi_mode_t mode) { set8(BLE_MIDI, static_cast<uint8_t>(mode)); }
         def::command::ex_midi_mode_t getBLEMIDI(void) const { return static_cast<def::command::ex_midi_mode_t>(get8(BLE_MIDI)); }
+
+        void setUSBMIDI(def::command::ex_midi_mode_t mode) { set8(USB_MIDI, static_cast<uint8_t>(mode)); }
+        def::command::ex_midi_mode_t getUSBMIDI(void) const { return static_cast<def::command::ex_midi_mode_t>(get8(USB_MIDI)); }
+
+        void setRTPMIDI(def::command::ex_midi_mode_t mode) { set8(RTP_MIDI, static_cast<uint8_t>(mode)); }
+        def::command::ex_midi_mode_t getRTPMIDI(void) const { return static_cast<def::command::ex_midi_mode_t>(get8(RTP_MIDI)); }
+
+        void setRTPPeerIP(uint32_t ip) { set32(RTP_PEER_IP, ip); }
+        uint32_t getRTPPeerIP(void) const { return get32(RTP_PEER_IP); }
+
+        void setChordInputChannel(uint8_t channel) { set8(CHORD_INPUT_CHANNEL, channel <= def::midi::channel_max ? channel : 0); }
+        uint8_t getChordInputChannel(void) const { return get8(CHORD_INPUT_CHANNEL); }
+
+        void setRoute(def::midi::port_t in_port, def::midi::port_t out_port, const def::midi::route_t& route) { set32(ROUTE_START + (in_port * def::midi::port_max + out_port) * 4, route.getValue()); }
+        def::midi::route_t getRoute(def::midi::port_t in_port, def::midi::port_t out_port) const { return def::midi::route_t { get32(ROUTE_START + (in_port * def::midi::port_max + out_port) * 4) }; }
     } midi_port_setting;
 
+    // 受信したコントロールチェンジ / NRPN のパラメータへの割当
+    struct reg_midi_control_mapping_t : public registry_t {
+        reg_midi_control_mapping_t(void) : registry_t(def::midi::max_control_map * 4, 0, DATA_SIZE_32) {}
+        void setMap(uint8_t index, const def::midi::control_map_t& map) { set32(index * 4, map.getValue()); }
+        def::midi::control_map_t getMap(uint8_t index) const { return def::midi::control_map_t { get32(index * 4) }; }
+
+        // 割当を登録する。同じ入力または同じパラメータの割当があれば置き換え、空きが無い場合は最後の割当を置き換える
+        void learn(const def::midi::control_map_t& map) {
+            int index = -1;
+            int empty = -1;
+            for (int i = 0; i < (int)def::midi::max_control_map; ++i) {
+                auto m = getMap(i);
+                if (!m.isEnabled()) {
+                    if (empty < 0) { empty = i; }
+                    continue;
+                }
+                if (m.isSameSource(map) || (m.target == map.target && (!m.isPartTarget() || m.part == map.part))) {
+                    // 置き換え対象以外に同じ入力・パラメータの割当が残らないよう消しておく
+                    if (index >= 0) { setMap(i, def::midi::control_map_t {}); }
+                    else { index = i; }
+                }
+            }
+            if (index < 0) { index = (empty < 0) ? def::midi::max_control_map - 1 : empty; }
+            setMap(index, map);
+        }
+        void reset(void) {
+            for (int i = 0; i < _registry_size; i += 4) {
+                set32(i, 0);
+            }
+        }
+    } midi_control_mapping;
+
     // 実行時に変化する情報 (設定画面が存在しない可変情報)
     struct reg_runtime_info_t : public registry_t {
-        reg_runtime_info_t(void) : registry_t(32, 0, DATA_SIZE_8) {}
+        reg_runtime_info_t(void) : registry_t(48, 0, DATA_SIZE_8) {}
         enum index_t : uint16_t {
             PART_EFFECT_1,
             PART_EFFECT_2,
@@ -164,6 +237,13 @@ protected:
             EDIT_VELOCITY,
             BUTTON_MAPPING_SWITCH,
             DEVELOPER_MODE,
+            ACTIVE_VOICE_COUNT,
+            SEQUENCE_PLAY,
+            VOICE_STEAL_COUNT = 28, // 16bit
+            LAYER_SLOT_2 = 30,      // レイヤー2 ～ max_layer
+            GUI_DIAG_VIEW = 31,
+            SEQUENCE_BAR = 32,      // 16bit
+            MIDI_LEARN = 34,        // 下位4bit:割当待ちのパラメータ (0:待機なし) 上位4bit:パート番号
         };
 
         // 音が鳴ったパートへの発光エフェクト設定
@@ -256,6 +336,39 @@ protected:
         // 開発者モード
         void setDeveloperMode(bool enabled) { set8(DEVELOPER_MODE, enabled); }
         bool getDeveloperMode(void) const { return get8(DEVELOPER_MODE); }
+
+        // 内部音源で発音中のボイス数
+        void setActiveVoiceCount(uint8_t count) { set8(ACTIVE_VOICE_COUNT, count); }
+        uint8_t getActiveVoiceCount(void) const { return get8(ACTIVE_VOICE_COUNT); }
+
+        // 同時発音数の上限によって停止させたボイスの累計数
+        void setVoiceStealCount(uint16_t count) { set16(VOICE_STEAL_COUNT, count); }
+        uint16_t getVoiceStealCount(void) const { return get16(VOICE_STEAL_COUNT); }
+
+        // レイヤー演奏で重ねるスロット番号 (1 ～ max_slot, 0 はレイヤー無効) layer_index は 1 以上
+        void setLayerSlot(uint8_t layer_index, uint8_t slot_number) {
+            if (0 < layer_index && layer_index < def::app::max_layer && slot_number <= def::app::max_slot) {
+                set8(LAYER_SLOT_2 + layer_index - 1, slot_number);
+            }
+        }
+        uint8_t getLayerSlot(uint8_t layer_index) const { return get8(LAYER_SLOT_2 + layer_index - 1); }
+
+        // コード進行トラックによる自動演奏が有効か否か
+        void setSequencePlay(bool enabled) { set8(SEQUENCE_PLAY, enabled); }
+        bool getSequencePlay(void) const { return get8(SEQUENCE_PLAY); }
+
+        // コード進行トラックの現在の演奏位置 (小節番号, 0 始まり)
+        void setSequenceBar(uint16_t bar) { set16(SEQUENCE_BAR, bar); }
+        uint16_t getSequenceBar(void) const { return get16(SEQUENCE_BAR); }
+
+        // タスクの稼働状況の診断画面を表示するか否か (設定には保存しない)
+        void setGuiDiagView(bool enabled) { set8(GUI_DIAG_VIEW, enabled); }
+        bool getGuiDiagView(void) const { return get8(GUI_DIAG_VIEW); }
+
+        // MIDIラーン (次に受信したCC / NRPN を割り当てるパラメータ。設定には保存しない)
+        void setMidiLearn(def::midi::control_map_t::target_t target, uint8_t part_index = 0) { set8(MIDI_LEARN, (part_index << 4) | (target & 0x0F)); }
+        def::midi::control_map_t::target_t getMidiLearnTarget(void) const { return (def::midi::control_map_t::target_t)(get8(MIDI_LEARN) & 0x0F); }
+        uint8_t getMidiLearnPart(void) const { return get8(MIDI_LEARN) >> 4; }
     } runtime_info;
 
     struct reg_popup_notify_t : public registry_t {
@@ -320,7 +433,7 @@ protected:
     };
 
     struct reg_task_status_t : public registry_t {
-        reg_task_status_t(void) : registry_t(64, 4, DATA_SIZE_32) {}
+        reg_task_status_t(void) : registry_t(8, 4, DATA_SIZE_32) {}
         enum bitindex_t : uint32_t {
             TASK_SPI,
             TASK_I2S,
@@ -332,31 +445,56 @@ protected:
             TASK_MIDI_EXTERNAL,
             TASK_MIDI_USB,
             TASK_MIDI_BLE,
+            TASK_MIDI_RTP,
             TASK_WIFI,
             MAX_TASK,
         };
         enum index_t : uint16_t {
-            TASK_STATUS = 0x00,
-            LOW_POWER_COUNTER = 0x04,
-            HIGH_POWER_COUNTER = 0x08,
-            TASK_SPI_COUNTER = 0x0C,
-            TASK_I2S_COUNTER = 0x10,
-            TASK_I2C_COUNTER = 0x14,
-            TASK_COMMANDER_COUNTER = 0x18,
-            TASK_OPERATOR_COUNTER = 0x1C,
-            TASK_KANTANPLAY_COUNTER = 0x20,
-            TASK_MIDI_INTERNAL_COUNTER = 0x24,
-            TASK_MIDI_EXTERNAL_COUNTER = 0x28,
-            TASK_MIDI_USB_COUNTER = 0x2C,
-            TASK_MIDI_BLE_COUNTER = 0x30,
-            TASK_MIDI_WIFI_COUNTER = 0x34,
+            STEP_PLAY_USEC_MAX = 0x00,
+        };
+        static constexpr const size_t max_core = 2;
+
+        // タスクごとの稼働時間の集計値
+        // 各値は該当タスク自身の setWorking / setSuspend からのみ更新されるため、ロックせずに読み書きできる
+        struct task_counter_t {
+            std::atomic<uint32_t> run_usec { 0 };       // 累計の稼働時間 (usec)
+            std::atomic<uint32_t> wake_count { 0 };     // 累計の起床回数
+            std::atomic<uint32_t> max_slice_usec { 0 }; // 1回の起床あたりの稼働時間の最大値 (usec)
+            std::atomic<uint32_t> start_usec { 0 };     // 直近に起床した時刻
+            std::atomic<uint8_t> core { 0 };            // 直近に動作したCPUコア番号
         };
+
         void setWorking(bitindex_t index);
         void setSuspend(bitindex_t index);
-        bool isWorking(void) const { return get32(TASK_STATUS); }
-        uint32_t getLowPowerCounter(void) const { return get32(LOW_POWER_COUNTER); }
-        uint32_t getHighPowerCounter(void) const { return get32(HIGH_POWER_COUNTER); }
-        uint32_t getWorkingCounter(index_t index) const { return get32(index); }
+        bool isWorking(void) const { return _working_mask.load(std::memory_order_relaxed); }
+        const task_counter_t& getTaskCounter(bitindex_t index) const { return _task_counter[index]; }
+        // 稼働時間の最大値を取得して 0 に戻す (表示の更新周期ごとの最大値を得るため)
+        uint32_t takeMaxSliceUsec(bitindex_t index) { return _task_counter[index].max_slice_usec.exchange(0, std::memory_order_relaxed); }
+        // CPUコアごとの累計の稼働時間 (usec)
+        uint32_t getCoreRunUsec(uint8_t core) const { return core < max_core ? _core_run_usec[core].load(std::memory_order_relaxed) : 0; }
+        // CPUクロックが低速(80MHz)・高速(160MHz)だった累計時間 (usec)
+        uint32_t getLowPowerCounter(void) const { return _low_power_usec.load(std::memory_order_relaxed); }
+        uint32_t getHighPowerCounter(void) const { return _high_power_usec.load(std::memory_order_relaxed); }
+        static const char* getTaskName(bitindex_t index);
+
+        // コード演奏の1ステップ分の処理時間の最大値 (usec)
+        void setStepPlayUsecMax(uint32_t usec) { set32(STEP_PLAY_USEC_MAX, usec); }
+        uint32_t getStepPlayUsecMax(void) const { return get32(STEP_PLAY_USEC_MAX); }
+    protected:
+        // タスクの稼働状況からCPUクロックの切替えを判定する
+        void updateCpuFreq(void);
+
+        task_counter_t _task_counter[MAX_TASK];
+        std::atomic<uint32_t> _core_run_usec[max_core] = {};
+        // 稼働中のタスクのビットマスク
+        std::atomic<uint32_t> _working_mask { 0 };
+        std::atomic<uint32_t> _low_power_usec { 0 };
+        std::atomic<uint32_t> _high_power_usec { 0 };
+        // クロック切替えの判定中フラグ (判定中に他のタスクが呼んだ場合は待たずに判定を任せる)
+        std::atomic_flag _freq_busy = ATOMIC_FLAG_INIT;
+        // 以下は _freq_busy を得たタスクのみが読み書きする
+        uint32_t _freq_change_usec = 0;
+        bool _cpu_high = true;
     };
 
     struct reg_internal_input_t : public registry_t {
@@ -379,7 +517,7 @@ protected:
     };
 
     struct reg_external_input_t : public registry_t {
-        reg_external_input_t(void) : registry_t(8, 8, DATA_SIZE_32) {}
+        reg_external_input_t(void) : registry_t(16, 16, DATA_SIZE_32) {}
         enum index_t : uint16_t {
             PORTA_BITMASK_BYTE0 = 0x00,
             PORTA_BITMASK_BYTE1 = 0x01,
@@ -389,10 +527,15 @@ protected:
             PORTB_BITMASK_BYTE1 = 0x05,
             PORTB_BITMASK_BYTE2 = 0x06,
             PORTB_BITMASK_BYTE3 = 0x07,
+            PORTB_EDGE_USEC_1   = 0x08,
+            PORTB_EDGE_USEC_2   = 0x0C,
         };
         void setPortABitmask8(uint8_t index, uint8_t bitmask) { set8(PORTA_BITMASK_BYTE0 + index, bitmask); }
         void setPortBValue8(uint8_t index, uint8_t bitmask) { set8(PORTB_BITMASK_BYTE0 + index, bitmask); }
         uint8_t getPortBValue8(uint8_t index) const { return get8(PORTB_BITMASK_BYTE0 + index); }
+        // ポートBの各ピンで最後にエッジを検出した時刻 (割込み発生時点のマイクロ秒)
+        void setPortBEdgeUsec(uint8_t index, uint32_t usec) { set32(PORTB_EDGE_USEC_1 + index * 4, usec); }
+        uint32_t getPortBEdgeUsec(uint8_t index) const { return get32(PORTB_EDGE_USEC_1 + index * 4); }
 
         uint32_t getPortAButtonBitmask(void) const { return get32(PORTA_BITMASK_BYTE0); }
         uint32_t getPortBButtonBitmask(void) const { return get32(PORTB_BITMASK_BYTE0); }
@@ -425,23 +568,121 @@ protected:
             MIDI_CONTROL_VOLUME_END = MIDI_CONTROL_VOLUME_CH1 + def::midi::channel_max,
             MIDI_CONTROL_CHANGE_START = MIDI_CONTROL_VOLUME_END,
             MIDI_CONTROL_CHANGE_END = MIDI_CONTROL_CHANGE_START + 128,
+            MIDI_CONTROL_CHANNEL_PRESSURE = MIDI_CONTROL_CHANGE_END,
         };
         // MIDIチャンネルコントロール (ベロシティ128×16チャンネル分 + プログラムチェンジ+チャンネルボリューム×16チャンネル分)
         // 読み出しには非対応、値をセットすると履歴として取得できる
-        reg_midi_out_control_t(void) : registry_base_t(128) {}
+        reg_midi_out_control_t(void) : registry_base_t(128) {
+            resetShadow();
+        }
+
+        // force_notify を指定した場合はバッチ処理中でも保留せずに通知する
+        void set8(uint16_t index, uint8_t value, bool force_notify = false) override {
+            _addHistory(index, value, data_size_t::DATA_SIZE_8);
+            ++_write_count;
+            if (_batch.load() && !force_notify) {
+                // バッチ処理中は通知を保留し、endBatchでまとめて1回だけ通知する。
+                // ただし保留中の履歴が履歴数の半分に達した場合は、読み出し側が追い越されないよう途中で通知する
+                if (_batch_pending.exchange(true)) { ++_notify_skip_count; }
+                if (++_batch_count < (_history_count >> 1)) { return; }
+            }
+            _batch_pending.store(false);
+            _batch_count = 0;
+            ++_notify_count;
+            _execNotify();
+        }
 
         void setNoteVelocity(uint8_t channel, uint8_t note, uint8_t value) {
             set8(MIDI_CONTROL_NOTE_CH1 + channel * 128 + note, value);
         }
+        // プログラム・ボリューム・CCは送信済みの値を保持し、変化が無い場合は履歴に積まない
+        // 保持値は他のタスク (MIDIタスクの初期値送信) からも読まれるため、exchange で比較と更新を1回で行う
         void setProgramChange(uint8_t channel, uint8_t value) {
+            checkShadow();
+            if (_program_shadow[channel].exchange(value) == value) { ++_write_skip_count; return; }
             set8(MIDI_CONTROL_PROGRAM_CH1 + channel, value);
         }
         void setChannelVolume(uint8_t channel, uint8_t value) {
+            checkShadow();
+            if (_volume_shadow[channel].exchange(value) == value) { ++_write_skip_count; return; }
             set8(MIDI_CONTROL_VOLUME_CH1 + channel, value);
         }
         void setControlChange(uint8_t control, uint8_t value) {
-            set8(MIDI_CONTROL_CHANGE_START + control, value, true);
+            checkShadow();
+            // 120番以降はチャンネルモードメッセージ(全消音等)のため、同値でも必ず送信し、バッチ処理を待たずに通知する
+            if (control < 120) {
+                if (_cc_shadow[control].exchange(value) == value) { ++_write_skip_count; return; }
+            } else if (control == 121) {
+                // リセットオールコントローラで音源側のコントローラ値が初期化されるため、保持している値も破棄する
+                for (auto &cc : _cc_shadow) { cc.store(0xFF); }
+                _pressure_shadow.store(0);
+            }
+            set8(MIDI_CONTROL_CHANGE_START + control, value, control >= 120);
+        }
+        // チャンネルアフタータッチ (発音中のチャンネルへ、送信間隔を空けて送信される)
+        void setChannelPressure(uint8_t value) {
+            checkShadow();
+            if (_pressure_shadow.exchange(value) == value) { ++_write_skip_count; return; }
+            set8(MIDI_CONTROL_CHANNEL_PRESSURE, value);
+        }
+
+        // 最後に設定された値 (未設定の場合は 0xFF)
+        uint8_t getProgramChange(uint8_t channel) const { return _program_shadow[channel].load(); }
+        uint8_t getChannelVolume(uint8_t channel) const { return _volume_shadow[channel].load(); }
+
+        // 音源がリセットされた場合に、保持している送信済みの値を破棄する
+        // (他のタスクから呼ばれるため、次に値を設定する際に書込み側のタスクで破棄する)
+        void invalidateShadow(void) { _invalidate_count.fetch_add(1); }
+        // 送信済みの値を破棄した回数 (出力側が独自に保持している値の破棄に使用する)
+        uint32_t getInvalidateCount(void) const { return _invalidate_count.load(); }
+
+        // 1ステップ分の出力をまとめて通知するためのバッチ処理
+        void beginBatch(void) { _batch.store(true); }
+        void endBatch(void) {
+            _batch.store(false);
+            if (_batch_pending.exchange(false)) {
+                _batch_count = 0;
+                ++_notify_count;
+                _execNotify();
+            }
+        }
+
+        // 統計情報 (累計値)
+        uint32_t getWriteCount(void) const { return _write_count.load(); }
+        uint32_t getWriteSkipCount(void) const { return _write_skip_count.load(); }
+        uint32_t getNotifyCount(void) const { return _notify_count.load(); }
+        uint32_t getNotifySkipCount(void) const { return _notify_skip_count.load(); }
+
+    protected:
+        void checkShadow(void) {
+            uint32_t count = _invalidate_count.load();
+            if (_shadow_checked.exchange(count) != count) {
+                resetShadow();
+            }
         }
+        void resetShadow(void) {
+            for (auto &v : _program_shadow) { v.store(0xFF); }
+            for (auto &v : _volume_shadow) { v.store(0xFF); }
+            for (auto &v : _cc_shadow) { v.store(0xFF); }
+            _pressure_shadow.store(0);
+        }
+
+        // 送信済みの値は演奏タスクが書込み、MIDIタスクが読み出すため atomic とする
+        std::atomic<uint8_t> _program_shadow[def::midi::channel_max];
+        std::atomic<uint8_t> _volume_shadow[def::midi::channel_max];
+        std::atomic<uint8_t> _cc_shadow[120];
+        std::atomic<uint8_t> _pressure_shadow { 0 };
+        // 統計情報は複数のタスクから加算されるため atomic とする
+        std::atomic<uint32_t> _write_count { 0 };
+        std::atomic<uint32_t> _write_skip_count { 0 };
+        std::atomic<uint32_t> _notify_count { 0 };
+        std::atomic<uint32_t> _notify_skip_count { 0 };
+        // バッチ処理の状態は演奏タスク以外 (操作タスク等) からの書込みとも共有するため atomic とする
+        std::atomic<uint16_t> _batch_count { 0 };   // 通知を保留している履歴の数
+        std::atomic<bool> _batch { false };
+        std::atomic<bool> _batch_pending { false };
+        std::atomic<uint32_t> _invalidate_count { 0 };
+        std::atomic<uint32_t> _shadow_checked { 0 };
     } midi_out_control;    // MIDI出力コントロール
 
     // コード演奏アルペジオパターン
@@ -493,6 +734,11 @@ protected:
         void setTone(uint8_t program) { set8(PROGRAM_NUMBER, program); }
         uint8_t getTone(void) const { return get8(PROGRAM_NUMBER); }
         bool isDrumPart(void) const { return get8(PROGRAM_NUMBER) == 128; }
+        // ベースパート判定 (GMのベース系音色、またはベースライン向けボイシング)
+        bool isBassPart(void) const {
+            auto tone = get8(PROGRAM_NUMBER);
+            return (32 <= tone && tone < 40) || getVoicing() == KANTANMusic_Voicing_Static;
+        }
         // パートのボリューム
         void setVolume(uint8_t volume) { set8(VOLUME, volume); }
         uint8_t getVolume(void) const { return get8(VOLUME); }
@@ -781,12 +1027,13 @@ protected:
     };
 
     struct reg_file_command_t : public registry_t {
-        reg_file_command_t(void) : registry_t(16, 4, DATA_SIZE_32) {}
+        reg_file_command_t(void) : registry_t(20, 4, DATA_SIZE_32) {}
         enum index_t : uint8_t {
             CURRENT_SONG_INFO = 0x00,
             UPDATE_LIST = 0x04,
             FILE_LOAD = 0x08,
             FILE_SAVE = 0x0C,
+            TRACE_SAVE = 0x10,
         };
         void setCurrentSongInfo(const def::app::file_command_info_t& info) { set32(CURRENT_SONG_INFO, info.raw, true); }
         def::app::file_command_info_t getCurrentSongInfo(void) const { return def::app::file_command_info_t(get32(CURRENT_SONG_INFO)); }
@@ -796,6 +1043,8 @@ protected:
         def::app::file_command_info_t getFileLoadRequest(void) const { return def::app::file_command_info_t(get32(FILE_LOAD)); }
         void setFileSaveRequest(const def::app::file_command_info_t& info) { set32(FILE_SAVE, info.raw, true); }
         def::app::file_command_info_t getFileSaveRequest(void) const { return def::app::file_command_info_t(get32(FILE_SAVE)); }
+        // レイテンシトレースの記録内容をシリアル出力とSDカードへ保存する要求
+        void setTraceSaveRequest(void) { set32(TRACE_SAVE, 0, true); }
     };
 
     struct reg_song_info_t : public registry_t {
@@ -832,6 +1081,73 @@ protected:
     };
 
     // ソングデータ
+    // コード進行トラック
+    // 曲の展開に合わせて、指定した小節・拍で コード(度数・コード種・オンコード) とスロットを切り替える
+    // 先頭8Byteがヘッダ、以降は1イベントあたり8Byte。イベントは登録順に保持し、演奏時に時間順へ展開する
+    struct reg_chord_sequence_t : public registry_t {
+        reg_chord_sequence_t(void) : registry_t(8 + def::app::max_sequence_event * 8, 0, DATA_SIZE_8) {}
+        enum index_t : uint16_t {
+            EVENT_COUNT,
+            LOOP_START_BAR = 2, // 16bit
+            LOOP_END_BAR = 4,   // 16bit ループ終端 (この小節の手前で LOOP_START_BAR に戻る。0 はループなし)
+            EVENT_TOP = 8,
+        };
+        enum event_index_t : uint8_t {
+            EVENT_BAR = 0,      // 16bit
+            EVENT_BEAT = 2,     // 小節内の拍位置 (0 ～ sequence_beat_per_bar - 1)
+            EVENT_DEGREE,       // 1 ～ 7
+            EVENT_MODIFIER,     // KANTANMusic_Modifier
+            EVENT_BASS_DEGREE,  // 0 はオンコードなし
+            EVENT_SLOT,         // 1 ～ max_slot , 0 はスロットを切り替えない
+        };
+        struct event_t {
+            uint16_t bar;
+            uint8_t beat;
+            uint8_t degree;
+            uint8_t modifier;
+            uint8_t bass_degree;
+            uint8_t slot;
+        };
+        uint8_t getEventCount(void) const { return get8(EVENT_COUNT); }
+        void setEventCount(uint8_t count) {
+            if (count > def::app::max_sequence_event) { count = def::app::max_sequence_event; }
+            set8(EVENT_COUNT, count);
+        }
+        void setEvent(uint8_t index, const event_t& event) {
+            if (index >= def::app::max_sequence_event) { return; }
+            const uint16_t i = EVENT_TOP + index * 8;
+            set16(i + EVENT_BAR, event.bar);
+            set8(i + EVENT_BEAT, event.beat < def::app::sequence_beat_per_bar ? event.beat : 0);
+            set8(i + EVENT_DEGREE, event.degree);
+            set8(i + EVENT_MODIFIER, event.modifier);
+            set8(i + EVENT_BASS_DEGREE, event.bass_degree);
+            set8(i + EVENT_SLOT, event.slot <= def::app::max_slot ? event.slot : 0);
+        }
+        event_t getEvent(uint8_t index) const {
+            const uint16_t i = EVENT_TOP + index * 8;
+            return event_t { get16(i + EVENT_BAR), get8(i + EVENT_BEAT), get8(i + EVENT_DEGREE)
+                           , get8(i + EVENT_MODIFIER), get8(i + EVENT_BASS_DEGREE), get8(i + EVENT_SLOT) };
+        }
+        bool addEvent(const event_t& event) {
+            auto count = getEventCount();
+            if (count >= def::app::max_sequence_event) { return false; }
+            setEvent(count, event);
+            setEventCount(count + 1);
+            return true;
+        }
+        void setLoop(uint16_t start_bar, uint16_t end_bar) {
+            set16(LOOP_START_BAR, start_bar);
+            set16(LOOP_END_BAR, end_bar);
+        }
+        uint16_t getLoopStartBar(void) const { return get16(LOOP_START_BAR); }
+        uint16_t getLoopEndBar(void) const { return get16(LOOP_END_BAR); }
+        void reset(void) {
+            for (int i = 0; i < _registry_size; ++i) {
+                set8(i, 0);
+            }
+        }
+    };
+
     struct song_data_t {
         reg_song_info_t song_info;
 
@@ -840,6 +1156,8 @@ protected:
         // コード演奏時のドラムパートの情報は全スロット共通、パート別に設定する
         reg_chord_part_drum_t chord_part_drum[def::app::max_chord_part];
 
+        reg_chord_sequence_t chord_sequence;
+
         size_t saveSongJSON(uint8_t* data, size_t data_length);
 
         bool loadSongJSON(const uint8_t* data, size_t data_length);
@@ -852,6 +1170,7 @@ protected:
             for (int i = 0; i < def::app::max_chord_part; ++i) {
                 chord_part_drum[i].init(psram);
             }
+            chord_sequence.init(psram);
         }
 
         // メモリ上の文字列データから読み込む(旧仕様)
@@ -868,6 +1187,7 @@ protected:
             for (int i = 0; i < def::app::max_chord_part; ++i) {
                 chord_part_drum[i].assign(src.chord_part_drum[i]);
             }
+            chord_sequence.assign(src.chord_sequence);
             return true;
         }
         void reset(void) {
@@ -878,6 +1198,7 @@ protected:
             for (int i = 0; i < def::app::max_chord_part; ++i) {
                 chord_part_drum[i].reset();
             }
+            chord_sequence.reset();
         }
 
         // 比較オペレータ
@@ -889,6 +1210,7 @@ protected:
             for (int j = 0; j < def::app::max_chord_part; ++j) {
                 if (chord_part_drum[j] != src.chord_part_drum[j]) { return false; }
             }
+            if (chord_sequence != src.chord_sequence) { return false; }
             return true;
         }
         bool operator!= (const song_data_t &src) const { return !(*this == src); }
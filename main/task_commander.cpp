@@ -7,10 +7,35 @@
 
 #include "task_commander.hpp"
 #include "system_registry.hpp"
+#include "latency_trace.hpp"
+#include "velocity_curve.hpp"
+#include "sim_host.hpp"
 
 namespace kanplay_ns {
 //-------------------------------------------------------------------------
 
+// IMUの偏差平方和からベロシティ加算量を求めるための四乗根テーブル (pow4[k] == k^4)
+struct fourth_root_table_t {
+  uint32_t pow4[256];
+  constexpr fourth_root_table_t(void) : pow4 { 0 } {
+    for (uint32_t k = 0; k < 256; ++k) { pow4[k] = k * k * k * k; }
+  }
+};
+static constexpr const fourth_root_table_t fourth_root_table;
+
+// 四乗根を求める (戻り値は 下位8bitが小数部の固定小数点)
+// 整数部はテーブルの二分探索で求め、小数部は隣接するテーブル値の間を線形補間する
+static uint32_t fourthRoot_q8(uint32_t value)
+{
+  uint32_t k = 0;
+  for (uint32_t bit = 128; bit; bit >>= 1) {
+    if (fourth_root_table.pow4[k + bit] <= value) { k += bit; }
+  }
+  uint64_t lower = fourth_root_table.pow4[k];
+  uint64_t upper = (uint64_t)(k + 1) * (k + 1) * (k + 1) * (k + 1);
+  return (k << 8) + (uint32_t)(((value - lower) << 8) / (upper - lower));
+}
+
 class commander_t {
   // チャタリング防止のための前回ボタンを押したタイミングの記録
   uint32_t _chattering_prev_msec[def::hw::max_button_mask];
@@ -27,10 +52,11 @@ class commander_t {
   const uint16_t _thresh_release;
   const uint8_t _bitlength = 1; // ボタンひとつあたりのビット数 (通常は 1。 アナログ扱いの PortB は 8bitとする) 
   const bool _use_internal_imu = false;
+  const def::play::velocity_source_t _velocity_source;
 
 public:
 
-  commander_t(uint8_t bitlen, bool use_internal_imu, uint32_t chattering_bitmask)
+  commander_t(uint8_t bitlen, bool use_internal_imu, uint32_t chattering_bitmask, def::play::velocity_source_t velocity_source)
   : _chattering_target_bitmask { chattering_bitmask }
   , _mask_all       { (uint16_t)((1 << bitlen)- 1 ) }
   , _mask_single    { (uint16_t)( 1 <<(bitlen - 1)) }
@@ -38,6 +64,7 @@ public:
   , _thresh_release { (uint16_t)( _mask_all - _thresh_press ) }
   , _bitlength { bitlen }
   , _use_internal_imu { use_internal_imu }
+  , _velocity_source { velocity_source }
   {}
 
   void start(void)
@@ -120,10 +147,11 @@ public:
             int velocity = imu_base;
             if (_use_internal_imu && imu_ratio) {
               uint32_t imu_sd = system_registry.internal_imu.getImuStandardDeviation();
-              velocity += sqrtf(sqrtf(imu_sd)) * imu_ratio / 100;
+              velocity += (fourthRoot_q8(imu_sd) * imu_ratio / 100) >> 8;
               if (velocity < 1) { velocity = 1; }
               if (velocity > 255) { velocity = 255; }
             }
+            velocity = velocity_curve::apply(_velocity_source, velocity);
             system_registry.operator_command.addQueue( { def::command::set_velocity, velocity } );
             break;
           }
@@ -137,6 +165,9 @@ public:
 // M5_LOGV("command_param:%04x", command_param.raw);
         uint8_t command = command_param.getCommand();
         if (command == 0) { continue; }
+        if (pressed) {
+          latency_trace.bindCommand(command_param.raw);
+        }
         system_registry.operator_command.addQueue(command_param, pressed);
       }
     }
@@ -204,7 +235,7 @@ public:
             int velocity = imu_base;
             if (_use_internal_imu && imu_ratio) {
               uint32_t imu_sd = system_registry.internal_imu.getImuStandardDeviation();
-              velocity += sqrtf(sqrtf(imu_sd)) * imu_ratio / 100;
+              velocity += (fourthRoot_q8(imu_sd) * imu_ratio / 100) >> 8;
               if (velocity < 1) { velocity = 1; }
               if (velocity > 255) { velocity = 255; }
             }
@@ -280,9 +311,9 @@ public:
 #endif
 };
 
-static commander_t commander_internal { 1, true , (1 << def::hw::max_rgb_led) - 1};
-static commander_t commander_port_a   { 1, false, ~0u };
-static commander_t commander_port_b   { 8, false, ~0u };
+static commander_t commander_internal { 1, true , (1 << def::hw::max_rgb_led) - 1, def::play::velocity_source_internal };
+static commander_t commander_port_a   { 1, false, ~0u, def::play::velocity_source_port_a };
+static commander_t commander_port_b   { 8, false, ~0u, def::play::velocity_source_port_b };
 
 void task_commander_t::start(void)
 {
@@ -290,7 +321,9 @@ void task_commander_t::start(void)
   commander_port_a.start();
   commander_port_b.start();
 
-#if defined (M5UNIFIED_PC_BUILD)
+#if defined (KANPLAY_HEADLESS_SIM)
+  // スレッドは作らず、シミュレータから proc を呼び出す (ボタン入力はシミュレータが設定する)
+#elif defined (M5UNIFIED_PC_BUILD)
   // 
   static constexpr const SDL_KeyCode keymap[] = {
     SDL_KeyCode::SDLK_z, SDL_KeyCode::SDLK_x, SDL_KeyCode::SDLK_c, SDL_KeyCode::SDLK_v, SDL_KeyCode::SDLK_b,
@@ -310,8 +343,8 @@ void task_commander_t::start(void)
 #else
   TaskHandle_t handle = nullptr;
   xTaskCreatePinnedToCore((TaskFunction_t)task_func, "command", 1024 * 3, this, def::system::task_priority_commander, &handle, def::system::task_cpu_commander);
-  system_registry.internal_input.setNotifyTaskHandle(handle);
-  system_registry.external_input.setNotifyTaskHandle(handle);
+  system_registry.internal_input.setNotifyTaskHandle(handle, notify_internal_input);
+  system_registry.external_input.setNotifyTaskHandle(handle, notify_external_input);
 #endif
 }
 
@@ -329,74 +362,135 @@ void task_commander_t::task_func(task_commander_t* me)
   // 起動直後に表示されているQRコードについて、何か操作があったらQRコードを消す
   system_registry.popup_qr.setQRCodeType(def::qrcode_type_t::QRCODE_NONE);
 
+  // 起動直後の待機中に受けた通知は消費済みのため、初回は全ての入力元を確認する
+  delay_msec = me->proc(notify_all);
+
+#if defined (M5UNIFIED_PC_BUILD)
+  system_registry.runtime_info.setPressVelocity(100);
+  uint32_t prev_btn_mask = 0;
+  uint32_t wake_msec = 0;
+#endif
+
   for (;;) {
+    uint32_t notify_bits = 0;
     system_registry.task_status.setSuspend(system_registry_t::reg_task_status_t::bitindex_t::TASK_COMMANDER);
 #if defined (M5UNIFIED_PC_BUILD)
-    M5.delay(delay_msec);
+    // PC環境ではキー入力の通知手段が無いため1msおきに読み取り、変化があった場合と期限を迎えた場合のみ処理する
+    M5.delay(1);
     uint32_t btn_mask = 0;
     for (int i = 0; i < 32; ++i) {
       btn_mask |= (m5gfx::gpio_in(i) ? 0 : 1) << i;
     }
-    system_registry.internal_input.setButtonBitmask(btn_mask);
-    system_registry.runtime_info.setPressVelocity(100);
-    delay_msec = 1;
+    if (prev_btn_mask != btn_mask) {
+      prev_btn_mask = btn_mask;
+      system_registry.internal_input.setButtonBitmask(btn_mask);
+      notify_bits = notify_internal_input;
+    }
+    if (notify_bits == 0 && (delay_msec == ~0u || (int32_t)(M5.millis() - wake_msec) < (int32_t)delay_msec)) {
+      continue;
+    }
 #else
-    ulTaskNotifyTake(pdTRUE, delay_msec);
-    delay_msec = portMAX_DELAY;
+    xTaskNotifyWait(0, ~0u, &notify_bits, delay_msec);
 #endif
     system_registry.task_status.setWorking(system_registry_t::reg_task_status_t::bitindex_t::TASK_COMMANDER);
 
-    bool hit = 0;
+    delay_msec = me->proc(notify_bits);
+#if defined (M5UNIFIED_PC_BUILD)
+    wake_msec = M5.millis();
+#endif
+  }
+}
+
+uint32_t task_commander_t::proc(uint32_t notify_bits)
+{
+  const uint32_t msec = engine_millis();
+  bool updated[source_max] = { false, false, false };
+
+  auto update = [&](source_t source, commander_t* commander, uint32_t value, system_registry_t::reg_command_mapping_t* mapping)
+  {
+    updated[source] = true;
+    // チャタリング回避のための遅延処理がある場合はその期限を記録する
+    auto result = commander->update(value, msec, mapping);
+    if (result != ~0u) {
+      _deadline_msec[source] = msec + result;
+      _deadline_mask |= 1 << source;
+    } else {
+      _deadline_mask &= ~(1 << source);
+    }
+  };
+
+  // アフタータッチとして使用中のポートB(ピン1)のアナログ値はボタンとして扱わない
+  const bool port_b_aftertouch = system_registry.user_setting.getPortBAftertouch();
+  const uint32_t port_b_button_mask = port_b_aftertouch ? ~0xFFu : ~0u;
 
-    const registry_t::history_t* history = nullptr;
-    while (nullptr != (history = system_registry.internal_input.getHistory(me->_internal_input_history_code)))
+  const registry_t::history_t* history = nullptr;
+  if (notify_bits & notify_internal_input) {
+    while (nullptr != (history = system_registry.internal_input.getHistory(_internal_input_history_code)))
     {
-      hit = true;
       if (history->index == system_registry_t::reg_internal_input_t::BUTTON_BITMASK) {
-        auto result = commander_internal.update(history->value, M5.millis(), &system_registry.command_mapping_current);
-        if (delay_msec > result) {
-          delay_msec = result;
-        }
-      }
-    }
-    if (hit == 0) { // 履歴がない場合は読み取って処理を行う (チャタリング回避のための遅延処理があり得るため)
-      auto result = commander_internal.update(system_registry.internal_input.getButtonBitmask(), M5.millis(), &system_registry.command_mapping_current);
-      if (delay_msec > result) {
-        delay_msec = result;
+        update(source_internal, &commander_internal, history->value, &system_registry.command_mapping_current);
       }
     }
+  }
 
+  if (notify_bits & notify_external_input) {
+    // 履歴は1Byte単位で積まれるため、いずれかのバイトに変化があった入力元は全体のビットマスクを読み直して1回だけ処理する
     bool hit_a = false, hit_b = false;
-    while (nullptr != (history = system_registry.external_input.getHistory(me->_external_input_history_code)))
+    while (nullptr != (history = system_registry.external_input.getHistory(_external_input_history_code)))
     {
-      if (history->index == system_registry_t::reg_external_input_t::PORTA_BITMASK_BYTE0) {
+      if (history->index <= system_registry_t::reg_external_input_t::PORTA_BITMASK_BYTE3) {
         hit_a = true;
-        auto result = commander_port_a.update(history->value, M5.millis(), &system_registry.command_mapping_external);
-        if (delay_msec > result) {
-          delay_msec = result;
-        }
       } else
-      if (history->index == system_registry_t::reg_external_input_t::PORTB_BITMASK_BYTE0) {
+      if (history->index <= system_registry_t::reg_external_input_t::PORTB_BITMASK_BYTE3) {
         hit_b = true;
-        auto result = commander_port_b.update(history->value, M5.millis(), &system_registry.command_mapping_port_b);
-        if (delay_msec > result) {
-          delay_msec = result;
-        }
       }
     }
-    if (hit_a == false) { // 履歴がない場合は読み取って処理を行う (チャタリング回避のための遅延処理があり得るため)
-      auto result = commander_port_a.update(system_registry.external_input.getPortAButtonBitmask(), M5.millis(), &system_registry.command_mapping_external);
-      if (delay_msec > result) {
-        delay_msec = result;
-      }
+    if (hit_a) {
+      update(source_port_a, &commander_port_a, system_registry.external_input.getPortAButtonBitmask(), &system_registry.command_mapping_external);
+    }
+    if (hit_b) {
+      update(source_port_b, &commander_port_b, system_registry.external_input.getPortBButtonBitmask() & port_b_button_mask, &system_registry.command_mapping_port_b);
     }
-    if (hit_b == false) {
-      auto result = commander_port_b.update(system_registry.external_input.getPortBButtonBitmask(), M5.millis(), &system_registry.command_mapping_port_b);
-      if (delay_msec > result) {
-        delay_msec = result;
+  }
+
+  // 履歴による処理が無く、チャタリング判定の期限を迎えた入力元は現在の状態を読み取って処理する
+  if (_deadline_mask) {
+    for (int source = 0; source < source_max; ++source) {
+      if (updated[source] || !(_deadline_mask & (1 << source))) { continue; }
+      if ((int32_t)(msec - _deadline_msec[source]) < 0) { continue; }
+      switch (source) {
+      default: break;
+      case source_internal:
+        update(source_internal, &commander_internal, system_registry.internal_input.getButtonBitmask(), &system_registry.command_mapping_current);
+        break;
+      case source_port_a:
+        update(source_port_a, &commander_port_a, system_registry.external_input.getPortAButtonBitmask(), &system_registry.command_mapping_external);
+        break;
+      case source_port_b:
+        update(source_port_b, &commander_port_b, system_registry.external_input.getPortBButtonBitmask() & port_b_button_mask, &system_registry.command_mapping_port_b);
+        break;
       }
     }
   }
+
+  if ((notify_bits & notify_external_input) && port_b_aftertouch) {
+    // ポートB(ピン1)のアナログ値をベロシティカーブで変換し、チャンネルアフタータッチとして送る
+    uint8_t pressure = velocity_curve::apply(def::play::velocity_source_port_b, system_registry.external_input.getPortBValue8(0)) >> 1;
+    if (_port_b_pressure != pressure) {
+      _port_b_pressure = pressure;
+      system_registry.operator_command.addQueue( { def::command::channel_pressure, pressure } );
+    }
+  }
+
+  // 最も近いチャタリング判定の期限までの時間を返す。期限が無い場合は portMAX_DELAY 相当の値を返す
+  uint32_t delay_msec = ~0u;
+  for (int source = 0; source < source_max; ++source) {
+    if (!(_deadline_mask & (1 << source))) { continue; }
+    int32_t remain = _deadline_msec[source] - msec;
+    if (remain < 0) { remain = 0; }
+    if (delay_msec > (uint32_t)remain) { delay_msec = remain; }
+  }
+  return delay_msec;
 }
 
 //-------------------------------------------------------------------------
@@ -10,10 +10,33 @@ namespace kanplay_ns {
 //-------------------------------------------------------------------------
 class task_commander_t {
 public:
+  // 入力レジストリからの通知ビット (通知元のレジストリを識別する)
+  enum notify_bit_t : uint32_t {
+    notify_internal_input = 1 << 0,
+    notify_external_input = 1 << 1,
+    notify_all = ~0u,
+  };
+
   void start(void);
+  // 入力の変化を処理してコマンドを発行する。戻り値は次に処理が必要になるまでの時間 (msec)
+  // notify_bits で示されたレジストリの変化と、期限を迎えたチャタリング判定のみを処理する
+  uint32_t proc(uint32_t notify_bits = notify_all);
 private:
+  enum source_t : uint8_t {
+    source_internal,
+    source_port_a,
+    source_port_b,
+    source_max,
+  };
+  // 入力元ごとのチャタリング判定の期限 (msec)
+  uint32_t _deadline_msec[source_max] = { 0, };
+  // チャタリング判定の期限が設定されている入力元のビットマスク
+  uint8_t _deadline_mask = 0;
+
   registry_t::history_code_t _internal_input_history_code = 0;
   registry_t::history_code_t _external_input_history_code = 0;
+  // 最後に送信したポートBのアフタータッチの値
+  uint8_t _port_b_pressure = 0;
   static void task_func(task_commander_t* me);
 };
 
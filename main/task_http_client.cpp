@@ -7,6 +7,8 @@
 
 #include "system_registry.hpp"
 
+#include "ota_patch.hpp"
+
 #if defined (M5UNIFIED_PC_BUILD)
 namespace kanplay_ns {
 
@@ -27,6 +29,7 @@ void task_http_client_t::task_func(task_http_client_t* me)
 #include <esp_https_ota.h>
 #include <esp_crt_bundle.h>
 #include <string.h>
+#include <vector>
 
 #define HASH_LEN 32
 
@@ -59,7 +62,7 @@ static esp_err_t execHttpClient(const char* url, char* data, const size_t length
 
   esp_http_client_config_t config;
   memset(&config, 0, sizeof(esp_http_client_config_t));
-  config.url = def::app::url_ota_info;
+  config.url = url;
   config.crt_bundle_attach = esp_crt_bundle_attach;
   config.event_handler = _http_client_event_handler;
   config.keep_alive_enable = true;
@@ -68,6 +71,7 @@ static esp_err_t execHttpClient(const char* url, char* data, const size_t length
   esp_http_client_handle_t client = esp_http_client_init(&config);
   esp_err_t err = esp_http_client_perform(client);
   esp_http_client_close(client);
+  esp_http_client_cleanup(client);
   return err;
 }
 
@@ -144,74 +148,217 @@ static esp_err_t exec_http_ota(const char* binary_url)
   return esp_https_ota(&ota_config);
 }
 
-static def::command::wifi_ota_state_t exec_get_binary_url(const char* json_url, char* data, const size_t length)
+//-------------------------------------------------------------------------
+// 差分OTA
+// 動作中のパーティションをソースとして差分パッチを適用し、更新先のパーティションへ書き込む
+class delta_ota_io_t : public ota_patch_t::io_t {
+public:
+  bool onHeader(const ota_patch_t::header_t& header) override
+  {
+    // パッチの作成元が動作中のファームウェアと一致するか確認する
+    if (header.source_size > source->size) { return false; }
+    sha256_t sha256;
+    uint8_t buf[1024];
+    for (size_t pos = 0; pos < header.source_size; pos += sizeof(buf)) {
+      size_t len = header.source_size - pos;
+      if (len > sizeof(buf)) { len = sizeof(buf); }
+      if (ESP_OK != esp_partition_read(source, pos, buf, len)) { return false; }
+      sha256.update(buf, len);
+    }
+    uint8_t hash[sha256_t::hash_size];
+    sha256.finish(hash);
+    if (memcmp(hash, header.source_sha256, sha256_t::hash_size) != 0) {
+      M5_LOGW("delta ota: source mismatch");
+      return false;
+    }
+    if (header.target_size > target->size) { return false; }
+    // 書込みに合わせて消去する (先に全体を消去すると、その間に受信が止まり接続が切れることがある)
+    if (ESP_OK != esp_ota_begin(target, OTA_WITH_SEQUENTIAL_WRITES, &handle)) {
+      handle = 0;
+      return false;
+    }
+    target_size = header.target_size;
+    return true;
+  }
+
+  bool readSource(size_t offset, uint8_t* dst, size_t length) override
+  {
+    return ESP_OK == esp_partition_read(source, offset, dst, length);
+  }
+
+  bool writeTarget(const uint8_t* src, size_t length) override
+  {
+    if (ESP_OK != esp_ota_write(handle, src, length)) { return false; }
+    written += length;
+    system_registry.runtime_info.setWiFiOtaProgress(target_size ? written * 100 / target_size : 0);
+    return true;
+  }
+
+  const esp_partition_t* source = nullptr;
+  const esp_partition_t* target = nullptr;
+  esp_ota_handle_t handle = 0;
+  size_t target_size = 0;
+  size_t written = 0;
+};
+
+static bool exec_delta_ota(const char* patch_url)
 {
-  _http_dst = data;
-  _http_dst_remain = length;
-  if (ESP_OK == execHttpClient(json_url, data, length)) {
-    ArduinoJson::JsonDocument json;
-    auto error = deserializeJson(json, data);
-    data[0] = 0;
-
-    if (!error) {
-      auto firmware_array = json["firmware"].as<JsonArray>();
-      auto array_size = firmware_array.size();
-      M5_LOGV("firmware count:%d", array_size);
-      if (array_size != 0) {
-        const char* target_type = "release";
-        if (system_registry.runtime_info.getDeveloperMode()) {
-          target_type = "develop";
-        }
+  delta_ota_io_t io;
+  io.source = esp_ota_get_running_partition();
+  io.target = esp_ota_get_next_update_partition(nullptr);
+  if (io.source == nullptr || io.target == nullptr) {
+    return false;
+  }
+
+  esp_http_client_config_t config;
+  memset(&config, 0, sizeof(esp_http_client_config_t));
+  config.url = patch_url;
+  config.crt_bundle_attach = esp_crt_bundle_attach;
+  config.keep_alive_enable = true;
+  config.skip_cert_common_name_check = true;
+
+  esp_http_client_handle_t client = esp_http_client_init(&config);
+  if (client == nullptr) {
+    return false;
+  }
+
+  ESP_LOGI(TAG, "Attempting to download delta patch from %s", patch_url);
+  ota_patch_t patch;
+  patch.begin(&io);
+  auto result = ota_patch_t::result_error_format;
+  if (ESP_OK == esp_http_client_open(client, 0)
+   && 0 <= esp_http_client_fetch_headers(client)
+   && 200 == esp_http_client_get_status_code(client)) {
+    // 受信した分から順に適用する
+    std::vector<uint8_t> buf(2048);
+    int len;
+    while (0 < (len = esp_http_client_read(client, (char*)buf.data(), buf.size()))) {
+      if (ota_patch_t::result_continue != patch.feed(buf.data(), len)) { break; }
+    }
+    result = patch.getResult();
+  }
+  esp_http_client_close(client);
+  esp_http_client_cleanup(client);
+
+  if (io.handle) {
+    if (result != ota_patch_t::result_done) {
+      esp_ota_abort(io.handle);
+    } else if (ESP_OK == esp_ota_end(io.handle)
+            && ESP_OK == esp_ota_set_boot_partition(io.target)) {
+      return true;
+    }
+  }
+  M5_LOGW("delta ota failed : result:%d  written:%d", result, (int)patch.getTargetWritten());
+  return false;
+}
+
+//-------------------------------------------------------------------------
+
+struct ota_url_t {
+  char full[256];   // ファームウェア全体のURL
+  char delta[256];  // 動作中のバージョンからの差分パッチのURL (無い場合は空)
+};
+
+static def::command::wifi_ota_state_t exec_get_binary_url(const char* json_url, ota_url_t* dst)
+{
+  dst->full[0] = 0;
+  dst->delta[0] = 0;
 
 #if defined ( CONFIG_IDF_TARGET_ESP32S3 )
-        const char* board_name = "cores3";
+  const char* board_name = "cores3";
 #else
-        const char* board_name = "core2";
+  const char* board_name = "core2";
 #endif
-        for (int i = 0; i < array_size; ++i) {
-          auto type = firmware_array[i]["type"].as<const char*>();
-          auto ver = firmware_array[i]["ver"].as<const char*>();
-          auto url_list = firmware_array[i]["url"].as<JsonObject>();
-
-          M5_LOGD("type: %s", type);
-          M5_LOGD("ver: %s", type);
-
-          // ターゲットタイプが同じか確認
-          bool target_check = (0 == strcmp(target_type, type));
-          if (target_check) {
-            auto url = url_list[board_name].as<const char*>();
-            M5_LOGD("url: %s", url);
-            if (url != nullptr) {
-              strncpy(data, url, length);
-              // バージョンが今と一致しているか確認
-              bool version_check = (0 == strcmp(def::app::app_version_string, ver));
-              if (version_check) {
-                return def::command::wifi_ota_state_t::ota_already_up_to_date;
-              }
-              return def::command::wifi_ota_state_t::ota_update_available;
-            }
-          }
-        }
+
+  // 差分パッチの情報が加わるとマニフェストが大きくなるため、受信バッファはヒープに確保し、
+  // 解析時は必要な項目のみを残すフィルタを使用してメモリの使用量を抑える
+  static constexpr const size_t MAX_HTTP_OUTPUT_BUFFER = 4096;
+  std::vector<char> data(MAX_HTTP_OUTPUT_BUFFER + 1, 0);
+  if (ESP_OK != execHttpClient(json_url, data.data(), MAX_HTTP_OUTPUT_BUFFER)) {
+    return def::command::wifi_ota_state_t::ota_connection_error;
+  }
+
+  ArduinoJson::JsonDocument filter;
+  filter["firmware"][0]["type"] = true;
+  filter["firmware"][0]["ver"] = true;
+  filter["firmware"][0]["url"][board_name] = true;
+  filter["firmware"][0]["delta"][board_name] = true;
+
+  ArduinoJson::JsonDocument json;
+  auto error = deserializeJson(json, (const char*)data.data(), DeserializationOption::Filter(filter));
+  if (error) {
+    return def::command::wifi_ota_state_t::ota_connection_error;
+  }
+
+  auto firmware_array = json["firmware"].as<JsonArray>();
+  auto array_size = firmware_array.size();
+  M5_LOGV("firmware count:%d", array_size);
+
+  const char* target_type = "release";
+  if (system_registry.runtime_info.getDeveloperMode()) {
+    target_type = "develop";
+  }
+
+  for (int i = 0; i < array_size; ++i) {
+    auto type = firmware_array[i]["type"].as<const char*>();
+    auto ver = firmware_array[i]["ver"].as<const char*>();
+
+    M5_LOGD("type: %s", type);
+    M5_LOGD("ver: %s", ver);
+
+    // ターゲットタイプが同じか確認
+    if (type == nullptr || ver == nullptr || 0 != strcmp(target_type, type)) { continue; }
+
+    auto url = firmware_array[i]["url"][board_name].as<const char*>();
+    M5_LOGD("url: %s", url);
+    if (url == nullptr) { continue; }
+    strncpy(dst->full, url, sizeof(dst->full) - 1);
+
+    // バージョンが今と一致しているか確認
+    if (0 == strcmp(def::app::app_version_string, ver)) {
+      return def::command::wifi_ota_state_t::ota_already_up_to_date;
+    }
+
+    // 動作中のバージョンを作成元とする差分パッチを探す
+    // 形式 : "delta": { "core2": [ { "from": "033", "url": "https://..." }, ... ] }
+    for (auto delta : firmware_array[i]["delta"][board_name].as<JsonArray>()) {
+      auto from = delta["from"].as<const char*>();
+      auto delta_url = delta["url"].as<const char*>();
+      if (from != nullptr && delta_url != nullptr && 0 == strcmp(def::app::app_version_string, from)) {
+        M5_LOGD("delta url: %s", delta_url);
+        strncpy(dst->delta, delta_url, sizeof(dst->delta) - 1);
+        break;
       }
     }
+    return def::command::wifi_ota_state_t::ota_update_available;
   }
   return def::command::wifi_ota_state_t::ota_connection_error;
 }
 
 static void exec_ota_inner(const char* json_url)
 {
-  static constexpr const size_t MAX_HTTP_OUTPUT_BUFFER = 512;
-  char local_response_buffer[MAX_HTTP_OUTPUT_BUFFER + 1] = { 0 };
+  ota_url_t url = { { 0 }, { 0 } };
 
-  auto state = exec_get_binary_url(json_url, local_response_buffer, MAX_HTTP_OUTPUT_BUFFER);
+  auto state = exec_get_binary_url(json_url, &url);
   system_registry.runtime_info.setWiFiOtaProgress(state);
 
   if (state != def::command::wifi_ota_state_t::ota_update_available) {
     return;
   }
-  auto ret = exec_http_ota(local_response_buffer);
+
+  // 差分パッチがあれば優先して使用し、失敗した場合はファームウェア全体を取得する
+  bool success = false;
+  if (url.delta[0]) {
+    success = exec_delta_ota(url.delta);
+    if (!success) {
+      system_registry.runtime_info.setWiFiOtaProgress(0);
+    }
+  }
+  if (!success) {
+    success = (ESP_OK == exec_http_ota(url.full));
+  }
   system_registry.wifi_control.setOperation(def::command::wifi_operation_t::wfop_disable);
-  if (ret == ESP_OK) {
+  if (success) {
     system_registry.runtime_info.setWiFiOtaProgress(def::command::wifi_ota_state_t::ota_update_done);
     // M5.delay(1024);
     // OTA完了後に本体リセット
@@ -94,6 +94,12 @@ TODO:CoreS3でのSDカード挿抜状態判定を追加する
           system_registry.popup_notify.setPopup(true, def::notify_type_t::NOTIFY_DEVELOPER_MODE);
         }
 
+        // 開発者モードでは電源ボタンの3回クリックでレイテンシトレースを出力する
+        if (M5.BtnPWR.wasClicked() && M5.BtnPWR.getClickCount() == 3
+         && system_registry.runtime_info.getDeveloperMode()) {
+          system_registry.file_command.setTraceSaveRequest();
+        }
+
 #if 0 // for DEBUG
         // これはデバッグ目的で、電源ボタンのクリックに割り当てる特殊操作
         // 謎のピー音放出バグが発生したときにGPIO設定を変更することで音が止まるかを確認するためのコード
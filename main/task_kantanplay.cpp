@@ -3,42 +3,121 @@
 
 #include <M5Unified.h>
 
+#include <algorithm>
+
 #include "common_define.hpp"
 
 #include "task_kantanplay.hpp"
 #include "system_registry.hpp"
+#include "latency_trace.hpp"
+#include "midi_control_mapper.hpp"
+#include "sim_host.hpp"
 
 #include "kantan-music/include/KANTANMusic.h"
 
+#if !defined (M5UNIFIED_PC_BUILD)
+#include <esp_heap_caps.h>
+#endif
+
 namespace kanplay_ns {
 //-------------------------------------------------------------------------
 
+// 演奏用に展開したデータはPSRAMに置かれないよう内部RAMから確保する
+static void* heap_alloc_internal(size_t size)
+{
+#if defined (M5UNIFIED_PC_BUILD)
+  return malloc(size);
+#else
+  return heap_caps_malloc(size, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+#endif
+}
+
+static void heap_free_internal(void* ptr)
+{
+#if defined (M5UNIFIED_PC_BUILD)
+  free(ptr);
+#else
+  heap_caps_free(ptr);
+#endif
+}
+
 void task_kantanplay_t::start(void)
 {
   memset(_midi_pitch_manage, 0xFF, sizeof(_midi_pitch_manage));
+  memset(_layer_step, 0xFF, sizeof(_layer_step));
 
-  _current_usec = M5.micros();
+  _current_usec = engine_micros();
+  setPressVelocity(100);
 
-#if defined (M5UNIFIED_PC_BUILD)
+#if defined (KANPLAY_HEADLESS_SIM)
+  // スレッドは作らず、シミュレータから proc を呼び出す
+#elif defined (M5UNIFIED_PC_BUILD)
   auto thread = SDL_CreateThread((SDL_ThreadFunction)task_func, "kanplay", this);
 #else
   TaskHandle_t handle = nullptr;
   xTaskCreatePinnedToCore((TaskFunction_t)task_func, "kanplay", 1024*3, this, def::system::task_priority_kantanplay, &handle, def::system::task_cpu_kantanplay);
   system_registry.player_command.setNotifyTaskHandle(handle);
+  midi_control_mapper_t::setNotifyTaskHandle(handle);
 #endif
 }
 
+uint32_t task_kantanplay_t::proc(void)
+{
+  uint32_t next_usec;
+  // MIDI出力の通知は処理の区切りごとに1回にまとめる
+  system_registry.midi_out_control.beginBatch();
+  do {
+    _prev_usec = _current_usec;
+    _current_usec = engine_micros();
+    auto next1 = autoProc();
+    auto next2 = chordProc();
+    next_usec = next1 < next2 ? next1 : next2;
+  } while (commandProccessor());
+
+  // 自動演奏中はステップ毎にCC / NRPN の値を反映する。ステップが進まない間は一定間隔で反映する
+  if (_auto_play_onbeat_remain_usec < 0 && midi_control_mapper_t::hasPending()) {
+    int32_t remain_usec = midi_control_idle_cycle_usec - (int32_t)(_current_usec - _midi_control_usec);
+    if (remain_usec <= 0) {
+      applyMidiControl();
+    } else if (next_usec > (uint32_t)remain_usec) {
+      next_usec = remain_usec;
+    }
+  }
+  system_registry.midi_out_control.endBatch();
+  return next_usec;
+}
+
+void task_kantanplay_t::setPressVelocity(uint8_t velocity)
+{
+  _press_velocity = velocity;
+  // パターンの各ベロシティ値に対する結果を先に求めておき、発音時は表引きのみとする
+  for (int v = 0; v < 128; ++v) {
+    int result = v * velocity / 100;
+    if (result > 127) { result = 127; }
+    if (result < 1) { result = 1; }
+    _velocity_scale_table[v] = result;
+  }
+}
+
+task_kantanplay_t::engine_stat_t task_kantanplay_t::getEngineStat(void) const
+{
+  auto stat = _engine_stat;
+  stat.note_on_count = _voice_allocator.getNoteOnCount() - _engine_stat.note_on_count;
+  stat.note_off_count = _voice_allocator.getNoteOffCount() - _engine_stat.note_off_count;
+  return stat;
+}
+
+void task_kantanplay_t::resetEngineStat(void)
+{
+  _engine_stat = engine_stat_t();
+  _engine_stat.note_on_count = _voice_allocator.getNoteOnCount();
+  _engine_stat.note_off_count = _voice_allocator.getNoteOffCount();
+}
+
 void task_kantanplay_t::task_func(task_kantanplay_t* me)
 {
   for (;;) {
-    uint32_t next_usec;
-    do {
-      me->_prev_usec = me->_current_usec;
-      me->_current_usec = M5.micros();
-      auto next1 = me->autoProc();
-      auto next2 = me->chordProc();
-      next_usec = next1 < next2 ? next1 : next2;
-    } while (me->commandProccessor());
+    uint32_t next_usec = me->proc();
 
 #if !defined (M5UNIFIED_PC_BUILD)
     taskYIELD();
@@ -63,6 +142,11 @@ bool task_kantanplay_t::commandProccessor(void)
   if (false == system_registry.player_command.getQueue(&_player_command_history_code, &command_param, &is_pressed))
   { return false; }
 
+  if (is_pressed) {
+    // このコマンドによる発音をトレースの記録対象にする
+    latency_trace.setNoteContext(latency_trace.markCommand(latency_trace_t::hop_player, command_param.raw));
+  }
+
   switch (command_param.getCommand()) {
   default:
     break;
@@ -71,7 +155,19 @@ bool task_kantanplay_t::commandProccessor(void)
     {
       const auto param = command_param.getParam();
       system_registry.runtime_info.setPressVelocity(param);
-      _press_velocity = param;
+      setPressVelocity(param);
+    }
+    break;
+  case def::command::channel_pressure:
+    if (is_pressed) {
+      system_registry.midi_out_control.setChannelPressure(command_param.getParam() & 0x7F);
+    }
+    break;
+  case def::command::panic_stop:
+    if (is_pressed) {
+      // 全消音 (CC120) で止まった音がボイスとして残らないよう、管理情報を空にする
+      _voice_allocator.reset();
+      system_registry.midi_out_control.setControlChange(120, 0);
     }
     break;
   case def::command::sound_effect:
@@ -92,6 +188,9 @@ bool task_kantanplay_t::commandProccessor(void)
   case def::command::chord_step_reset_request:
     procChordStepResetRequest(command_param, is_pressed);
     break;
+  case def::command::sequence_control:
+    procSequenceControl(command_param, is_pressed);
+    break;
 
   case def::command::autoplay_switch:
     if (is_pressed)
@@ -163,6 +262,19 @@ uint32_t task_kantanplay_t::autoProc(void)
     int remain_usec = _auto_play_onbeat_remain_usec - progress_usec;
     if (remain_usec < 0) {
       auto auto_play = system_registry.runtime_info.getChordAutoplayState();
+
+      // コード進行トラックの再生中は、このオモテ拍で演奏するコードとスロットを確定させる
+      if (auto_play == def::play::auto_play_mode_t::auto_play_running
+       && system_registry.runtime_info.getSequencePlay()
+       && !sequenceProc())
+      { // 曲の終端に達したので自動演奏を停止する
+        auto_play = def::play::auto_play_mode_t::auto_play_none;
+        system_registry.runtime_info.setChordAutoplayState(auto_play);
+        system_registry.runtime_info.setSequencePlay(false);
+        _auto_play_offbeat_remain_usec = -1;
+        chordStepReset();
+      }
+
       if (auto_play == def::play::auto_play_mode_t::auto_play_running)
       {
         auto onbeat_cycle_usec = getOnbeatCycleBySongTempo();
@@ -201,12 +313,23 @@ uint32_t task_kantanplay_t::chordProc(void)
 {
   uint32_t next_event_timing = INT32_MAX;
   const int progress_usec = (int32_t)(_current_usec - _prev_usec);
-
-  for (int part = 0; part < def::app::max_chord_part; ++part) {
+  uint32_t pending_count = 0;
+
+  for (int track = 0; track < def::app::max_chord_track; ++track) {
+    // 予定の残っていないトラックは処理しない
+    if (0 == (_track_busy_mask & (1u << track))) { continue; }
+    const int layer = track / def::app::max_chord_part;
+    const int part = track % def::app::max_chord_part;
+    auto slot = getLayerSlot(layer);
+    const bool is_bass = slot && slot->chord_part[part].part_info.isBassPart();
     bool hit_flg = false;
+    bool busy_flg = false;
     for (int pitch = 0; pitch < def::app::max_pitch_with_drum; ++pitch) {
       for (int m = 0; m < max_manage_history; ++m) {
-        auto manage = &_midi_pitch_manage[part][pitch][m];
+        auto manage = &_midi_pitch_manage[track][pitch][m];
+        if (manage->press_usec >= 0 || manage->release_usec >= 0) {
+          ++pending_count;
+        }
 
         int press_usec = manage->press_usec;
         if (press_usec >= 0) {
@@ -216,13 +339,14 @@ uint32_t task_kantanplay_t::chordProc(void)
             auto midi_ch = manage->midi_ch;
             auto velocity = manage->velocity;
             if (velocity) {
-              velocity |= 0x80;
-              system_registry.midi_out_control.setNoteVelocity(midi_ch, note_number, 0);
-              system_registry.midi_out_control.setNoteVelocity(midi_ch, note_number, velocity);
+              _voice_allocator.noteOn(midi_ch, note_number, velocity, is_bass);
               hit_flg = true;
             }
-          } else if (next_event_timing > press_usec) {
-            next_event_timing = press_usec;
+          } else {
+            busy_flg = true;
+            if (next_event_timing > press_usec) {
+              next_event_timing = press_usec;
+            }
           }
           manage->press_usec = press_usec;
         }
@@ -234,22 +358,32 @@ uint32_t task_kantanplay_t::chordProc(void)
             auto note_number = manage->note_number;
             auto midi_ch = manage->midi_ch;
             // 同じノートナンバーの音が他のピッチで鳴っていない場合は音を停止する
-            if (0 == checkOtherPitchNote(part, pitch, midi_ch, note_number)) {
-              system_registry.midi_out_control.setNoteVelocity(manage->midi_ch, manage->note_number, 0);
+            if (0 == checkOtherPitchNote(track, pitch, midi_ch, note_number)) {
+              _voice_allocator.noteOff(manage->midi_ch, manage->note_number);
             }
             manage->note_number = 0xFF;
             manage->velocity = 0;
-          } else if (next_event_timing > release_usec) {
-            next_event_timing = release_usec;
+          } else {
+            busy_flg = true;
+            if (next_event_timing > release_usec) {
+              next_event_timing = release_usec;
+            }
           }
           manage->release_usec = release_usec;
         }
       }
     }
-    if (hit_flg) {
+    if (!busy_flg) {
+      _track_busy_mask &= ~(1u << track);
+    }
+    // パートの発光エフェクトはメインのスロットのみ反映する
+    if (hit_flg && layer == 0) {
       system_registry.runtime_info.hitPartEffect(part);
     }
   }
+  if (_engine_stat.pitch_manage_peak < pending_count) {
+    _engine_stat.pitch_manage_peak = pending_count;
+  }
 
   // パターン編集モードでない場合
   if (system_registry.runtime_info.getPlayMode() != def::playmode::playmode_t::chord_edit_mode) {
@@ -318,6 +452,159 @@ void task_kantanplay_t::procChordDegree(const def::command::command_param_t& com
   }
 }
 
+// コード進行トラックを時間軸に展開する (データに変更がなければ何もしない)
+void task_kantanplay_t::updateSequenceTimeline(void)
+{
+  const auto sequence = &system_registry.song_data.chord_sequence;
+  const auto change = sequence->getChangeCounter();
+  if (_sequence_change == change) { return; }
+  _sequence_change = change;
+
+  static constexpr const uint32_t beat_per_bar = def::app::sequence_beat_per_bar;
+
+  _sequence_timeline.clear();
+  const int count = sequence->getEventCount();
+  _sequence_timeline.reserve(count);
+  uint32_t end_bar = 0;
+  for (int i = 0; i < count; ++i) {
+    auto ev = sequence->getEvent(i);
+    if (ev.degree < 1 || 7 < ev.degree) { continue; }
+    if (end_bar <= ev.bar) { end_bar = ev.bar + 1; }
+    _sequence_timeline.push_back( { ev.bar * beat_per_bar + ev.beat, ev.degree, ev.modifier, ev.bass_degree, ev.slot } );
+  }
+  std::stable_sort(_sequence_timeline.begin(), _sequence_timeline.end(),
+    [](const sequence_entry_t& a, const sequence_entry_t& b) { return a.beat < b.beat; });
+
+  // 同じ拍のイベントは後から登録したものを優先する
+  size_t size = 0;
+  for (auto &entry : _sequence_timeline) {
+    if (size && _sequence_timeline[size - 1].beat == entry.beat) {
+      --size;
+    }
+    _sequence_timeline[size++] = entry;
+  }
+  _sequence_timeline.resize(size);
+
+  _sequence_end_beat = end_bar * beat_per_bar;
+  _sequence_loop_start_beat = sequence->getLoopStartBar() * beat_per_bar;
+  _sequence_loop_end_beat = sequence->getLoopEndBar() * beat_per_bar;
+  if (_sequence_loop_end_beat <= _sequence_loop_start_beat) {
+    _sequence_loop_start_beat = 0;
+    _sequence_loop_end_beat = 0;
+  }
+
+  // 再生位置は維持したままカーソルを新しいタイムラインに合わせる
+  sequenceSeek(_sequence_beat);
+}
+
+// コード進行トラックの再生位置を変更する
+void task_kantanplay_t::sequenceSeek(uint32_t beat)
+{
+  _sequence_beat = beat;
+
+  // 移動先の拍以前で最後のイベントを指しておき、次回のオモテ拍で適用させる
+  auto it = std::upper_bound(_sequence_timeline.begin(), _sequence_timeline.end(), beat,
+    [](uint32_t b, const sequence_entry_t& entry) { return b < entry.beat; });
+  _sequence_cursor = (it == _sequence_timeline.begin()) ? 0 : (it - _sequence_timeline.begin()) - 1;
+
+  system_registry.runtime_info.setSequenceBar(beat / def::app::sequence_beat_per_bar);
+}
+
+bool task_kantanplay_t::sequenceProc(void)
+{
+  updateSequenceTimeline();
+  if (_sequence_timeline.empty()) { return false; }
+
+  if (_sequence_loop_end_beat && _sequence_beat >= _sequence_loop_end_beat) {
+    sequenceSeek(_sequence_loop_start_beat);
+  } else if (_sequence_beat >= _sequence_end_beat) {
+    return false;
+  }
+
+  // タイムラインは拍順に並んでいるため、1拍につき先頭の1件だけを確認すればよい
+  if (_sequence_cursor < _sequence_timeline.size()) {
+    auto &entry = _sequence_timeline[_sequence_cursor];
+    if (entry.beat <= _sequence_beat) {
+      sequenceApply(entry);
+      ++_sequence_cursor;
+    }
+  }
+
+  system_registry.runtime_info.setSequenceBar(_sequence_beat / def::app::sequence_beat_per_bar);
+  ++_sequence_beat;
+  return true;
+}
+
+void task_kantanplay_t::sequenceApply(const sequence_entry_t& entry)
+{
+  // スロットは今回のオモテ拍から切り替える (ボタン表示等の更新は operator 側で行う)
+  if (entry.slot
+   && entry.slot - 1 != system_registry.runtime_info.getPlaySlot()
+   && system_registry.runtime_info.getPlayMode() != def::playmode::playmode_t::chord_edit_mode) {
+    system_registry.runtime_info.setPlaySlot(entry.slot - 1);
+    system_registry.operator_command.addQueue( { def::command::slot_select, entry.slot } );
+  }
+
+  auto chord_play = &system_registry.chord_play;
+  chord_play->setChordModifier(entry.modifier);
+  chord_play->setChordBassDegree(entry.bass_degree);
+  chord_play->setChordDegree(entry.degree);
+
+  _next_option.degree = entry.degree;
+  _next_option.bass_degree = entry.bass_degree;
+}
+
+void task_kantanplay_t::procSequenceControl(const def::command::command_param_t& command_param, const bool is_pressed)
+{
+  if (!is_pressed) { return; }
+  updateSequenceTimeline();
+
+  bool play = system_registry.runtime_info.getSequencePlay();
+  // 直前に演奏した小節
+  const uint32_t bar = _sequence_beat ? (_sequence_beat - 1) / def::app::sequence_beat_per_bar : 0;
+
+  switch (command_param.getParam()) {
+  default: break;
+  case def::command::sequence_control_t::sequence_toggle:
+    play = !play;
+    if (play) { sequenceSeek(0); }
+    break;
+
+  case def::command::sequence_control_t::sequence_start:
+    if (!play) {
+      play = true;
+      sequenceSeek(0);
+    }
+    break;
+
+  case def::command::sequence_control_t::sequence_stop:
+    play = false;
+    break;
+
+  case def::command::sequence_control_t::sequence_rewind:
+    sequenceSeek(0);
+    break;
+
+  case def::command::sequence_control_t::sequence_prev_bar:
+    sequenceSeek((bar ? bar - 1 : 0) * def::app::sequence_beat_per_bar);
+    break;
+
+  case def::command::sequence_control_t::sequence_next_bar:
+    sequenceSeek((bar + 1) * def::app::sequence_beat_per_bar);
+    break;
+  }
+
+  if (_sequence_timeline.empty()) { play = false; }
+
+  if (play != system_registry.runtime_info.getSequencePlay()) {
+    system_registry.runtime_info.setSequencePlay(play);
+    // 再生・停止は自動演奏の開始・停止と連動させる
+    system_registry.player_command.addQueue( { def::command::autoplay_switch
+                                             , play ? def::command::autoplay_switch_t::autoplay_start
+                                                    : def::command::autoplay_switch_t::autoplay_stop } );
+  }
+}
+
 void task_kantanplay_t::procChordBeat(const def::command::command_param_t& command_param, const bool is_pressed)
 {
   if (!is_pressed) { return; }
@@ -335,15 +622,20 @@ void task_kantanplay_t::procChordBeat(const def::command::command_param_t& comma
 
   const auto auto_play = system_registry.runtime_info.getChordAutoplayState();
   const auto offbeat_style = system_registry.user_setting.getOffbeatStyle();
+  const uint32_t beat_usec = getBeatUsec();
 
   if (on_beat) {
     // 自動演奏のサイクルを更新する
-    setOnbeatCycle(_current_usec - _reactive_onbeat_usec);
-    _reactive_onbeat_usec = _current_usec;
+    setOnbeatCycle(beat_usec - _reactive_onbeat_usec);
+    _reactive_onbeat_usec = beat_usec;
 
     if ((auto_play != def::play::auto_play_mode_t::auto_play_none)
      || (offbeat_style != def::play::offbeat_style_t::offbeat_self)) {
       updateOffbeatTiming();
+      // 拍の時刻から処理時点までに経過した分だけ次のウラ拍を早める
+      int32_t delay_usec = _current_usec - beat_usec;
+      _auto_play_offbeat_remain_usec = (_auto_play_offbeat_remain_usec > delay_usec)
+                                     ? _auto_play_offbeat_remain_usec - delay_usec : 0;
     }
   } else {
     // ウラ拍の演奏が手動の場合
@@ -352,7 +644,7 @@ void task_kantanplay_t::procChordBeat(const def::command::command_param_t& comma
       // 手動だが step per beat が 3以上の場合は、後続のウラ拍を自動演奏にする
       const uint_fast8_t step_per_beat = system_registry.current_slot->slot_info.getStepPerBeat();
       if (step_per_beat >= 3) {
-        auto offbeat_cycle_usec = _current_usec - _reactive_onbeat_usec;
+        auto offbeat_cycle_usec = beat_usec - _reactive_onbeat_usec;
         // ウラ拍のタイミングを更新する (TODO : スイングに対応する)
         uint32_t step_cycle_usec = offbeat_cycle_usec;
         _auto_play_offbeat_remain_usec = step_cycle_usec;
@@ -369,6 +661,9 @@ void task_kantanplay_t::chordBeat(const bool on_beat)
   // 何ステップ進むか調べる (ウラを飛ばしてオモテが連打されるケースに対応するため)
   int advance = calcStepAdvance(on_beat);
   if (advance == 0) return;
+  if (on_beat) {
+    ++_engine_stat.beat_count;
+  }
 
   do {
     // アルペジエータのステップを進める
@@ -379,6 +674,41 @@ void task_kantanplay_t::chordBeat(const bool on_beat)
   } while (--advance);
 }
 
+// 拍の時刻を取得する
+// 拍の入力が割り当てられた外部パルス(ポートB)のピンで、押下のエッジがこの処理の直前に検出されていれば、
+// 割込みで記録したエッジの時刻を返す。それ以外の場合は現在の処理時刻を返す
+uint32_t task_kantanplay_t::getBeatUsec(void)
+{
+  // エッジから処理までの経過時間がこれより長いものは今回の拍とは無関係とみなす
+  static constexpr const int32_t edge_valid_usec = 50000;
+
+  uint32_t result = _current_usec;
+  int32_t min_elapsed = edge_valid_usec;
+  for (int i = 0; i < def::hw::max_port_b_pins; ++i) {
+    uint32_t edge_usec = system_registry.external_input.getPortBEdgeUsec(i);
+    if (edge_usec == _port_b_edge_usec[i]) { continue; }
+    _port_b_edge_usec[i] = edge_usec;
+    // 離したエッジ (現在のレベルが非押下) と、拍以外の機能が割り当てられたピンのエッジは使用しない
+    if (system_registry.external_input.getPortBValue8(i) == 0) { continue; }
+    if (!isPortBBeatPin(i)) { continue; }
+    int32_t elapsed = _current_usec - edge_usec;
+    if (0 <= elapsed && elapsed < min_elapsed) {
+      min_elapsed = elapsed;
+      result = edge_usec;
+    }
+  }
+  return result;
+}
+
+bool task_kantanplay_t::isPortBBeatPin(uint8_t pin)
+{
+  auto command = system_registry.command_mapping_port_b.getCommandParamArray(pin);
+  for (auto &cp : command.array) {
+    if (cp.getCommand() == def::command::chord_beat) { return true; }
+  }
+  return false;
+}
+
 void task_kantanplay_t::setOnbeatCycle(int32_t usec)
 {
   uint32_t song_tempo = getOnbeatCycleBySongTempo();
@@ -469,6 +799,12 @@ int32_t task_kantanplay_t::calcStepAdvance(const bool on_beat)
   return advance;
 }
 
+void task_kantanplay_t::applyMidiControl(void)
+{
+  _midi_control_usec = _current_usec;
+  midi_control_mapper_t::apply();
+}
+
 // アルペジエータのステップを進める
 void task_kantanplay_t::chordStepAdvance(void)
 {
@@ -478,6 +814,9 @@ void task_kantanplay_t::chordStepAdvance(void)
     return;
   }
 
+  // CC / NRPN で操作されたパラメータは、このステップの演奏から適用する
+  applyMidiControl();
+
   auto chord_play = &system_registry.chord_play;
 
   bool on_beat = (++_current_beat_index % step_per_beat) == 0;
@@ -607,6 +946,7 @@ void task_kantanplay_t::chordStepAdvance(void)
       }
       system_registry.chord_play.setPartStep(i, current_step);
     }
+    layerStepAdvance(true, force_reset, normal_reset);
   }
   else
   { // オフビート (ウラ拍) の場合
@@ -617,6 +957,59 @@ void task_kantanplay_t::chordStepAdvance(void)
       }
       system_registry.chord_play.setPartStep(i, current_step);
     }
+    layerStepAdvance(false, false, false);
+  }
+}
+
+system_registry_t::kanplay_slot_t* task_kantanplay_t::getLayerSlot(uint8_t layer)
+{
+  if (layer == 0) { return system_registry.current_slot; }
+  uint8_t slot_number = system_registry.runtime_info.getLayerSlot(layer);
+  // 無効なスロット番号や、メインと同じスロットが指定されている場合はレイヤー無効とする
+  if (slot_number == 0 || slot_number > def::app::max_slot) { return nullptr; }
+  auto slot = &system_registry.song_data.slot[slot_number - 1];
+  if (slot == system_registry.current_slot) { return nullptr; }
+  return slot;
+}
+
+// レイヤー演奏のスロットのステップを進める (ビートの進行はメインのスロットに従う)
+void task_kantanplay_t::layerStepAdvance(bool on_beat, bool force_reset, bool normal_reset)
+{
+  const uint_fast8_t step_per_beat = system_registry.current_slot->slot_info.getStepPerBeat();
+  for (int layer = 1; layer < def::app::max_layer; ++layer) {
+    auto slot = getLayerSlot(layer);
+    uint8_t slot_number = slot ? system_registry.runtime_info.getLayerSlot(layer) : 0;
+    bool layer_reset = force_reset;
+    if (_layer_slot_number[layer] != slot_number) {
+      _layer_slot_number[layer] = slot_number;
+      layer_reset = true;
+      for (int i = 0; i < def::app::max_chord_part; ++i) {
+        chordNoteOff(layer * def::app::max_chord_part + i);
+        _layer_step[layer][i] = -1;
+      }
+    }
+    if (slot == nullptr) { continue; }
+
+    for (int i = 0; i < def::app::max_chord_part; ++i) {
+      int current_step = _layer_step[layer][i];
+      if (on_beat) {
+        auto part_info = &slot->chord_part[i].part_info;
+        const int loop_step = part_info->getLoopStep();
+        if (layer_reset || current_step < 0
+         || (normal_reset && current_step >= part_info->getAnchorStep())) {
+          chordNoteOff(layer * def::app::max_chord_part + i);
+          current_step = 0;
+        } else {
+          current_step = ((current_step + step_per_beat) / step_per_beat) * step_per_beat;
+          if (current_step > loop_step) {
+            current_step = 0;
+          }
+        }
+      } else if (current_step >= 0) {
+        current_step = ((current_step / step_per_beat) * step_per_beat) + _current_beat_index;
+      }
+      _layer_step[layer][i] = current_step;
+    }
   }
 }
 
@@ -627,10 +1020,8 @@ void task_kantanplay_t::chordStepPlay(void)
     // コードが選ばれていない場合は終了
     return;
   }
-  int master_key = system_registry.runtime_info.getMasterKey();
-  int slot_key = master_key + (int8_t)system_registry.current_slot->slot_info.getKeyOffset();
-  while (slot_key < 0) { slot_key += 12; }
-  while (slot_key >= 12) { slot_key -= 12; }
+  const uint32_t start_usec = engine_cpu_micros();
+  const int master_key = system_registry.runtime_info.getMasterKey();
 
   KANTANMusic_GetMidiNoteNumberOptions options;
   KANTANMusic_GetMidiNoteNumber_SetDefaultOptions(&options);
@@ -641,33 +1032,148 @@ void task_kantanplay_t::chordStepPlay(void)
   options.bass_semitone_shift =  _bass_semitone_shift;
 
 // M5_LOGE("key: %d, minor_swap: %d, modifier: %d, semitone: %d", key, minor_swap, (int)modifier, semitone);
-  for (int part = 0; part < def::app::max_chord_part; ++part) {
-    bool part_en = system_registry.chord_play.getPartEnable(part);
-    uint8_t midi_ch = part;
-    auto chord_part = &system_registry.current_slot->chord_part[part];
-    auto part_info = &chord_part->part_info;
-    options.position = part_info->getPosition();
-    options.voicing = part_info->getVoicing();
-
-    int displacement_usec = 1000 * part_info->getStrokeSpeed();
-    int autorelease_usec = 1000 * def::app::autorelease_msec;
-    int32_t press_usec = 0;
-    int step = system_registry.chord_play.getPartStep(part);
-    if (step < 0) {
-      continue;
+  for (int layer = 0; layer < def::app::max_layer; ++layer) {
+    auto slot = getLayerSlot(layer);
+    if (slot == nullptr) { continue; }
+
+    int slot_key = master_key + (int8_t)slot->slot_info.getKeyOffset();
+    while (slot_key < 0) { slot_key += 12; }
+    while (slot_key >= 12) { slot_key -= 12; }
+
+    for (int part = 0; part < def::app::max_chord_part; ++part) {
+      const int track = layer * def::app::max_chord_part + part;
+      // メインのスロットは chord_play のステップとパート有効状態を使用する
+      int step;
+      bool part_en = true;
+      if (layer == 0) {
+        step = system_registry.chord_play.getPartStep(part);
+        part_en = system_registry.chord_play.getPartEnable(part);
+      } else {
+        step = _layer_step[layer][part];
+      }
+      if (step < 0 || step >= def::app::max_arpeggio_step) {
+        continue;
+      }
+      auto compiled = getCompiledPart(track, slot);
+
+      // パートが無効の場合はミュート奏法のステップのみ消音処理を行う
+      if (!part_en && !((compiled->mute_step >> step) & 1)) {
+        continue;
+      }
+
+      uint8_t midi_ch = compiled->is_drum ? def::midi::channel_10 : def::app::layer_midi_channel_base[layer] + part;
+      options.position = compiled->position;
+      options.voicing = compiled->voicing;
+
+      bool flg_use = false;
+      for (int i = compiled->step_index[step]; i < compiled->step_index[step + 1]; ++i) {
+        auto &n = compiled->note[i];
+        int velocity = part_en ? n.velocity : 0;
+        if (0 < velocity) {
+          velocity = _velocity_scale_table[velocity & 0x7F];
+        }
+
+        uint32_t note = 0;
+        if (compiled->is_drum) {
+          note = system_registry.song_data.chord_part_drum[part].getDrumNoteNumber(n.pitch);
+        } else {
+          // M5_LOGV("degree: %d, slot_key: %d, semitone: %d, base_degree:%d, base_semitone:%d", degree, slot_key, options.semitone_shift, options.bass_degree, options.bass_semitone_shift);
+          note = KANTANMusic_GetMidiNoteNumber(
+            6 - n.pitch
+            , degree
+            , slot_key
+            , &options
+          );
+        }
+        setPitchManage(track, n.pitch, midi_ch, note, velocity, n.press_usec, n.release_usec);
+        flg_use = true;
+      }
+      if (flg_use) {
+        system_registry.midi_out_control.setProgramChange(midi_ch, compiled->program);
+        system_registry.midi_out_control.setChannelVolume(midi_ch, compiled->chvolume);
+      }
+    }
+  }
+
+  // ステップ演奏処理の所要時間の最大値を記録する
+  uint32_t usec = engine_cpu_micros() - start_usec;
+  ++_engine_stat.step_count;
+  _engine_stat.step_usec_total += usec;
+  if (_engine_stat.step_usec_max < usec) {
+    _engine_stat.step_usec_max = usec;
+  }
+  if (_step_play_usec_max < usec) {
+    _step_play_usec_max = usec;
+    system_registry.task_status.setStepPlayUsecMax(usec);
+  }
+}
+
+const task_kantanplay_t::compiled_part_t* task_kantanplay_t::getCompiledPart(uint8_t track, const system_registry_t::kanplay_slot_t* slot)
+{
+  auto compiled = &_compiled_part[track];
+  auto chord_part = &slot->chord_part[track % def::app::max_chord_part];
+  // スロットが切り替わったか、パターンやパート設定が編集された場合は展開しなおす
+  if (compiled->slot != slot
+   || compiled->arpeggio_change != chord_part->arpeggio.getChangeCounter()
+   || compiled->part_info_change != chord_part->part_info.getChangeCounter()) {
+    compilePart(track, slot);
+  }
+  return compiled;
+}
+
+void task_kantanplay_t::compilePart(uint8_t track, const system_registry_t::kanplay_slot_t* slot)
+{
+  auto compiled = &_compiled_part[track];
+  auto chord_part = &slot->chord_part[track % def::app::max_chord_part];
+  auto part_info = &chord_part->part_info;
+
+  compiled->slot = slot;
+  compiled->arpeggio_change = chord_part->arpeggio.getChangeCounter();
+  compiled->part_info_change = part_info->getChangeCounter();
+
+  compiled->is_drum = part_info->isDrumPart();
+  compiled->position = part_info->getPosition();
+  compiled->voicing = part_info->getVoicing();
+  compiled->program = part_info->getTone();
+  uint8_t chvolume = part_info->getVolume() * 127 / 100;
+  if (chvolume > 127) { chvolume = 127; }
+  compiled->chvolume = chvolume;
+
+  compiled->mute_step = 0;
+
+  // 必要なノート数を数え、確保済みの容量を超える場合のみ確保しなおす
+  const int pitch_max = compiled->is_drum ? def::app::max_pitch_with_drum : def::app::max_pitch_without_drum;
+  size_t note_count = 0;
+  for (int step = 0; step < def::app::max_arpeggio_step; ++step) {
+    bool mute = !compiled->is_drum && chord_part->arpeggio.getStyle(step) == def::play::arpeggio_style_t::mute;
+    for (int pitch_index = 0; pitch_index < pitch_max; ++pitch_index) {
+      if (mute || chord_part->arpeggio.getVelocity(step, pitch_index) != 0) { ++note_count; }
     }
-    bool flg_use = false;
+  }
+  if (compiled->note_capacity < note_count) {
+    heap_free_internal(compiled->note);
+    compiled->note = (compiled_note_t*)heap_alloc_internal(note_count * sizeof(compiled_note_t));
+    compiled->note_capacity = compiled->note ? note_count : 0;
+    if (compiled->note == nullptr) {
+      M5_LOGE("compilePart: heap_alloc failed. size:%d", (int)(note_count * sizeof(compiled_note_t)));
+    }
+  }
+
+  const int stroke_usec = 1000 * part_info->getStrokeSpeed();
+  uint16_t note_index = 0;
+  for (int step = 0; step < def::app::max_arpeggio_step; ++step) {
+    compiled->step_index[step] = note_index;
 
+    int displacement_usec = stroke_usec;
+    int autorelease_usec = 1000 * def::app::autorelease_msec;
     int pitch_flow = 1;
     int pitch_index = 0;
     int pitch_last = def::app::max_pitch_with_drum;
 
     // ドラムパートの場合の処理分岐
-    bool is_drum = (part_info->isDrumPart());
     bool mute = false;
-    if (is_drum) {
+    if (compiled->is_drum) {
       displacement_usec = 0;
-      midi_ch = def::midi::channel_10;
     } else {
       switch (chord_part->arpeggio.getStyle(step))
       {
@@ -703,51 +1209,22 @@ void task_kantanplay_t::chordStepPlay(void)
         break;
       }
     }
+    if (mute) {
+      compiled->mute_step |= 1ull << step;
+    }
 
+    int32_t press_usec = 0;
     for (; pitch_index != pitch_last; pitch_index += pitch_flow) {
-      int velocity = 0;
-      if (part_en) { velocity = chord_part->arpeggio.getVelocity(step, pitch_index); }
-      if (velocity) {
-        if (0 < velocity) {
-          velocity = velocity * _press_velocity / 100;
-          if (velocity > 127) { velocity = 127; }
-          if (velocity < 1) { velocity = 1; }
-        }
-      } else {
-        if (!mute) {
-          continue;
-        }
-        // if (manage->velocity == 0
-        //  && manage->midi_ch == midi_ch) {
-        //     continue;
-        //  }
-      }
-
-      uint32_t note = 0;
-      if (is_drum) {
-        note = system_registry.song_data.chord_part_drum[part].getDrumNoteNumber(pitch_index);
-      } else {
-        if (pitch_index >= 6) { continue; }
-        // M5_LOGV("degree: %d, slot_key: %d, semitone: %d, base_degree:%d, base_semitone:%d", degree, slot_key, options.semitone_shift, options.bass_degree, options.bass_semitone_shift);
-        note = KANTANMusic_GetMidiNoteNumber(
-          6 - pitch_index
-          , degree
-          , slot_key
-          , &options
-        );
-      }
-      setPitchManage(part, pitch_index, midi_ch, note, velocity, press_usec, press_usec + autorelease_usec);
+      if (!compiled->is_drum && pitch_index >= def::app::max_pitch_without_drum) { continue; }
+      int velocity = chord_part->arpeggio.getVelocity(step, pitch_index);
+      // ミュート奏法の場合はベロシティ0のピッチも消音のために残しておく
+      if (velocity == 0 && !mute) { continue; }
+      if (note_index >= compiled->note_capacity) { continue; }
+      compiled->note[note_index++] = { press_usec, press_usec + autorelease_usec, (uint8_t)pitch_index, (int8_t)velocity };
       press_usec += displacement_usec;
-      flg_use = true;
-    }
-    if (flg_use) {
-      uint8_t program = part_info->getTone();
-      uint8_t chvolume = part_info->getVolume() * 127 / 100;
-      if (chvolume > 127) { chvolume = 127; }
-      system_registry.midi_out_control.setProgramChange(midi_ch, program);
-      system_registry.midi_out_control.setChannelVolume(midi_ch, chvolume);
     }
   }
+  compiled->step_index[def::app::max_arpeggio_step] = note_index;
 }
 
 
@@ -905,6 +1382,7 @@ void task_kantanplay_t::chordStepReset(void)
     for (int i = 0; i < def::app::max_chord_part; ++i) {
       system_registry.chord_play.setPartStep(i, -1);
     }
+    memset(_layer_step, 0xFF, sizeof(_layer_step));
   }
 }
 
@@ -914,13 +1392,13 @@ void task_kantanplay_t::chordStepReset(void)
 
 
 // 指定したノートナンバーの音が他のピッチでも鳴っている数を調べる関数
-int32_t task_kantanplay_t::checkOtherPitchNote(int part, int pitch, int midi_ch, int note_number)
+int32_t task_kantanplay_t::checkOtherPitchNote(int track, int pitch, int midi_ch, int note_number)
 {
   int count = 0;
   for (int p = 0; p < def::app::max_pitch_with_drum; ++p) {
     if (p == pitch) { continue; }
     for (int m = 0; m < max_manage_history; ++m) {
-      auto manage = &_midi_pitch_manage[part][p][m];
+      auto manage = &_midi_pitch_manage[track][p][m];
       // まだ鳴っていない音や鳴り終わった音は除外する
       if (manage->press_usec >= 0 || manage->release_usec < 0) { continue; }
       if (manage->note_number != note_number || manage->midi_ch != midi_ch) { continue; }
@@ -934,12 +1412,12 @@ int32_t task_kantanplay_t::checkOtherPitchNote(int part, int pitch, int midi_ch,
   return count;
 }
 
-void task_kantanplay_t::chordNoteOff(int part)
+void task_kantanplay_t::chordNoteOff(int track)
 {
   // auto chord_part = &system_registry.current_slot->chord_part[part];
   for (int pitch_index = 0; pitch_index < def::app::max_pitch_with_drum; ++pitch_index) {
     for (int m = 0; m < max_manage_history; ++m) {
-      auto manage = &_midi_pitch_manage[part][pitch_index][m];
+      auto manage = &_midi_pitch_manage[track][pitch_index][m];
       if (manage->press_usec >= 0 || manage->release_usec >= 0) {
         auto note = manage->note_number;
         manage->velocity = 0;
@@ -948,16 +1426,17 @@ void task_kantanplay_t::chordNoteOff(int part)
         manage->note_number = 0xFF;
         auto midi_ch = manage->midi_ch;
         if (note < def::midi::max_note && midi_ch < def::midi::channel_max) {
-          system_registry.midi_out_control.setNoteVelocity(midi_ch, note, 0);
+          _voice_allocator.noteOff(midi_ch, note);
         }
       }
     }
   }
 }
 
-void task_kantanplay_t::setPitchManage(uint8_t part, uint8_t pitch, uint8_t midi_ch, uint8_t note_number, int8_t velocity, int32_t press_usec, int32_t release_usec)
+void task_kantanplay_t::setPitchManage(uint8_t track, uint8_t pitch, uint8_t midi_ch, uint8_t note_number, int8_t velocity, int32_t press_usec, int32_t release_usec)
 {
-  auto manage = &_midi_pitch_manage[part][pitch][0];
+  _track_busy_mask |= 1u << track;
+  auto manage = &_midi_pitch_manage[track][pitch][0];
   { // 履歴末尾のデータが消失する前に、管理している音を停止する
     if (manage[0].press_usec < 0 && manage[0].release_usec >= 0)
     {
@@ -965,15 +1444,15 @@ void task_kantanplay_t::setPitchManage(uint8_t part, uint8_t pitch, uint8_t midi
       manage[0].press_usec = -1;
 
       // 同じノートナンバーの音が他のピッチで鳴っていない場合は音を停止する
-      if (0 == checkOtherPitchNote(part, pitch, midi_ch, note_number)) {
+      if (0 == checkOtherPitchNote(track, pitch, midi_ch, note_number)) {
 // M5_LOGV("stop note: %d, pitch: %d, midi_ch: %d, note_number: %d, velocity: %d, press_usec: %d, release_usec: %d", part, pitch, midi_ch, note_number, velocity, press_usec, release_usec);
-        system_registry.midi_out_control.setNoteVelocity(midi_ch, note_number, 0);
+        _voice_allocator.noteOff(midi_ch, note_number);
       }
     }
   }
 
   // 履歴をずらす
-  memmove(&(_midi_pitch_manage[part][pitch][0]), &(_midi_pitch_manage[part][pitch][1]), sizeof(midi_pitch_manage_t) * (max_manage_history - 1));
+  memmove(&(_midi_pitch_manage[track][pitch][0]), &(_midi_pitch_manage[track][pitch][1]), sizeof(midi_pitch_manage_t) * (max_manage_history - 1));
 
   // 今回指定された音よりも後のタイミングで処理される予定だった音を探し、予定をキャンセルしたり早めたりする
   for (int m = 0; m < max_manage_history - 1; ++m) {
@@ -1006,6 +1485,83 @@ void task_kantanplay_t::setPitchManage(uint8_t part, uint8_t pitch, uint8_t midi
   }
 }
 
+int task_kantanplay_t::voice_allocator_t::find(uint8_t midi_ch, uint8_t note_number) const
+{
+  for (int i = 0; i < _active_count; ++i) {
+    if (_voice[i].note_number == note_number && _voice[i].midi_ch == midi_ch) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+void task_kantanplay_t::voice_allocator_t::remove(int index)
+{
+  // 末尾の要素で穴埋めする (順序は order で管理しているため並びは問わない)
+  if (index < --_active_count) {
+    _voice[index] = _voice[_active_count];
+  }
+}
+
+void task_kantanplay_t::voice_allocator_t::updateInfo(void)
+{
+  system_registry.runtime_info.setActiveVoiceCount(_active_count);
+  system_registry.runtime_info.setVoiceStealCount(_steal_count);
+}
+
+void task_kantanplay_t::voice_allocator_t::reset(void)
+{
+  _active_count = 0;
+  updateInfo();
+}
+
+void task_kantanplay_t::voice_allocator_t::noteOn(uint8_t midi_ch, uint8_t note_number, uint8_t velocity, bool is_bass)
+{
+  int index = find(midi_ch, note_number);
+  if (index < 0) {
+    // 上限に達している場合、ベースパート以外で最も古い音を停止する
+    const uint8_t limit = system_registry.user_setting.getPolyphonyLimit();
+    while (_active_count >= limit) {
+      int victim = -1;
+      for (int i = 0; i < _active_count; ++i) {
+        if (_voice[i].is_bass) { continue; }
+        if (victim < 0 || (int32_t)(_voice[i].order - _voice[victim].order) < 0) {
+          victim = i;
+        }
+      }
+      if (victim < 0) { break; }
+      system_registry.midi_out_control.setNoteVelocity(_voice[victim].midi_ch, _voice[victim].note_number, 0);
+      remove(victim);
+      ++_steal_count;
+    }
+    if (_active_count < def::app::polyphony_max) {
+      index = _active_count++;
+      _voice[index].midi_ch = midi_ch;
+      _voice[index].note_number = note_number;
+    }
+  }
+  // 同じ音が既に鳴っている場合は一度止めてから鳴らし直す (ボイスは消費しない)
+  if (index >= 0) {
+    _voice[index].order = _order_counter++;
+    _voice[index].is_bass = is_bass;
+  }
+  system_registry.midi_out_control.setNoteVelocity(midi_ch, note_number, 0);
+  system_registry.midi_out_control.setNoteVelocity(midi_ch, note_number, 0x80 | velocity);
+  ++_note_on_count;
+  latency_trace.markNoteOut();
+  updateInfo();
+}
+
+void task_kantanplay_t::voice_allocator_t::noteOff(uint8_t midi_ch, uint8_t note_number)
+{
+  int index = find(midi_ch, note_number);
+  if (index >= 0) {
+    remove(index);
+    updateInfo();
+  }
+  system_registry.midi_out_control.setNoteVelocity(midi_ch, note_number, 0);
+  ++_note_off_count;
+}
 
 void task_kantanplay_t::procNoteButton(const def::command::command_param_t& command_param, const bool is_pressed)
 {
@@ -1020,7 +1576,7 @@ void task_kantanplay_t::procNoteButton(const def::command::command_param_t& comm
   auto midi_ch = manage->midi_ch;
   auto note = manage->note_number;
   if (note < 127 && midi_ch < def::midi::channel_max) {
-    system_registry.midi_out_control.setNoteVelocity(midi_ch, note, 0);
+    _voice_allocator.noteOff(midi_ch, note);
     manage->note_number = 0xFF;
   }
   if (!on_beat) {
@@ -1045,9 +1601,8 @@ void task_kantanplay_t::procNoteButton(const def::command::command_param_t& comm
     manage->note_number = note;
     system_registry.midi_out_control.setChannelVolume(midi_ch, chvolume);
     system_registry.midi_out_control.setProgramChange(midi_ch, program);
-    system_registry.midi_out_control.setNoteVelocity(midi_ch, note, 0);
-    uint8_t velocity = 0x80 | (_press_velocity > 127 ? 127 : _press_velocity);
-    system_registry.midi_out_control.setNoteVelocity(midi_ch, note, velocity);
+    uint8_t velocity = (_press_velocity > 127 ? 127 : _press_velocity);
+    _voice_allocator.noteOn(midi_ch, note, velocity, false);
   }
 }
 
@@ -1063,7 +1618,7 @@ void task_kantanplay_t::procDrumButton(const def::command::command_param_t& comm
   auto note = manage->note_number;
 
   if (note < 127 && midi_ch < def::midi::channel_max) {
-    system_registry.midi_out_control.setNoteVelocity(midi_ch, note, 0);
+    _voice_allocator.noteOff(midi_ch, note);
     manage->note_number = 0xFF;
   }
   if (!on_beat) {
@@ -1082,8 +1637,8 @@ void task_kantanplay_t::procDrumButton(const def::command::command_param_t& comm
     manage->note_number = note;
     system_registry.midi_out_control.setChannelVolume(midi_ch, chvolume);
 
-    uint8_t velocity = 0x80 | (_press_velocity > 127 ? 127 : _press_velocity);
-    system_registry.midi_out_control.setNoteVelocity(def::midi::channel_10, note, velocity);
+    uint8_t velocity = (_press_velocity > 127 ? 127 : _press_velocity);
+    _voice_allocator.noteOn(def::midi::channel_10, note, velocity, false);
   }
 }
 
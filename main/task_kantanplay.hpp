@@ -11,6 +11,22 @@ namespace kanplay_ns {
 class task_kantanplay_t {
 public:
   void start(void);
+  // 自動演奏・発音処理と、溜まっているコマンドの処理を行う。戻り値は次に処理が必要になるまでの時間 (usec)
+  uint32_t proc(void);
+
+  // 演奏エンジンの処理量の集計値 (ベンチマークで性能の変化を検出するため)
+  struct engine_stat_t
+  {
+    uint32_t step_count = 0;        // ステップ演奏処理の実行回数
+    uint32_t step_usec_total = 0;   // ステップ演奏処理の所要時間の合計 (usec)
+    uint32_t step_usec_max = 0;     // ステップ演奏処理の所要時間の最大値 (usec)
+    uint32_t beat_count = 0;        // 演奏したオモテ拍の数
+    uint32_t note_on_count = 0;     // 発音の回数
+    uint32_t note_off_count = 0;    // 消音の回数
+    uint16_t pitch_manage_peak = 0; // 発音・消音の予定を持つ _midi_pitch_manage の要素数の最大値
+  };
+  engine_stat_t getEngineStat(void) const;
+  void resetEngineStat(void);
 private:
   registry_t::history_code_t _player_command_history_code = 0;
   static void task_func(task_kantanplay_t* me);
@@ -116,6 +132,15 @@ Degree操作コマンド {
   // 最新のオンビート演奏時点の時間情報 (usec)
   uint32_t _reactive_onbeat_usec = 0;
 
+  // CC / NRPN の値を最後に反映した時間情報 (usec)
+  uint32_t _midi_control_usec = 0;
+
+  // ステップが進まない間に CC / NRPN の値を反映する間隔 (usec)
+  static constexpr const int32_t midi_control_idle_cycle_usec = 20000;
+
+  // 拍の時刻として採用済みのポートBのエッジ時刻 (usec)
+  uint32_t _port_b_edge_usec[def::hw::max_port_b_pins] = { 0, };
+
   // ステップのオン・オフ進行状況保持用 0==オンビート , 1~3==オフビート位置
   uint8_t _current_beat_index = 0;
 
@@ -139,11 +164,16 @@ Degree操作コマンド {
 
   void chordBeat(const bool on_beat);
   void chordStepAdvance(void);
+  void applyMidiControl(void);
   void chordStepPlay(void);
   int32_t calcSwing_x100(void);
   int32_t calcStepAdvance(const bool on_beat);
   void updateOffbeatTiming(void);
   void setOnbeatCycle(int32_t usec = -1);
+  uint32_t getBeatUsec(void);
+  // ポートBのピンに拍の入力 (chord_beat) が割り当てられているか
+  static bool isPortBBeatPin(uint8_t pin);
+  void setPressVelocity(uint8_t velocity);
   int32_t getOnbeatCycle(void);
   int32_t getOnbeatCycleBySongTempo(void);
   uint32_t autoProc(void);
@@ -153,13 +183,14 @@ Degree操作コマンド {
 
 
   void chordStepReset(void);
-  void chordNoteOff(int part);
+  void chordNoteOff(int track);
   void procSoundEffect(const def::command::command_param_t& command_param, const bool is_pressed);
   void procNoteButton(const def::command::command_param_t& command_param, const bool is_pressed);
   void procDrumButton(const def::command::command_param_t& command_param, const bool is_pressed);
   void procChordStepResetRequest(const def::command::command_param_t& command_param, const bool is_pressed);
 
-  void setPitchManage(uint8_t part, uint8_t pitch, uint8_t midi_ch, uint8_t note_number, int8_t velocity, int32_t press_usec, int32_t release_usec);
+  // track は レイヤー番号 * max_chord_part + パート番号 (レイヤー0はメインのスロット)
+  void setPitchManage(uint8_t track, uint8_t pitch, uint8_t midi_ch, uint8_t note_number, int8_t velocity, int32_t press_usec, int32_t release_usec);
 
   struct midi_pitch_manage_t
   {
@@ -172,8 +203,91 @@ Degree操作コマンド {
   // ピッチごとの演奏情報 (履歴を最大2個分持てるようにする)
   // 履歴の配列は 0 が古い。max_manage_history - 1 が最新
   static constexpr const size_t max_manage_history = 3;
-  midi_pitch_manage_t _midi_pitch_manage[def::app::max_chord_part][def::app::max_pitch_with_drum][max_manage_history];
-  int32_t checkOtherPitchNote(int part, int pitch, int midi_ch, int note_number);
+  midi_pitch_manage_t _midi_pitch_manage[def::app::max_chord_track][def::app::max_pitch_with_drum][max_manage_history];
+  int32_t checkOtherPitchNote(int track, int pitch, int midi_ch, int note_number);
+
+  // 発音・消音の予定が残っているトラックのビットマスク (chordProcはこのトラックのみ処理する)
+  uint32_t _track_busy_mask = 0;
+
+  // レイヤー演奏のスロットを取得する (無効なレイヤーは nullptr)
+  system_registry_t::kanplay_slot_t* getLayerSlot(uint8_t layer);
+  void layerStepAdvance(bool on_beat, bool force_reset, bool normal_reset);
+
+  // レイヤー(メイン以外)のパートごとのステップ位置
+  int8_t _layer_step[def::app::max_layer][def::app::max_chord_part];
+  // レイヤー(メイン以外)のスロット番号 (変化を検出してステップを先頭に戻す)
+  uint8_t _layer_slot_number[def::app::max_layer] = { 0, };
+
+  // パート情報とアルペジオパターンを演奏用に展開したデータ
+  // ステップ毎の演奏処理ではレジストリを読まずにこのデータを使用する
+  struct compiled_note_t
+  {
+    int32_t press_usec;     // ステップ開始から発音までの時間
+    int32_t release_usec;   // ステップ開始から消音までの時間
+    uint8_t pitch;
+    int8_t velocity;
+  };
+  struct compiled_part_t
+  {
+    // 全ステップ分のノートを演奏順に並べたもの (ノートの無いステップは要素を持たない)
+    // ステップ演奏で毎回参照するため内部RAMに確保し、再展開時は容量が足りる限り同じ領域を使う
+    compiled_note_t* note = nullptr;
+    uint16_t note_capacity = 0;
+    // ステップごとの note 配列の開始位置
+    uint16_t step_index[def::app::max_arpeggio_step + 1];
+    // ミュート奏法のステップ (1bitが1ステップに対応)
+    uint64_t mute_step;
+
+    // 展開元のデータ。変更を検出したら再展開する
+    const system_registry_t::kanplay_slot_t* slot = nullptr;
+    uint32_t arpeggio_change = 0;
+    uint32_t part_info_change = 0;
+
+    KANTANMusic_Voicing voicing;
+    int8_t position;
+    uint8_t program;
+    uint8_t chvolume;
+    bool is_drum;
+  };
+  compiled_part_t _compiled_part[def::app::max_chord_track];
+  const compiled_part_t* getCompiledPart(uint8_t track, const system_registry_t::kanplay_slot_t* slot);
+  void compilePart(uint8_t track, const system_registry_t::kanplay_slot_t* slot);
+
+  // コード進行トラックを曲頭からの拍位置の時間軸に展開したデータ
+  // 拍順に並べ、同じ拍に複数のイベントがある場合は後から登録したものだけを残す
+  struct sequence_entry_t
+  {
+    uint32_t beat;        // 曲頭からの拍数
+    uint8_t degree;
+    uint8_t modifier;
+    uint8_t bass_degree;
+    uint8_t slot;         // 1 ～ max_slot , 0 はスロットを切り替えない
+  };
+  std::vector<sequence_entry_t> _sequence_timeline;
+  // 展開元のデータの変更カウンタ。変化を検出したら再展開する
+  uint32_t _sequence_change = ~0u;
+  // 次回のオモテ拍の曲頭からの拍位置
+  uint32_t _sequence_beat = 0;
+  // 最後のイベントがある小節の終端の拍位置
+  uint32_t _sequence_end_beat = 0;
+  // ループ区間の拍位置 (終端が 0 の場合はループなし)
+  uint32_t _sequence_loop_start_beat = 0;
+  uint32_t _sequence_loop_end_beat = 0;
+  // 次に適用するイベントのタイムライン上の位置
+  uint16_t _sequence_cursor = 0;
+
+  void updateSequenceTimeline(void);
+  void sequenceSeek(uint32_t beat);
+  // オモテ拍ごとにタイムラインを1拍進めて、該当するイベントを適用する (曲の終端に達したら false)
+  bool sequenceProc(void);
+  void sequenceApply(const sequence_entry_t& entry);
+  void procSequenceControl(const def::command::command_param_t& command_param, const bool is_pressed);
+
+  // ステップ演奏処理の所要時間の最大値 (usec)
+  uint32_t _step_play_usec_max = 0;
+
+  // 処理量の集計値 (発音・消音の回数は _voice_allocator の値との差分で求める)
+  engine_stat_t _engine_stat;
 
   struct midi_note_manage_t
   {
@@ -182,6 +296,38 @@ Degree操作コマンド {
   };
   midi_note_manage_t _midi_note_manage[def::hw::max_main_button];
 
+  // 内部音源の同時発音数を管理し、上限を超える場合は古い音から停止する (ボイススティール)
+  // ベースパートの音はスティールの対象外とする
+  struct voice_allocator_t
+  {
+    void noteOn(uint8_t midi_ch, uint8_t note_number, uint8_t velocity, bool is_bass);
+    void noteOff(uint8_t midi_ch, uint8_t note_number);
+    // 全ての音が停止された時に、発音中のボイスを全て解放する
+    void reset(void);
+    uint32_t getNoteOnCount(void) const { return _note_on_count; }
+    uint32_t getNoteOffCount(void) const { return _note_off_count; }
+  private:
+    struct voice_t
+    {
+      uint32_t order;   // 発音順 (値が小さいほど古い)
+      uint8_t midi_ch;
+      uint8_t note_number;
+      bool is_bass;
+    };
+    int find(uint8_t midi_ch, uint8_t note_number) const;
+    void remove(int index);
+    void updateInfo(void);
+
+    // 発音中のボイス一覧 (先頭から _active_count 個が有効)
+    voice_t _voice[def::app::polyphony_max];
+    uint32_t _order_counter = 0;
+    uint8_t _active_count = 0;
+    uint16_t _steal_count = 0;
+    uint32_t _note_on_count = 0;
+    uint32_t _note_off_count = 0;
+  };
+  voice_allocator_t _voice_allocator;
+
   // registry_t::history_code_t _slot_index;
   uint32_t _prev_usec = 0;
   uint32_t _current_usec = 0;
@@ -191,6 +337,8 @@ Degree操作コマンド {
 
   // 演奏時のベロシティ
   uint8_t _press_velocity;
+  // パターンのベロシティ(1-127)に演奏時ベロシティを反映した値の表 (set_velocity受信時に更新する)
+  uint8_t _velocity_scale_table[128];
 
   bool _step_reset_request = false;
 };
@@ -7,10 +7,20 @@
 
 #include "common_define.hpp"
 #include "system_registry.hpp"
+#include "latency_trace.hpp"
+#include "velocity_curve.hpp"
+#include "midi_router.hpp"
+#include "midi_chord_recognizer.hpp"
+#include "midi_bulk_transfer.hpp"
+#include "midi_control_mapper.hpp"
+#include "sim_host.hpp"
 // #include "driver_midi.hpp"
 
 #include "midi/midi_transport_uart.hpp"
 #include "midi/midi_transport_ble.hpp"
+#include "midi/midi_transport_usb.hpp"
+#include "midi/midi_transport_rtp.hpp"
+#include "midi/midi_transport_capture.hpp"
 
 #if __has_include(<freertos/freertos.h>)
  #include <freertos/FreeRTOS.h>
@@ -19,137 +29,164 @@
 
 namespace kanplay_ns {
 //-------------------------------------------------------------------------
+static midi_router_t midi_router;
+#if !defined (M5UNIFIED_PC_BUILD)
+static TaskHandle_t midi_task_handle = nullptr;
+#endif
+
 class subtask_midi_t {
 private:
   midi_driver::MIDIDriver _midi;
+  midi_chord_recognizer_t _chord_recognizer;
+  midi_bulk_transfer_t _bulk_transfer;
+  midi_control_mapper_t _control_mapper;
   system_registry_t::reg_task_status_t::bitindex_t _task_status_index;
+  def::midi::port_t _port;
+  uint8_t _chord_channel = 0;
 
 public:
-  subtask_midi_t(midi_driver::MIDI_Transport* transport, system_registry_t::reg_task_status_t::bitindex_t task_status_index)
+  subtask_midi_t(midi_driver::MIDI_Transport* transport, system_registry_t::reg_task_status_t::bitindex_t task_status_index, def::midi::port_t port)
   : _midi { transport }
+  , _bulk_transfer { port }
   , _task_status_index { task_status_index }
+  , _port { port }
   {
+    _bulk_transfer.setOutput(sysex_output, this);
   }
 
+  def::midi::port_t getPort(void) const { return _port; }
+
   static void task_func(subtask_midi_t* me)
   {
-    registry_t::history_code_t history_code_midi_out = 0;
-    uint8_t prev_midi_volume = 0;
-    bool prev_tx_enable = false;
-    bool prev_rx_enable = false;
-    uint8_t channel_volume[def::midi::channel_max];
-    uint8_t program_number[def::midi::channel_max];
-    auto midi = &(me->_midi);
-
     for (;;) {
-      if (!prev_rx_enable) {
+      if (!me->_prev_rx_enable) {
         system_registry.task_status.setSuspend(me->_task_status_index);
       }
   #if defined (M5UNIFIED_PC_BUILD)
       M5.delay(1);
   #else
-      ulTaskNotifyTake(pdTRUE, prev_rx_enable ? 1 : 2048);
+      ulTaskNotifyTake(pdTRUE, me->_prev_rx_enable ? 1 : 2048);
+  #endif
+      if (me->proc()) {
+        // 受信メッセージを振り分けるためルータ段を起こす
+  #if !defined (M5UNIFIED_PC_BUILD)
+        xTaskNotifyGive(midi_task_handle);
   #endif
-      bool tx_enable = midi->getEnableTx();
-      bool rx_enable = midi->getEnableRx();
-      if (tx_enable || rx_enable) {
-        system_registry.task_status.setWorking(me->_task_status_index);
-      }
-      if (rx_enable) {
-        prev_rx_enable = rx_enable;
-        midi->receive();
-        midi_driver::MIDI_Message message;
-        while (midi->receiveMessage(&message)) {
-// printf("status:%02x  len:%d  data:%02x %02x", message.status, message.data.size(), message.data[0], message.data[1]);
-          uint8_t channel = message.channel;
-          if ((channel == 0) && ((message.type & ~1) == 0x08)) {
-            uint8_t note = message.data[0];
-            auto command_param_array = system_registry.command_mapping_midinote.getCommandParamArray(note);
-            if (!command_param_array.empty()) {
-              uint8_t velocity = (message.type == 0x09) // NoteOn
-                               ? message.data[1]
-                               : 0;
-              if (velocity) {
-                system_registry.operator_command.addQueue( { def::command::set_velocity, velocity } );
-              }
-              for (auto command_param : command_param_array.array) {
-                uint8_t command = command_param.getCommand();
-                if (command == 0) { continue; }
-                system_registry.operator_command.addQueue(command_param, velocity ? true : false);
-              }
-            }
-          }
-        }
       }
+    }
+  }
 
-      if (prev_tx_enable != tx_enable) {
-        prev_tx_enable = tx_enable;
-        if (tx_enable) {
-          prev_midi_volume = 0;
-          for (int i = 0; i < 16; ++i) {
-            // チャンネルボリュームおよびプログラムチェンジを設定
-            uint8_t vol = channel_volume[i];
-            midi->sendControlChange(def::midi::channel_1 + i, 7, vol);
-            uint8_t prg = program_number[i];
-            midi->sendProgramChange(def::midi::channel_1 + i, prg);
-          }
-        }
+  // 受信したメッセージの処理と、ルータ段が振り分けたメッセージの送信を1回分行う
+  // 受信メッセージをルータ段へ渡した場合は true を返す
+  bool proc(void)
+  {
+    auto midi = &_midi;
+    bool tx_enable = midi->getEnableTx();
+    bool rx_enable = midi->getEnableRx();
+    if (tx_enable || rx_enable) {
+      system_registry.task_status.setWorking(_task_status_index);
+    }
+    bool routed = false;
+    if (rx_enable) {
+      _prev_rx_enable = rx_enable;
+      uint8_t chord_channel = system_registry.midi_port_setting.getChordInputChannel();
+      if (_chord_channel != chord_channel) {
+        _chord_channel = chord_channel;
+        _chord_recognizer.reset();
       }
-      if (tx_enable) {
-        auto midi_volume = system_registry.user_setting.getMIDIMasterVolume();
-        if (prev_midi_volume != midi_volume) {
-          prev_midi_volume = midi_volume;
-          // マスターボリューム設定
-          midi->sendControlChange(def::midi::channel_1, 99, 55);
-          midi->sendControlChange(def::midi::channel_1, 98,  7);
-          midi->sendControlChange(def::midi::channel_1,  6, midi_volume);
+      midi->receive();
+      midi_driver::MIDI_Message message;
+      while (midi->receiveMessage(&message)) {
+// printf("status:%02x  len:%d  data:%02x %02x", message.status, message.data.size(), message.data[0], message.data[1]);
+        uint8_t channel = message.channel;
+        if ((channel + 1 == _chord_channel) && ((message.type & ~1) == 0x08)) {
+          // コード判定用チャンネルのノートは、ノート番号ごとのコマンド割当を使わずに押鍵状態からコードを判定する
+          _chord_recognizer.noteEvent(channel, message.data[0], (message.type == 0x09) ? message.data[1] : 0);
         }
-        const registry_t::history_t* history;
-        while (nullptr != (history = system_registry.midi_out_control.getHistory(history_code_midi_out))) {
-          if (system_registry_t::reg_midi_out_control_t::MIDI_CONTROL_NOTE_CH1 <= history->index && history->index < system_registry_t::reg_midi_out_control_t::MIDI_CONTROL_NOTE_END)
-          {
-            int index = history->index - system_registry_t::reg_midi_out_control_t::MIDI_CONTROL_NOTE_CH1;
-            auto channel = index >> 7;
-            auto note = index & 0x7F;
-            auto velocity = history->value;
-            velocity = (velocity > 0x80) ? velocity & 0x7F : 0;
-
-            midi->sendNoteOn(channel, note, velocity);
-          }
-          else if (system_registry_t::reg_midi_out_control_t::MIDI_CONTROL_PROGRAM_CH1 <= history->index && history->index < system_registry_t::reg_midi_out_control_t::MIDI_CONTROL_PROGRAM_END) {
-            int channel = history->index - system_registry_t::reg_midi_out_control_t::MIDI_CONTROL_PROGRAM_CH1;
-            auto value = history->value & 0x7F;
-            if (program_number[channel] != value) {
-              program_number[channel] = value;
-              midi->sendProgramChange(channel, value);
+        else if ((channel == 0) && ((message.type & ~1) == 0x08)) {
+          uint8_t note = message.data[0];
+          auto command_param_array = system_registry.command_mapping_midinote.getCommandParamArray(note);
+          if (!command_param_array.empty()) {
+            uint8_t velocity = (message.type == 0x09) // NoteOn
+                             ? message.data[1]
+                             : 0;
+            if (velocity) {
+              velocity = velocity_curve::apply(def::play::velocity_source_midi, velocity);
+              system_registry.operator_command.addQueue( { def::command::set_velocity, velocity } );
             }
-          }
-          else if (system_registry_t::reg_midi_out_control_t::MIDI_CONTROL_VOLUME_CH1 <= history->index && history->index < system_registry_t::reg_midi_out_control_t::MIDI_CONTROL_VOLUME_END) {
-            int channel = history->index - system_registry_t::reg_midi_out_control_t::MIDI_CONTROL_VOLUME_CH1;
-            auto value = history->value & 0x7F;
-            if (channel_volume[channel] != value) {
-              midi->sendControlChange(channel, 7, value);
-              channel_volume[channel] = value;
-            }
-          }
-          else if (system_registry_t::reg_midi_out_control_t::MIDI_CONTROL_CHANGE_START <= history->index && history->index < system_registry_t::reg_midi_out_control_t::MIDI_CONTROL_CHANGE_END) {
-            int cc = history->index - system_registry_t::reg_midi_out_control_t::MIDI_CONTROL_CHANGE_START;
-            auto value = history->value & 0x7F;
-  M5_LOGV("cc: %d, value: %d", cc, value);
-            for (int channel = def::midi::channel_1; channel < def::midi::channel_max; ++channel) {
-              midi->sendControlChange(channel, cc, value);
+            for (auto command_param : command_param_array.array) {
+              uint8_t command = command_param.getCommand();
+              if (command == 0) { continue; }
+              system_registry.operator_command.addQueue(command_param, velocity ? true : false);
             }
           }
         }
-        midi->sendFlush();
-      } else {
-        history_code_midi_out = system_registry.midi_out_control.getHistoryCode();
+        else if (message.type == 0x0B) { // ControlChange
+          _control_mapper.controlChange(channel, message.data[0], message.data[1]);
+        }
+        // 他のポートへのルーティング (SysExは対象外)
+        size_t data_len = message.data.size();
+        if (message.status == def::midi::system_exclusive) {
+          _bulk_transfer.receive(message.data.data(), data_len, engine_millis());
+        }
+        else if (data_len <= 2) {
+          routed |= midi_router.input(_port, message.status
+                                      , data_len > 0 ? message.data[0] : 0
+                                      , data_len > 1 ? message.data[1] : 0);
+        }
+      }
+    } else if (_chord_channel) {
+      // 受信を停止した時点で押鍵状態を破棄し、発行中のコードを離す
+      _chord_channel = 0;
+      _chord_recognizer.reset();
+    }
+
+    // バルク転送の先行送信・再送
+    if (_bulk_transfer.isBusy()) {
+      _bulk_transfer.proc(engine_millis());
+    }
+
+    // ルータ段が振り分けたメッセージを送信する (ランニングステータスは MIDIDriver で付け直す)
+    uint8_t message[midi_router_t::message_size];
+    if (tx_enable) {
+      bool note_on = false;
+      while (midi_router.popOutput(_port, message)) {
+        note_on |= ((message[0] & 0xF0) == def::midi::note_on) && message[2];
+        midi->sendMessage(message[0], message[1], message[2]);
+      }
+      midi->sendFlush();
+      // SysEx を含め、この回に送信したデータをまとめて出力する
+      midi->flushTransport();
+      if (note_on) {
+        latency_trace.markTransport();
       }
+    } else {
+      // 送信停止中に残ったメッセージは破棄する
+      while (midi_router.popOutput(_port, message)) {}
     }
+    return routed;
   }
+
+private:
+  static void sysex_output(void* user, const uint8_t* data, size_t length)
+  {
+    auto me = (subtask_midi_t*)user;
+    if (me->_midi.getEnableTx()) {
+      me->_midi.sendSysEx(data, length);
+    }
+  }
+
+  bool _prev_rx_enable = false;
 };
 
-#if defined (M5UNIFIED_PC_BUILD)
+#if defined (KANPLAY_HEADLESS_SIM)
+// ヘッドレスシミュレータでは内部MIDIの代わりに送信内容をファイルへ記録する
+static midi_driver::MIDI_Transport_Capture capture_midi_transport;
+static subtask_midi_t subtask_array[] = {
+  { &capture_midi_transport, system_registry_t::reg_task_status_t::bitindex_t::TASK_MIDI_INTERNAL, def::midi::port_internal },
+};
+
+#elif defined (M5UNIFIED_PC_BUILD)
 //  static windows_midi_transport_t windows_midi_transport; // かんぷれ内部MIDI
 //  static subtask_midi_t subtask_array[] = {
 //    { &windows_midi_transport, system_registry_t::reg_task_status_t::bitindex_t::TASK_MIDI_INTERNAL },
@@ -164,16 +201,28 @@ static midi_driver::MIDI_Transport_UART portc_midi_transport; // PortC外部MIDI
 #ifdef MIDI_TRANSPORT_BLE_HPP
 static midi_driver::MIDI_Transport_BLE ble_midi_transport; // BLE-MIDI
 #endif
+#if defined (MIDI_TRANSPORT_USB_ENABLED)
+static midi_driver::MIDI_Transport_USB usb_midi_transport; // USB-MIDI
+#endif
+#if defined (MIDI_TRANSPORT_RTP_ENABLED)
+static midi_driver::MIDI_Transport_RTP rtp_midi_transport; // RTP-MIDI (Wi-Fi)
+#endif
 
 // static uart_midi_transport_t in_uart_midi_transport; // かんぷれ内部MIDI
 // static uart_midi_transport_t ex_uart_midi_transport; // PortC外部MIDI
 // static ble_midi_transport_t ble_midi_transport; // BLE MIDI
 // static usb_midi_transport_t usb_midi_transport; // USB MIDI
 static subtask_midi_t subtask_array[] = {
-  { &in_uart_midi_transport, system_registry_t::reg_task_status_t::bitindex_t::TASK_MIDI_INTERNAL },
-  { &portc_midi_transport  , system_registry_t::reg_task_status_t::bitindex_t::TASK_MIDI_EXTERNAL },
+  { &in_uart_midi_transport, system_registry_t::reg_task_status_t::bitindex_t::TASK_MIDI_INTERNAL, def::midi::port_internal },
+  { &portc_midi_transport  , system_registry_t::reg_task_status_t::bitindex_t::TASK_MIDI_EXTERNAL, def::midi::port_portc },
 #ifdef MIDI_TRANSPORT_BLE_HPP
-  { &ble_midi_transport    , system_registry_t::reg_task_status_t::bitindex_t::TASK_MIDI_BLE },
+  { &ble_midi_transport    , system_registry_t::reg_task_status_t::bitindex_t::TASK_MIDI_BLE     , def::midi::port_ble },
+#endif
+#if defined (MIDI_TRANSPORT_USB_ENABLED)
+  { &usb_midi_transport    , system_registry_t::reg_task_status_t::bitindex_t::TASK_MIDI_USB     , def::midi::port_usb },
+#endif
+#if defined (MIDI_TRANSPORT_RTP_ENABLED)
+  { &rtp_midi_transport    , system_registry_t::reg_task_status_t::bitindex_t::TASK_MIDI_RTP     , def::midi::port_rtp },
 #endif
 // {&ble_midi_transport, system_registry_t::reg_task_status_t::bitindex_t::TASK_MIDI_BLE }, 
 // {&usb_midi_transport, system_registry_t::reg_task_status_t::bitindex_t::TASK_MIDI_USB }, 
@@ -181,7 +230,8 @@ static subtask_midi_t subtask_array[] = {
 #endif
 static constexpr const size_t max_subtask = sizeof(subtask_array)/sizeof(subtask_array[0]);
 
-#if defined (M5UNIFIED_PC_BUILD)
+#if defined (KANPLAY_HEADLESS_SIM)
+#elif defined (M5UNIFIED_PC_BUILD)
  SDL_Thread* subtask_handle[max_subtask];
 #else
  TaskHandle_t subtask_handle[max_subtask];
@@ -189,8 +239,14 @@ static constexpr const size_t max_subtask = sizeof(subtask_array)/sizeof(subtask
 
 void task_midi_t::start(void)
 {
+  midi_chord_recognizer_t::initTable();
 
-#if defined (M5UNIFIED_PC_BUILD)
+#if defined (KANPLAY_HEADLESS_SIM)
+  // スレッドは作らず、シミュレータから proc を呼び出す
+  capture_midi_transport.begin();
+  capture_midi_transport.setEnable(true, true);
+  midi_router.setOutputEnable(def::midi::port_internal, true);
+#elif defined (M5UNIFIED_PC_BUILD)
   // windows_midi_transport_t::config_t config;
 
   // config.deviceID = 0;
@@ -212,6 +268,7 @@ void task_midi_t::start(void)
     in_uart_midi_transport.setConfig(config);
     in_uart_midi_transport.begin();
     in_uart_midi_transport.setEnable(true, false);
+    midi_router.setOutputEnable(def::midi::port_internal, true);
 
     // 外部PortC用MIDI
     config.uart_port_num = 2; // UART_NUM_2
@@ -229,9 +286,28 @@ void task_midi_t::start(void)
     // オン・オフはsystem_registryで設定する
   }
 #endif
+#if defined (MIDI_TRANSPORT_USB_ENABLED)
+  {
+    midi_driver::MIDI_Transport_USB::config_t config;
+    usb_midi_transport.setConfig(config);
+    usb_midi_transport.begin();
+    // オン・オフはsystem_registryで設定する
+  }
+#endif
+#if defined (MIDI_TRANSPORT_RTP_ENABLED)
+  {
+    // ソケットは Wi-Fi の接続後に受信タスクの中で開く
+    midi_driver::MIDI_Transport_RTP::config_t config;
+    config.port = def::midi::rtp_midi_port;
+    rtp_midi_transport.setConfig(config);
+    rtp_midi_transport.begin();
+    // オン・オフはsystem_registryで設定する
+  }
+#endif
 
   TaskHandle_t handle = nullptr;
   xTaskCreatePinnedToCore((TaskFunction_t)task_func, "midi", 1024*3, this, def::system::task_priority_midi, &handle, def::system::task_cpu_midi);
+  midi_task_handle = handle;
   system_registry.midi_out_control.setNotifyTaskHandle(handle);
   system_registry.midi_port_setting.setNotifyTaskHandle(handle);
 
@@ -248,25 +324,83 @@ void task_midi_t::task_func(task_midi_t* me)
     M5.delay(1);
   }
 #else
+  uint32_t port_setting_counter = ~0u;
   for (;;) {
-    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    // 送信間隔の制限で保留しているメッセージがある場合は、通知が無くても一定時間後に処理する
+    TickType_t wait_ticks = portMAX_DELAY;
+    if (midi_router.isOutputPending()) {
+      wait_ticks = pdMS_TO_TICKS(midi_router_t::pressure_interval_msec);
+      if (wait_ticks == 0) { wait_ticks = 1; }
+    }
+    ulTaskNotifyTake(pdTRUE, wait_ticks);
 
-    auto portc_setting = system_registry.midi_port_setting.getPortCMIDI();
-    bool portc_out = portc_setting & def::command::ex_midi_mode_t::midi_output;
-    bool portc_in  = portc_setting & def::command::ex_midi_mode_t::midi_input;
-    portc_midi_transport.setEnable(portc_out, portc_in);
+    auto counter = system_registry.midi_port_setting.getChangeCounter();
+    bool port_changed = port_setting_counter != counter;
+    if (port_changed) {
+      port_setting_counter = counter;
+      auto portc_setting = system_registry.midi_port_setting.getPortCMIDI();
+      bool portc_out = portc_setting & def::command::ex_midi_mode_t::midi_output;
+      bool portc_in  = portc_setting & def::command::ex_midi_mode_t::midi_input;
+      portc_midi_transport.setEnable(portc_out, portc_in);
+      midi_router.setOutputEnable(def::midi::port_portc, portc_out);
 #ifdef MIDI_TRANSPORT_BLE_HPP
-    auto ble_setting = system_registry.midi_port_setting.getBLEMIDI();
-    bool ble_out = ble_setting & def::command::ex_midi_mode_t::midi_output;
-    bool ble_in  = ble_setting & def::command::ex_midi_mode_t::midi_input;
-    ble_midi_transport.setEnable(ble_out, ble_in);
+      auto ble_setting = system_registry.midi_port_setting.getBLEMIDI();
+      bool ble_out = ble_setting & def::command::ex_midi_mode_t::midi_output;
+      bool ble_in  = ble_setting & def::command::ex_midi_mode_t::midi_input;
+      ble_midi_transport.setEnable(ble_out, ble_in);
+      midi_router.setOutputEnable(def::midi::port_ble, ble_out);
+#endif
+#if defined (MIDI_TRANSPORT_USB_ENABLED)
+      auto usb_setting = system_registry.midi_port_setting.getUSBMIDI();
+      bool usb_out = usb_setting & def::command::ex_midi_mode_t::midi_output;
+      bool usb_in  = usb_setting & def::command::ex_midi_mode_t::midi_input;
+      usb_midi_transport.setEnable(usb_out, usb_in);
+      midi_router.setOutputEnable(def::midi::port_usb, usb_out);
+#endif
+#if defined (MIDI_TRANSPORT_RTP_ENABLED)
+      auto rtp_setting = system_registry.midi_port_setting.getRTPMIDI();
+      bool rtp_out = rtp_setting & def::command::ex_midi_mode_t::midi_output;
+      bool rtp_in  = rtp_setting & def::command::ex_midi_mode_t::midi_input;
+      rtp_midi_transport.setPeer(system_registry.midi_port_setting.getRTPPeerIP(), def::midi::rtp_midi_port);
+      rtp_midi_transport.setEnable(rtp_out, rtp_in);
+      midi_router.setOutputEnable(def::midi::port_rtp, rtp_out);
 #endif
+    }
+
+    // 振り分けたメッセージがあるポートの送信タスクだけを起こす
+    // (設定が変わった場合は受信の有効・無効を反映させるため全て起こす)
+    uint32_t pushed_mask = midi_router.proc();
     for (int i = 0; i < max_subtask; ++i) {
-      xTaskNotifyGive(subtask_handle[i]);
+      if (port_changed || (pushed_mask & (1 << subtask_array[i].getPort()))) {
+        xTaskNotifyGive(subtask_handle[i]);
+      }
     }
   }
 #endif
 }
 
+#if defined (KANPLAY_HEADLESS_SIM)
+void task_midi_t::proc(void)
+{
+  midi_router.proc();
+  for (auto &subtask : subtask_array) {
+    subtask.proc();
+  }
+}
+
+void task_midi_t::setCapture(FILE* file, uint32_t (*get_usec)(void))
+{
+  midi_driver::MIDI_Transport_Capture::config_t config;
+  config.file = file;
+  config.get_usec = get_usec;
+  capture_midi_transport.setConfig(config);
+}
+
+void task_midi_t::pushReceiveData(const uint8_t* data, size_t length)
+{
+  capture_midi_transport.pushReceiveData(data, length);
+}
+#endif
+
 //-------------------------------------------------------------------------
 }; // namespace kanplay_ns
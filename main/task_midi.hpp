@@ -4,11 +4,23 @@
 #ifndef KANPLAY_TASK_MIDI_HPP
 #define KANPLAY_TASK_MIDI_HPP
 
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+
 namespace kanplay_ns {
 //-------------------------------------------------------------------------
 class task_midi_t {
 public:
   void start(void);
+#if defined (KANPLAY_HEADLESS_SIM)
+  // ヘッドレスシミュレータ用 : 各サブタスクの処理を1回ずつ実行する
+  void proc(void);
+  // MIDI出力の記録先 (時刻は get_usec で取得する)
+  void setCapture(FILE* file, uint32_t (*get_usec)(void));
+  // MIDI入力として受信させるデータを追加する
+  void pushReceiveData(const uint8_t* data, size_t length);
+#endif
 protected:
   static void task_func(task_midi_t* me);
 };
@@ -7,6 +7,7 @@
 
 #include "task_operator.hpp"
 #include "system_registry.hpp"
+#include "latency_trace.hpp"
 #include "file_manage.hpp"
 #include "menu_data.hpp"
 
@@ -114,7 +115,9 @@ void task_operator_t::start(void)
   // オンコードボタンを押した順序の記録を初期化
   memset(_base_degree_press_order, 0, sizeof(_base_degree_press_order));
 
-#if defined (M5UNIFIED_PC_BUILD)
+#if defined (KANPLAY_HEADLESS_SIM)
+  // スレッドは作らず、シミュレータから proc を呼び出す
+#elif defined (M5UNIFIED_PC_BUILD)
   auto thread = SDL_CreateThread((SDL_ThreadFunction)task_func, "operator", this);
 #else
   TaskHandle_t handle = nullptr;
@@ -126,7 +129,6 @@ void task_operator_t::start(void)
 
 void task_operator_t::task_func(task_operator_t* me)
 {
-  uint32_t working_command_change_counter = 0;
   for (;;) {
     system_registry.task_status.setSuspend(system_registry_t::reg_task_status_t::bitindex_t::TASK_OPERATOR);
 #if defined (M5UNIFIED_PC_BUILD)
@@ -136,82 +138,90 @@ void task_operator_t::task_func(task_operator_t* me)
 #endif
     system_registry.task_status.setWorking(system_registry_t::reg_task_status_t::bitindex_t::TASK_OPERATOR);
 
-    bool is_pressed;
-    def::command::command_param_t command_param;
-    while (system_registry.operator_command.getQueue(&me->_history_code, &command_param, &is_pressed))
-    {
-      me->commandProccessor(command_param, is_pressed);
+    me->proc();
+  }
+}
+
+void task_operator_t::proc(void)
+{
+  bool is_pressed;
+  def::command::command_param_t command_param;
+  while (system_registry.operator_command.getQueue(&_history_code, &command_param, &is_pressed))
+  {
+    if (is_pressed) {
+      latency_trace.markCommand(latency_trace_t::hop_operator, command_param.raw);
+    }
+    commandProccessor(command_param, is_pressed);
 #if !defined (M5UNIFIED_PC_BUILD)
-      // commander側で待機中の処理があり得るためここでYIELD処理を行う
-      taskYIELD();
+    // commander側で待機中の処理があり得るためここでYIELD処理を行う
+    taskYIELD();
 #endif
-    }
+  }
 
-    auto tmp = system_registry.working_command.getChangeCounter();
-    if (working_command_change_counter != tmp)
-    {
-      working_command_change_counter = tmp;
-
-      { // メインボタンの色設定
-        for (int i = 0; i < def::hw::max_main_button; ++i) {
-          auto pair = system_registry.command_mapping_current.getCommandParamArray(i);
-          uint32_t color = 0;
-          bool hit = true;
-          for (int j = 0; pair.array[j].command != def::command::none; ++j) {
-            auto command_param = pair.array[j];
-            color = getColorByCommand(command_param);
-            hit &= system_registry.working_command.check(command_param);
-          }
+  auto tmp = system_registry.working_command.getChangeCounter();
+  if (_working_command_change_counter != tmp)
+  {
+    _working_command_change_counter = tmp;
+
+    { // メインボタンの色設定
+      for (int i = 0; i < def::hw::max_main_button; ++i) {
+        auto pair = system_registry.command_mapping_current.getCommandParamArray(i);
+        uint32_t color = 0;
+        bool hit = true;
+        for (int j = 0; pair.array[j].command != def::command::none; ++j) {
+          auto command_param = pair.array[j];
+          color = getColorByCommand(command_param);
+          hit &= system_registry.working_command.check(command_param);
+        }
 
-          if (!hit) {
-            int r = (color >> 16) & 0xFF;
-            int g = (color >> 8) & 0xFF;
-            int b = color & 0xFF;
-            r = (r * 3) >> 3;
-            g = (g * 3) >> 3;
-            b = (b * 3) >> 3;
-            color = (r << 16) | (g << 8) | b;
-          }
-          system_registry.rgbled_control.setColor(i, color);
+        if (!hit) {
+          int r = (color >> 16) & 0xFF;
+          int g = (color >> 8) & 0xFF;
+          int b = color & 0xFF;
+          r = (r * 3) >> 3;
+          g = (g * 3) >> 3;
+          b = (b * 3) >> 3;
+          color = (r << 16) | (g << 8) | b;
         }
+        system_registry.rgbled_control.setColor(i, color);
       }
+    }
 
-      { // サブボタンの色設定
-        bool is_swap = isSubButtonSlotSwap();
-        for (int i = 0; i < def::hw::max_sub_button*2; ++i) {
-          auto pair = system_registry.sub_button.getCommandParamArray(i);
-          auto command_param = pair.array[0];
-          auto color = getColorByCommand(command_param);
-          bool isWorking = system_registry.working_command.check(command_param);
-
-          if (!isWorking) {
-            int r = (color >> 16) & 0xFF;
-            int g = (color >> 8) & 0xFF;
-            int b = color & 0xFF;
-            if (is_swap == (i < def::hw::max_sub_button)) {
-              // RGB色を合成してグレー化する
-              // gamma2.0 convert and ITU-R BT.601 RGB to Y convert
-              uint32_t y = ( (r * r * 19749)    // R 0.299
-                          + (g * g * 38771)    // G 0.587
-                          + (b * b *  7530)    // B 0.114
-                          ) >> 24;
-              y = (y * 3) >> 3;
-              color = y | (y << 8) | (y << 16);
-            } else {
-              int k = 7;
-              r = (r * k) >> 4;
-              g = (g * k) >> 4;
-              b = (b * k) >> 4;
-              color = (r << 16) | (g << 8) | b;
-            }
-          }
-          if (is_swap == (i >= def::hw::max_sub_button)) {
-            int sub_button_index = i % def::hw::max_sub_button;
-            system_registry.rgbled_control.setColor(sub_button_index + def::hw::max_main_button, color);
-  // M5_LOGE("sub_button_index:%d color:%08x", sub_button_index, color);
+    { // サブボタンの色設定
+      bool is_swap = isSubButtonSlotSwap();
+      for (int i = 0; i < def::hw::max_sub_button*2; ++i) {
+        auto pair = system_registry.sub_button.getCommandParamArray(i);
+        auto command_param = pair.array[0];
+        auto color = getColorByCommand(command_param);
+        bool isWorking = system_registry.working_command.check(command_param);
+
+        if (!isWorking) {
+          int r = (color >> 16) & 0xFF;
+          int g = (color >> 8) & 0xFF;
+          int b = color & 0xFF;
+          if (is_swap == (i < def::hw::max_sub_button)) {
+            // RGB色を合成してグレー化する
+            // gamma2.0 convert and ITU-R BT.601 RGB to Y convert
+            uint32_t y = ( (r * r * 19749)    // R 0.299
+                        + (g * g * 38771)    // G 0.587
+                        + (b * b *  7530)    // B 0.114
+                        ) >> 24;
+            y = (y * 3) >> 3;
+            color = y | (y << 8) | (y << 16);
+          } else {
+            int k = 7;
+            r = (r * k) >> 4;
+            g = (g * k) >> 4;
+            b = (b * k) >> 4;
+            color = (r << 16) | (g << 8) | b;
           }
-          system_registry.sub_button.setSubButtonColor(i, color);
         }
+        if (is_swap == (i >= def::hw::max_sub_button)) {
+          int sub_button_index = i % def::hw::max_sub_button;
+          system_registry.rgbled_control.setColor(sub_button_index + def::hw::max_main_button, color);
+// M5_LOGE("sub_button_index:%d color:%08x", sub_button_index, color);
+        }
+        system_registry.sub_button.setSubButtonColor(i, color);
       }
     }
   }
@@ -297,6 +307,8 @@ void task_operator_t::commandProccessor(const def::command::command_param_t& com
   case def::command::chord_beat:
   case def::command::chord_step_reset_request:
   case def::command::autoplay_switch:
+  case def::command::sequence_control:
+  case def::command::channel_pressure:
     system_registry.player_command.addQueue(command_param, is_pressed);
     break;
 
@@ -700,8 +712,20 @@ void task_operator_t::commandProccessor(const def::command::command_param_t& com
     break;
 
   case def::command::panic_stop:
+    // 全消音と同時にボイスの管理情報を破棄する必要があるため、演奏タスク側で処理する
+    system_registry.player_command.addQueue(command_param, is_pressed);
+    break;
+
+  case def::command::midi_learn:
     if (is_pressed) {
-      system_registry.midi_out_control.setControlChange(120, 0);
+      auto target = (def::midi::control_map_t::target_t)param;
+      if (target >= def::midi::control_map_t::target_max) { break; }
+      // 同じ対象で再度実行した場合はラーンを取り消す
+      if (system_registry.runtime_info.getMidiLearnTarget() == target) {
+        target = def::midi::control_map_t::target_none;
+      }
+      // パートを対象とするパラメータは、現在の編集対象パートに割り当てる
+      system_registry.runtime_info.setMidiLearn(target, system_registry.chord_play.getEditTargetPart());
     }
     break;
   }
@@ -11,8 +11,11 @@ namespace kanplay_ns {
 class task_operator_t {
 public:
   void start(void);
+  // 溜まっているコマンドの処理と、動作中コマンドに応じたボタン色の更新を行う
+  void proc(void);
 private:
   registry_t::history_code_t _history_code = 0;
+  uint32_t _working_command_change_counter = 0;
   // 前回発動したコマンド
 
   static constexpr const size_t max_command_history = 4;
@@ -8,17 +8,100 @@
 #include "common_define.hpp"
 #include "system_registry.hpp"
 
+#include <atomic>
+
+#if !defined (M5UNIFIED_PC_BUILD)
+ #include <driver/gpio.h>
+ #include <esp_timer.h>
+ #if __has_include(<esp_adc/adc_oneshot.h>)
+  #include <esp_adc/adc_oneshot.h>
+  #define KANPLAY_PORT_B_ADC
+ #endif
+#endif
+
 namespace kanplay_ns {
 //-------------------------------------------------------------------------
 static uint8_t pin_index[def::hw::max_port_b_pins] = { UINT8_MAX, UINT8_MAX };
 
-bool task_port_b_t::start(void)
+// エッジ検出後、チャタリングとして後続のエッジを無視する期間
+static constexpr const uint32_t debounce_usec = 5000;
+
+// 割込みで記録したピンごとのエッジ情報
+struct port_b_edge_t {
+  std::atomic<uint32_t> usec { 0 };   // 最後にエッジを検出した時刻
+  std::atomic<uint32_t> count { 0 };  // エッジの検出回数
+};
+static port_b_edge_t edge_info[def::hw::max_port_b_pins];
+
+// アフタータッチ有効時にピン1のアナログ値を読み取る間隔
+static constexpr const uint32_t analog_poll_msec = 10;
+
+#if defined (KANPLAY_PORT_B_ADC)
+
+static adc_oneshot_unit_handle_t adc_handle = nullptr;
+static adc_channel_t adc_channel;
+
+// ピン1をADC入力に切り替える。ADCに対応していないピンの場合は false を返す
+static bool beginAnalog(void)
 {
-#if defined (M5UNIFIED_PC_BUILD)
+  adc_unit_t unit;
+  if (ESP_OK != adc_oneshot_io_to_channel(pin_index[0], &unit, &adc_channel)) { return false; }
+  if (adc_handle == nullptr) {
+    adc_oneshot_unit_init_cfg_t unit_cfg = {};
+    unit_cfg.unit_id = unit;
+    if (ESP_OK != adc_oneshot_new_unit(&unit_cfg, &adc_handle)) { return false; }
+  }
+  adc_oneshot_chan_cfg_t chan_cfg = {};
+  chan_cfg.atten = ADC_ATTEN_DB_12;
+  chan_cfg.bitwidth = ADC_BITWIDTH_12;
+  return ESP_OK == adc_oneshot_config_channel(adc_handle, adc_channel, &chan_cfg);
+}
+
+// ピン1をデジタル入力に戻す
+static void endAnalog(void)
+{
+  m5gfx::pinMode(pin_index[0], m5gfx::pin_mode_t::input_pullup);
+}
+
+// プルアップされた入力を押圧で引き下げる想定のため、電圧が低いほど大きな値 (0-255) とする
+static bool readAnalog(uint8_t* level)
+{
+  int raw = 0;
+  if (ESP_OK != adc_oneshot_read(adc_handle, adc_channel, &raw)) { return false; }
+  *level = 255 - (raw >> 4);
+  return true;
+}
+
 #else
-  xTaskCreatePinnedToCore((TaskFunction_t)task_func, "port_b", 2048, this, def::system::task_priority_port_b, nullptr, def::system::task_cpu_port_b);
+
+static bool beginAnalog(void) { return false; }
+static void endAnalog(void) {}
+static bool readAnalog(uint8_t*) { return false; }
+
+#endif
+
+#if !defined (M5UNIFIED_PC_BUILD)
+
+static TaskHandle_t task_handle = nullptr;
+
+static void IRAM_ATTR gpio_interrupt_handler(void* args)
+{
+  auto edge = &edge_info[(uintptr_t)args];
+  // 割込み発生時点の時刻を記録する (タスクが起床するまでの遅延を含めないため)
+  edge->usec.store((uint32_t)esp_timer_get_time(), std::memory_order_relaxed);
+  edge->count.fetch_add(1, std::memory_order_release);
+
+  BaseType_t xHigherPriorityTaskWoken = pdFALSE;
+  vTaskNotifyGiveFromISR(task_handle, &xHigherPriorityTaskWoken);
+  if (xHigherPriorityTaskWoken) {
+    portYIELD_FROM_ISR();
+  }
+}
+
 #endif
 
+bool task_port_b_t::start(void)
+{
   pin_index[0] = M5.getPin(m5::pin_name_t::port_b_pin1); // pin1 == input side
   pin_index[1] = M5.getPin(m5::pin_name_t::port_b_pin2); // pin2 == output side
 
@@ -26,31 +109,128 @@ bool task_port_b_t::start(void)
     m5gfx::pinMode(pin_index[i], m5gfx::pin_mode_t::input_pullup);
   }
 
+#if defined (M5UNIFIED_PC_BUILD)
+#else
+  xTaskCreatePinnedToCore((TaskFunction_t)task_func, "port_b", 2048, this, def::system::task_priority_port_b, &task_handle, def::system::task_cpu_port_b);
+
+  // 両エッジで割込みを発生させる (ISRサービスが既に導入済みの場合のエラーは無視する)
+  gpio_install_isr_service(ESP_INTR_FLAG_LEVEL1);
+  for (int i = 0; i < def::hw::max_port_b_pins; ++i) {
+    if (pin_index[i] >= GPIO_NUM_MAX) { continue; }
+    auto pin = (gpio_num_t)pin_index[i];
+    gpio_set_intr_type(pin, GPIO_INTR_ANYEDGE);
+    gpio_isr_handler_add(pin, gpio_interrupt_handler, (void*)(uintptr_t)i);
+    gpio_intr_enable(pin);
+  }
+#endif
+
   return true;
 }
 
 void task_port_b_t::task_func(task_port_b_t* me)
 {
+#if !defined (M5UNIFIED_PC_BUILD)
   uint8_t pin_level[def::hw::max_port_b_pins];
+  uint32_t edge_count[def::hw::max_port_b_pins];
+  uint32_t lock_usec[def::hw::max_port_b_pins];
+  bool locked[def::hw::max_port_b_pins];
 
   for (int i = 0; i < def::hw::max_port_b_pins; ++i) {
+    edge_count[i] = edge_info[i].count.load(std::memory_order_acquire);
     pin_level[i] = m5gfx::gpio_in(pin_index[i]) ? 0 : 255;
+    system_registry.external_input.setPortBValue8(i, pin_level[i]);
+    locked[i] = false;
+    lock_usec[i] = 0;
   }
 
+  bool analog = false;
+
   for (;;) {
-    M5.delay(1);
+    // アフタータッチ設定が変更されたらピン1の入力方法を切り替える
+    bool analog_request = system_registry.user_setting.getPortBAftertouch();
+    if (analog != analog_request) {
+      auto pin = (gpio_num_t)pin_index[0];
+      if (analog_request) {
+        analog = beginAnalog();
+        if (analog) {
+          gpio_intr_disable(pin);
+          locked[0] = false;
+        }
+      } else {
+        analog = false;
+        endAnalog();
+        edge_count[0] = edge_info[0].count.load(std::memory_order_acquire);
+        locked[0] = false;
+        pin_level[0] = m5gfx::gpio_in(pin_index[0]) ? 0 : 255;
+        system_registry.external_input.setPortBValue8(0, pin_level[0]);
+        gpio_intr_enable(pin);
+      }
+    }
 
+    // 変化が無い間は割込みによる通知があるまで眠る。
+    // チャタリング除去の期間中のピンがある場合のみ、その期間の終了時に起床する
+    // (アフタータッチ設定の変更を検出するため、最長でも1秒おきには起床する)
+    TickType_t wait_ticks = pdMS_TO_TICKS(analog ? analog_poll_msec : 1000);
+    if (wait_ticks == 0) { wait_ticks = 1; }
+    uint32_t now = M5.micros();
     for (int i = 0; i < def::hw::max_port_b_pins; ++i) {
-      uint8_t level = m5gfx::gpio_in(pin_index[i]) ? 0 : 255;
-      if (pin_level[i] != level) {
-        int diff = (int32_t)(pin_level[i] - level);
+      if (!locked[i]) { continue; }
+      int32_t remain = debounce_usec - (now - lock_usec[i]);
+      TickType_t ticks = (remain > 0) ? pdMS_TO_TICKS((remain + 999) / 1000) : 0;
+      if (ticks == 0 && remain > 0) { ticks = 1; }
+      if (wait_ticks > ticks) { wait_ticks = ticks; }
+    }
+    if (wait_ticks) {
+      ulTaskNotifyTake(pdTRUE, wait_ticks);
+    }
+
+    now = M5.micros();
+    if (analog) {
+      uint8_t level;
+      if (readAnalog(&level)) {
+        // 変動を滑らかにするため前回値との間を補間する
+        int diff = (int32_t)(pin_level[0] - level);
         diff = diff * 3;
         level += (diff < 0 ? diff + 1 : diff) >> 2;
-        pin_level[i] = level;
-        system_registry.external_input.setPortBValue8(i, level);
+        if (pin_level[0] != level) {
+          pin_level[0] = level;
+          system_registry.external_input.setPortBValue8(0, level);
+        }
+      }
+    }
+    for (int i = analog ? 1 : 0; i < def::hw::max_port_b_pins; ++i) {
+      uint32_t count = edge_info[i].count.load(std::memory_order_acquire);
+      if (locked[i]) {
+        if (now - lock_usec[i] < debounce_usec) { continue; }
+        // 期間中に発生したエッジはチャタリングとして捨て、期間終了時点のレベルと照合する
+        locked[i] = false;
+        edge_count[i] = count;
+        uint8_t level = m5gfx::gpio_in(pin_index[i]) ? 0 : 255;
+        if (pin_level[i] != level) {
+          // 期間中に状態が戻っていた場合 (短いパルス) はここで反映する
+          pin_level[i] = level;
+          locked[i] = true;
+          lock_usec[i] = now;
+          system_registry.external_input.setPortBEdgeUsec(i, now);
+          system_registry.external_input.setPortBValue8(i, level);
+        }
+        continue;
       }
+      if (edge_count[i] == count) { continue; }
+      edge_count[i] = count;
+
+      // 安定状態からの最初のエッジで即座にレベルを反転させる。
+      // 拍の時刻としてタスクの起床時刻ではなく割込み時点の時刻を伝える
+      uint32_t usec = edge_info[i].usec.load(std::memory_order_relaxed);
+      uint8_t level = pin_level[i] ? 0 : 255;
+      pin_level[i] = level;
+      locked[i] = true;
+      lock_usec[i] = usec;
+      system_registry.external_input.setPortBEdgeUsec(i, usec);
+      system_registry.external_input.setPortBValue8(i, level);
     }
   }
+#endif
 }
 
 //-------------------------------------------------------------------------
@@ -6,6 +6,8 @@
 
 /*
 task_port_b は 外部ポートB (主にGPIO用途)を使用するタスクです。
+ピンの変化はGPIO割込みで検出し、割込み時点の時刻をエッジ時刻として記録します。
+変化が無い間はタスクは眠ったままとなります。
 */
 
 namespace kanplay_ns {
@@ -6,6 +6,7 @@
 #include "task_spi.hpp"
 #include "gui.hpp"
 #include "file_manage.hpp"
+#include "latency_trace.hpp"
 
 #include "system_registry.hpp"
 
@@ -23,6 +24,7 @@ void task_spi_t::start(void)
   TaskHandle_t handle = nullptr;
   xTaskCreatePinnedToCore((TaskFunction_t)task_func, "spi", 4096, this, def::system::task_priority_spi, &handle, def::system::task_cpu_spi);
   system_registry.file_command.setNotifyTaskHandle(handle);
+  file_manage.setStorageTaskHandle(handle);
 #endif
 }
 
@@ -77,8 +79,23 @@ M5_LOGV("file_command_info type:%d file:%d mem:%d ", file_command_info.dir_type,
             system_registry.checkSongModified();
           }
           break;
+
+        case system_registry_t::reg_file_command_t::index_t::TRACE_SAVE:
+          {
+            static constexpr const size_t trace_buffer_size = 64 * 1024;
+            auto buffer = (char*)m5gfx::heap_alloc_psram(trace_buffer_size);
+            if (buffer == nullptr) { break; }
+            auto len = latency_trace.writeChromeTrace(buffer, trace_buffer_size);
+            bool result = storage_sd.beginStorage()
+                       && storage_sd.saveFromMemoryToFile("/kanplay_trace.json", (const uint8_t*)buffer, len) > 0;
+            m5gfx::heap_free(buffer);
+            system_registry.popup_notify.setPopup(result, def::notify_type_t::NOTIFY_FILE_SAVE);
+          }
+          break;
         }
       }
+      // 他のタスクから依頼されたストレージへの処理 (Webサーバーからの転送など)
+      file_manage.procStorageJob();
 //       {
 //         int file_index = system_registry.file_command.getFileIndex();
 // // TODO:★★★file_commandにdir_typeやindexを設定する作業をすること★★★★
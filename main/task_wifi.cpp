@@ -4,6 +4,8 @@
 #include <M5Unified.h>
 
 #include <string.h>
+#include <stdarg.h>
+#include <atomic>
 
 #include "task_wifi.hpp"
 
@@ -11,6 +13,8 @@
 
 #include "system_registry.hpp"
 
+#include "file_manage.hpp"
+
 #if defined (M5UNIFIED_PC_BUILD)
 namespace kanplay_ns {
 
@@ -100,6 +104,9 @@ asm (\
 
 IMPORT_FILE(.rodata, "incbin/html/wifi.html", html_wifi);
 IMPORT_FILE(.rodata, "incbin/html/main.html", html_main);
+// generate_web_assets.py で事前に gzip 圧縮したもの
+IMPORT_FILE(.rodata, "incbin/html/wifi.html.gz", html_wifi_gz);
+IMPORT_FILE(.rodata, "incbin/html/main.html.gz", html_main_gz);
 
 namespace kanplay_ns {
 //-------------------------------------------------------------------------
@@ -462,20 +469,116 @@ static esp_err_t response_top_handler(httpd_req_t *req)
   return response_redirect(req, "/main");
 }
 
+// 動的に生成するページの出力を溜めておき、TCPの1セグメントに収まる大きさ毎にチャンク送信する
+// (ハンドラは httpd タスクでひとつずつ実行されるため、バッファは共用する)
+class http_chunk_writer_t {
+public:
+  http_chunk_writer_t(httpd_req_t *req) : _req { req } {}
+
+  void print(const char* str) { write(str, strlen(str)); }
+
+  void printf(const char* format, ...)
+  {
+    for (int retry = 0; retry < 2; ++retry) {
+      va_list args;
+      va_start(args, format);
+      int len = vsnprintf(&_buf[_len], sizeof(_buf) - _len, format, args);
+      va_end(args);
+      if (len < 0) { return; }
+      if (_len + len < sizeof(_buf)) {
+        _len += len;
+        return;
+      }
+      // 収まらなかった場合は送信してから書き直す (バッファより長いものは切り詰める)
+      if (retry == 0 && _len) {
+        flush();
+      } else {
+        _len = sizeof(_buf) - 1;
+        return;
+      }
+    }
+  }
+
+  void write(const char* data, size_t length)
+  {
+    while (length) {
+      size_t len = sizeof(_buf) - _len;
+      if (len > length) { len = length; }
+      memcpy(&_buf[_len], data, len);
+      _len += len;
+      data += len;
+      length -= len;
+      if (_len == sizeof(_buf)) { flush(); }
+    }
+  }
+
+  void flush(void)
+  {
+    if (_len) {
+      httpd_resp_send_chunk(_req, _buf, _len);
+      _len = 0;
+    }
+  }
+
+  void finish(void)
+  {
+    flush();
+    httpd_resp_send_chunk(_req, nullptr, 0);
+  }
+
+private:
+  // TCP_MSS (1436) からチャンクの見出しと終端の分を除いた大きさ
+  static char _buf[1436 - 8];
+  httpd_req_t *_req;
+  size_t _len = 0;
+};
+char http_chunk_writer_t::_buf[1436 - 8];
+
+static uint32_t fnv1a32(const char* data, size_t length)
+{
+  uint32_t hash = 0x811C9DC5u;
+  for (size_t i = 0; i < length; ++i) {
+    hash = (hash ^ (uint8_t)data[i]) * 0x01000193u;
+  }
+  return hash;
+}
+
+// 組み込みのファイルを送信する。ブラウザが対応していれば gzip 圧縮したものを送る
+// ファイルはファームウェア更新時のみ変化するため、ETag で照合して変化が無ければ 304 を返す
+static esp_err_t response_asset(httpd_req_t *req, const char* type, const char* raw, size_t raw_size, const char* gz, size_t gz_size)
+{
+  // 圧縮の有無に関わらず内容は同じなので、弱いETagを元のファイルから求める
+  char etag[16];
+  snprintf(etag, sizeof(etag), "W/\"%08lx\"", (unsigned long)fnv1a32(raw, raw_size));
+  httpd_resp_set_hdr(req, "ETag", etag);
+  httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+
+  char value[64];
+  if (ESP_OK == httpd_req_get_hdr_value_str(req, "If-None-Match", value, sizeof(value))
+   && nullptr != strstr(value, &etag[2])) {
+    httpd_resp_set_status(req, "304 Not Modified");
+    return httpd_resp_send(req, nullptr, 0);
+  }
+
+  httpd_resp_set_type(req, type);
+  httpd_resp_set_hdr(req, "Vary", "Accept-Encoding");
+  // 値が長く切り詰められた場合も、先頭部分に gzip があれば対応しているものとする
+  auto ret = httpd_req_get_hdr_value_str(req, "Accept-Encoding", value, sizeof(value));
+  if ((ret == ESP_OK || ret == ESP_ERR_HTTPD_RESULT_TRUNC) && nullptr != strstr(value, "gzip")) {
+    httpd_resp_set_hdr(req, "Content-Encoding", "gzip");
+    return httpd_resp_send(req, gz, gz_size);
+  }
+  return httpd_resp_send(req, raw, raw_size);
+}
+
 static esp_err_t response_wifi_handler(httpd_req_t *req)
 {
-  httpd_resp_set_type(req, "text/html");
-  httpd_resp_send(req, html_wifi, (uint32_t)sizeof_html_wifi);
-  httpd_resp_send_chunk(req, nullptr, 0);
-  return ESP_OK;
+  return response_asset(req, "text/html", html_wifi, (uint32_t)sizeof_html_wifi, html_wifi_gz, (uint32_t)sizeof_html_wifi_gz);
 }
 
 static esp_err_t response_main_handler(httpd_req_t *req)
 {
-  httpd_resp_set_type(req, "text/html");
-  httpd_resp_send(req, html_main, (uint32_t)sizeof_html_main);
-  httpd_resp_send_chunk(req, nullptr, 0);
-  return ESP_OK;
+  return response_asset(req, "text/html", html_main, (uint32_t)sizeof_html_main, html_main_gz, (uint32_t)sizeof_html_main_gz);
 }
 
 static esp_err_t response_ctrl_handler(httpd_req_t *req)
@@ -493,30 +596,40 @@ static esp_err_t response_ctrl_handler(httpd_req_t *req)
     {{internal_button, 1}, "zZ1"}, {{internal_button, 2}, "xX2"}, {{internal_button, 3}, "cC3"}, {{internal_button, 4}, "vV0"}, {{internal_button, 5}, "bB"},
   };
 
-  httpd_resp_sendstr_chunk(req, 
+  http_chunk_writer_t writer { req };
+  writer.print(
     "<!DOCTYPE html><html lang=\"en\"><head><meta charset=\"utf-8\">\n"
     "<script>\n"
     "let ct={"
   );
 
-  char linebuf[16];
   for (auto& btn : btnctrl_table) {
     int i = 0;
     do {
-      snprintf(linebuf, sizeof(linebuf), "'%c':%d,", btn.keycode_array[i], btn.command.raw);
-      httpd_resp_sendstr_chunk(req, linebuf);
+      writer.printf("'%c':%d,", btn.keycode_array[i], btn.command.raw);
     } while (btn.keycode_array[++i]);
-    httpd_resp_sendstr_chunk(req, "\n");
+    writer.print("\n");
   }
-  httpd_resp_sendstr_chunk(req, 
+  writer.print(
     "};\n"
-    "const ws=new WebSocket('/ws');"
-    "document.addEventListener('keydown',function(e){ if(!e.repeat&&e.key in ct){ ws.send('cmd=p'+ct[e.key]); } });\n"
-    "document.addEventListener('keyup',function(e){ if(!e.repeat&&e.key in ct){ ws.send('cmd=r'+ct[e.key]); } });\n"
+    "const ws=new WebSocket('/ws');ws.binaryType='arraybuffer';\n"
+    // 同時に発生したキー操作はひとつのフレームにまとめて送信する
+    "let q=[];\n"
+    "function tx(c,p){ if(!q.length){ setTimeout(function(){ let b=new Uint8Array(1+q.length*3);b[0]=1;"
+    "q.forEach(function(v,i){ b[1+i*3]=v[0]&255;b[2+i*3]=v[0]>>8;b[3+i*3]=v[1]; });q=[];if(ws.readyState==1){ ws.send(b); } },0); } q.push([c,p]); }\n"
+    "document.addEventListener('keydown',function(e){ if(!e.repeat&&e.key in ct){ tx(ct[e.key],1); } });\n"
+    "document.addEventListener('keyup',function(e){ if(!e.repeat&&e.key in ct){ tx(ct[e.key],0); } });\n"
+    // 本体から送られる状態の差分を反映する
+    "let st={1:[],2:[],3:[]};\n"
+    "ws.onmessage=function(m){ let d=new Uint8Array(m.data);if(d[0]!=0x81){ return; } let i=2;\n"
+    " while(i<d.length){ let t=d[i];if(!st[t]){ break; }\n"
+    "  if(t==3){ let n=d[i+1];st[3]=[];for(let k=0;k<n;++k){ st[3].push(d[i+2+k*2]|d[i+3+k*2]<<8); } i+=2+n*2; }\n"
+    "  else{ let o=d[i+1],n=d[i+2];for(let k=0;k<n;++k){ st[t][o+k]=d[i+3+k]; } i+=3+n; } }\n"
+    " document.getElementById('s').textContent='chord: '+st[1].slice(0,6).join(',')+'\\nworking: '+st[3].join(','); };\n"
     "</script>\n"
-    "</head><body>KEYBOARD CONTROL</body></html>\n"
+    "</head><body>KEYBOARD CONTROL<pre id=\"s\"></pre></body></html>\n"
   );
-  httpd_resp_sendstr_chunk(req, nullptr);
+  writer.finish();
   return ESP_OK;
 }
 
@@ -531,19 +644,20 @@ static esp_err_t response_ssid_handler(httpd_req_t *req) {
   }
 
   httpd_resp_set_type(req, "application/json");
-  httpd_resp_sendstr_chunk(req, "{\"ssids\":[\"");
+  http_chunk_writer_t writer { req };
+  writer.print("{\"ssids\":[\"");
   if (count > 0) {
     for (int i = 0; i < count; ++i) {
       auto ssid = WiFi.SSID(i);
       if (i) {
-        httpd_resp_sendstr_chunk(req, "\",\"");
+        writer.print("\",\"");
       }
-      httpd_resp_sendstr_chunk(req, ssid.c_str());
+      writer.print(ssid.c_str());
     }
   }
   WiFi.scanDelete();
-  httpd_resp_sendstr_chunk(req, "\"]}");
-  httpd_resp_sendstr_chunk(req, nullptr);
+  writer.print("\"]}");
+  writer.finish();
   return ESP_OK;
 }
 
@@ -597,114 +711,496 @@ static esp_err_t response_post_wifi_handler(httpd_req_t *req) {
   return ESP_OK;
 }
 
+//-------------------------------------------------------------------------
+// 曲データと設定ファイルの転送
+//  GET /songs?offset=0&limit=50 : ユーザー曲の一覧 (JSON) を指定位置から指定数だけ取得する
+//  GET /songs/<name>            : 曲データを取得する
+//  PUT /songs/<name>            : 曲データを保存する
+//  GET /settings , PUT /settings : 設定ファイルを取得・保存する
+// ファイルの内容は transfer_chunk_size 単位で通信とストレージの読み書きを交互に行い、全体をメモリに保持しない
+// 保存は本体での保存と同じく一時ファイルへ書き込み、全て受信できた場合のみ元のファイルと置き換える
+static constexpr const size_t transfer_chunk_size = 4096;
+static constexpr const size_t song_list_default_limit = 50;
+static constexpr const size_t song_list_max_limit = 200;
+static constexpr const size_t song_filename_max_length = 64;
+
+// URLからファイル名を取り出す。ディレクトリを移動する名前や長すぎる名前は受け付けない
+static bool get_song_filename(httpd_req_t *req, std::string& filename)
+{
+  static constexpr const char prefix[] = "/songs/";
+  if (strncmp(req->uri, prefix, sizeof(prefix) - 1) != 0) { return false; }
+  const char* name = &req->uri[sizeof(prefix) - 1];
+  filename = url_decode(std::string(name, strcspn(name, "?")));
+  if (filename.empty() || filename.size() > song_filename_max_length) { return false; }
+  if (filename[0] == '.' || filename.find_first_of("/\\") != std::string::npos) { return false; }
+  return true;
+}
+
+static esp_err_t response_file_download(httpd_req_t *req, storage_base_t* storage, const std::string& path)
+{
+  storage_stream_t* stream = nullptr;
+  file_manage.execStorageJob([&]() {
+    if (!storage->beginStorage()) { return false; }
+    stream = storage->openStream(path.c_str(), false);
+    return stream != nullptr;
+  });
+  if (stream == nullptr) {
+    return httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "File not found");
+  }
+
+  httpd_resp_set_type(req, "application/json");
+  std::vector<uint8_t> buf(transfer_chunk_size);
+  esp_err_t ret = ESP_OK;
+  for (;;) {
+    int len = 0;
+    file_manage.execStorageJob([&]() {
+      len = stream->read(buf.data(), buf.size());
+      return len > 0;
+    });
+    if (len <= 0) { break; }
+    ret = httpd_resp_send_chunk(req, (const char*)buf.data(), len);
+    if (ret != ESP_OK) { break; }
+  }
+  file_manage.execStorageJob([&]() {
+    delete stream;
+    return true;
+  });
+  if (ret == ESP_OK) {
+    ret = httpd_resp_send_chunk(req, nullptr, 0);
+  }
+  return ret;
+}
+
+// written : ファイルの置き換えまで完了したか (応答の送信結果とは別に返す)
+static esp_err_t response_file_upload(httpd_req_t *req, storage_base_t* storage, const std::string& path, bool& written)
+{
+  written = false;
+  size_t remain = req->content_len;
+  if (remain == 0 || remain > def::app::max_file_len) {
+    return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid length");
+  }
+
+  storage_stream_t* stream = nullptr;
+  file_manage.execStorageJob([&]() {
+    if (!storage->beginStorage()) { return false; }
+    stream = storage->beginAtomicWrite(path.c_str());
+    return stream != nullptr;
+  });
+  if (stream == nullptr) {
+    return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to open file");
+  }
+
+  std::vector<uint8_t> buf(transfer_chunk_size);
+  bool success = true;
+  bool first = true;
+  int timeout_count = 0;
+  while (remain) {
+    int len = httpd_req_recv(req, (char*)buf.data(), remain < buf.size() ? remain : buf.size());
+    if (len == HTTPD_SOCK_ERR_TIMEOUT && ++timeout_count < 8) { continue; }
+    if (len <= 0) {
+      success = false;
+      break;
+    }
+    timeout_count = 0;
+    // 曲データ・設定ファイルは共に JSON のため、本体での保存時と同じく先頭の文字を確認する
+    if (first) {
+      first = false;
+      if (buf[0] != '{') {
+        success = false;
+        break;
+      }
+    }
+    success = file_manage.execStorageJob([&]() {
+      return len == stream->write(buf.data(), len);
+    });
+    if (!success) { break; }
+    remain -= len;
+  }
+
+  file_manage.execStorageJob([&]() {
+    if (success) {
+      success = storage->commitAtomicWrite(stream, path.c_str());
+    } else {
+      storage->abortAtomicWrite(stream, path.c_str());
+    }
+    return success;
+  });
+  if (!success) {
+    return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to write file");
+  }
+  written = true;
+  httpd_resp_set_status(req, "204 No Content");
+  return httpd_resp_send(req, nullptr, 0);
+}
+
+static void write_json_string(http_chunk_writer_t& writer, const char* str)
+{
+  const char* begin = str;
+  for (; *str; ++str) {
+    if (*str == '"' || *str == '\\') {
+      writer.write(begin, str - begin);
+      writer.write("\\", 1);
+      begin = str;
+    }
+  }
+  writer.write(begin, str - begin);
+}
+
+static esp_err_t response_song_list_handler(httpd_req_t *req)
+{
+  size_t offset = 0;
+  size_t limit = song_list_default_limit;
+  char query[64];
+  if (ESP_OK == httpd_req_get_url_query_str(req, query, sizeof(query))) {
+    char value[12];
+    if (ESP_OK == httpd_query_key_value(query, "offset", value, sizeof(value))) {
+      offset = strtoul(value, nullptr, 10);
+    }
+    if (ESP_OK == httpd_query_key_value(query, "limit", value, sizeof(value))) {
+      limit = strtoul(value, nullptr, 10);
+    }
+  }
+  if (limit == 0 || limit > song_list_max_limit) {
+    limit = song_list_max_limit;
+  }
+
+  // 指定範囲の情報だけを複製する。一覧の読み直しは先頭のページを要求された時のみ行う
+  std::vector<file_info_t> page;
+  size_t total = 0;
+  auto dir = file_manage.getDirManage(def::app::data_type_t::data_song_users);
+  file_manage.execStorageJob([&]() {
+    if (offset == 0 || dir->isEmpty()) {
+      dir->getStorage()->beginStorage();
+      dir->update();
+    }
+    total = dir->getCount();
+    for (size_t i = offset; i < total && page.size() < limit; ++i) {
+      page.push_back(*dir->getInfo(i));
+    }
+    return true;
+  });
+
+  httpd_resp_set_type(req, "application/json");
+  http_chunk_writer_t writer { req };
+  writer.printf("{\"total\":%u,\"offset\":%u,\"files\":[", (unsigned)total, (unsigned)offset);
+  for (size_t i = 0; i < page.size(); ++i) {
+    writer.print(i ? ",{\"name\":\"" : "{\"name\":\"");
+    write_json_string(writer, page[i].filename.c_str());
+    writer.printf("\",\"size\":%u}", (unsigned)page[i].filesize);
+  }
+  writer.print("]}");
+  writer.finish();
+  return ESP_OK;
+}
+
+static esp_err_t response_get_song_handler(httpd_req_t *req)
+{
+  std::string filename;
+  if (!get_song_filename(req, filename)) {
+    return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid file name");
+  }
+  auto dir = file_manage.getDirManage(def::app::data_type_t::data_song_users);
+  return response_file_download(req, dir->getStorage(), dir->makeFullPath(filename.c_str()));
+}
+
+static esp_err_t response_put_song_handler(httpd_req_t *req)
+{
+  std::string filename;
+  if (!get_song_filename(req, filename)) {
+    return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid file name");
+  }
+  auto dir = file_manage.getDirManage(def::app::data_type_t::data_song_users);
+  bool written;
+  auto ret = response_file_upload(req, dir->getStorage(), dir->makeFullPath(filename.c_str()), written);
+  // 本体側のファイル一覧を更新する
+  if (written) {
+    system_registry.file_command.setUpdateList(def::app::data_type_t::data_song_users);
+  }
+  return ret;
+}
+
+static esp_err_t response_get_settings_handler(httpd_req_t *req)
+{
+  auto dir = file_manage.getDirManage(def::app::data_type_t::data_setting);
+  return response_file_download(req, dir->getStorage(), dir->makeFullPath(""));
+}
+
+static esp_err_t response_put_settings_handler(httpd_req_t *req)
+{
+  auto dir = file_manage.getDirManage(def::app::data_type_t::data_setting);
+  bool written;
+  auto ret = response_file_upload(req, dir->getStorage(), dir->makeFullPath(""), written);
+  // 保存した設定を読み込んで反映する (保存に失敗した場合は現在の設定をそのまま使う)
+  if (written) {
+    system_registry.file_command.setUpdateList(def::app::data_type_t::data_setting);
+    def::app::file_command_info_t info;
+    info.file_index = 0;
+    info.dir_type = def::app::data_type_t::data_setting;
+    system_registry.file_command.setFileLoadRequest(info);
+  }
+  return ret;
+}
+
+
+//-------------------------------------------------------------------------
+// WebSocket バイナリプロトコル (数値は全てリトルエンディアン)
+// クライアント → 本体 : [ws_frame_command_batch] + { command_param_t::raw (16bit) , 押下状態 (1:押下 0:解放) } × n
+// 本体 → クライアント : [ws_frame_state_delta] [シーケンス番号] + レコード × n
+//   ws_record_chord_play , ws_record_runtime_info : [種別] [開始位置] [バイト数] [値 × バイト数]
+//     前回の送信時から変化した範囲のみを送る。接続直後は全範囲を送る
+//   ws_record_working_command : [種別] [個数] + command_param_t::raw (16bit) × 個数
+// 従来のテキスト形式 ( cmd=p123 , cmd=r123 ) も引き続き受け付ける
+enum ws_frame_type_t : uint8_t {
+  ws_frame_command_batch = 0x01,
+  ws_frame_state_delta = 0x81,
+};
+enum ws_record_type_t : uint8_t {
+  ws_record_chord_play = 0x01,
+  ws_record_runtime_info = 0x02,
+  ws_record_working_command = 0x03,
+};
 
-#if 0
-/*
- * Structure holding server handle
- * and internal socket fd in order
- * to use out of request send
- */
-struct async_resp_arg {
-    httpd_handle_t hd;
-    int fd;
+static constexpr const size_t ws_max_client = 4;
+static constexpr const size_t ws_frame_pool_count = 4;
+static constexpr const size_t ws_frame_size = 256;
+static constexpr const size_t ws_recv_size = 128;
+static constexpr const size_t ws_shadow_size = 64;
+static constexpr const size_t ws_max_working_command = 32;
+static constexpr const uint32_t ws_push_interval_msec = 16;
+
+// 全レコードを一度に送る場合でもひとつのフレームに収まること
+static_assert(2 + (3 + ws_shadow_size) * 2 + 2 + ws_max_working_command * 2 <= ws_frame_size, "ws_frame_size is too small");
+
+// 送信フレームは固定数のバッファから確保し、httpd タスクでの送信完了後に返却する
+struct ws_frame_t {
+  httpd_handle_t hd;
+  uint16_t len;
+  uint8_t data[ws_frame_size];
 };
+static ws_frame_t ws_frame_pool[ws_frame_pool_count];
+static std::atomic<uint8_t> ws_frame_used { 0 };
 
-/*
- * async send function, which we put into the httpd work queue
- */
-static void ws_async_send(void *arg)
+// 以下は httpd タスクからのみ操作する
+static int ws_client_fd[ws_max_client] = { -1, -1, -1, -1 };
+static uint8_t ws_recv_buf[ws_recv_size];
+
+// 以下は wifi タスクから参照する
+static std::atomic<uint8_t> ws_client_count { 0 };
+static std::atomic<bool> ws_full_sync_request { false };
+
+static ws_frame_t* ws_frame_alloc(void)
 {
-    static const char * data = "Async data";
-    auto resp_arg = (async_resp_arg*)arg;
-    httpd_handle_t hd = resp_arg->hd;
-    int fd = resp_arg->fd;
-    httpd_ws_frame_t ws_pkt;
-    memset(&ws_pkt, 0, sizeof(httpd_ws_frame_t));
-    ws_pkt.payload = (uint8_t*)data;
-    ws_pkt.len = strlen(data);
-    ws_pkt.type = HTTPD_WS_TYPE_TEXT;
-
-    httpd_ws_send_frame_async(hd, fd, &ws_pkt);
-    free(resp_arg);
+  uint8_t used = ws_frame_used.load();
+  for (;;) {
+    size_t i = 0;
+    while (i < ws_frame_pool_count && (used & (1 << i))) { ++i; }
+    if (i == ws_frame_pool_count) { return nullptr; }
+    if (ws_frame_used.compare_exchange_weak(used, used | (1 << i))) {
+      return &ws_frame_pool[i];
+    }
+  }
 }
 
-static esp_err_t trigger_async_send(httpd_handle_t handle, httpd_req_t *req)
+static void ws_frame_free(ws_frame_t* frame)
 {
-    auto resp_arg = (async_resp_arg*)malloc(sizeof(async_resp_arg));
-    if (resp_arg == NULL) {
-        return ESP_ERR_NO_MEM;
+  ws_frame_used.fetch_and(~(1 << (frame - ws_frame_pool)));
+}
+
+static void ws_client_update_count(void)
+{
+  uint8_t count = 0;
+  for (auto fd : ws_client_fd) {
+    if (fd >= 0) { ++count; }
+  }
+  ws_client_count.store(count);
+}
+
+static void ws_client_add(int fd)
+{
+  int* empty = nullptr;
+  for (auto &c : ws_client_fd) {
+    if (c == fd) { return; }
+    if (c < 0 && empty == nullptr) { empty = &c; }
+  }
+  if (empty == nullptr) {
+    M5_LOGW("ws: too many clients");
+    return;
+  }
+  *empty = fd;
+  ws_client_update_count();
+  ws_full_sync_request.store(true);
+}
+
+// サーバー停止時に呼ぶ (httpd タスクが終了しているため、未送信のフレームも回収する)
+static void ws_client_reset(void)
+{
+  for (auto &c : ws_client_fd) { c = -1; }
+  ws_client_update_count();
+  ws_frame_used.store(0);
+}
+
+// httpd タスクで実行され、接続中の全クライアントへ同じフレームを送信する
+static void ws_async_send(void* arg)
+{
+  auto frame = (ws_frame_t*)arg;
+  httpd_ws_frame_t ws_pkt;
+  memset(&ws_pkt, 0, sizeof(httpd_ws_frame_t));
+  ws_pkt.payload = frame->data;
+  ws_pkt.len = frame->len;
+  ws_pkt.type = HTTPD_WS_TYPE_BINARY;
+  ws_pkt.final = true;
+
+  for (auto &fd : ws_client_fd) {
+    if (fd < 0) { continue; }
+    // 切断済み、または同じ番号で別の接続が開かれている場合はクライアントから外す
+    if (httpd_ws_get_fd_info(frame->hd, fd) != HTTPD_WS_CLIENT_WEBSOCKET
+     || httpd_ws_send_frame_async(frame->hd, fd, &ws_pkt) != ESP_OK) {
+      fd = -1;
     }
-    resp_arg->hd = req->handle;
-    resp_arg->fd = httpd_req_to_sockfd(req);
-    esp_err_t ret = httpd_queue_work(handle, ws_async_send, resp_arg);
-    if (ret != ESP_OK) {
-        free(resp_arg);
+  }
+  ws_client_update_count();
+  ws_frame_free(frame);
+}
+
+// レジストリの前回送信時から変化した範囲をレコードとして追加する。戻り値は追加後の書込み位置
+static size_t ws_append_registry_delta(uint8_t* dst, size_t pos, uint8_t type, const registry_t &reg, uint8_t* shadow, bool full)
+{
+  auto src = (const uint8_t*)reg.getBuffer(0);
+  size_t size = reg.getSize();
+  if (size > ws_shadow_size) { size = ws_shadow_size; }
+
+  size_t i = 0;
+  while (i < size) {
+    if (!full && src[i] == shadow[i]) { ++i; continue; }
+    size_t start = i;
+    size_t end = i + 1;
+    // 間に挟まる未変化部分がレコードの見出しより短ければひとつのレコードにまとめる
+    for (size_t j = end; j < size && j < end + 3; ++j) {
+      if (full || src[j] != shadow[j]) { end = j + 1; }
     }
-    return ret;
+    size_t len = end - start;
+    dst[pos++] = type;
+    dst[pos++] = start;
+    dst[pos++] = len;
+    memcpy(&dst[pos], &src[start], len);
+    memcpy(&shadow[start], &dst[pos], len);
+    pos += len;
+    i = end;
+  }
+  return pos;
 }
-#endif
+
+// 前回の送信以降の状態の変化をひとつのフレームにまとめて送信する (wifi タスクから ws_push_interval_msec 毎に呼ぶ)
+static void ws_push_state(httpd_handle_t hd)
+{
+  static uint8_t shadow_chord_play[ws_shadow_size];
+  static uint8_t shadow_runtime_info[ws_shadow_size];
+  static uint32_t chord_play_counter;
+  static uint32_t runtime_info_counter;
+  static uint32_t working_command_counter;
+  static uint8_t seq;
+
+  if (hd == nullptr || ws_client_count.load() == 0) { return; }
+
+  bool full = ws_full_sync_request.load();
+  uint32_t cp_counter = system_registry.chord_play.getChangeCounter();
+  uint32_t ri_counter = system_registry.runtime_info.getChangeCounter();
+  uint32_t wc_counter = system_registry.working_command.getChangeCounter();
+  if (!full
+   && cp_counter == chord_play_counter
+   && ri_counter == runtime_info_counter
+   && wc_counter == working_command_counter) { return; }
+
+  // 送信待ちのフレームが詰まっている場合は、次回の周期でまとめて送る
+  auto frame = ws_frame_alloc();
+  if (frame == nullptr) { return; }
+  ws_full_sync_request.store(false);
+
+  auto dst = frame->data;
+  size_t pos = 0;
+  dst[pos++] = ws_frame_state_delta;
+  dst[pos++] = seq;
+  if (full || cp_counter != chord_play_counter) {
+    chord_play_counter = cp_counter;
+    pos = ws_append_registry_delta(dst, pos, ws_record_chord_play, system_registry.chord_play, shadow_chord_play, full);
+  }
+  if (full || ri_counter != runtime_info_counter) {
+    runtime_info_counter = ri_counter;
+    pos = ws_append_registry_delta(dst, pos, ws_record_runtime_info, system_registry.runtime_info, shadow_runtime_info, full);
+  }
+  if (full || wc_counter != working_command_counter) {
+    working_command_counter = wc_counter;
+    def::command::command_param_t list[ws_max_working_command];
+    size_t count = system_registry.working_command.getList(list, ws_max_working_command);
+    dst[pos++] = ws_record_working_command;
+    dst[pos++] = count;
+    for (size_t i = 0; i < count; ++i) {
+      dst[pos++] = list[i].raw;
+      dst[pos++] = list[i].raw >> 8;
+    }
+  }
+  // 値が元に戻っていた場合など、送るべき差分が無ければ送信しない
+  if (pos <= 2) {
+    ws_frame_free(frame);
+    return;
+  }
+  ++seq;
+  frame->hd = hd;
+  frame->len = pos;
+  if (httpd_queue_work(hd, ws_async_send, frame) != ESP_OK) {
+    ws_frame_free(frame);
+  }
+}
+
 static esp_err_t response_ws_handler(httpd_req_t *req)
 {
   if (req->method == HTTP_GET) {
-    // M5_LOGI("Handshake done, the new connection was opened");
+    // ハンドシェイク完了。状態の送信先として登録する
+    ws_client_add(httpd_req_to_sockfd(req));
     return ESP_OK;
   }
   httpd_ws_frame_t ws_pkt;
-  uint8_t *buf = nullptr;
   memset(&ws_pkt, 0, sizeof(httpd_ws_frame_t));
-  ws_pkt.type = HTTPD_WS_TYPE_TEXT;
 
   esp_err_t ret = httpd_ws_recv_frame(req, &ws_pkt, 0);
-  if (ret != ESP_OK) {
-    // M5_LOGE("httpd_ws_recv_frame failed to get frame len with %d", ret);
+  if (ret != ESP_OK || ws_pkt.len == 0) {
     return ret;
   }
-  // M5_LOGI("frame len is %d", ws_pkt.len);
-  if (ws_pkt.len) {
-    /* ws_pkt.len + 1 is for NULL termination as we are expecting a string */
-    buf = (uint8_t*)calloc(1, ws_pkt.len + 1);
-    if (buf == nullptr) {
-      // M5_LOGE("Failed to calloc memory for buf");
-      return ESP_ERR_NO_MEM;
-    }
-    ws_pkt.payload = buf;
-    /* Set max_len = ws_pkt.len to get the frame payload */
-    ret = httpd_ws_recv_frame(req, &ws_pkt, ws_pkt.len);
-    if (ret != ESP_OK) {
-      // M5_LOGE("httpd_ws_recv_frame failed with %d", ret);
-      free(buf);
-      return ret;
-    }
-    // M5_LOGI("Got packet with message: %s", ws_pkt.payload);
-    // auto data = ws_pkt.payload;
-    if (memcmp(buf, "cmd=", 4) == 0) {
-      bool press = (buf[4] == 'p');
-      def::command::command_param_t cmd;
-      // buf[ws_pkt.len] = 0;
-      cmd.raw = atoi((const char*)&buf[5]);
-      system_registry.operator_command.addQueue(cmd, press);
-    }
-  }
-/*
-  M5_LOGI("Packet type: %d", ws_pkt.type);
-  if (ws_pkt.type == HTTPD_WS_TYPE_TEXT &&
-    strcmp((char*)ws_pkt.payload,"Trigger async") == 0) {
-    free(buf);
-    return trigger_async_send(req->handle, req);
+  if (ws_pkt.len >= ws_recv_size) {
+    M5_LOGW("ws: frame too large : %d", (int)ws_pkt.len);
+    return ESP_ERR_INVALID_SIZE;
   }
-  ret = httpd_ws_send_frame(req, &ws_pkt);
+  auto buf = ws_recv_buf;
+  ws_pkt.payload = buf;
+  ret = httpd_ws_recv_frame(req, &ws_pkt, ws_pkt.len);
   if (ret != ESP_OK) {
-    M5_LOGE("httpd_ws_send_frame failed with %d", ret);
+    return ret;
   }
-*/
-  free(buf);
-  return ret;
+  buf[ws_pkt.len] = 0;
+
+  if (ws_pkt.type == HTTPD_WS_TYPE_BINARY) {
+    if (buf[0] == ws_frame_command_batch) {
+      for (size_t i = 1; i + 3 <= ws_pkt.len; i += 3) {
+        def::command::command_param_t cmd { (uint16_t)(buf[i] | buf[i + 1] << 8) };
+        system_registry.operator_command.addQueue(cmd, buf[i + 2] != 0);
+      }
+    }
+  } else if (memcmp(buf, "cmd=", 4) == 0) {
+    bool press = (buf[4] == 'p');
+    def::command::command_param_t cmd;
+    cmd.raw = atoi((const char*)&buf[5]);
+    system_registry.operator_command.addQueue(cmd, press);
+  }
+  return ESP_OK;
 }
 
 static httpd_handle_t start_webserver(void)
 {
   httpd_handle_t server = NULL;
   httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+  config.max_uri_handlers = 16;
+  // "/songs/*" のようにワイルドカードで登録する
+  config.uri_match_fn = httpd_uri_match_wildcard;
 
   // Start the httpd server
   M5_LOGI("Starting server on port: '%d'", config.server_port);
@@ -720,6 +1216,11 @@ static httpd_handle_t start_webserver(void)
       { "/ssid", HTTP_GET , response_ssid_handler     , nullptr, false, false, nullptr },
       { "/wifi", HTTP_POST, response_post_wifi_handler, nullptr, false, false, nullptr },
       { "/ws"  , HTTP_GET , response_ws_handler       , nullptr,  true, false, nullptr },
+      { "/songs"   , HTTP_GET , response_song_list_handler   , nullptr, false, false, nullptr },
+      { "/songs/*" , HTTP_GET , response_get_song_handler    , nullptr, false, false, nullptr },
+      { "/songs/*" , HTTP_PUT , response_put_song_handler    , nullptr, false, false, nullptr },
+      { "/settings", HTTP_GET , response_get_settings_handler, nullptr, false, false, nullptr },
+      { "/settings", HTTP_PUT , response_put_settings_handler, nullptr, false, false, nullptr },
     };
 
     for (auto& uri : uri_table) {
@@ -736,7 +1237,10 @@ static httpd_handle_t start_webserver(void)
 static esp_err_t stop_webserver(httpd_handle_t server)
 {
   // Stop the httpd server
-  return server ? httpd_stop(server) : ESP_OK;
+  if (server == nullptr) { return ESP_OK; }
+  auto res = httpd_stop(server);
+  ws_client_reset();
+  return res;
 }
 
 static void disconnect_handler(void* arg, esp_event_base_t event_base,
@@ -992,6 +1496,7 @@ void task_wifi_t::task_func(task_wifi_t* me)
     }
   };
   control_flg_t ctrl_flg;
+  uint32_t ws_push_msec = 0;
 
   for (;;) {
 #if defined (M5UNIFIED_PC_BUILD)
@@ -1003,6 +1508,13 @@ void task_wifi_t::task_func(task_wifi_t* me)
       dnsServer.processNextRequest();
       wait = 4;
     }
+    if (ctrl_flg.server) {
+      auto msec = M5.millis();
+      if (msec - ws_push_msec >= ws_push_interval_msec) {
+        ws_push_msec = msec;
+        ws_push_state(http_server);
+      }
+    }
     taskYIELD();
     ulTaskNotifyTake(pdTRUE, wait);
 
@@ -1078,6 +1590,10 @@ void task_wifi_t::task_func(task_wifi_t* me)
 #endif
         MDNS.begin(def::app::wifi_mdns);
         MDNS.addService("http", "tcp", http_port);
+        if (system_registry.midi_port_setting.getRTPMIDI() != def::command::ex_midi_mode_t::midi_off) {
+          // macOS / iOS の Audio MIDI 設定のネットワーク一覧に表示させる
+          MDNS.addService("apple-midi", "udp", def::midi::rtp_midi_port);
+        }
         if (ctrl_flg.ap) {
           dnsServer.start( dns_port, "*", WiFi.softAPIP() );
         }
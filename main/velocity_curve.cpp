@@ -0,0 +1,54 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 InstaChord Corp.
+
+#include "velocity_curve.hpp"
+
+#include "system_registry.hpp"
+
+namespace kanplay_ns {
+//-------------------------------------------------------------------------
+namespace velocity_curve {
+
+  struct curve_table_t {
+    uint8_t value[def::play::velocity_curve_max][128];
+    constexpr curve_table_t(void) : value { { 0 } } {
+      for (uint32_t i = 0; i < 128; ++i) {
+        value[def::play::velocity_curve_linear][i] = i;
+        // 上に凸の二次曲線 (中間値 64 → 96)
+        value[def::play::velocity_curve_soft][i] = (i * (254 - i) + 63) / 127;
+        // 下に凸の二次曲線 (中間値 64 → 32)
+        value[def::play::velocity_curve_hard][i] = (i * i + 63) / 127;
+        // 入力が 0 (消音) 以外は演奏時ベロシティ 100% 相当 (0-255 の範囲で 100)
+        value[def::play::velocity_curve_fixed][i] = i ? 50 : 0;
+      }
+    }
+  };
+  static constexpr const curve_table_t curve_table;
+
+  const uint8_t* getTable(def::play::velocity_curve_t curve)
+  {
+    if (curve >= def::play::velocity_curve_max) { curve = def::play::velocity_curve_linear; }
+    return curve_table.value[curve];
+  }
+
+  uint8_t apply(def::play::velocity_source_t source, uint8_t velocity)
+  {
+    auto curve = system_registry.user_setting.getVelocityCurve(source);
+    if (curve == def::play::velocity_curve_linear) { return velocity; }
+    uint8_t result;
+    if (source == def::play::velocity_source_midi) {
+      // MIDI入力のベロシティは 0-127 のため、そのままテーブルを引く
+      // (固定値は他の入力元と同じ演奏時ベロシティにするため、テーブルの値を 0-255 の範囲に戻す)
+      result = getTable(curve)[velocity & 0x7F];
+      if (curve == def::play::velocity_curve_fixed) { result <<= 1; }
+    } else {
+      // 最下位bitは変換せずに残す (リニア時の値と一致させるため)
+      result = (getTable(curve)[velocity >> 1] << 1) | (velocity & 1);
+    }
+    return (velocity && !result) ? 1 : result;
+  }
+
+};
+
+//-------------------------------------------------------------------------
+}; // namespace kanplay_ns
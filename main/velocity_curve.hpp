@@ -0,0 +1,30 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 InstaChord Corp.
+
+#ifndef KANPLAY_VELOCITY_CURVE_HPP
+#define KANPLAY_VELOCITY_CURVE_HPP
+
+#include <stdint.h>
+
+#include "common_define.hpp"
+
+namespace kanplay_ns {
+//-------------------------------------------------------------------------
+// 入力元ごとのベロシティカーブ
+// カーブはそれぞれ128要素の変換テーブルとしてコンパイル時に生成しておき、適用時は表引きのみ行う
+namespace velocity_curve {
+
+  // カーブの変換テーブルを取得する (入力 0-127 → 出力 0-127)
+  const uint8_t* getTable(def::play::velocity_curve_t curve);
+
+  // 入力元に設定されたカーブを適用する。
+  // MIDI入力の値は 0-127 の範囲でそのままテーブルを引き、
+  // それ以外の入力元は演奏時ベロシティ(set_velocity)と同じく 0-255 の範囲で扱い、テーブルは上位7bitで引く
+  uint8_t apply(def::play::velocity_source_t source, uint8_t velocity);
+
+};
+
+//-------------------------------------------------------------------------
+}; // namespace kanplay_ns
+
+#endif
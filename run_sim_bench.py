@@ -0,0 +1,55 @@
+# SPDX-License-Identifier: MIT
+# Copyright (c) 2025 InstaChord Corp.
+#
+# ヘッドレスシミュレータ (native_headless) で演奏エンジンのベンチマークを実行する
+# incbin/preset/*.json の全ソング・全スロットを固定のテンポ・スウィング・コード進行で演奏し、
+#  - MIDI出力が test/golden/ の基準出力と一致しないケース
+#  - 後続のスロットをレイヤーとして重ねた状態で、1ステップ分の演奏処理の最大時間が
+#    def::app::step_play_usec_budget を超えたケース
+# があれば失敗とする
+#
+# 使い方:
+#   pio run -e native_headless -t sim_bench    ベンチマークを実行する
+#   pio run -e native_headless -t sim_golden   演奏エンジンの出力を意図して変更した場合に基準出力を作りなおす
+
+Import("env")
+import glob
+import os
+import subprocess
+
+root_dir = env.subst("$PROJECT_DIR")
+build_dir = env.subst("$BUILD_DIR")
+golden_dir = os.path.join(root_dir, 'test', 'golden')
+presets = sorted(glob.glob(os.path.join(root_dir, 'incbin', 'preset', '*.json')))
+
+
+def run_bench(out_dir, args):
+    os.makedirs(out_dir, exist_ok=True)
+    return subprocess.call([env.subst("$PROGPATH"), '--bench', out_dir] + args + presets)
+
+
+def sim_bench(target, source, env):
+    result = run_bench(os.path.join(build_dir, 'sim_bench'), ['--golden', golden_dir])
+    result_layer = run_bench(os.path.join(build_dir, 'sim_bench_layer'), ['--layer'])
+    return result or result_layer
+
+
+def sim_golden(target, source, env):
+    for path in glob.glob(os.path.join(golden_dir, '*.txt')):
+        os.remove(path)
+    return run_bench(golden_dir, [])
+
+
+env.AddCustomTarget(
+    name="sim_bench",
+    dependencies="$PROGPATH",
+    actions=[sim_bench],
+    title="Simulator Benchmark",
+    description="Compare every preset song with the golden output and check the layered step time")
+
+env.AddCustomTarget(
+    name="sim_golden",
+    dependencies="$PROGPATH",
+    actions=[sim_golden],
+    title="Simulator Golden",
+    description="Regenerate the golden output in test/golden")
@@ -0,0 +1,268 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 InstaChord Corp.
+
+// BLE-MIDI エンコーダ・デコーダのテスト
+// 仕様どおりのパケット (ヘッダ , 13bitタイムスタンプ , ランニングステータス , SysEx の分割) が生成されること、
+// 任意のMIDIバイト列をエンコードしてデコードすると元のメッセージ列に戻ること、処理速度が十分であることを確認する
+
+#include <unity.h>
+
+#include "midi/midi_ble_codec.hpp"
+
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include <random>
+#include <vector>
+
+using namespace midi_driver;
+
+static std::vector<std::vector<uint8_t>> packets;
+static std::vector<uint8_t> decoded;
+static std::vector<uint16_t> timestamps;
+
+static void encoder_output(void*, const uint8_t* packet, size_t length)
+{
+  packets.emplace_back(packet, packet + length);
+}
+
+static void decoder_output(void*, const uint8_t* data, size_t length, uint16_t timestamp)
+{
+  decoded.insert(decoded.end(), data, data + length);
+  timestamps.push_back(timestamp);
+}
+
+// 入力バイト列をデコーダの出力と同じ形 (ランニングステータスを展開し、不完全なメッセージを除いたもの) に変換する
+static std::vector<uint8_t> canonicalize(const std::vector<uint8_t>& input)
+{
+  std::vector<uint8_t> result;
+  std::vector<uint8_t> msg;
+  uint8_t status = 0;
+  int need = 0;
+  bool in_sysex = false;
+  for (uint8_t value : input) {
+    if (value >= 0xF8) {
+      result.push_back(value);
+      continue;
+    }
+    if (value & 0x80) {
+      if (in_sysex) {
+        in_sysex = false;
+        result.push_back(0xF7);
+        if (value == 0xF7) { continue; }
+      } else if (value == 0xF7) {
+        continue;
+      }
+      msg.clear();
+      if (value == 0xF0) {
+        in_sysex = true;
+        status = 0;
+        result.push_back(value);
+        continue;
+      }
+      int n = getDataByteLength(value);
+      status = (value < 0xF0) ? value : 0;
+      if (n <= 0) {
+        result.push_back(value);
+        continue;
+      }
+      msg.push_back(value);
+      need = n + 1;
+      continue;
+    }
+    if (in_sysex) {
+      result.push_back(value);
+      continue;
+    }
+    if (msg.empty()) {
+      if (status == 0) { continue; }
+      msg.push_back(status);
+      need = getDataByteLength(status) + 1;
+    }
+    msg.push_back(value);
+    if ((int)msg.size() == need) {
+      result.insert(result.end(), msg.begin(), msg.end());
+      msg.clear();
+    }
+  }
+  return result;
+}
+
+void setUp(void)
+{
+  packets.clear();
+  decoded.clear();
+  timestamps.clear();
+}
+
+void tearDown(void) {}
+
+static void test_encode_packet_format(void)
+{
+  BLE_MIDI_Encoder encoder;
+  encoder.setOutput(encoder_output, nullptr);
+  encoder.setPacketSize(BLE_MIDI_Encoder::default_packet_size);
+  // ノートオン×2 (ランニングステータス) , タイミングクロック , ノートオン , ノートオフ
+  static constexpr const uint8_t input[] = { 0x90, 60, 100, 62, 100, 0xF8, 64, 100, 0x80, 60, 0 };
+  encoder.push(input, sizeof(input), 0x1234);
+  encoder.flush();
+
+  // 同じ時刻・同じステータスの2件目はタイムスタンプとステータスを省略し、
+  // リアルタイムメッセージの後はタイムスタンプを置き直してランニングステータスを続ける
+  static constexpr const uint8_t expected[] = {
+    0xA4, 0xB4, 0x90, 0x3C, 0x64, 0x3E, 0x64, 0xB4, 0xF8, 0xB4, 0x40, 0x64, 0xB4, 0x80, 0x3C, 0x00 };
+  TEST_ASSERT_EQUAL(1, packets.size());
+  TEST_ASSERT_EQUAL(sizeof(expected), packets[0].size());
+  TEST_ASSERT_EQUAL_MEMORY(expected, packets[0].data(), sizeof(expected));
+
+  BLE_MIDI_Decoder decoder;
+  decoder.setOutput(decoder_output, nullptr);
+  TEST_ASSERT_TRUE(decoder.decode(packets[0].data(), packets[0].size()));
+  static constexpr const uint8_t expected_decoded[] = { 0x90, 60, 100, 0x90, 62, 100, 0xF8, 0x90, 64, 100, 0x80, 60, 0 };
+  TEST_ASSERT_EQUAL(sizeof(expected_decoded), decoded.size());
+  TEST_ASSERT_EQUAL_MEMORY(expected_decoded, decoded.data(), sizeof(expected_decoded));
+  for (auto ts : timestamps) {
+    TEST_ASSERT_EQUAL(0x1234, ts);
+  }
+}
+
+static void test_timestamp_wrap(void)
+{
+  // 13bitの時刻が一周する前後でも、各メッセージの時刻がそのまま復元されること
+  BLE_MIDI_Encoder encoder;
+  encoder.setOutput(encoder_output, nullptr);
+  encoder.setPacketSize(100);
+  static constexpr const uint16_t input_ts[] = { 8100, 8180, 8191, 0, 5, 200, 1000 };
+  for (auto ts : input_ts) {
+    static constexpr const uint8_t msg[] = { 0x90, 1, 2 };
+    encoder.push(msg, sizeof(msg), ts);
+  }
+  encoder.flush();
+
+  BLE_MIDI_Decoder decoder;
+  decoder.setOutput(decoder_output, nullptr);
+  for (auto& packet : packets) {
+    TEST_ASSERT_TRUE(decoder.decode(packet.data(), packet.size()));
+  }
+  TEST_ASSERT_EQUAL(sizeof(input_ts) / sizeof(input_ts[0]), timestamps.size());
+  for (size_t i = 0; i < timestamps.size(); ++i) {
+    TEST_ASSERT_EQUAL(input_ts[i], timestamps[i]);
+  }
+}
+
+static void test_round_trip_random(void)
+{
+  // 任意のパケット長・任意のバイト列 (ランニングステータス , SysEx , リアルタイムメッセージの割込み) で往復させる
+  std::mt19937 rng(1);
+  for (int iter = 0; iter < 5000; ++iter) {
+    setUp();
+    BLE_MIDI_Encoder encoder;
+    encoder.setOutput(encoder_output, nullptr);
+    encoder.setPacketSize(BLE_MIDI_Encoder::min_packet_size + rng() % (BLE_MIDI_Encoder::max_packet_size - BLE_MIDI_Encoder::min_packet_size + 1));
+    BLE_MIDI_Decoder decoder;
+    decoder.setOutput(decoder_output, nullptr);
+
+    std::vector<uint8_t> all;
+    uint16_t ts = rng() % 8192;
+    int chunks = 1 + rng() % 8;
+    for (int c = 0; c < chunks; ++c) {
+      std::vector<uint8_t> input;
+      int n = rng() % 60;
+      for (int i = 0; i < n; ++i) {
+        int kind = rng() % 20;
+        uint8_t value;
+        if      (kind < 12) { value = rng() % 128; }
+        else if (kind < 17) { value = 0x80 | (rng() % 0x70); }
+        else if (kind < 18) { value = 0xF8 + rng() % 8; }
+        else if (kind < 19) { value = 0xF0; }
+        else                { value = 0xF1 + rng() % 7; }
+        input.push_back(value);
+      }
+      all.insert(all.end(), input.begin(), input.end());
+      encoder.push(input.data(), input.size(), ts);
+      ts = (ts + rng() % 300) & 0x1FFF;
+      if (rng() & 1) { encoder.flush(); }
+    }
+    // 比較のため、最後に SysEx を閉じておく
+    static constexpr const uint8_t eox = 0xF7;
+    all.push_back(eox);
+    encoder.push(&eox, 1, ts);
+    encoder.flush();
+
+    for (auto& packet : packets) {
+      TEST_ASSERT_LESS_OR_EQUAL(encoder.getPacketSize(), packet.size());
+      TEST_ASSERT_TRUE(decoder.decode(packet.data(), packet.size()));
+    }
+    auto expected = canonicalize(all);
+    TEST_ASSERT_EQUAL(expected.size(), decoded.size());
+    TEST_ASSERT_TRUE(expected == decoded);
+  }
+}
+
+static void test_reject_malformed_packet(void)
+{
+  BLE_MIDI_Decoder decoder;
+  decoder.setOutput(decoder_output, nullptr);
+  // ヘッダの最上位bitが無いもの、ヘッダのみのもの
+  static constexpr const uint8_t no_header[] = { 0x00, 0x80, 0x90, 0x3C, 0x64 };
+  static constexpr const uint8_t header_only[] = { 0x80 };
+  TEST_ASSERT_FALSE(decoder.decode(no_header, sizeof(no_header)));
+  TEST_ASSERT_FALSE(decoder.decode(header_only, sizeof(header_only)));
+  TEST_ASSERT_EQUAL(2, decoder.getErrorCount());
+  TEST_ASSERT_EQUAL(0, decoded.size());
+}
+
+static void test_throughput(void)
+{
+  // 64件のノートオン (192byte) を ATT_MTU 247 のパケットに詰める
+  std::vector<uint8_t> input;
+  for (int i = 0; i < 64; ++i) {
+    input.push_back(0x90 | (i & 15));
+    input.push_back(i);
+    input.push_back(100);
+  }
+  BLE_MIDI_Encoder encoder;
+  size_t packet_count = 0;
+  encoder.setOutput([](void* user, const uint8_t*, size_t) { ++*(size_t*)user; }, &packet_count);
+  encoder.setPacketSize(BLE_MIDI_Encoder::max_packet_size);
+
+  static constexpr const int loop = 20000;
+  auto t0 = std::chrono::steady_clock::now();
+  for (int i = 0; i < loop; ++i) {
+    encoder.push(input.data(), input.size(), i & 0x1FFF);
+    encoder.flush();
+  }
+  auto t1 = std::chrono::steady_clock::now();
+  // 1件あたり タイムスタンプ1byte + 3byte のため、2パケットに収まること
+  TEST_ASSERT_EQUAL(loop * 2, packet_count);
+
+  BLE_MIDI_Decoder decoder;
+  size_t decoded_bytes = 0;
+  decoder.setOutput([](void* user, const uint8_t*, size_t length, uint16_t) { *(size_t*)user += length; }, &decoded_bytes);
+  static constexpr const uint8_t packet[] = { 0x80, 0x80, 0x90, 1, 2, 0x81, 3, 4, 0x82, 0x80, 5, 6 };
+  for (int i = 0; i < loop * 16; ++i) {
+    decoder.decode(packet, sizeof(packet));
+  }
+  auto t2 = std::chrono::steady_clock::now();
+  TEST_ASSERT_EQUAL((size_t)loop * 16 * 9, decoded_bytes);
+
+  double encode_mbps = loop * input.size() / 1e6 / std::chrono::duration<double>(t1 - t0).count();
+  double decode_mbps = loop * 16.0 * sizeof(packet) / 1e6 / std::chrono::duration<double>(t2 - t1).count();
+  char text[96];
+  snprintf(text, sizeof(text), "encode %.1f MB/s , decode %.1f MB/s", encode_mbps, decode_mbps);
+  TEST_MESSAGE(text);
+  // BLE の通信速度 (数十KB/s) に対して十分に速いこと
+  TEST_ASSERT_TRUE(encode_mbps > 1.0);
+  TEST_ASSERT_TRUE(decode_mbps > 1.0);
+}
+
+int main(int, char**)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_encode_packet_format);
+  RUN_TEST(test_timestamp_wrap);
+  RUN_TEST(test_round_trip_random);
+  RUN_TEST(test_reject_malformed_packet);
+  RUN_TEST(test_throughput);
+  return UNITY_END();
+}
@@ -0,0 +1,373 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 InstaChord Corp.
+
+// RTP-MIDI (AppleMIDI) セッション・リカバリジャーナル・ジッタバッファのテスト
+// 前半は2つのセッションを、遅延・揺らぎ・欠落を再現する仮想の通信路でつないで確認する。
+// 後半はループバックの UDP 上で、本体のトランスポートと相手役のトランスポートを接続して確認する
+
+#include <unity.h>
+
+#include "midi/midi_rtp_session.hpp"
+#include "midi/midi_transport_rtp.hpp"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <random>
+#include <thread>
+#include <vector>
+
+using namespace midi_driver;
+
+//-------------------------------------------------------------------------
+// 仮想の通信路でつないだ2つのセッション
+// 各セッションの時刻には別々のずれを与え、時刻合わせが必要な状態にする
+class sim_network_t
+{
+public:
+  struct endpoint_t {
+    RTP_MIDI_Session session;
+    RTP_MIDI_Session::address_t address;
+    uint64_t clock_offset;
+    std::vector<uint8_t> received;
+    std::vector<uint64_t> note_on_usec;  // ノートオンを read で取り出した時刻 (共通の時刻)
+    sim_network_t* network;
+  };
+
+  uint32_t latency_usec = 2000;
+  uint32_t jitter_usec = 0;      // 遅延に加える揺らぎの最大値
+  int rtp_loss_percent = 0;      // RTP パケット (制御パケット以外) を欠落させる割合
+  uint32_t rtp_sent = 0;
+  uint32_t rtp_dropped = 0;
+  std::vector<uint64_t> arrive_usec; // [0] に RTP パケットが届いた時刻
+
+  endpoint_t endpoint[2];
+
+  sim_network_t(void)
+  {
+    static constexpr const uint64_t offset_table[] = { 0, 987654321ull };
+    for (int i = 0; i < 2; ++i) {
+      auto& ep = endpoint[i];
+      ep.network = this;
+      ep.address.ip = 0x7F000001 + i;
+      ep.address.port = 5004;
+      ep.clock_offset = offset_table[i];
+      ep.session.setSender(send_func, &ep);
+      ep.session.begin(0x1000 + i, getClock(i));
+    }
+  }
+
+  uint64_t getClock(int index) const { return _now + endpoint[index].clock_offset; }
+
+  // [1] から [0] へ接続する
+  bool connect(void)
+  {
+    endpoint[1].session.setPeer(endpoint[0].address);
+    step(6000000);
+    return endpoint[0].session.getConnectedCount() == 1 && endpoint[1].session.getConnectedCount() == 1;
+  }
+
+  void send(int index, const uint8_t* data, size_t length)
+  {
+    endpoint[index].session.send(data, length, getClock(index));
+  }
+
+  // 100μs 単位で時刻を進め、届いたパケットの受信と出力時刻に達したメッセージの取り出しを行う
+  void step(uint64_t usec)
+  {
+    uint64_t end = _now + usec;
+    while (_now < end) {
+      _now += 100;
+      for (auto it = _packets.begin(); it != _packets.end();) {
+        if (it->arrive_usec > _now) {
+          ++it;
+          continue;
+        }
+        auto packet = std::move(*it);
+        it = _packets.erase(it);
+        if (packet.to == 0 && !isControl(packet.data.data())) { arrive_usec.push_back(_now); }
+        endpoint[packet.to].session.receive(packet.kind, packet.from, packet.data.data(), packet.data.size(), getClock(packet.to));
+      }
+      for (int i = 0; i < 2; ++i) {
+        auto& ep = endpoint[i];
+        ep.session.proc(getClock(i));
+        uint8_t buf[32];
+        size_t len;
+        while (0 != (len = ep.session.read(buf, sizeof(buf), getClock(i)))) {
+          ep.received.insert(ep.received.end(), buf, buf + len);
+          for (size_t k = 0; k < len; ++k) {
+            if (buf[k] == 0x90) { ep.note_on_usec.push_back(_now); }
+          }
+        }
+      }
+    }
+  }
+
+private:
+  struct packet_t {
+    int to;
+    RTP_MIDI_Session::port_kind_t kind;
+    RTP_MIDI_Session::address_t from;
+    std::vector<uint8_t> data;
+    uint64_t arrive_usec;
+  };
+
+  static bool isControl(const uint8_t* data) { return data[0] == 0xFF && data[1] == 0xFF; }
+
+  static void send_func(void* user, RTP_MIDI_Session::port_kind_t kind, const RTP_MIDI_Session::address_t& to, const uint8_t* data, size_t length)
+  {
+    auto ep = (endpoint_t*)user;
+    auto me = ep->network;
+    if (!isControl(data)) {
+      ++me->rtp_sent;
+      if ((int)(me->_rng() % 100) < me->rtp_loss_percent) {
+        ++me->rtp_dropped;
+        return;
+      }
+    }
+    auto from = ep->address;
+    if (kind == RTP_MIDI_Session::port_data) { ++from.port; }
+    uint64_t arrive = me->_now + me->latency_usec + (me->jitter_usec ? me->_rng() % me->jitter_usec : 0);
+    int dst = (to.ip == me->endpoint[0].address.ip) ? 0 : 1;
+    me->_packets.push_back({ dst, kind, from, std::vector<uint8_t>(data, data + length), arrive });
+  }
+
+  std::deque<packet_t> _packets;
+  std::mt19937 _rng { 1 };
+  uint64_t _now = 1000000000ull;
+};
+
+static std::unique_ptr<sim_network_t> net;
+
+void setUp(void)
+{
+  net.reset(new sim_network_t());
+}
+
+void tearDown(void)
+{
+  net.reset();
+}
+
+//-------------------------------------------------------------------------
+
+static void test_session_handshake(void)
+{
+  TEST_ASSERT_TRUE(net->connect());
+
+  // BY を受けた側も切断すること
+  net->endpoint[1].session.end();
+  net->step(100000);
+  TEST_ASSERT_EQUAL(0, net->endpoint[0].session.getConnectedCount());
+}
+
+static void test_journal_recovery(void)
+{
+  // RTP パケットの 30% を欠落させながらノートオン・オフと CC を送り、
+  // リカバリジャーナルにより最終的な状態が送信側と一致することを確認する
+  TEST_ASSERT_TRUE(net->connect());
+  net->rtp_loss_percent = 30;
+  net->jitter_usec = 3000;
+
+  std::mt19937 rng(2);
+  uint8_t note_state[128] = {};
+  uint8_t volume = 0;
+  for (int k = 0; k < 400; ++k) {
+    uint8_t note = 40 + rng() % 20;
+    uint8_t msg[3] = { 0x90, note, 100 };
+    if (note_state[note]) {
+      msg[0] = 0x80;
+      msg[2] = 0x40;
+    }
+    note_state[note] = !note_state[note];
+    net->send(1, msg, sizeof(msg));
+    if (k % 7 == 0) {
+      volume = k & 0x7F;
+      uint8_t cc[3] = { 0xB1, 7, volume };
+      net->send(1, cc, sizeof(cc));
+    }
+    net->step(20000);
+  }
+  // 欠落の無い状態で最後のパケットを送り、残りの欠落を復元させる
+  net->rtp_loss_percent = 0;
+  static constexpr const uint8_t bend[] = { 0xE0, 0, 0x40 };
+  net->send(1, bend, sizeof(bend));
+  net->step(2000000);
+
+  auto& rx = net->endpoint[0];
+  TEST_ASSERT_GREATER_THAN(0, net->rtp_dropped);
+  TEST_ASSERT_GREATER_THAN(0, rx.session.getLostCount());
+  TEST_ASSERT_GREATER_THAN(0, rx.session.getRecoverCount());
+
+  MIDI_Decoder decoder;
+  decoder.addData(rx.received.data(), rx.received.size());
+  MIDI_Message msg;
+  uint8_t received_state[128] = {};
+  int received_volume = -1;
+  while (decoder.popMessage(&msg)) {
+    if (msg.type == 9 && msg.data[1]) {
+      received_state[msg.data[0]] = 1;
+    } else if (msg.type == 8 || msg.type == 9) {
+      received_state[msg.data[0]] = 0;
+    } else if (msg.status == 0xB1 && msg.data[0] == 7) {
+      received_volume = msg.data[1];
+    }
+  }
+  TEST_ASSERT_EQUAL_MEMORY(note_state, received_state, sizeof(note_state));
+  TEST_ASSERT_EQUAL(volume, received_volume);
+}
+
+static void test_sysex_and_running_status(void)
+{
+  TEST_ASSERT_TRUE(net->connect());
+
+  // 1パケットに収まらない SysEx は分割して送られ、受信側で元の並びに戻ること
+  std::vector<uint8_t> sysex;
+  sysex.push_back(0xF0);
+  for (int i = 0; i < 700; ++i) { sysex.push_back(i & 0x7F); }
+  sysex.push_back(0xF7);
+  net->send(1, sysex.data(), sysex.size());
+  net->step(100000);
+  TEST_ASSERT_TRUE(net->endpoint[0].received == sysex);
+
+  // ランニングステータスの入力は、ステータスを補ったメッセージとして受信されること
+  static constexpr const uint8_t input[] = { 0x90, 60, 100, 62, 100, 64, 0 };
+  static constexpr const uint8_t expected[] = { 0x90, 60, 100, 0x90, 62, 100, 0x90, 64, 0 };
+  net->send(0, input, sizeof(input));
+  net->step(100000);
+  TEST_ASSERT_EQUAL(sizeof(expected), net->endpoint[1].received.size());
+  TEST_ASSERT_EQUAL_MEMORY(expected, net->endpoint[1].received.data(), sizeof(expected));
+}
+
+static double getIntervalDeviation(const std::vector<uint64_t>& list)
+{
+  double sum = 0, sum2 = 0;
+  size_t n = 0;
+  for (size_t i = 1; i < list.size(); ++i) {
+    double d = (double)(list[i] - list[i - 1]);
+    sum += d;
+    sum2 += d * d;
+    ++n;
+  }
+  double mean = sum / n;
+  return sqrt(sum2 / n - mean * mean);
+}
+
+static void test_jitter_buffer(void)
+{
+  // 10msec 間隔で送ったノートが 0~4msec の揺らぎを持って届いても、取り出す間隔は揃っていること
+  net->latency_usec = 3000;
+  TEST_ASSERT_TRUE(net->connect());
+  net->jitter_usec = 4000;
+  net->arrive_usec.clear();
+  for (int k = 0; k < 300; ++k) {
+    static constexpr const uint8_t note[] = { 0x90, 60, 100, 0x80, 60, 0 };
+    net->send(1, note, sizeof(note));
+    net->step(10000);
+  }
+  net->step(100000);
+
+  auto& rx = net->endpoint[0];
+  TEST_ASSERT_EQUAL(300, rx.note_on_usec.size());
+  double arrive_sd = getIntervalDeviation(net->arrive_usec);
+  double deliver_sd = getIntervalDeviation(rx.note_on_usec);
+  char text[96];
+  snprintf(text, sizeof(text), "interval deviation : arrive %.0f usec , deliver %.0f usec", arrive_sd, deliver_sd);
+  TEST_MESSAGE(text);
+  TEST_ASSERT_TRUE(arrive_sd > 1000);
+  TEST_ASSERT_TRUE(deliver_sd < arrive_sd / 4);
+  TEST_ASSERT_EQUAL(0, rx.session.getReceiveDropCount());
+}
+
+//-------------------------------------------------------------------------
+// ループバックの UDP 上で、本体と相手役のトランスポートを接続する
+
+static constexpr const uint16_t device_port = 25004;
+static constexpr const uint16_t peer_port = 25104;
+
+// 両方の受信処理を回しながら、指定の時間だけ待つ
+static void pollTransport(MIDI_Transport_RTP& device, MIDI_Transport_RTP& peer, int msec, std::vector<uint8_t>* device_rx, std::vector<uint8_t>* peer_rx)
+{
+  uint8_t buf[32];
+  for (int i = 0; i < msec; ++i) {
+    size_t len = device.read(buf, sizeof(buf));
+    if (device_rx) { device_rx->insert(device_rx->end(), buf, buf + len); }
+    len = peer.read(buf, sizeof(buf));
+    if (peer_rx) { peer_rx->insert(peer_rx->end(), buf, buf + len); }
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+}
+
+static void test_udp_loopback(void)
+{
+  MIDI_Transport_RTP device, peer;
+  MIDI_Transport_RTP::config_t config;
+  config.port = device_port;
+  device.setConfig(config);
+  config.port = peer_port;
+  config.session_name = "peer";
+  peer.setConfig(config);
+  TEST_ASSERT_TRUE(device.begin());
+  TEST_ASSERT_TRUE(peer.begin());
+  device.setEnable(true, true);
+  peer.setEnable(true, true);
+
+  // 相手役から本体へ接続する
+  peer.setPeer(0x7F000001, device_port);
+  uint8_t buf[32];
+  for (int i = 0; i < 3000 && !(device.getConnectedCount() && peer.getConnectedCount()); ++i) {
+    device.read(buf, sizeof(buf));
+    peer.read(buf, sizeof(buf));
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  TEST_ASSERT_EQUAL(1, device.getConnectedCount());
+  TEST_ASSERT_EQUAL(1, peer.getConnectedCount());
+
+  // 相手役 → 本体
+  static constexpr const uint8_t notes[] = { 0x90, 60, 100, 64, 100, 0x80, 60, 0 };
+  static constexpr const uint8_t expected_notes[] = { 0x90, 60, 100, 0x90, 64, 100, 0x80, 60, 0 };
+  std::vector<uint8_t> received;
+  peer.write(notes, sizeof(notes));
+  pollTransport(device, peer, 200, &received, nullptr);
+  TEST_ASSERT_EQUAL(sizeof(expected_notes), received.size());
+  TEST_ASSERT_EQUAL_MEMORY(expected_notes, received.data(), sizeof(expected_notes));
+
+  // 本体の受信を無効にした場合は、接続を保ったまま受信したメッセージを破棄すること
+  device.setEnable(true, false);
+  received.clear();
+  peer.write(notes, 3);
+  pollTransport(device, peer, 100, &received, nullptr);
+  TEST_ASSERT_EQUAL(0, received.size());
+
+  // 本体 → 相手役
+  static constexpr const uint8_t volume[] = { 0xB0, 7, 99 };
+  received.clear();
+  device.write(volume, sizeof(volume));
+  pollTransport(device, peer, 100, nullptr, &received);
+  TEST_ASSERT_EQUAL(sizeof(volume), received.size());
+  TEST_ASSERT_EQUAL_MEMORY(volume, received.data(), sizeof(volume));
+
+  // 相手役の終了 (BY) で本体側も切断すること
+  peer.end();
+  for (int i = 0; i < 20; ++i) {
+    device.read(buf, sizeof(buf));
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  TEST_ASSERT_EQUAL(0, device.getConnectedCount());
+  device.end();
+}
+
+int main(int, char**)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_session_handshake);
+  RUN_TEST(test_journal_recovery);
+  RUN_TEST(test_sysex_and_running_status);
+  RUN_TEST(test_jitter_buffer);
+  RUN_TEST(test_udp_loopback);
+  return UNITY_END();
+}
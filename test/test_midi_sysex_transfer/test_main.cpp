@@ -0,0 +1,258 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 InstaChord Corp.
+
+// SysEx バルク転送のテスト
+// 2台の転送処理を、帯域・遅延・欠落・破損を再現する仮想の通信路でつなぎ、
+// ロード (相手へ送信) とダンプ (相手から受信) でデータが一致すること、各トランスポートでの転送速度、
+// 途中で失敗した場合に受信側のデータが書き換わらないことを確認する
+
+#include <unity.h>
+
+#include "midi/midi_sysex_transfer.hpp"
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <deque>
+#include <random>
+#include <vector>
+
+using namespace midi_driver;
+
+// ソングデータ・設定のバルク転送と同じく、受信中のデータは別の領域に溜めて成功時のみ反映する
+class peer_t : public MIDI_SysEx_Transfer
+{
+public:
+  std::vector<uint8_t> data;
+  std::deque<std::vector<uint8_t>> outbox;
+  bool allow_write = true;
+  bool finished = false;
+  bool success = false;
+
+  peer_t(void) { setOutput(output, this); }
+
+protected:
+  uint32_t getDataSize(uint8_t) override { return data.size(); }
+  void readData(uint8_t, uint32_t offset, uint8_t* dst, size_t length) override { memcpy(dst, &data[offset], length); }
+  bool beginWrite(uint8_t) override
+  {
+    _incoming.assign(data.size(), 0);
+    return allow_write;
+  }
+  void writeData(uint8_t, uint32_t offset, const uint8_t* src, size_t length) override { memcpy(&_incoming[offset], src, length); }
+  void endWrite(uint8_t, bool result) override
+  {
+    if (result) { data = _incoming; }
+  }
+  void onFinish(uint8_t, bool, bool result, uint32_t, uint32_t) override
+  {
+    finished = true;
+    success = result;
+  }
+
+private:
+  static void output(void* user, const uint8_t* data, size_t length)
+  {
+    ((peer_t*)user)->outbox.emplace_back(data, data + length);
+  }
+  std::vector<uint8_t> _incoming;
+};
+
+// 片方向の通信路。byte_per_msec の速度で1メッセージずつ送り出し、latency_msec 後に相手へ届く
+struct link_t {
+  link_t(double byte_per_msec, uint32_t latency_msec, double loss = 0, double corrupt = 0)
+  : byte_per_msec { byte_per_msec }, latency_msec { latency_msec }, loss { loss }, corrupt { corrupt } {}
+
+  double byte_per_msec;
+  uint32_t latency_msec;
+  double loss;          // メッセージが欠落する確率
+  double corrupt;       // メッセージの1bitが化ける確率
+  uint32_t cut_after = UINT32_MAX; // この件数より後のメッセージを全て欠落させる (切断の再現)
+
+  std::deque<std::pair<double, std::vector<uint8_t>>> queue;
+  double busy_until = 0;
+  uint32_t count = 0;
+};
+
+struct result_t {
+  bool receiver_success;
+  bool sender_success;
+  double sec;
+};
+
+// dump が true の場合は host が device にダンプを要求し、false の場合は host から device へ送る
+static result_t simulate(peer_t& device, peer_t& host, link_t* link, bool dump, uint32_t seed)
+{
+  std::mt19937 rng(seed);
+  std::uniform_real_distribution<> random(0, 1);
+  if (dump) {
+    host.requestDump(0, 0);
+  } else {
+    host.startSend(0, 0);
+  }
+  peer_t* peer[2] = { &device, &host };
+  result_t result = { false, false, 0 };
+  for (uint32_t msec = 0; msec < 600000; ++msec) {
+    for (int i = 0; i < 2; ++i) {
+      peer[i]->proc(msec);
+      auto& l = link[i];
+      while (!peer[i]->outbox.empty()) {
+        auto msg = std::move(peer[i]->outbox.front());
+        peer[i]->outbox.pop_front();
+        // F0 , F7 を含めた長さで通信路を占有する
+        double start = std::max<double>(l.busy_until, msec);
+        l.busy_until = start + (msg.size() + 2) / l.byte_per_msec;
+        if (++l.count > l.cut_after || random(rng) < l.loss) { continue; }
+        if (random(rng) < l.corrupt) { msg[rng() % msg.size()] ^= 1 << (rng() % 7); }
+        l.queue.push_back({ l.busy_until + l.latency_msec, std::move(msg) });
+      }
+      while (!l.queue.empty() && l.queue.front().first <= msec) {
+        auto& msg = l.queue.front().second;
+        peer[1 - i]->receive(msg.data(), msg.size(), msec);
+        l.queue.pop_front();
+      }
+    }
+    if (device.finished && host.finished && link[0].queue.empty() && link[1].queue.empty()) {
+      result.sec = msec / 1000.0;
+      break;
+    }
+  }
+  auto& receiver = dump ? host : device;
+  auto& sender = dump ? device : host;
+  result.receiver_success = receiver.finished && receiver.success;
+  result.sender_success = sender.finished && sender.success;
+  return result;
+}
+
+static std::vector<uint8_t> makeData(size_t size, uint32_t seed)
+{
+  std::mt19937 rng(seed);
+  std::vector<uint8_t> data(size);
+  for (auto& d : data) { d = rng(); }
+  return data;
+}
+
+//-------------------------------------------------------------------------
+
+void setUp(void) {}
+void tearDown(void) {}
+
+static void test_pack7_round_trip(void)
+{
+  for (size_t length = 0; length <= MIDI_SysEx_Transfer::chunk_size; ++length) {
+    uint8_t src[MIDI_SysEx_Transfer::chunk_size];
+    uint8_t packed[MIDI_SysEx_Transfer::packed_chunk_size];
+    uint8_t dst[MIDI_SysEx_Transfer::chunk_size];
+    for (size_t i = 0; i < length; ++i) { src[i] = i * 37 + 200; }
+    size_t packed_length = MIDI_SysEx_Transfer::pack7(src, length, packed);
+    TEST_ASSERT_LESS_OR_EQUAL(sizeof(packed), packed_length);
+    for (size_t i = 0; i < packed_length; ++i) {
+      TEST_ASSERT_EQUAL(0, packed[i] & 0x80);
+    }
+    TEST_ASSERT_EQUAL(length, MIDI_SysEx_Transfer::unpack7(packed, packed_length, dst));
+    TEST_ASSERT_EQUAL_MEMORY(src, dst, length);
+  }
+}
+
+static void test_transport_throughput(void)
+{
+  // ソングデータ相当の大きさを、各トランスポートの帯域と遅延でロード・ダンプする
+  static constexpr const size_t song_size = 26160;
+  static constexpr const struct {
+    const char* name;
+    double byte_per_msec;
+    uint32_t latency_msec;
+    uint32_t min_byte_per_sec;  // 下回った場合は流量制御が帯域を使い切れていない
+  } transport_table[] = {
+    { "UART 31.25kbps", 3.125,  1,  2000 },
+    { "BLE (7.5ms CI)", 2.6  , 15,  1500 },
+    { "USB Full-Speed", 100  ,  1, 20000 },
+  };
+  auto source = makeData(song_size, 1);
+  for (auto& transport : transport_table) {
+    for (int dump = 0; dump < 2; ++dump) {
+      peer_t device, host;
+      device.data.resize(song_size);
+      host.data.resize(song_size);
+      (dump ? device : host).data = source;
+      link_t link[2] = { { transport.byte_per_msec, transport.latency_msec }, { transport.byte_per_msec, transport.latency_msec } };
+      auto result = simulate(device, host, link, dump, 1);
+
+      TEST_ASSERT_TRUE(result.receiver_success);
+      TEST_ASSERT_TRUE(result.sender_success);
+      TEST_ASSERT_TRUE((dump ? host : device).data == source);
+      TEST_ASSERT_TRUE(result.sec > 0);
+      uint32_t byte_per_sec = song_size / result.sec;
+      char text[96];
+      snprintf(text, sizeof(text), "%s %s : %.2f sec (%u byte/s)", transport.name, dump ? "dump" : "load", result.sec, (unsigned)byte_per_sec);
+      TEST_MESSAGE(text);
+      TEST_ASSERT_GREATER_OR_EQUAL(transport.min_byte_per_sec, byte_per_sec);
+    }
+  }
+}
+
+static void test_lossy_link(void)
+{
+  // 欠落・破損のある通信路でも、再送によって最終的にデータが一致すること
+  for (uint32_t seed = 0; seed < 1000; ++seed) {
+    size_t size = 1 + seed * 97 % 5000;
+    bool dump = seed & 1;
+    auto source = makeData(size, seed);
+    peer_t device, host;
+    device.data.resize(size);
+    host.data.resize(size);
+    (dump ? device : host).data = source;
+    link_t link[2] = { { 3.125, 2, 0.08, 0.05 }, { 3.125, 2, 0.08, 0.05 } };
+    auto result = simulate(device, host, link, dump, seed);
+
+    TEST_ASSERT_TRUE(result.receiver_success);
+    TEST_ASSERT_TRUE((dump ? host : device).data == source);
+  }
+}
+
+static void test_interrupted_load_keeps_data(void)
+{
+  // 途中で通信が途絶えた場合、受信側はタイムアウトで中止し、元のデータを書き換えないこと
+  static constexpr const size_t size = 4096;
+  auto source = makeData(size, 2);
+  auto original = makeData(size, 3);
+  peer_t device, host;
+  device.data = original;
+  host.data = source;
+  link_t link[2] = { { 3.125, 1 }, { 3.125, 1 } };
+  link[1].cut_after = 20;
+  auto result = simulate(device, host, link, false, 2);
+
+  TEST_ASSERT_TRUE(device.finished);
+  TEST_ASSERT_FALSE(result.receiver_success);
+  TEST_ASSERT_FALSE(result.sender_success);
+  TEST_ASSERT_TRUE(device.data == original);
+}
+
+static void test_rejected_load(void)
+{
+  // 受信側が受け付けない場合 (ロード中・編集中など) は、送信側が失敗として終了すること
+  static constexpr const size_t size = 1000;
+  auto original = makeData(size, 4);
+  peer_t device, host;
+  device.data = original;
+  device.allow_write = false;
+  host.data = makeData(size, 5);
+  link_t link[2] = { { 3.125, 1 }, { 3.125, 1 } };
+  auto result = simulate(device, host, link, false, 4);
+
+  TEST_ASSERT_TRUE(host.finished);
+  TEST_ASSERT_FALSE(result.sender_success);
+  TEST_ASSERT_TRUE(device.data == original);
+}
+
+int main(int, char**)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_pack7_round_trip);
+  RUN_TEST(test_transport_throughput);
+  RUN_TEST(test_lossy_link);
+  RUN_TEST(test_interrupted_load_keeps_data);
+  RUN_TEST(test_rejected_load);
+  return UNITY_END();
+}
@@ -0,0 +1,278 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 InstaChord Corp.
+
+// USB-MIDI エンコーダ・デコーダのテスト
+// 仕様どおりのイベントパケット (CIN , ランニングステータスの展開 , SysEx の分割と終了) が生成されること、
+// 任意のMIDIバイト列をエンコードしてデコードすると元のメッセージ列に戻ること、
+// 出力がバルク転送1回分 (64byte) ずつまとめられることを確認する
+
+#include <unity.h>
+
+#include "midi/midi_usb_codec.hpp"
+#include "midi/midi_driver.hpp"
+
+#include <random>
+#include <vector>
+
+using namespace midi_driver;
+
+static std::vector<uint8_t> packets;
+static std::vector<size_t> output_length;
+
+static void encoder_output(void*, const uint8_t* data, size_t length)
+{
+  packets.insert(packets.end(), data, data + length);
+  output_length.push_back(length);
+}
+
+static std::vector<uint8_t> decode_all(const std::vector<uint8_t>& src)
+{
+  std::vector<uint8_t> result;
+  uint8_t buf[3];
+  for (size_t i = 0; i + 4 <= src.size(); i += 4) {
+    size_t len = USB_MIDI_Decoder::decode(&src[i], buf);
+    result.insert(result.end(), buf, buf + len);
+  }
+  return result;
+}
+
+// 入力バイト列をデコーダの出力と同じ形 (ランニングステータスを展開し、不完全なメッセージを除いたもの) に変換する
+// リアルタイムメッセージは SysEx の途中でも先に送られるため、比較時は別の列として扱う
+static std::vector<uint8_t> canonicalize(const std::vector<uint8_t>& input)
+{
+  std::vector<uint8_t> result;
+  std::vector<uint8_t> msg;
+  uint8_t status = 0;
+  int need = 0;
+  bool in_sysex = false;
+  for (uint8_t value : input) {
+    if (value >= 0xF8) {
+      result.push_back(value);
+      continue;
+    }
+    if (value & 0x80) {
+      if (in_sysex) {
+        in_sysex = false;
+        result.push_back(0xF7);
+        if (value == 0xF7) { continue; }
+      } else if (value == 0xF7) {
+        continue;
+      }
+      msg.clear();
+      if (value == 0xF0) {
+        in_sysex = true;
+        status = 0;
+        result.push_back(value);
+        continue;
+      }
+      int n = getDataByteLength(value);
+      status = (value < 0xF0) ? value : 0;
+      if (n <= 0) {
+        result.push_back(value);
+        continue;
+      }
+      msg.push_back(value);
+      need = n + 1;
+      continue;
+    }
+    if (in_sysex) {
+      result.push_back(value);
+      continue;
+    }
+    if (msg.empty()) {
+      if (status == 0) { continue; }
+      msg.push_back(status);
+      need = getDataByteLength(status) + 1;
+    }
+    msg.push_back(value);
+    if ((int)msg.size() == need) {
+      result.insert(result.end(), msg.begin(), msg.end());
+      msg.clear();
+    }
+  }
+  return result;
+}
+
+static std::vector<uint8_t> split_realtime(const std::vector<uint8_t>& data, bool realtime)
+{
+  std::vector<uint8_t> result;
+  for (auto value : data) {
+    if ((value >= 0xF8) == realtime) { result.push_back(value); }
+  }
+  return result;
+}
+
+static void encode(const uint8_t* data, size_t length, uint8_t cable = 0)
+{
+  USB_MIDI_Encoder encoder;
+  encoder.setOutput(encoder_output, nullptr);
+  encoder.setCable(cable);
+  encoder.push(data, length);
+  encoder.flush();
+}
+
+void setUp(void)
+{
+  packets.clear();
+  output_length.clear();
+}
+
+void tearDown(void) {}
+
+static void test_running_status(void)
+{
+  // ランニングステータスで省略されたステータスは各パケットに付け直される
+  static constexpr const uint8_t input[] = { 0x90, 60, 100, 62, 0, 0xC3, 5, 7, 0xF2, 1, 2, 3 };
+  encode(input, sizeof(input), 1);
+
+  // システムコモンの後はランニングステータスが解除されるため、末尾の 3 は捨てられる
+  static constexpr const uint8_t expected[] = {
+    0x19, 0x90, 60, 100,
+    0x19, 0x90, 62, 0,
+    0x1C, 0xC3, 5, 0,
+    0x1C, 0xC3, 7, 0,
+    0x13, 0xF2, 1, 2,
+  };
+  TEST_ASSERT_EQUAL(sizeof(expected), packets.size());
+  TEST_ASSERT_EQUAL_MEMORY(expected, packets.data(), sizeof(expected));
+  TEST_ASSERT_EQUAL(1, USB_MIDI_Decoder::getCable(packets.data()));
+
+  static constexpr const uint8_t expected_decoded[] = { 0x90, 60, 100, 0x90, 62, 0, 0xC3, 5, 0xC3, 7, 0xF2, 1, 2 };
+  auto decoded = decode_all(packets);
+  TEST_ASSERT_EQUAL(sizeof(expected_decoded), decoded.size());
+  TEST_ASSERT_EQUAL_MEMORY(expected_decoded, decoded.data(), sizeof(expected_decoded));
+}
+
+static void test_sysex_termination(void)
+{
+  // SysEx の終了パケットは、最後のパケットに含まれるバイト数で CIN 0x5 / 0x6 / 0x7 を使い分ける
+  struct case_t {
+    std::vector<uint8_t> input;
+    std::vector<uint8_t> expected;
+  };
+  const case_t cases[] = {
+    // F0 F7 のみ : CIN 0x6
+    { { 0xF0, 0xF7 }, { 0x06, 0xF0, 0xF7, 0 } },
+    // 3byte で終了 : CIN 0x7
+    { { 0xF0, 1, 0xF7 }, { 0x07, 0xF0, 1, 0xF7 } },
+    // 開始・継続 (CIN 0x4) の後に F7 のみ : CIN 0x5
+    { { 0xF0, 1, 2, 0xF7 }, { 0x04, 0xF0, 1, 2, 0x05, 0xF7, 0, 0 } },
+    // 継続の後に 2byte : CIN 0x6
+    { { 0xF0, 1, 2, 3, 0xF7 }, { 0x04, 0xF0, 1, 2, 0x06, 3, 0xF7, 0 } },
+    // 継続の後に 3byte : CIN 0x7
+    { { 0xF0, 1, 2, 3, 4, 0xF7 }, { 0x04, 0xF0, 1, 2, 0x07, 3, 4, 0xF7 } },
+    // F7 以外のステータスで打ち切られた場合も F7 を付けて終了する
+    { { 0xF0, 1, 0x90, 60, 100 }, { 0x07, 0xF0, 1, 0xF7, 0x09, 0x90, 60, 100 } },
+    // 1byteのシステムコモン (Tune Request) も CIN 0x5
+    { { 0xF6 }, { 0x05, 0xF6, 0, 0 } },
+  };
+  for (auto& c : cases) {
+    setUp();
+    encode(c.input.data(), c.input.size());
+    TEST_ASSERT_EQUAL(c.expected.size(), packets.size());
+    TEST_ASSERT_EQUAL_MEMORY(c.expected.data(), packets.data(), c.expected.size());
+    TEST_ASSERT_TRUE(canonicalize(c.input) == decode_all(packets));
+  }
+}
+
+static void test_realtime_in_sysex(void)
+{
+  // SysEx の途中のリアルタイムメッセージは単独のパケット (CIN 0xF) で先に送り、SysEx はそのまま続ける
+  static constexpr const uint8_t input[] = { 0xF0, 1, 0xF8, 2, 3, 0xFE, 0xF7 };
+  encode(input, sizeof(input));
+
+  static constexpr const uint8_t expected[] = {
+    0x0F, 0xF8, 0, 0,
+    0x04, 0xF0, 1, 2,
+    0x0F, 0xFE, 0, 0,
+    0x06, 3, 0xF7, 0,
+  };
+  TEST_ASSERT_EQUAL(sizeof(expected), packets.size());
+  TEST_ASSERT_EQUAL_MEMORY(expected, packets.data(), sizeof(expected));
+
+  static constexpr const uint8_t expected_decoded[] = { 0xF8, 0xF0, 1, 2, 0xFE, 3, 0xF7 };
+  auto decoded = decode_all(packets);
+  TEST_ASSERT_EQUAL(sizeof(expected_decoded), decoded.size());
+  TEST_ASSERT_EQUAL_MEMORY(expected_decoded, decoded.data(), sizeof(expected_decoded));
+}
+
+static void test_bulk_batching(void)
+{
+  // 16パケット (64byte) に達するまでは出力せず、flush で残りを出力する
+  USB_MIDI_Encoder encoder;
+  encoder.setOutput(encoder_output, nullptr);
+  static constexpr const uint8_t note_on[] = { 0x90, 60, 100 };
+  for (int i = 0; i < 15; ++i) {
+    encoder.push(note_on, sizeof(note_on));
+  }
+  TEST_ASSERT_EQUAL(0, output_length.size());
+  encoder.push(note_on, sizeof(note_on));
+  TEST_ASSERT_EQUAL(1, output_length.size());
+  TEST_ASSERT_EQUAL(64, output_length[0]);
+  for (int i = 0; i < 3; ++i) {
+    encoder.push(note_on, sizeof(note_on));
+  }
+  TEST_ASSERT_EQUAL(1, output_length.size());
+  encoder.flush();
+  TEST_ASSERT_EQUAL(2, output_length.size());
+  TEST_ASSERT_EQUAL(12, output_length[1]);
+  // 保持しているパケットが無ければ何も出力しない
+  encoder.flush();
+  TEST_ASSERT_EQUAL(2, output_length.size());
+}
+
+static void test_round_trip_random(void)
+{
+  // 任意のバイト列 (ランニングステータス , SysEx , リアルタイムメッセージの割込み) で往復させる
+  std::mt19937 rng(1);
+  for (int iter = 0; iter < 5000; ++iter) {
+    setUp();
+    USB_MIDI_Encoder encoder;
+    encoder.setOutput(encoder_output, nullptr);
+
+    std::vector<uint8_t> all;
+    int chunks = 1 + rng() % 6;
+    for (int c = 0; c < chunks; ++c) {
+      std::vector<uint8_t> input;
+      int n = rng() % 80;
+      for (int i = 0; i < n; ++i) {
+        int kind = rng() % 20;
+        uint8_t value;
+        if      (kind < 12) { value = rng() % 128; }
+        else if (kind < 17) { value = 0x80 | (rng() % 0x70); }
+        else if (kind < 18) { value = 0xF8 + rng() % 8; }
+        else if (kind < 19) { value = 0xF0; }
+        else                { value = 0xF1 + rng() % 7; }
+        input.push_back(value);
+      }
+      all.insert(all.end(), input.begin(), input.end());
+      encoder.push(input.data(), input.size());
+      if (rng() & 1) { encoder.flush(); }
+    }
+    // 比較のため、最後に SysEx を閉じておく
+    static constexpr const uint8_t eox = 0xF7;
+    all.push_back(eox);
+    encoder.push(&eox, 1);
+    encoder.flush();
+
+    for (auto length : output_length) {
+      TEST_ASSERT_EQUAL(0, length & 3);
+      TEST_ASSERT_LESS_OR_EQUAL(USB_MIDI_Encoder::max_packet_count * 4, length);
+    }
+    auto expected = canonicalize(all);
+    auto decoded = decode_all(packets);
+    TEST_ASSERT_TRUE(split_realtime(expected, false) == split_realtime(decoded, false));
+    TEST_ASSERT_TRUE(split_realtime(expected, true) == split_realtime(decoded, true));
+  }
+}
+
+int main(int, char**)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_running_status);
+  RUN_TEST(test_sysex_termination);
+  RUN_TEST(test_realtime_in_sysex);
+  RUN_TEST(test_bulk_batching);
+  RUN_TEST(test_round_trip_random);
+  return UNITY_END();
+}
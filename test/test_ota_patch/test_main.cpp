@@ -0,0 +1,268 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 InstaChord Corp.
+
+// 差分OTAパッチ適用処理のテスト
+// ota_bin/ のファームウェアの組から generate_ota_patch.py でパッチを生成し、
+// ローカルのHTTPサーバ (代替) から受信しながら適用して、生成結果が新しいファームウェアと一致することを確認する
+// (pio test -e native_test はプロジェクトのディレクトリで実行されるため、相対パスでファイルを参照する)
+
+#include <unity.h>
+
+#include "ota_patch.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <signal.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+using namespace kanplay_ns;
+
+static constexpr const char* source_path = "ota_bin/KANTAN_Play_Core2_v0_3_3.bin";
+static constexpr const char* target_path = "ota_bin/KANTAN_Play_Core2_v0_3_4.bin";
+static constexpr const char* other_path  = "ota_bin/KANTAN_Play_Core2_v0_3_2.bin";
+static constexpr const char* patch_path  = ".pio/test_ota_patch_033_034.kpd";
+
+static std::vector<uint8_t> loadFile(const char* path)
+{
+  std::vector<uint8_t> data;
+  auto fp = fopen(path, "rb");
+  if (fp == nullptr) { return data; }
+  uint8_t buf[4096];
+  size_t len;
+  while (0 < (len = fread(buf, 1, sizeof(buf), fp))) {
+    data.insert(data.end(), buf, buf + len);
+  }
+  fclose(fp);
+  return data;
+}
+
+//-------------------------------------------------------------------------
+// 配信サーバの代替。1回の GET に対して Content-Length 付きでデータを返す
+// 通信路の分割を再現するため、応答は小さな単位に分けて送る
+class http_stand_in_t
+{
+public:
+  bool begin(const std::vector<uint8_t>* body)
+  {
+    _body = body;
+    _listen = socket(AF_INET, SOCK_STREAM, 0);
+    if (_listen < 0) { return false; }
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;
+    socklen_t addr_len = sizeof(addr);
+    if (bind(_listen, (struct sockaddr*)&addr, sizeof(addr)) < 0
+     || listen(_listen, 1) < 0
+     || getsockname(_listen, (struct sockaddr*)&addr, &addr_len) < 0) {
+      close(_listen);
+      return false;
+    }
+    _port = ntohs(addr.sin_port);
+    _thread = std::thread(serve, this);
+    return true;
+  }
+
+  void end(void)
+  {
+    if (_thread.joinable()) { _thread.join(); }
+    if (_listen >= 0) { close(_listen); }
+    _listen = -1;
+  }
+
+  uint16_t getPort(void) const { return _port; }
+
+private:
+  static void serve(http_stand_in_t* me)
+  {
+    int sock = accept(me->_listen, nullptr, nullptr);
+    if (sock < 0) { return; }
+    // リクエストヘッダの終端まで読み捨てる
+    std::string request;
+    char buf[512];
+    while (request.find("\r\n\r\n") == std::string::npos) {
+      auto len = recv(sock, buf, sizeof(buf), 0);
+      if (len <= 0) { break; }
+      request.append(buf, len);
+    }
+    char header[128];
+    int header_len = snprintf(header, sizeof(header), "HTTP/1.1 200 OK\r\nContent-Length: %u\r\nConnection: close\r\n\r\n", (unsigned)me->_body->size());
+    send(sock, header, header_len, 0);
+    static constexpr const size_t chunk_size = 1371;
+    for (size_t pos = 0; pos < me->_body->size(); pos += chunk_size) {
+      size_t len = std::min(chunk_size, me->_body->size() - pos);
+      if (send(sock, me->_body->data() + pos, len, 0) <= 0) { break; }
+    }
+    close(sock);
+  }
+
+  const std::vector<uint8_t>* _body = nullptr;
+  std::thread _thread;
+  int _listen = -1;
+  uint16_t _port = 0;
+};
+
+//-------------------------------------------------------------------------
+// 端末の delta_ota_io_t と同様に、ヘッダを受け取った時点でソースのサイズと SHA-256 を確認する
+class memory_io_t : public ota_patch_t::io_t
+{
+public:
+  memory_io_t(const std::vector<uint8_t>* source) : _source { source } {}
+
+  bool onHeader(const ota_patch_t::header_t& header) override
+  {
+    if (header.source_size != _source->size()) { return false; }
+    uint8_t hash[sha256_t::hash_size];
+    sha256_t sha256;
+    sha256.update(_source->data(), _source->size());
+    sha256.finish(hash);
+    return 0 == memcmp(hash, header.source_sha256, sizeof(hash));
+  }
+  bool readSource(size_t offset, uint8_t* dst, size_t length) override
+  {
+    if (offset + length > _source->size()) { return false; }
+    memcpy(dst, _source->data() + offset, length);
+    return true;
+  }
+  bool writeTarget(const uint8_t* src, size_t length) override
+  {
+    target.insert(target.end(), src, src + length);
+    return true;
+  }
+
+  std::vector<uint8_t> target;
+
+private:
+  const std::vector<uint8_t>* _source;
+};
+
+// HTTPで受信したボディを受信した単位のままパッチ適用処理へ与える
+static ota_patch_t::result_t downloadAndApply(uint16_t port, ota_patch_t::io_t* io)
+{
+  ota_patch_t patch;
+  patch.begin(io);
+
+  int sock = socket(AF_INET, SOCK_STREAM, 0);
+  if (sock < 0) { return ota_patch_t::result_error_format; }
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = htons(port);
+  if (connect(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+    close(sock);
+    return ota_patch_t::result_error_format;
+  }
+  static constexpr const char request[] = "GET /patch.kpd HTTP/1.1\r\nHost: localhost\r\n\r\n";
+  send(sock, request, sizeof(request) - 1, 0);
+
+  std::vector<uint8_t> buf(2048);
+  std::string header;
+  bool in_body = false;
+  ssize_t len;
+  while (0 < (len = recv(sock, buf.data(), buf.size(), 0))) {
+    const uint8_t* data = buf.data();
+    if (!in_body) {
+      header.append((const char*)data, len);
+      auto pos = header.find("\r\n\r\n");
+      if (pos == std::string::npos) { continue; }
+      in_body = true;
+      // ヘッダと同じ受信単位に含まれていたボディの先頭部分
+      size_t body_len = header.size() - (pos + 4);
+      data = buf.data() + len - body_len;
+      len = body_len;
+      if (len == 0) { continue; }
+    }
+    if (ota_patch_t::result_continue != patch.feed(data, len)) { break; }
+  }
+  close(sock);
+  return patch.getResult();
+}
+
+//-------------------------------------------------------------------------
+
+static std::vector<uint8_t> source;
+static std::vector<uint8_t> target;
+static std::vector<uint8_t> patch_data;
+
+void setUp(void) {}
+void tearDown(void) {}
+
+static void test_generate_patch(void)
+{
+  source = loadFile(source_path);
+  target = loadFile(target_path);
+  TEST_ASSERT_TRUE_MESSAGE(!source.empty() && !target.empty(), "ota_bin not found");
+
+  std::string command = std::string("python3 generate_ota_patch.py ") + source_path + " " + target_path + " " + patch_path;
+  TEST_ASSERT_EQUAL_INT(0, system(command.c_str()));
+  patch_data = loadFile(patch_path);
+  TEST_ASSERT_GREATER_THAN(ota_patch_t::header_size, patch_data.size());
+  // 差分パッチはファームウェア全体より十分に小さいこと
+  TEST_ASSERT_LESS_THAN(target.size() / 4, patch_data.size());
+}
+
+static void test_apply_over_http(void)
+{
+  TEST_ASSERT_TRUE(!patch_data.empty());
+  http_stand_in_t server;
+  TEST_ASSERT_TRUE(server.begin(&patch_data));
+  memory_io_t io(&source);
+  auto result = downloadAndApply(server.getPort(), &io);
+  server.end();
+
+  TEST_ASSERT_EQUAL_INT(ota_patch_t::result_done, result);
+  TEST_ASSERT_EQUAL(target.size(), io.target.size());
+  TEST_ASSERT_EQUAL_MEMORY(target.data(), io.target.data(), target.size());
+}
+
+static void test_reject_wrong_source(void)
+{
+  // 動作中のファームウェアがパッチの作成元と異なる場合は、ターゲットを書き込む前に中止すること
+  auto other = loadFile(other_path);
+  TEST_ASSERT_TRUE(!other.empty() && !patch_data.empty());
+  http_stand_in_t server;
+  TEST_ASSERT_TRUE(server.begin(&patch_data));
+  memory_io_t io(&other);
+  auto result = downloadAndApply(server.getPort(), &io);
+  server.end();
+
+  TEST_ASSERT_EQUAL_INT(ota_patch_t::result_error_source, result);
+  TEST_ASSERT_EQUAL(0, io.target.size());
+}
+
+static void test_reject_corrupted_patch(void)
+{
+  // 命令列の途中のデータが壊れている場合は、最後の SHA-256 の照合で失敗すること
+  TEST_ASSERT_TRUE(!patch_data.empty());
+  auto broken = patch_data;
+  broken[broken.size() - 16] ^= 0x55;
+  memory_io_t io(&source);
+  ota_patch_t patch;
+  patch.begin(&io);
+  auto result = patch.feed(broken.data(), broken.size());
+  TEST_ASSERT_NOT_EQUAL(ota_patch_t::result_done, result);
+  TEST_ASSERT_NOT_EQUAL(ota_patch_t::result_continue, result);
+}
+
+int main(int, char**)
+{
+  // 適用を中止して切断した後も配信側が送信を続けるため、SIGPIPE で終了しないようにする
+  signal(SIGPIPE, SIG_IGN);
+  UNITY_BEGIN();
+  RUN_TEST(test_generate_patch);
+  RUN_TEST(test_apply_over_http);
+  RUN_TEST(test_reject_wrong_source);
+  RUN_TEST(test_reject_corrupted_patch);
+  return UNITY_END();
+}